@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+import sys, pathlib
+sys.path.append(str(pathlib.Path(__file__).resolve().parents[1]))
+
+import argparse, gzip, lzma, subprocess, time
+
+parser = argparse.ArgumentParser(description='Compare device-side gz/xz/zstd/lz4 payload decompression')
+parser.add_argument('payload', type=pathlib.Path, help="uncompressed payload (e.g. a kernel Image)")
+parser.add_argument('-r', '--repeat', type=int, default=3)
+parser.add_argument('-v', '--verify', action="store_true", help="read back and compare the output")
+args = parser.parse_args()
+
+from m1n1.setup import *
+
+def compress_zstd(data):
+    try:
+        import zstandard
+        return zstandard.ZstdCompressor(level=19).compress(data)
+    except ImportError:
+        return subprocess.run(["zstd", "-19", "-c"], input=data, stdout=subprocess.PIPE,
+                              check=True).stdout
+
+def compress_lz4(data):
+    try:
+        import lz4.frame
+        return lz4.frame.compress(data, compression_level=9)
+    except ImportError:
+        return subprocess.run(["lz4", "-9", "-c"], input=data, stdout=subprocess.PIPE,
+                              check=True).stdout
+
+CODECS = [
+    # The in-tree XZ decoder needs a single block with CRC32 or no checksum
+    ("gz", lambda d: gzip.compress(d, compresslevel=9), p.gzdec),
+    ("xz", lambda d: lzma.compress(d, check=lzma.CHECK_CRC32), p.xzdec),
+    ("zstd", compress_zstd, p.zstddec),
+    ("lz4", compress_lz4, p.lz4dec),
+]
+
+data = args.payload.read_bytes()
+dest = u.memalign(2 * 1024 * 1024, len(data))
+
+print(f"Payload: {len(data)} bytes")
+print(f"{'codec':6} {'size':>10} {'ratio':>6} {'upload':>8} {'decode':>8} {'MB/s':>8} {'total':>8}")
+
+for name, compress, dec in CODECS:
+    payload = compress(data)
+
+    with u.heap.guarded_malloc(len(payload)) as addr:
+        t = time.time()
+        iface.writemem(addr, payload)
+        upload = time.time() - t
+
+        timeout = iface.dev.timeout
+        iface.dev.timeout = None
+        try:
+            best = None
+            for i in range(args.repeat):
+                t = time.time()
+                ret = dec(addr, len(payload), dest, len(data))
+                elapsed = time.time() - t
+                best = elapsed if best is None else min(best, elapsed)
+        finally:
+            iface.dev.timeout = timeout
+
+        if ret != len(data) or (args.verify and iface.readmem(dest, len(data)) != data):
+            print(f"{name:6} decode failed ({ret})")
+            continue
+
+        print(f"{name:6} {len(payload):10d} {len(payload) / len(data):6.3f} {upload:7.2f}s "
+              f"{best:7.3f}s {len(data) / best / 1e6:8.1f} {upload + best:7.2f}s")
+
+u.free(dest)
@@ -1,8 +1,10 @@
 # SPDX-License-Identifier: MIT
-import itertools, fnmatch, sys
+import itertools, fnmatch, sys, struct, json, hashlib
+from collections import namedtuple
 from construct import *
 import sys
 
+from .buildcache import BuildCache
 from .utils import AddrLookup, FourCC, SafeGreedyRange
 
 __all__ = ["load_adt"]
@@ -20,6 +22,31 @@ ADTNodeStruct = Struct(
     "children" / Array(this.child_count, LazyBound(lambda: ADTNodeStruct))
 )
 
+# What ADTNodeStruct.parse() returns, without construct's per-field overhead
+ADTRawProperty = namedtuple("ADTRawProperty", ["name", "size", "value"])
+ADTRawNode = namedtuple("ADTRawNode", ["properties", "children"])
+
+_node_hdr = struct.Struct("<II")
+_prop_hdr = struct.Struct("<32sI")
+
+def parse_raw_node(data, off=0):
+    property_count, child_count = _node_hdr.unpack_from(data, off)
+    off += _node_hdr.size
+    properties = []
+    for i in range(property_count):
+        name, size = _prop_hdr.unpack_from(data, off)
+        off += _prop_hdr.size
+        end = off + (size & 0x7fffffff)
+        if end > len(data):
+            raise ValueError(f"ADT property at {off:#x} runs past the end")
+        properties.append(ADTRawProperty(name.rstrip(b"\0").decode("ascii"), size, data[off:end]))
+        off = (end + 3) & ~3
+    children = []
+    for i in range(child_count):
+        child, off = parse_raw_node(data, off)
+        children.append(child)
+    return ADTRawNode(properties, children), off
+
 ADTStringList = SafeGreedyRange(CString("ascii"))
 
 ADT2Tuple = Array(2, Hex(Int64ul))
@@ -498,13 +525,85 @@ def build_prop(path, name, v, t=None):
 
     return t.build(v)
 
+class ADTProperties(dict):
+    """Property values of one node, each parsed from its raw bytes on first access
+
+    Most users look at a handful of nodes out of thousands, so parsing is deferred. Parsing a
+    value can read others it depends on (#address-cells, compatible, ...), which are then parsed
+    in turn. Iterating over the keys or testing for one does not parse anything.
+    """
+    def __init__(self, node):
+        super().__init__()
+        self._node = node
+        self._raw = {}
+
+    def add_raw(self, name, value, is_template):
+        self._raw[name] = value, is_template
+        super().__setitem__(name, None)
+
+    def raw(self, name):
+        """Return (value, is_template) of a property that was never parsed, or None"""
+        return self._raw.get(name, None)
+
+    def _parse(self, name, node_name=None):
+        value, is_template = self._raw.pop(name)
+        node = self._node
+        if node_name is None:
+            node_name = node.name
+        path = node._parent_path + node_name
+        try:
+            t, v = parse_prop(node, path, node_name, name, value, is_template)
+        except Exception as e:
+            print(f"Exception parsing {path}.{name} value {value.hex()}:", file=sys.stderr)
+            raise
+        node._types[name] = t, is_template
+        super().__setitem__(name, v)
+        if isinstance(v, (list, dict)):
+            # Could be edited in place from here on
+            node._touch()
+        return v
+
+    def __getitem__(self, name):
+        if name in self._raw:
+            return self._parse(name)
+        return super().__getitem__(name)
+
+    def __setitem__(self, name, value):
+        self._raw.pop(name, None)
+        super().__setitem__(name, value)
+        self._node._touch()
+
+    def __delitem__(self, name):
+        self._raw.pop(name, None)
+        super().__delitem__(name)
+        self._node._touch()
+
+    def get(self, name, default=None):
+        if name in self:
+            return self[name]
+        return default
+
+    def pop(self, name, *default):
+        if name in self._raw:
+            self._parse(name)
+        if name in self:
+            self._node._touch()
+        return super().pop(name, *default)
+
+    def items(self):
+        return [(k, self[k]) for k in self]
+
+    def values(self):
+        return [self[k] for k in self]
+
 class ADTNode:
     def __init__(self, val=None, path="/", parent=None):
         self._children = []
-        self._properties = {}
+        self._properties = ADTProperties(self)
         self._types = {}
         self._parent_path = path
         self._parent = parent
+        self._cache_key = None
 
         if val is not None:
             for p in val.properties:
@@ -514,32 +613,21 @@ class ADTNode:
             else:
                 raise ValueError(f"Node in {path} has no name!")
 
-            path = self._parent_path + _name
-
-            raw = {}
             for p in val.properties:
-                raw[p.name] = p.value
-                is_template = bool(p.size & 0x80000000)
-                try:
-                    t, v = parse_prop(self, path, _name, p.name, p.value, is_template)
-                    self._types[p.name] = t, is_template
-                    self._properties[p.name] = v
-                except Exception as e:
-                    print(f"Exception parsing {path}.{p.name} value {p.value.hex()}:", file=sys.stderr)
-                    raise
-
-            # Second pass
-            for k, (t, is_template) in self._types.items():
-                if t is None:
-                    t, v = parse_prop(self, path, _name, k, self._properties[k], is_template)
-                    self._types[k] = t, is_template
-                    self._properties[k] = v
-                    assert build_prop(self._path, k, v, t=t) == raw[k]
+                self._properties.add_raw(p.name, p.value, bool(p.size & 0x80000000))
+            self._properties._parse("name", _name)
 
             for c in val.children:
                 node = ADTNode(c, f"{self._path}/", parent=self)
                 self._children.append(node)
 
+    def _touch(self):
+        # The tree may no longer match the blob it was loaded from
+        node = self
+        while node._parent is not None:
+            node = node._parent
+        node._cache_key = None
+
     @property
     def _path(self):
         return self._parent_path + self.name
@@ -573,6 +661,7 @@ class ADTNode:
                 self._children.append(value)
         else:
             self._children[item] = value
+        self._touch()
 
     def __delitem__(self, item):
         if isinstance(item, str):
@@ -585,10 +674,12 @@ class ADTNode:
             for i, c in enumerate(self._children):
                 if c.name == item:
                     del self._children[i]
+                    self._touch()
                     return
             raise KeyError(f"Child node '{item}' not found")
 
         del self._children[item]
+        self._touch()
 
     def __contains__(self, item):
         if isinstance(item, str):
@@ -745,9 +836,13 @@ class ADTNode:
 
     def tostruct(self):
         properties = []
-        for k,v in itertools.chain(self._properties.items()):
-            t, is_template = self._types.get(k, (None, False))
-            value = build_prop(self._path, k, v, t=t)
+        for k in self._properties:
+            raw = self._properties.raw(k)
+            if raw is not None:
+                value, is_template = raw
+            else:
+                t, is_template = self._types.get(k, (None, False))
+                value = build_prop(self._path, k, self._properties[k], t=t)
             properties.append({
                 "name": k,
                 "size": len(value) | (0x80000000 if is_template else 0),
@@ -770,8 +865,7 @@ class ADTNode:
         for child in self:
             yield from child
 
-    def build_addr_lookup(self):
-        lookup = AddrLookup()
+    def _addr_entries(self):
         for node in self.walk_tree():
             reg = getattr(node, 'reg', None)
             if not isinstance(reg, list):
@@ -784,8 +878,33 @@ class ADTNode:
                     continue
                 if size == 0:
                     continue
-                lookup.add(range(addr, addr + size), node.name + f"[{index}]")
+                yield addr, addr + size, node.name + f"[{index}]"
 
+    def build_addr_lookup(self):
+        """Map device register ranges to node names
+
+        Building the map parses every reg and ranges property in the tree, so while the tree
+        is known to match the blob it was loaded from, the entries are cached on disk by the
+        hash of the blob.
+        """
+        key = self._cache_key
+        cache = BuildCache("adt")
+        entries = None
+        if key is not None:
+            data = cache.load_data(key, "addr.json")
+            try:
+                entries = json.loads(data) if data is not None else None
+            except ValueError:
+                entries = None
+
+        if entries is None:
+            entries = list(self._addr_entries())
+            if key is not None:
+                cache.store_data(key, "addr.json", json.dumps(entries).encode("ascii"))
+
+        lookup = AddrLookup()
+        for start, stop, name in entries:
+            lookup.add(range(start, stop), name)
         return lookup
 
     def create_node(self, name):
@@ -802,7 +921,10 @@ class ADTNode:
         return node
 
 def load_adt(data):
-    return ADTNode(ADTNodeStruct.parse(data))
+    root, size = parse_raw_node(data)
+    adt = ADTNode(root)
+    adt._cache_key = BuildCache.key(hashlib.sha256(data).digest())
+    return adt
 
 if __name__ == "__main__":
     import sys, argparse, pathlib
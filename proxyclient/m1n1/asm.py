@@ -1,6 +1,8 @@
 # SPDX-License-Identifier: MIT
-import os, tempfile, shutil, subprocess, re
+import os, tempfile, shutil, subprocess, re, functools
+from concurrent.futures import ThreadPoolExecutor
 from . import sysreg
+from .buildcache import BuildCache, toolchain_id
 from .toolchain import Toolchain
 
 __all__ = ["AsmException", "ARMAsm"]
@@ -8,14 +10,32 @@ __all__ = ["AsmException", "ARMAsm"]
 class AsmException(Exception):
     pass
 
+@functools.lru_cache(maxsize=None)
+def _sysreg_pattern():
+    # One pass over the source for all names; longest first, so no name shadows a longer one
+    names = sorted(sysreg.sysreg_fwd, key=len, reverse=True)
+    return re.compile(r"\b(" + "|".join(map(re.escape, names)) + r")\b")
+
+def _sysreg_encode(match):
+    enc = sysreg.sysreg_fwd[match.group(1)]
+    return f"s{enc[0]}_{enc[1]}_c{enc[2]}_c{enc[3]}_{enc[4]}"
+
 class BaseAsm(object):
+    CACHE_FILES = ("bin", "nm", "elf")
+
     def __init__(self, source, addr = 0):
         self.toolchain = Toolchain()
         self.source = source
-        self._tmp = tempfile.mkdtemp() + os.sep
+        self._tmp = None
         self.addr = addr
         self.compile(source)
 
+    @classmethod
+    def build_all(cls, snippets, max_workers=None):
+        '''assemble independent (source, addr) snippets in parallel, returning them in order'''
+        with ThreadPoolExecutor(max_workers=max_workers) as pool:
+            return list(pool.map(lambda s: cls(*s), snippets))
+
     def _call(self, program, args):
         subprocess.check_call(program + " " + args, shell=True)
 
@@ -23,29 +43,21 @@ class BaseAsm(object):
         return subprocess.check_output(program + " " + args, shell=True).decode("ascii")
 
     def compile(self, source):
-        for name, enc in sysreg.sysreg_fwd.items():
-            source = re.sub("\\b" + name + "\\b", f"s{enc[0]}_{enc[1]}_c{enc[2]}_c{enc[3]}_{enc[4]}", source)
+        source = _sysreg_pattern().sub(_sysreg_encode, source)
+        text = self.HEADER + "\n" + source + "\n" + self.FOOTER + "\n"
 
-        self.sfile = self._tmp + "b.S"
-        with open(self.sfile, "w") as fd:
-            fd.write(self.HEADER + "\n")
-            fd.write(source + "\n")
-            fd.write(self.FOOTER + "\n")
+        cache = BuildCache("asm")
+        key = cache.key(text, self.addr, toolchain_id(self.toolchain))
+        files = cache.lookup(key, self.CACHE_FILES)
+        if files is None:
+            files = cache.store(key, self._build(text))
 
-        self.ofile = self._tmp + "b.o"
-        self.elffile = self._tmp + "b.elf"
-        self.bfile = self._tmp + "b.b"
-        self.nfile = self._tmp + "b.n"
-
-        self._call(self.toolchain.CC, f"-c -o {self.ofile} {self.sfile}")
-        self._call(self.toolchain.LD, f"--Ttext={self.addr:#x} -o {self.elffile} {self.ofile}")
-        self._call(self.toolchain.OBJCOPY, f"-j.text -O binary {self.elffile} {self.bfile}")
-        self._call(self.toolchain.NM, f"{self.elffile} > {self.nfile}")
+        self.elffile = files["elf"]
 
-        with open(self.bfile, "rb") as fd:
+        with open(files["bin"], "rb") as fd:
             self.data = fd.read()
 
-        with open(self.nfile) as fd:
+        with open(files["nm"]) as fd:
             for line in fd:
                 line = line.replace("\n", "")
                 addr, type, name = line.split()
@@ -55,6 +67,25 @@ class BaseAsm(object):
         self.len = len(self.data)
         self.end = self.start + self.len
 
+    def _build(self, text):
+        self._tmp = tempfile.mkdtemp() + os.sep
+
+        self.sfile = self._tmp + "b.S"
+        with open(self.sfile, "w") as fd:
+            fd.write(text)
+
+        self.ofile = self._tmp + "b.o"
+        elffile = self._tmp + "b.elf"
+        bfile = self._tmp + "b.b"
+        nfile = self._tmp + "b.n"
+
+        self._call(self.toolchain.CC, f"-c -o {self.ofile} {self.sfile}")
+        self._call(self.toolchain.LD, f"--Ttext={self.addr:#x} -o {elffile} {self.ofile}")
+        self._call(self.toolchain.OBJCOPY, f"-j.text -O binary {elffile} {bfile}")
+        self._call(self.toolchain.NM, f"{elffile} > {nfile}")
+
+        return {"bin": bfile, "nm": nfile, "elf": elffile}
+
     def objdump(self):
         self._call(self.toolchain.OBJDUMP, f"-rd {self.elffile}")
 
@@ -70,7 +101,7 @@ class BaseAsm(object):
             yield line
 
     def __del__(self):
-        if self._tmp:
+        if getattr(self, "_tmp", None):
             shutil.rmtree(self._tmp)
             self._tmp = None
 
@@ -0,0 +1,113 @@
+# SPDX-License-Identifier: MIT
+"""
+m1n1: on-disk cache for code built and data derived on the proxyclient host
+
+Entries are keyed by a hash of everything that goes into them (source, load address,
+toolchain version, a blob fetched from the device, ...) and hold one or more files. The cache lives in
+$M1N1_BUILD_CACHE, or $XDG_CACHE_HOME/m1n1 (~/.cache/m1n1) by default, and
+M1N1_BUILD_CACHE=0 turns it off.
+"""
+
+import functools
+import hashlib
+import os
+import shutil
+import subprocess
+import tempfile
+
+__all__ = ["BuildCache", "toolchain_id"]
+
+
+@functools.lru_cache(maxsize=None)
+def _tool_version(tool):
+    try:
+        out = subprocess.run(tool + " --version", shell=True, capture_output=True, check=False)
+        return out.stdout.decode("utf-8", "replace").split("\n")[0]
+    except OSError:
+        return ""
+
+
+def toolchain_id(toolchain):
+    """Identify a Toolchain by its commands and the compiler and linker versions"""
+    return "\0".join([toolchain.CC, toolchain.LD, toolchain.OBJCOPY, toolchain.NM,
+                      _tool_version(toolchain.CC), _tool_version(toolchain.LD)])
+
+
+class BuildCache:
+    """Cache of build outputs or derived data for one kind of entry (asm, inline C, adt, ...)"""
+
+    def __init__(self, kind):
+        root = os.environ.get("M1N1_BUILD_CACHE", None)
+        if root == "0":
+            self.path = None
+            return
+        if root is None:
+            xdg = os.environ.get("XDG_CACHE_HOME", os.path.expanduser("~/.cache"))
+            root = os.path.join(xdg, "m1n1")
+        self.path = os.path.join(root, kind)
+
+    @staticmethod
+    def key(*parts):
+        h = hashlib.sha256()
+        for part in parts:
+            if isinstance(part, str):
+                part = part.encode("utf-8")
+            elif isinstance(part, int):
+                part = str(part).encode("ascii")
+            h.update(len(part).to_bytes(8, "little"))
+            h.update(part)
+        return h.hexdigest()
+
+    def lookup(self, key, names):
+        """Return {name: path} of a complete entry, or None"""
+        if self.path is None:
+            return None
+        paths = {name: os.path.join(self.path, f"{key}.{name}") for name in names}
+        if all(os.path.exists(p) for p in paths.values()):
+            return paths
+        return None
+
+    def _private_file(self):
+        # Concurrent writers of the same entry each write a private file and rename
+        os.makedirs(self.path, exist_ok=True)
+        return tempfile.mkstemp(dir=self.path, prefix=".tmp-")
+
+    def store(self, key, files):
+        """Copy the {name: path} output files into the cache and return their cached paths"""
+        if self.path is None:
+            return files
+        try:
+            paths = {}
+            for name, src in files.items():
+                dest = os.path.join(self.path, f"{key}.{name}")
+                fd, tmp = self._private_file()
+                os.close(fd)
+                shutil.copyfile(src, tmp)
+                os.replace(tmp, dest)
+                paths[name] = dest
+            return paths
+        except OSError:
+            return files
+
+    def load_data(self, key, name):
+        """Return the contents of one file of an entry, or None"""
+        paths = self.lookup(key, [name])
+        if paths is None:
+            return None
+        try:
+            with open(paths[name], "rb") as fd:
+                return fd.read()
+        except OSError:
+            return None
+
+    def store_data(self, key, name, data):
+        """Store bytes as one file of an entry"""
+        if self.path is None:
+            return
+        try:
+            fd, tmp = self._private_file()
+            with os.fdopen(fd, "wb") as f:
+                f.write(data)
+            os.replace(tmp, os.path.join(self.path, f"{key}.{name}"))
+        except OSError:
+            pass
@@ -4,7 +4,7 @@ from construct import *
 
 from ..asm import ARMAsm
 from ..tgtypes import *
-from ..proxy import IODEV, START, EVENT, EXC, EXC_RET, ExcInfo
+from ..proxy import IODEV, START, EVENT, EXC, EXC_RET, ExcInfo, ProxyCommandError
 from ..utils import *
 from ..sysreg import *
 from ..macho import MachO
@@ -71,6 +71,10 @@ class HV(Reloadable):
         ELR_GL1: ELR_GL12,
     }
 
+    # Flags for sysreg_pass(), as in hv.h
+    SYSREG_UNLOCKED = 1 << 0
+    SYSREG_RAZ_WI = 1 << 1
+
     AIC_EVT_TYPE_HW = 1
     IRQTRACE_IRQ = 1
 
@@ -111,9 +115,12 @@ class HV(Reloadable):
         self.started = False
         self.ctx = None
         self.hvcall_handlers = {}
+        self.msr_handlers = {}
+        self.msr_counts = {}
         self.switching_context = False
         self.show_timestamps = False
         self.virtio_devs = {}
+        self._xlate_flush()
 
     def _reloadme(self):
         super()._reloadme()
@@ -198,44 +205,106 @@ class HV(Reloadable):
 
         assert self.p.hv_map(ipa, (index << 2) | flags | t, size, 0) >= 0
 
-    def readmem(self, va, size):
-        '''read from virtual memory'''
-        with io.BytesIO() as buffer:
-            while size > 0:
-                pa = self.p.hv_translate(va, False, False)
-                if pa == 0:
-                    break
-
-                size_in_page = 4096 - (va % 4096)
-                if size < size_in_page:
-                    buffer.write(self.iface.readmem(pa, size))
-                    break
-
-                buffer.write(self.iface.readmem(pa, size_in_page))
-                va += size_in_page
-                size -= size_in_page
+    # Guest VA translations are cached a 4K page at a time until the guest next runs, keyed on
+    # the TTBRs (which carry the ASID) so that CPUs stopped in the same address space share them.
+    XLATE_PAGE = 0x1000
+    XLATE_BATCH = 1024
+
+    def _xlate_flush(self):
+        self._xlate_cache = {}
+        self._xlate_ttbrs = {}
+
+    def _xlate_key(self, w):
+        cpu = self.ctx.cpu_id
+        if cpu not in self._xlate_ttbrs:
+            self._xlate_ttbrs[cpu] = (self.u.mrs(TTBR0_EL12), self.u.mrs(TTBR1_EL12))
+        return self._xlate_ttbrs[cpu] + (self.ctx.spsr.M >> 2, w)
+
+    def _xlate_fetch(self, key, va, size, w):
+        page = self.XLATE_PAGE
+        count = size // page + 2
+        buf = self.u.heap.malloc(count * XlateExtent.sizeof())
+        try:
+            n = self.p.hv_translate_range(va, size, False, w, buf, count)
+            extents = Array(n, XlateExtent).parse(
+                self.iface.readmem(buf, n * XlateExtent.sizeof()))
+        finally:
+            self.u.heap.free(buf)
+
+        for ext in extents:
+            for addr in range(va & ~(page - 1), va + ext.size, page):
+                self._xlate_cache[key + (addr,)] = ext.pa and ext.pa + addr - va
+            va += ext.size
+
+    def translate_range(self, va, size, w=False):
+        '''translate a virtual range into [(pa, size)] extents of contiguous PAs, where pa is 0
+        for pages that fault'''
+        page = self.XLATE_PAGE
+        key = self._xlate_key(w)
+
+        first = va & ~(page - 1)
+        end = va + size
+        for addr in range(first, end, page):
+            if key + (addr,) not in self._xlate_cache:
+                fetch_end = min(end, addr + self.XLATE_BATCH * page)
+                self._xlate_fetch(key, max(addr, va), fetch_end - max(addr, va), w)
+
+        extents = []
+        while va < end:
+            pa = self._xlate_cache[key + (va & ~(page - 1),)]
+            pa = pa and pa + (va & (page - 1))
+            chunk = min(end - va, page - (va & (page - 1)))
+            if extents and (extents[-1][0] + extents[-1][1] == pa if pa else not extents[-1][0]):
+                extents[-1][1] += chunk
+            else:
+                extents.append([pa, chunk])
+            va += chunk
 
-            return buffer.getvalue()
+        return [tuple(e) for e in extents]
 
-    def writemem(self, va, data):
-        '''write to virtual memory'''
-        written = 0
-        while written < len(data):
-            pa = self.p.hv_translate(va, False, True)
+    def _mapped_extents(self, va, size, w):
+        extents = []
+        for pa, length in self.translate_range(va, size, w):
             if pa == 0:
                 break
+            extents.append((pa, length))
+        return extents
 
-            size_in_page = 4096 - (va % 4096)
-            if len(data) - written < size_in_page:
-                self.iface.writemem(pa, data[written:])
-                written = len(data)
-                break
-
-            self.iface.writemem(pa, data[written:written + size_in_page])
-            va += size_in_page
-            written += size_in_page
+    def readmem(self, va, size):
+        '''read from virtual memory'''
+        extents = self._mapped_extents(va, size, False)
+        if len(extents) <= 2:
+            return b"".join(self.iface.readmem(pa, length) for pa, length in extents)
+
+        # Scattered pages are gathered into a bounce buffer by m1n1, and read in one go
+        table = b"".join(XlateExtent.build({"pa": pa, "size": length}) for pa, length in extents)
+        total = sum(length for pa, length in extents)
+        buf = self.u.heap.malloc(len(table) + total)
+        try:
+            self.iface.writemem(buf, table)
+            done = self.p.hv_gather(buf + len(table), buf, len(extents))
+            return self.iface.readmem(buf + len(table), done)
+        finally:
+            self.u.heap.free(buf)
 
-        return written
+    def writemem(self, va, data):
+        '''write to virtual memory'''
+        extents = self._mapped_extents(va, len(data), True)
+        if len(extents) <= 2:
+            written = 0
+            for pa, length in extents:
+                self.iface.writemem(pa, data[written:written + length])
+                written += length
+            return written
+
+        table = b"".join(XlateExtent.build({"pa": pa, "size": length}) for pa, length in extents)
+        total = sum(length for pa, length in extents)
+        buf = self.u.heap.malloc(len(table) + total)
+        try:
+            self.iface.writemem(buf, table + data[:total])
+            return self.p.hv_scatter(buf + len(table), buf, len(extents))
+        finally:
+            self.u.heap.free(buf)
 
     def trace_irq(self, device, num, count, flags):
         for n in range(num, num + count):
@@ -253,6 +322,205 @@ class HV(Reloadable):
 
         assert self.p.hv_trace_irq(self.AIC_EVT_TYPE_HW, num, count, flags) > 0
 
+    def vgic_route_irq(self, num, spi):
+        """Route AIC IRQ num (die * max_irq + irq) to vGIC SPI spi, or back to the host if spi is 0"""
+        assert self.p.hv_vgic_route_irq(num, spi) == 0
+
+    def vgic_irq_stats(self, spi):
+        buf = self.u.heap.malloc(VGICIRQStats.sizeof())
+        try:
+            if self.p.hv_vgic_irq_stats(spi, buf) != 0:
+                return None
+            return VGICIRQStats.parse(self.iface.readmem(buf, VGICIRQStats.sizeof()))
+        finally:
+            self.u.heap.free(buf)
+
+    def tick_stats(self):
+        """Counters of the interruptible CPU's polling tick, in CNTPCT ticks"""
+        buf = self.u.heap.malloc(TickStats.sizeof())
+        try:
+            self.p.hv_tick_stats(buf)
+            return TickStats.parse(self.iface.readmem(buf, TickStats.sizeof()))
+        finally:
+            self.u.heap.free(buf)
+
+    def prof_enable(self, enable=True, reset=True):
+        """Start (or stop) timing guest exits, optionally clearing what was collected"""
+        self.p.hv_prof_enable(enable, reset)
+
+    def prof_dump(self):
+        size = self.p.hv_prof_dump(0, 0)
+        buf = self.u.heap.malloc(size)
+        try:
+            self.p.hv_prof_dump(buf, size)
+            return ProfDump.parse(self.iface.readmem(buf, size))
+        finally:
+            self.u.heap.free(buf)
+
+    @staticmethod
+    def _prof_percentile(hist, count, pct):
+        # Upper bound of the log2 bucket the percentile falls in, in ticks
+        need = count * pct / 100
+        seen = 0
+        for bucket, n in enumerate(hist):
+            seen += n
+            if n and seen >= need:
+                return 1 << bucket
+        return 0
+
+    def prof_report(self, top=20):
+        """Print where guest exits spent their time, by exit class and by hottest MMIO page"""
+        prof = self.prof_dump()
+        if not prof.freq:
+            # Older m1n1 builds only fill in the header once profiling has been enabled
+            print("No profile (profiling was never enabled)")
+            return
+        us = 1e6 / prof.freq
+
+        def row(name, s):
+            p50 = self._prof_percentile(s.hist, s.count, 50)
+            p99 = self._prof_percentile(s.hist, s.count, 99)
+            print(f"  {name:<32} {s.count:10d} {s.ticks * us / 1000:10.3f} "
+                  f"{s.ticks * us / s.count:9.2f} {p50 * us:9.2f} {p99 * us:9.2f} "
+                  f"{s.max * us:9.2f}")
+
+        hdr = f"  {'':<32} {'count':>10} {'total ms':>10} {'avg us':>9} {'p50 <us':>9} " \
+              f"{'p99 <us':>9} {'max us':>9}"
+
+        print("Guest exits by class:")
+        print(hdr)
+        for cls in HV_EXIT:
+            total = Container(count=0, ticks=0, max=0, hist=[0] * prof.nbuckets)
+            for cpu in prof.exits:
+                s = cpu[cls]
+                total.count += s.count
+                total.ticks += s.ticks
+                total.max = max(total.max, s.max)
+                total.hist = [a + b for a, b in zip(total.hist, s.hist)]
+            if total.count:
+                row(cls.name, total)
+
+        pages = sorted((p for p in prof.pages if p.page), key=lambda p: -p.stats.ticks)
+        if not pages:
+            return
+        print(f"Hottest MMIO pages ({len(pages)} seen, {prof.dropped_pages} aborts not counted):")
+        print(hdr)
+        for p in pages[:top]:
+            dev, r = self.device_addr_tbl.lookup(p.page)
+            row(f"{p.page:#x} {dev}", p.stats)
+
+    def sample_start(self, rate=1000, depth=16, ring_size=4096):
+        """Sample where every guest CPU is, rate times a second, with depth backtrace frames"""
+        if self.p.hv_sample_start(rate, depth, ring_size) < 0:
+            raise Exception("Failed to allocate the sample rings")
+
+    def sample_stop(self):
+        """Stop sampling, and return how many samples were lost to full rings"""
+        return self.p.hv_sample_stop()
+
+    def sample_drain(self, chunk=1024):
+        """Fetch and clear the samples collected so far"""
+        samples = []
+        buf = self.u.heap.malloc(chunk * HVSample.sizeof())
+        try:
+            while True:
+                count = self.p.hv_sample_drain(buf, chunk)
+                if count:
+                    data = self.iface.readmem(buf, count * HVSample.sizeof())
+                    samples.extend(Array(count, HVSample).parse(data))
+                if count < chunk:
+                    return samples
+        finally:
+            self.u.heap.free(buf)
+
+    def _sample_frame(self, addr, el):
+        if el > 0:
+            name = self.sym(addr)[1] if self.symbols else None
+            if name is not None:
+                return name
+        return f"0x{addr:x}"
+
+    def sample_folded(self, out=sys.stdout, samples=None):
+        """
+        Write samples as folded stacks, one "root;caller;...;callee count" line per unique stack,
+        for flamegraph.pl, inferno or speedscope. Stacks are rooted at the guest EL, and EL0 ones
+        at their TTBR0 too, which tells processes apart.
+        """
+        if isinstance(out, str):
+            with open(out, "w") as fd:
+                return self.sample_folded(fd, samples)
+        if samples is None:
+            samples = self.sample_drain()
+
+        stacks = {}
+        for s in samples:
+            el = (s.spsr >> 2) & 3
+            root = [f"EL{el}"] if el else ["EL0", f"ttbr0 {s.ttbr0:#x}"]
+            frames = [s.pc] + list(s.frames[:s.depth])
+            stack = ";".join(root + [self._sample_frame(a, el) for a in reversed(frames)])
+            stacks[stack] = stacks.get(stack, 0) + 1
+
+        for stack, count in sorted(stacks.items()):
+            out.write(f"{stack} {count}\n")
+
+    @staticmethod
+    def _sysreg_enc(reg):
+        op0, op1, crn, crm, op2 = sysreg_parse(reg)
+        return (op0 << 14) | (op1 << 11) | (crn << 7) | (crm << 3) | op2
+
+    def sysreg_register(self, reg, handler):
+        """
+        Handle guest accesses to a trapped system register that reach the proxy with
+        handler(ctx, iss, enc, name), which emulates the access and leaves ctx.elr alone.
+        """
+        self.msr_handlers[sysreg_parse(reg)] = handler
+
+    def sysreg_pass(self, reg, to=None, unlocked=True):
+        """
+        Pass guest accesses to a trapped system register through to the to register (itself by
+        default) in m1n1, without a round trip to the proxy. Unlocked ones also skip the HV lock.
+        """
+        flags = self.SYSREG_UNLOCKED if unlocked else 0
+        to = reg if to is None else to
+        if self.p.hv_sysreg_map(self._sysreg_enc(reg), self._sysreg_enc(to), flags) < 0:
+            raise Exception(f"Sysreg table full, cannot pass {sysreg_name(sysreg_parse(reg))}")
+
+    def sysreg_unregister(self, reg):
+        """Send a system register back to the proxy handler"""
+        self.p.hv_sysreg_unregister(self._sysreg_enc(reg))
+        self.msr_handlers.pop(sysreg_parse(reg), None)
+
+    def sysreg_stats(self, top=20, reset=False):
+        """
+        Print the most trapped system registers, counted in m1n1 for the ones it handles and
+        here for the ones that reach the proxy.
+        """
+        count = self.p.hv_sysreg_stats(0, 0, False)
+        buf = self.u.heap.malloc(max(count, 1) * SysregStats.sizeof())
+        try:
+            count = min(count, self.p.hv_sysreg_stats(buf, count, reset))
+            stats = Array(count, SysregStats).parse(
+                self.iface.readmem(buf, count * SysregStats.sizeof()))
+        finally:
+            self.u.heap.free(buf)
+
+        rows = []
+        for s in stats:
+            enc = ((s.enc >> 14) & 3, (s.enc >> 11) & 7, (s.enc >> 7) & 15, (s.enc >> 3) & 15,
+                   s.enc & 7)
+            where = "m1n1" if s.flags & self.SYSREG_UNLOCKED else "m1n1 (locked)"
+            rows.append((s.count, sysreg_name(enc), where))
+        for enc, n in self.msr_counts.items():
+            rows.append((n, sysreg_name(enc), "proxy"))
+        if reset:
+            self.msr_counts = {}
+
+        rows.sort(key=lambda r: -r[0])
+        print(f"{'Register':<32} {'Handled in':<16} {'Traps':>12}")
+        for n, name, where in rows[:top]:
+            if n:
+                print(f"{name:<32} {where:<16} {n:>12}")
+
     def add_tracer(self, zone, ident, mode=TraceMode.ASYNC, read=None, write=None, **kwargs):
         assert mode in (TraceMode.RESERVED, TraceMode.OFF, TraceMode.BYPASS) or read or write
         self.mmio_maps[zone, ident] = (mode, ident, read, write, kwargs)
@@ -598,6 +866,18 @@ class HV(Reloadable):
 
         return True
 
+    def handle_irq(self, ctx):
+        # With the vGIC running, m1n1 injects routed AIC IRQs itself and only passes on the
+        # events it has no route for. They come already acked (and so masked in the AIC), and
+        # m1n1 unmasks them when this returns, unless they were routed to an SPI meanwhile.
+        if not ctx.data:
+            return False
+
+        event = self.p.read32(ctx.data)
+        die, evt_type, num = event >> 24, (event >> 16) & 0xff, event & 0xffff
+        self.log(f"Unrouted AIC event: die {die} type {evt_type:#x} num {num}")
+        return True
+
     def handle_irqtrace(self, data):
         evt = EvtIRQTrace.parse(data)
 
@@ -646,6 +926,7 @@ class HV(Reloadable):
         enc = iss.Op0, iss.Op1, iss.CRn, iss.CRm, iss.Op2
 
         name = sysreg_name(enc)
+        self.msr_counts[enc] = self.msr_counts.get(enc, 0) + 1
 
         skip = set()
         shadow = {
@@ -693,7 +974,10 @@ class HV(Reloadable):
             shadow.add(DBGWVRn_EL1(i))
 
         value = 0
-        if enc == CYC_OVRD_EL1 and iss.DIR == MSR_DIR.WRITE:
+        handler = self.msr_handlers.get(enc, None)
+        if handler is not None:
+            handler(ctx, iss, enc, name)
+        elif enc == CYC_OVRD_EL1 and iss.DIR == MSR_DIR.WRITE:
             if iss.Rt != 31:
                 value = ctx.regs[iss.Rt]
             self.log(f"Skip: msr {name}, x{iss.Rt} = {value:x}")
@@ -1302,6 +1586,8 @@ class HV(Reloadable):
             if reason == START.EXCEPTION_LOWER:
                 if code == EXC.SYNC:
                     handled = self.handle_sync(ctx)
+                elif code == EXC.IRQ:
+                    handled = self.handle_irq(ctx)
                 elif code == EXC.FIQ:
                     self.u.msr(CNTV_CTL_EL0, 0)
                     self.u.print_context(ctx, False, sym=self.get_sym)
@@ -1342,6 +1628,7 @@ class HV(Reloadable):
         self._commit_context()
         self.ctx = None
         self.exc_orig_cpu = None
+        self._xlate_flush()
         self.p.exit(ret)
 
         self._in_handler = False
@@ -1421,6 +1708,7 @@ class HV(Reloadable):
             self.run_shell("Entering hypervisor shell", "Returning")
             signal.signal(signal.SIGINT, self._handle_sigint)
 
+        self._xlate_flush()
         self.p.exit(EXC_RET.HANDLED)
 
     def skip(self):
@@ -1475,6 +1763,7 @@ class HV(Reloadable):
         self.u.msr(MDSCR_EL1, MDSCR(SS=1, MDE=1).value)
         self.ctx.spsr.SS = 1
         self.p.hv_pin_cpu(self.ctx.cpu_id)
+        self._xlate_flush()
         self._switch_context()
         self.p.hv_pin_cpu(0xffffffffffffffff)
 
@@ -1713,6 +2002,13 @@ class HV(Reloadable):
         print("Initializing hypervisor over iodev %s" % self.iodev)
         self.p.hv_init()
 
+        # Plain EL12 redirects don't need the proxy, let m1n1 pass them straight through
+        try:
+            for reg, to in self.MSR_REDIRECTS.items():
+                self.sysreg_pass(reg, to)
+        except ProxyCommandError:
+            pass
+
         self.iface.set_handler(START.EXCEPTION_LOWER, EXC.SYNC, self.handle_exception)
         self.iface.set_handler(START.EXCEPTION_LOWER, EXC.IRQ, self.handle_exception)
         self.iface.set_handler(START.EXCEPTION_LOWER, EXC.FIQ, self.handle_exception)
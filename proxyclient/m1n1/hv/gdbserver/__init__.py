@@ -20,11 +20,16 @@ class GDBServer:
         "fpcr" / Int32ul,
     )
     __separator = re.compile("[,;:]")
+    __page_size = 4096
+
 
     def __init__(self, hv, address, log):
         self.__hc = None
         self.__hg = None
         self.__hv = hv
+        self.__binary_upload = False
+        self.__mem_cache = {}
+        self.__mem_cache_cpu = None
         self.__interrupt_eventfd = os.eventfd(0, flags=os.EFD_CLOEXEC | os.EFD_NONBLOCK)
         self.__interrupt_selector = selectors.DefaultSelector()
         self.__request = None
@@ -59,6 +64,97 @@ class GDBServer:
 
         self.__hv.cpu(cpu)
 
+    # Guest memory is cached a page at a time while the guest is stopped, since gdb and lldb
+    # read the same few bytes around the PC and stack over and over at every stop. Only pages
+    # backed by guest RAM are prefetched and cached whole; anything else (passthrough MMIO, or
+    # nothing at all) is read exactly as asked and never cached, as reads may have side effects.
+    def __invalidate_mem(self):
+        self.__mem_cache = {}
+
+    def __ram_pages(self, first, end):
+        ram_base = getattr(self.__hv, "ram_base", None)
+        ram_size = getattr(self.__hv, "ram_size", None)
+        if ram_base is None or ram_size is None:
+            return set()
+
+        page_size = GDBServer.__page_size
+        pages = set()
+        va = first
+        for pa, length in self.__hv.translate_range(first, end - first):
+            if pa:
+                for offset in range(0, length, page_size):
+                    if ram_base <= pa + offset < ram_base + ram_size:
+                        pages.add(va + offset)
+            va += length
+
+        return pages
+
+    def __read_mem(self, addr, size):
+        if self.__mem_cache_cpu != self.__hv.ctx.cpu_id:
+            self.__mem_cache = {}
+            self.__mem_cache_cpu = self.__hv.ctx.cpu_id
+
+        page_size = GDBServer.__page_size
+        first = addr & ~(page_size - 1)
+        end = addr + size
+        ram = self.__ram_pages(first, end)
+        exact = {}
+
+        page = first
+        while page < end:
+            if page in self.__mem_cache:
+                page += page_size
+                continue
+
+            if page not in ram:
+                lo, hi = max(addr, page), min(end, page + page_size)
+                data = self.__hv.readmem(lo, hi - lo)
+                exact[page] = (lo, data)
+                if len(data) < hi - lo:
+                    break
+
+                page += page_size
+                continue
+
+            # Fetch the whole run of missing RAM pages in one go
+            run_end = page
+            while run_end < end and run_end not in self.__mem_cache and run_end in ram:
+                run_end += page_size
+
+            data = self.__hv.readmem(page, run_end - page)
+            for offset in range(0, run_end - page, page_size):
+                self.__mem_cache[page + offset] = data[offset:offset + page_size]
+                if len(data) < offset + page_size:
+                    break
+
+            if len(data) < run_end - page:
+                break
+
+            page = run_end
+
+        with io.BytesIO() as buffer:
+            page = first
+            while page < end:
+                base, data = exact.get(page, (page, self.__mem_cache.get(page, b"")))
+                lo, hi = max(addr, page), min(end, page + page_size)
+                buffer.write(data[lo - base:hi - base])
+                if len(data) < hi - base:
+                    break
+
+                page += page_size
+
+            return buffer.getvalue()
+
+    def __write_mem(self, addr, data):
+        page_size = GDBServer.__page_size
+        for page in range(addr & ~(page_size - 1), addr + len(data), page_size):
+            self.__mem_cache.pop(page, None)
+
+        if self.__hv.writemem(addr, data) < len(data):
+            return b"E22"
+
+        return b"OK"
+
     def __stop_reply(self):
         self.__hc = None
         self.__hg = None
@@ -115,6 +211,7 @@ class GDBServer:
                 self.__cpu(self.__hc)
                 self.__hv.ctx.elr = int(data[1:].decode(), 16)
 
+            self.__invalidate_mem()
             self.__hv.cont()
             self.__wait_shell()
             return self.__stop_reply()
@@ -174,20 +271,22 @@ class GDBServer:
             return b""
 
         if data[0] in b"krR":
+            self.__invalidate_mem()
             self.__hv.reboot()
 
         if data[0] in b"m":
             split = GDBServer.__separator.split(data[1:].decode(), maxsplit=1)
             fields = [int(field, 16) for field in split]
-            return bytes(self.__hv.readmem(fields[0], fields[1]).hex(), "utf-8")
+            mem = self.__read_mem(fields[0], fields[1])
+            if fields[1] and not mem:
+                return b"E14"
+
+            return bytes(mem.hex(), "utf-8")
 
         if data[0] in b"M":
             split = GDBServer.__separator.split(data[1:].decode(), maxsplit=2)
             mem = bytes.fromhex(split[2])[:int(split[1], 16)]
-            if self.__hv.writemem(int(split[0], 16), mem) < len(mem):
-                return "E22"
-
-            return b"OK"
+            return self.__write_mem(int(split[0], 16), mem)
 
         if data[0] in b"p":
             number = int(data[1:].decode(), 16)
@@ -251,11 +350,15 @@ class GDBServer:
 
             if split[0] == "Rcmd":
                 self.__cpu(self.__hg)
+                self.__invalidate_mem()
                 self.__hv.run_code(split[1])
                 return b"OK"
 
             if split[0] == "Supported":
-                return b"PacketSize=65536;qXfer:features:read+;hwbreak+"
+                # gdb only takes binary x replies with a "b" prefix, and says so here. lldb
+                # sends x packets regardless and wants the bare data.
+                self.__binary_upload = len(split) > 1 and "binary-upload+" in split[1]
+                return b"PacketSize=65536;qXfer:features:read+;hwbreak+;binary-upload+"
 
             if split[0] == "ThreadExtraInfo":
                 thread_id = int(split[1], 16)
@@ -292,6 +395,7 @@ class GDBServer:
             if len(data) != 1:
                 self.__hv.ctx.elr = int(data[1:].decode(), 16)
 
+            self.__invalidate_mem()
             self.__hv.step()
             return self.__stop_reply()
 
@@ -301,14 +405,24 @@ class GDBServer:
 
             return b"E01"
 
+        if data[0] in b"x":
+            split = GDBServer.__separator.split(data[1:].decode(), maxsplit=1)
+            fields = [int(field, 16) for field in split]
+            prefix = b"b" if self.__binary_upload else b""
+            if fields[1] == 0:
+                return prefix or b"OK"
+
+            mem = self.__read_mem(fields[0], fields[1])
+            if not mem:
+                return b"E14"
+
+            return prefix + mem
+
         if data[0] in b"X":
             partition = data[1:].partition(b":")
             split = GDBServer.__separator.split(partition[0].decode(), maxsplit=1)
             mem = partition[2][:int(split[1], 16)]
-            if self.__hv.writemem(int(split[0], 16), mem) < len(mem):
-                return b"E22"
-
-            return b"OK"
+            return self.__write_mem(int(split[0], 16), mem)
 
         if data[0] in b"z":
             split = GDBServer.__separator.split(data[1:].decode(), maxsplit=2)
@@ -427,7 +541,7 @@ class GDBServer:
                         input_index = 0
                         input_last = 0
                         while input_index < len(input_data):
-                            if input_data[input_index] == b"*":
+                            if input_data[input_index] == ord("*"):
                                 input_decoded.write(input_data[input_last:input_index])
                                 instance = input_decoded.getvalue()[-1]
                                 input_index += 1
@@ -436,7 +550,7 @@ class GDBServer:
                                 input_decoded.write(input_run)
                                 input_index += 1
                                 input_last = input_index
-                            elif input_data[input_index] == b"}":
+                            elif input_data[input_index] == ord("}"):
                                 input_decoded.write(input_data[input_last:input_index])
                                 input_index += 1
                                 input_decoded.write(bytes([input_data[input_index] ^ 0x20]))
@@ -457,6 +571,7 @@ class GDBServer:
             self.__interrupt_selector.unregister(self.__request)
 
     def notify_in_shell(self):
+        self.__invalidate_mem()
         os.eventfd_write(self.__interrupt_eventfd, 1)
 
     def activate(self):
@@ -5,8 +5,8 @@ from enum import IntEnum
 from ..utils import *
 
 __all__ = [
-    "MMIOTraceFlags", "EvtMMIOTrace", "EvtIRQTrace", "HV_EVENT",
-    "VMProxyHookData", "TraceMode",
+    "MMIOTraceFlags", "EvtMMIOTrace", "EvtIRQTrace", "VGICIRQStats", "TickStats", "HV_EVENT",
+    "HV_EXIT", "ProfStats", "ProfDump", "HVSample", "SysregStats", "XlateExtent", "VMProxyHookData", "TraceMode",
 ]
 
 class MMIOTraceFlags(Register32):
@@ -31,6 +31,86 @@ EvtIRQTrace = Struct(
     "num" / Int16ul,
 )
 
+# struct hv_vgic_irq_stats, in CNTPCT ticks
+VGICIRQStats = Struct(
+    "count" / Int64ul,
+    "inject_ticks" / Int64ul,
+    "inject_max" / Int64ul,
+    "complete_ticks" / Int64ul,
+    "complete_max" / Int64ul,
+)
+
+# struct hv_tick_stats, in CNTPCT ticks
+TickStats = Struct(
+    "ticks" / Int64ul,
+    "idle_ticks" / Int64ul,
+    "user_interrupts" / Int64ul,
+    "latency_ticks" / Int64ul,
+    "latency_max" / Int64ul,
+    "interval" / Int64ul,
+)
+
+# enum hv_exit_class
+class HV_EXIT(IntEnum):
+    SYSREG_FAST = 0
+    SMC = 1
+    SYSREG = 2
+    DABORT = 3
+    SYNC = 4
+    IRQ = 5
+    FIQ_FAST = 6
+    FIQ_TICK = 7
+    FIQ = 8
+    SERROR = 9
+    PROXY = 10
+
+# struct hv_prof_stats, in CNTPCT ticks
+ProfStats = Struct(
+    "count" / Int64ul,
+    "ticks" / Int64ul,
+    "max" / Int64ul,
+    "hist" / Array(32, Int32ul),
+)
+
+# What P_HV_PROF_DUMP returns: the header, per CPU exit classes, and the MMIO page table
+ProfDump = Struct(
+    "ncpus" / Int32ul,
+    "nclasses" / Int32ul,
+    "nbuckets" / Int32ul,
+    "npages" / Int32ul,
+    "freq" / Int64ul,
+    "dropped_pages" / Int64ul,
+    "exits" / Array(this.ncpus, Array(this.nclasses, ProfStats)),
+    "pages" / Array(this.npages, Struct(
+        "page" / Hex(Int64ul),
+        "stats" / ProfStats,
+    )),
+)
+
+# struct hv_sample
+HVSample = Struct(
+    "time" / Int64ul,
+    "pc" / Hex(Int64ul),
+    "spsr" / Hex(Int64ul),
+    "ttbr0" / Hex(Int64ul),
+    "cpu" / Int32ul,
+    "depth" / Int32ul,
+    "frames" / Array(16, Hex(Int64ul)),
+)
+
+# struct hv_xlate_extent
+XlateExtent = Struct(
+    "pa" / Hex(Int64ul),
+    "size" / Int64ul,
+)
+
+# struct hv_sysreg_stats
+SysregStats = Struct(
+    "enc" / Hex(Int32ul),
+    "flags" / Int32ul,
+    "count" / Int64ul,
+)
+
 class HV_EVENT(IntEnum):
     HOOK_VM = 1
     VTIMER = 2
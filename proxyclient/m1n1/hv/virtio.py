@@ -64,6 +64,20 @@ class VirtioDev:
     def feats(self):
         return 0
 
+class VirtioConsole(VirtioDev):
+    """virtio-console on the vUART's USB pipe, served by m1n1 itself without exiting to Python"""
+
+    @property
+    def devid(self):
+        return 3
+
+    @property
+    def num_qus(self):
+        return 2
+
+    def handle_exc(self, ctx):
+        return False
+
 class Virtio9PTransport(VirtioDev):
     def __init__(self, tag="m1n1", root=None):
         p_stdin, self.fin = os.pipe()
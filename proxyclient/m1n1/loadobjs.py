@@ -5,6 +5,7 @@ import subprocess
 import tempfile
 import bisect
 
+from .buildcache import BuildCache, toolchain_id
 from .toolchain import Toolchain
 
 __all__ = ["LinkedProgram"]
@@ -154,15 +155,35 @@ class LinkedProgram:
             return None, None
         return self.symbols[idx]
 
+    def _inline_c_inputs(self):
+        # Everything besides the snippet that invoke_cc depends on: flags, headers and tools.
+        # Read afresh on every build, so header edits during a session are picked up.
+        h = [toolchain_id(_toolchain)]
+        h += [os.environ.get(v, "") for v in ("ARCH", "TOOLCHAIN", "USE_CLANG", "EXTRA_CFLAGS")]
+        root = pathlib.Path(self.SOURCE_ROOT)
+        paths = [root / "Makefile", root / "config.h"]
+        paths += sorted((root / "src").rglob("*.h")) + sorted((root / "sysinc").rglob("*.h"))
+        for path in paths:
+            h.append(str(path.relative_to(root)))
+            h.append(path.read_bytes() if path.exists() else b"")
+        return BuildCache.key(*h)
+
     def load_inline_c(self, source):
-        tmp = tempfile.mkdtemp()
-        cfile = tmp + ".c"
-        objfile = tmp + ".o"
-        with open(cfile, "w") as f:
-            f.write(source)
-        run_tool("make", "-C", self.SOURCE_ROOT, "invoke_cc",
-                 f"OBJFILE={objfile}", f"CFILE={cfile}", silent=True)
-        self.load_obj(objfile)
+        cache = BuildCache("inline_c")
+        key = cache.key(source, self._inline_c_inputs())
+        files = cache.lookup(key, ("o",))
+
+        if files is None:
+            tmp = tempfile.mkdtemp()
+            cfile = tmp + ".c"
+            objfile = tmp + ".o"
+            with open(cfile, "w") as f:
+                f.write(source)
+            run_tool("make", "-C", self.SOURCE_ROOT, "invoke_cc",
+                     f"OBJFILE={objfile}", f"CFILE={cfile}", silent=True)
+            files = cache.store(key, {"o": objfile})
+
+        self.load_obj(files["o"])
 
 
 if __name__ == "__main__":
@@ -1,9 +1,10 @@
 # SPDX-License-Identifier: MIT
 from io import BytesIO, SEEK_END, SEEK_SET
-import bisect
+import bisect, json, struct
 from construct import *
 import subprocess
 
+from .buildcache import BuildCache
 from .utils import *
 
 __all__ = ["MachO"]
@@ -228,19 +229,32 @@ class MachO:
 
         cmd = self.get_cmd(MachOLoadCmdType.SYMTAB)
 
+        # The symbol table of a given build is identified by its UUID
+        cache = BuildCache("macho")
+        key = None
+        uuids = list(self.get_cmds(MachOLoadCmdType.UUID))
+        if len(uuids) == 1:
+            key = cache.key(uuids[0].args, cmd.args.nsyms, cmd.args.strsize, str(demangle))
+            data = cache.load_data(key, "json")
+            if data is not None:
+                try:
+                    self.symbols = json.loads(data)
+                    return
+                except ValueError:
+                    pass
+
         nsyms = cmd.args.nsyms
         length = NList.sizeof() * nsyms
         self.io.seek(self.off + cmd.args.symoff)
         symdata = self.io.read(length)
-
-        symbols = Array(nsyms, NList).parse(symdata)
+        self.io.seek(self.off + cmd.args.stroff)
+        strtab = self.io.read(cmd.args.strsize)
 
         symbols_dict = {}
-        for i in symbols:
-            off = cmd.args.stroff + i.n_strx
-            self.io.seek(self.off + off)
-            name = self.io.read(1024).split(b"\x00")[0].decode("ascii")
-            symbols_dict[name] = i.n_value
+        for n_strx, n_type, n_sect, n_desc, n_value in struct.iter_unpack("<IBBhQ", symdata):
+            end = strtab.find(b"\x00", n_strx)
+            name = strtab[n_strx:end if end >= 0 else None].decode("ascii")
+            symbols_dict[name] = n_value
 
         if demangle:
             names = list(symbols_dict.keys())
@@ -256,6 +270,9 @@ class MachO:
         else:
             self.symbols = symbols_dict
 
+        if key is not None:
+            cache.store_data(key, "json", json.dumps(self.symbols).encode("ascii"))
+
 if __name__ == "__main__":
     import sys
     macho = MachO(open(sys.argv[1], "rb").read())
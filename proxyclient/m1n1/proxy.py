@@ -439,6 +439,12 @@ class ProxyRemoteError(ProxyError):
 class ProxyCommandError(ProxyRemoteError):
     pass
 
+class ProxyExceptionError(ProxyRemoteError):
+    '''a guarded call took an exception; retval is what the call returned anyway'''
+    def __init__(self, msg, retval):
+        super().__init__(msg)
+        self.retval = retval
+
 class AlignmentError(Exception):
     pass
 
@@ -466,6 +472,13 @@ class GUARD(IntFlag):
     RETURN = 3
     SILENT = 0x100
 
+class CALL(IntEnum):
+    EL2 = 0
+    EL1 = 1
+    EL0 = 2
+    GL2 = 3
+    GL1 = 4
+
 REGION_RWX_EL0 = 0x80000000000
 REGION_RW_EL0 = 0xa0000000000
 REGION_RX_EL1 = 0xc0000000000
@@ -475,6 +488,7 @@ REGION_RX_EL1 = 0xc0000000000
 class M1N1Proxy(Reloadable):
     S_OK = 0
     S_BADCMD = -1
+    S_EXCEPTION = -2
 
     P_NOP = 0x000
     P_EXIT = 0x001
@@ -495,6 +509,8 @@ class M1N1Proxy(Reloadable):
     P_REBOOT = 0x010
     P_SLEEP = 0x011
     P_EL3_CALL = 0x012
+    P_CALL_GUARDED = 0x013
+    P_SYSREG_RW = 0x014
 
     P_WRITE64 = 0x100
     P_WRITE32 = 0x101
@@ -549,6 +565,9 @@ class M1N1Proxy(Reloadable):
 
     P_XZDEC = 0x400
     P_GZDEC = 0x401
+    P_ZSTDDEC = 0x402
+    P_LZ4DEC = 0x403
+    P_CRC32 = 0x404
 
     P_SMP_START_SECONDARIES = 0x500
     P_SMP_CALL = 0x501
@@ -593,6 +612,7 @@ class M1N1Proxy(Reloadable):
     P_DART_SHUTDOWN = 0xb01
     P_DART_MAP = 0xb02
     P_DART_UNMAP = 0xb03
+    P_DART_MAP_BATCH = 0xb04
 
     P_HV_INIT = 0xc00
     P_HV_MAP = 0xc01
@@ -620,6 +640,20 @@ class M1N1Proxy(Reloadable):
     P_HV_PSCI_FEATURES = 0xc17
     P_HV_PSCI_MEM_PROTECT = 0xc18
     P_HV_PSCI_MEM_PROTECT_CHECK_RANGE = 0xc19
+    P_HV_VGIC_ROUTE_IRQ = 0xc1a
+    P_HV_VGIC_IRQ_STATS = 0xc1b
+    P_HV_TICK_STATS = 0xc1c
+    P_HV_PROF_ENABLE = 0xc1d
+    P_HV_PROF_DUMP = 0xc1e
+    P_HV_SAMPLE_START = 0xc1f
+    P_HV_SAMPLE_STOP = 0xc20
+    P_HV_SAMPLE_DRAIN = 0xc21
+    P_HV_SYSREG_MAP = 0xc22
+    P_HV_SYSREG_UNREGISTER = 0xc23
+    P_HV_SYSREG_STATS = 0xc24
+    P_HV_TRANSLATE_RANGE = 0xc25
+    P_HV_GATHER = 0xc26
+    P_HV_SCATTER = 0xc27
 
     P_FB_INIT = 0xd00
     P_FB_SHUTDOWN = 0xd01
@@ -638,6 +672,7 @@ class M1N1Proxy(Reloadable):
     P_NVME_SHUTDOWN = 0xf01
     P_NVME_READ = 0xf02
     P_NVME_FLUSH = 0xf03
+    P_NVME_READ_BLOCKS = 0xf04
 
     P_MCC_GET_CARVEOUTS = 0x1000
 
@@ -652,6 +687,11 @@ class M1N1Proxy(Reloadable):
 
     P_CPUFREQ_INIT = 0x1300
 
+    P_BOOTPROF_GET = 0x1400
+    P_BOOTPROF_SET_EXPORT = 0x1401
+
+    P_ADT_INDEX_BUILD = 0x1500
+
     def __init__(self, iface, debug=False):
         self.debug = debug
         self.iface = iface
@@ -678,6 +718,8 @@ class M1N1Proxy(Reloadable):
         if status != self.S_OK:
             if status == self.S_BADCMD:
                 raise ProxyCommandError("Reply error: Bad Command")
+            elif status == self.S_EXCEPTION:
+                raise ProxyExceptionError("Exception occurred", retval)
             else:
                 raise ProxyRemoteError("Reply error: Unknown error (%d)"%status)
         return retval
@@ -778,6 +820,15 @@ class M1N1Proxy(Reloadable):
         if len(args) > 4:
             raise ValueError("Too many arguments")
         return self.request(self.P_EL3_CALL, addr, *args)
+    def call_guarded(self, addr, *args, mode=CALL.EL2, guard=GUARD.SKIP):
+        '''call addr with the exception guard set, raises ProxyExceptionError on exceptions'''
+        if len(args) > 4:
+            raise ValueError("Too many arguments")
+        return self.request(self.P_CALL_GUARDED, addr, guard | (mode << 16), *args)
+    def sysreg_rw(self, enc, val=None, mode=CALL.EL2, guard=GUARD.SKIP):
+        '''mrs (val is None) or msr of the sysreg with MRS encoding bits [20:5] enc'''
+        flags = guard | (mode << 16) | ((1 << 24) if val is not None else 0)
+        return self.request(self.P_SYSREG_RW, enc, flags, val or 0)
 
     def write64(self, addr, data):
         '''write 8 byte value to given address'''
@@ -964,6 +1015,17 @@ class M1N1Proxy(Reloadable):
         return self.request(self.P_GZDEC, inbuf, insize, outbuf,
                             outsize, signed=True)
 
+    def zstddec(self, inbuf, insize, outbuf, outsize):
+        return self.request(self.P_ZSTDDEC, inbuf, insize, outbuf,
+                            outsize, signed=True)
+
+    def lz4dec(self, inbuf, insize, outbuf, outsize):
+        return self.request(self.P_LZ4DEC, inbuf, insize, outbuf,
+                            outsize, signed=True)
+
+    def crc32(self, addr, size):
+        return self.request(self.P_CRC32, addr, size)
+
     def smp_start_secondaries(self):
         self.request(self.P_SMP_START_SECONDARIES)
     def smp_call(self, cpu, addr, *args):
@@ -1058,6 +1120,11 @@ class M1N1Proxy(Reloadable):
         return self.request(self.P_DART_MAP, dart, iova, bfr, len)
     def dart_unmap(self, dart, iova, len):
         return self.request(self.P_DART_UNMAP, dart, iova, len)
+    def dart_map_batch(self, dart, maps):
+        # maps: (iova, paddr, len[, flags]) tuples, mapped with a single TLB invalidate
+        data = b"".join(struct.pack("<QQQII", *m[:3], m[3] if len(m) > 3 else 0, 0)
+                        for m in maps)
+        return self.request(self.P_DART_MAP_BATCH, dart, data, len(maps))
 
     def hv_init(self):
         return self.request(self.P_HV_INIT)
@@ -1069,6 +1136,14 @@ class M1N1Proxy(Reloadable):
         '''Translate virtual address
  stage 1 only if s1, for write if w'''
         return self.request(self.P_HV_TRANSLATE, addr, s1, w)
+    def hv_translate_range(self, addr, size, s1, w, ext, count):
+        '''Translate a virtual range into up to count extents at ext
+ stage 1 only if s1, for write if w. Returns the number of extents'''
+        return self.request(self.P_HV_TRANSLATE_RANGE, addr, size, s1, w, ext, count)
+    def hv_gather(self, dst, ext, count):
+        return self.request(self.P_HV_GATHER, dst, ext, count)
+    def hv_scatter(self, src, ext, count):
+        return self.request(self.P_HV_SCATTER, src, ext, count)
     def hv_pt_walk(self, addr):
         return self.request(self.P_HV_PT_WALK, addr)
     def hv_map_vuart(self, base, irq, iodev):
@@ -1111,6 +1186,28 @@ class M1N1Proxy(Reloadable):
         return self.request(self.P_HV_PSCI_MEM_PROTECT, enable_mem_protect)
     def hv_psci_mem_protect_check_range(self, base, length):
         return self.request(self.P_HV_PSCI_MEM_PROTECT_CHECK_RANGE, base, length)
+    def hv_vgic_route_irq(self, num, spi):
+        return self.request(self.P_HV_VGIC_ROUTE_IRQ, num, spi)
+    def hv_vgic_irq_stats(self, spi, buf):
+        return self.request(self.P_HV_VGIC_IRQ_STATS, spi, buf)
+    def hv_tick_stats(self, buf):
+        return self.request(self.P_HV_TICK_STATS, buf)
+    def hv_prof_enable(self, enable=True, reset=True):
+        return self.request(self.P_HV_PROF_ENABLE, enable, reset)
+    def hv_prof_dump(self, buf, size):
+        return self.request(self.P_HV_PROF_DUMP, buf, size)
+    def hv_sample_start(self, rate, depth, ring_size):
+        return self.request(self.P_HV_SAMPLE_START, rate, depth, ring_size, signed=True)
+    def hv_sample_stop(self):
+        return self.request(self.P_HV_SAMPLE_STOP)
+    def hv_sample_drain(self, buf, count):
+        return self.request(self.P_HV_SAMPLE_DRAIN, buf, count)
+    def hv_sysreg_map(self, enc, to, flags):
+        return self.request(self.P_HV_SYSREG_MAP, enc, to, flags, signed=True)
+    def hv_sysreg_unregister(self, enc):
+        return self.request(self.P_HV_SYSREG_UNREGISTER, enc)
+    def hv_sysreg_stats(self, buf, count, reset=False):
+        return self.request(self.P_HV_SYSREG_STATS, buf, count, reset)
 
     def fb_init(self):
         return self.request(self.P_FB_INIT)
@@ -1144,6 +1241,8 @@ class M1N1Proxy(Reloadable):
         return self.request(self.P_NVME_READ, nsid, lba, bfr)
     def nvme_flush(self, nsid):
         return self.request(self.P_NVME_FLUSH, nsid)
+    def nvme_read_blocks(self, nsid, lba, count, bfr):
+        return self.request(self.P_NVME_READ_BLOCKS, nsid, lba, count, bfr)
 
     def mcc_get_carveouts(self):
         return self.request(self.P_MCC_GET_CARVEOUTS)
@@ -1167,6 +1266,14 @@ class M1N1Proxy(Reloadable):
     def cpufreq_init(self):
         return self.request(self.P_CPUFREQ_INIT)
 
+    def bootprof_get(self):
+        return self.request(self.P_BOOTPROF_GET)
+    def bootprof_set_export(self, enable):
+        return self.request(self.P_BOOTPROF_SET_EXPORT, int(enable))
+
+    def adt_index_build(self, size):
+        return self.request(self.P_ADT_INDEX_BUILD, size)
+
 __all__.extend(k for k, v in globals().items()
                if (callable(v) or isinstance(v, type)) and v.__module__ == __name__)
 
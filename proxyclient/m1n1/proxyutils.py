@@ -1,11 +1,12 @@
 # SPDX-License-Identifier: MIT
-import serial, os, struct, sys, time, json, os.path, gzip, functools
+import serial, os, struct, sys, time, json, os.path, gzip, functools, math, zlib
 from contextlib import contextmanager
 from construct import *
 
 from .asm import ARMAsm
+from .buildcache import BuildCache
 from .proxy import *
-from .utils import Reloadable, chexdiff32
+from .utils import Reloadable, chexdiff32, align_up
 from .tgtypes import *
 from .sysreg import *
 from .malloc import Heap
@@ -38,8 +39,58 @@ VERSION_MAP = {
     "iBoot-8422.141.2": "V13_5",
 }
 
+class TransferCodec:
+    """A compression format compressed_writemem() can use, with its running performance figures
+
+    decode_rate is the device-side decompression speed and compress_rate the host-side one, both
+    in bytes of uncompressed data per second. They start out as rough guesses and are replaced by
+    a moving average of measured values as transfers happen.
+    """
+    def __init__(self, name, compress, decompress, decode_rate, compress_rate):
+        self.name = name
+        self.compress = compress
+        self.decompress = decompress
+        self.decode_rate = decode_rate
+        self.compress_rate = compress_rate
+
+    @staticmethod
+    def ewma(old, new, alpha=0.5):
+        return old * (1 - alpha) + new * alpha
+
+def transfer_codecs(proxy):
+    codecs = []
+    try:
+        import lz4.frame
+        codecs.append(TransferCodec(
+            "lz4", lambda d: lz4.frame.compress(d, compression_level=0, store_size=False),
+            proxy.lz4dec, 800e6, 400e6))
+    except ImportError:
+        pass
+    try:
+        import zstandard
+        codecs.append(TransferCodec(
+            "zstd", zstandard.ZstdCompressor(level=1).compress, proxy.zstddec, 250e6, 300e6))
+    except ImportError:
+        pass
+    codecs.append(TransferCodec(
+        "gz", lambda d: gzip.compress(d, compresslevel=1), proxy.gzdec, 30e6, 60e6))
+    return codecs
+
 class ProxyUtils(Reloadable):
+    # exec() stubs are uploaded once into CODE_SLOT_ALIGN aligned slots of the code buffer, which
+    # is emptied as a whole when it fills up
     CODE_BUFFER_SIZE = 0x10000
+    CODE_SLOT_ALIGN = 64
+    # compressed_writemem() tuning: transfers below COMPRESS_MIN bytes or with an estimated
+    # entropy above COMPRESS_MAX_ENTROPY bits/byte are sent as-is. Compressibility is estimated
+    # from COMPRESS_SAMPLES evenly spaced chunks of COMPRESS_SAMPLE_SIZE bytes.
+    COMPRESS_MIN = 0x10000
+    COMPRESS_MAX_ENTROPY = 7.5
+    COMPRESS_SAMPLES = 16
+    COMPRESS_SAMPLE_SIZE = 0x1000
+    # Fixed per transfer cost of the extra decompression request and heap bookkeeping
+    COMPRESS_OVERHEAD = 0.002
+    LINK_RATE_DEFAULT = 8e6
     def __init__(self, p, heap_size=1024 * 1024 * 1024):
         self.iface = p.iface
         self.proxy = p
@@ -90,7 +141,13 @@ class ProxyUtils(Reloadable):
 
         self.mmu_off = False
 
-        self.inst_cache = {}
+        self.code_slots = {}
+        self.code_top = self.code_buffer
+        # Cleared if m1n1 predates P_CALL_GUARDED and P_SYSREG_RW
+        self.guarded_ops = True
+
+        self.link_rate = self.LINK_RATE_DEFAULT
+        self.codecs = transfer_codecs(self.proxy)
 
         self.exec_modes = {
             None: (self.proxy.call, REGION_RX_EL1),
@@ -100,6 +157,14 @@ class ProxyUtils(Reloadable):
             "gl2": (self.proxy.gl2_call, REGION_RX_EL1),
             "gl1": (self.proxy.gl1_call, 0),
         }
+        self.guarded_modes = {
+            None: CALL.EL2,
+            "el2": CALL.EL2,
+            "el1": CALL.EL1,
+            "el0": CALL.EL0,
+            "gl2": CALL.GL2,
+            "gl1": CALL.GL1,
+        }
         self._read = {
             8: lambda addr: self.proxy.read8(addr),
             16: lambda addr: self.proxy.read16(addr),
@@ -162,8 +227,31 @@ class ProxyUtils(Reloadable):
         if self.proxy.get_exc_count():
             raise ProxyError("Exception occurred")
 
+    def _guarded(self, call):
+        if not self.guarded_ops or callable(call) or isinstance(call, tuple):
+            return None
+        return self.guarded_modes.get(call)
+
+    def _sysreg_rw(self, reg, val, silent, call):
+        mode = self._guarded(call)
+        if mode is None:
+            return None
+
+        op0, op1, CRn, CRm, op2 = sysreg_parse(reg)
+        enc = (op0 << 14) | (op1 << 11) | (CRn << 7) | (CRm << 3) | op2
+        guard = GUARD.SKIP | (GUARD.SILENT if silent else 0)
+        try:
+            return self.proxy.sysreg_rw(enc, val, mode=mode, guard=guard)
+        except ProxyCommandError:
+            self.guarded_ops = False
+            return None
+
     def mrs(self, reg, *, silent=False, call=None):
         '''read system register reg'''
+        val = self._sysreg_rw(reg, None, silent, call)
+        if val is not None:
+            return val
+
         op0, op1, CRn, CRm, op2 = sysreg_parse(reg)
 
         op =  ((op0 << 19) | (op1 << 16) | (CRn << 12) |
@@ -173,6 +261,9 @@ class ProxyUtils(Reloadable):
 
     def msr(self, reg, val, *, silent=False, call=None):
         '''Write val to system register reg'''
+        if self._sysreg_rw(reg, val, silent, call) is not None:
+            return
+
         op0, op1, CRn, CRm, op2 = sysreg_parse(reg)
 
         op =  ((op0 << 19) | (op1 << 16) | (CRn << 12) |
@@ -183,7 +274,41 @@ class ProxyUtils(Reloadable):
     sys = msr
     sysl = mrs
 
+    def _code_slot(self, op):
+        '''address of op's stub in the code buffer, uploading it on first use'''
+        if op in self.code_slots:
+            return self.code_slots[op]
+
+        for _ in range(2):
+            addr = self.code_top
+            if isinstance(op, tuple):
+                func = struct.pack(f"<{len(op)}II", *op, 0xd65f03c0) # ret
+            elif isinstance(op, int):
+                func = struct.pack("<II", op, 0xd65f03c0) # ret
+            elif isinstance(op, str):
+                func = ARMAsm(op + "; ret", addr).data
+            elif isinstance(op, bytes):
+                func = op
+            else:
+                raise ValueError()
+
+            assert len(func) < self.CODE_BUFFER_SIZE
+            if addr + len(func) <= self.code_buffer + self.CODE_BUFFER_SIZE:
+                break
+            self.code_slots = {}
+            self.code_top = self.code_buffer
+
+        self.iface.writemem(addr, func)
+        self.proxy.dc_cvau(addr, len(func))
+        self.proxy.ic_ivau(addr, len(func))
+
+        self.code_top = align_up(addr + len(func), self.CODE_SLOT_ALIGN)
+        self.code_slots[op] = addr
+        return addr
+
     def exec(self, op, r0=0, r1=0, r2=0, r3=0, *, silent=False, call=None, ignore_exceptions=False):
+        mode = self._guarded(call)
+
         if callable(call):
             region = REGION_RX_EL1
         elif isinstance(call, tuple):
@@ -194,32 +319,24 @@ class ProxyUtils(Reloadable):
         if isinstance(op, list):
             op = tuple(op)
 
-        if op in self.inst_cache:
-            func = self.inst_cache[op]
-        elif isinstance(op, tuple) or isinstance(op, list):
-            func = struct.pack(f"<{len(op)}II", *op, 0xd65f03c0) # ret
-        elif isinstance(op, int):
-            func = struct.pack("<II", op, 0xd65f03c0) # ret
-        elif isinstance(op, str):
-            c = ARMAsm(op + "; ret", self.code_buffer)
-            func = c.data
-        elif isinstance(op, bytes):
-            func = op
-        else:
-            raise ValueError()
-
         if self.mmu_off:
             region = 0
 
-        self.inst_cache[op] = func
-
-        assert len(func) < self.CODE_BUFFER_SIZE
-        self.iface.writemem(self.code_buffer, func)
-        self.proxy.dc_cvau(self.code_buffer, len(func))
-        self.proxy.ic_ivau(self.code_buffer, len(func))
+        addr = self._code_slot(op) | region
+        guard = GUARD.SKIP | (GUARD.SILENT if silent else 0)
 
-        self.proxy.set_exc_guard(GUARD.SKIP | (GUARD.SILENT if silent else 0))
-        ret = call(self.code_buffer | region, r0, r1, r2, r3)
+        if mode is not None:
+            try:
+                return self.proxy.call_guarded(addr, r0, r1, r2, r3, mode=mode, guard=guard)
+            except ProxyExceptionError as e:
+                if ignore_exceptions:
+                    return e.retval
+                raise
+            except ProxyCommandError:
+                self.guarded_ops = False
+
+        self.proxy.set_exc_guard(guard)
+        ret = call(addr, r0, r1, r2, r3)
         if not ignore_exceptions:
             cnt = self.proxy.get_exc_count()
             self.proxy.set_exc_guard(GUARD.OFF)
@@ -232,31 +349,104 @@ class ProxyUtils(Reloadable):
 
     inst = exec
 
-    def compressed_writemem(self, dest, data, progress=None):
+    def _timed_writemem(self, dest, data, progress=None):
+        t = time.time()
+        self.iface.writemem(dest, data, progress)
+        elapsed = time.time() - t
+        # Small transfers are dominated by latency and say little about bandwidth
+        if len(data) >= self.COMPRESS_MIN and elapsed > 0:
+            self.link_rate = TransferCodec.ewma(self.link_rate, len(data) / elapsed)
+
+    def choose_codec(self, data):
+        '''pick the transfer codec expected to get data to the device fastest (None: raw)'''
+        size = len(data)
+        if size < self.COMPRESS_MIN or not self.codecs:
+            return None
+
+        step = max(size // self.COMPRESS_SAMPLES, self.COMPRESS_SAMPLE_SIZE)
+        sample = b"".join(data[i:i + self.COMPRESS_SAMPLE_SIZE] for i in range(0, size, step))
+
+        counts = [sample.count(bytes((i,))) for i in range(256)]
+        entropy = -sum(c / len(sample) * math.log2(c / len(sample)) for c in counts if c)
+        if entropy > self.COMPRESS_MAX_ENTROPY:
+            return None
+
+        best, best_time = None, size / self.link_rate
+        for codec in self.codecs:
+            t = time.time()
+            ratio = len(codec.compress(sample)) / len(sample)
+            elapsed = time.time() - t
+            if elapsed > 0:
+                codec.compress_rate = TransferCodec.ewma(codec.compress_rate, len(sample) / elapsed)
+
+            est = (size / codec.compress_rate + size * ratio / self.link_rate +
+                   size / codec.decode_rate + self.COMPRESS_OVERHEAD)
+            if est < best_time:
+                best, best_time = codec, est
+
+        return best
+
+    def compressed_writemem(self, dest, data, progress=None, codec=None):
+        '''write data to dest, compressing it on the fly if that is expected to be faster
+
+        codec may be a TransferCodec name to force a specific one, or "none" to send data raw.
+        '''
         if not len(data):
             return
 
-        payload = gzip.compress(data, compresslevel=1)
+        if codec is None:
+            codec = self.choose_codec(data)
+        elif codec == "none":
+            codec = None
+        else:
+            codec = next(c for c in self.codecs if c.name == codec)
+
+        if codec is None:
+            self._timed_writemem(dest, data, progress)
+            return
+
+        payload = codec.compress(data)
         compressed_size = len(payload)
 
         with self.heap.guarded_malloc(compressed_size) as compressed_addr:
-            self.iface.writemem(compressed_addr, payload, progress)
+            self._timed_writemem(compressed_addr, payload, progress)
             timeout = self.iface.dev.timeout
             self.iface.dev.timeout = None
             try:
-                decompressed_size = self.proxy.gzdec(compressed_addr, compressed_size, dest, len(data))
+                t = time.time()
+                decompressed_size = codec.decompress(compressed_addr, compressed_size, dest, len(data))
+                elapsed = time.time() - t
             finally:
                 self.iface.dev.timeout = timeout
 
             assert decompressed_size == len(data)
+            if elapsed > 0:
+                codec.decode_rate = TransferCodec.ewma(codec.decode_rate, len(data) / elapsed)
 
     def get_adt(self):
         if self.adt_data is not None:
             return self.adt_data
         adt_base = (self.ba.devtree - self.ba.virt_base + self.ba.phys_base) & 0xffffffffffffffff
         adt_size = self.ba.devtree_size
-        print(f"Fetching ADT ({adt_size} bytes)...")
-        self.adt_data = self.iface.readmem(adt_base, self.ba.devtree_size)
+
+        # A reconnect to the same boot finds the ADT in the cache by its size and checksum
+        cache = BuildCache("adt")
+        try:
+            crc = self.proxy.crc32(adt_base, adt_size)
+        except ProxyCommandError: # old m1n1 has no P_CRC32
+            crc = None
+        key = cache.key(adt_size, crc) if crc is not None else None
+
+        data = cache.load_data(key, "bin") if key is not None else None
+        if data is not None and len(data) == adt_size and zlib.crc32(data) == crc:
+            print(f"Using cached ADT ({adt_size} bytes)")
+        else:
+            print(f"Fetching ADT ({adt_size} bytes)...")
+            data = self.iface.readmem(adt_base, adt_size)
+            if key is not None and zlib.crc32(data) == crc:
+                cache.store_data(key, "bin", data)
+
+        self.adt_data = data
         return self.adt_data
 
     def push_adt(self):
@@ -265,6 +455,11 @@ class ProxyUtils(Reloadable):
         adt_size = len(self.adt_data)
         print(f"Pushing ADT ({adt_size} bytes)...")
         self.iface.writemem(adt_base, self.adt_data)
+        try:
+            # The layout may have changed, so m1n1's lookup index has to be rebuilt
+            self.proxy.adt_index_build(adt_size)
+        except ProxyCommandError: # old m1n1 does not keep an ADT index
+            pass
 
     def disassemble_at(self, start, size, pc=None, vstart=None, sym=None):
         '''disassemble len bytes of memory from start
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+import sys, pathlib
+sys.path.append(str(pathlib.Path(__file__).resolve().parents[1]))
+
+import argparse, json
+
+from construct import *
+
+parser = argparse.ArgumentParser(description='Show the m1n1 boot-phase timing profile')
+parser.add_argument('-f', '--file', type=pathlib.Path,
+                    help="read a saved report (e.g. /proc/device-tree/chosen/m1n1,boot-profile) "
+                         "instead of asking m1n1 over the proxy")
+parser.add_argument('-j', '--json', action="store_true", help="print the spans as JSON")
+parser.add_argument('-b', '--baseline', type=pathlib.Path,
+                    help="JSON output of an earlier run to compare span durations against")
+parser.add_argument('-w', '--width', type=int, default=50, help="timeline width in columns")
+args = parser.parse_args()
+
+BOOTPROF_MAGIC = 0x666f7270746f6f62
+BOOTPROF_NO_PARENT = 0xffff
+
+BootProfHeader = Struct(
+    "magic" / Const(BOOTPROF_MAGIC, Int64ul),
+    "version" / Int32ul,
+    "span_size" / Int32ul,
+    "freq" / Int64ul,
+    "count" / Int32ul,
+    "dropped" / Int32ul,
+)
+
+BootProfSpan = Struct(
+    "name" / PaddedString(32, "ascii"),
+    "start" / Int64ul,
+    "end" / Int64ul,
+    "parent" / Int16ul,
+    "cpu" / Int8ul,
+    "depth" / Int8ul,
+    "pad" / Int32ul,
+)
+
+def parse(hdr_data, read_spans):
+    hdr = BootProfHeader.parse(hdr_data)
+    data = read_spans(hdr.span_size * hdr.count)
+    spans = [BootProfSpan.parse(data[i:i + hdr.span_size])
+             for i in range(0, len(data), hdr.span_size)]
+    return hdr, spans
+
+if args.file:
+    raw = args.file.read_bytes()
+    hsize = BootProfHeader.sizeof()
+    hdr, spans = parse(raw[:hsize], lambda size: raw[hsize:hsize + size])
+else:
+    from m1n1.setup import *
+
+    addr = p.bootprof_get()
+    hsize = BootProfHeader.sizeof()
+    hdr, spans = parse(iface.readmem(addr, hsize),
+                       lambda size: iface.readmem(addr + hsize, size))
+
+if not spans:
+    print("No spans recorded")
+    sys.exit(0)
+
+def ms(ticks):
+    return ticks * 1000 / hdr.freq
+
+t0 = min(s.start for s in spans)
+now = max(max(s.start, s.end) for s in spans)
+
+records = []
+for i, s in enumerate(spans):
+    end = s.end or now
+    records.append({
+        "id": i,
+        "name": s.name,
+        "cpu": s.cpu,
+        "depth": s.depth,
+        "parent": None if s.parent == BOOTPROF_NO_PARENT else s.parent,
+        "start_ms": round(ms(s.start - t0), 3),
+        "duration_ms": round(ms(end - s.start), 3),
+        "open": not s.end,
+    })
+
+if args.json:
+    json.dump({
+        "freq": hdr.freq,
+        "origin_ms": round(ms(t0), 3),
+        "dropped": hdr.dropped,
+        "spans": records,
+    }, sys.stdout, indent=2)
+    print()
+    sys.exit(0)
+
+baseline = {}
+if args.baseline:
+    for r in json.loads(args.baseline.read_text())["spans"]:
+        baseline.setdefault((r["name"], r["depth"]), r["duration_ms"])
+
+total = ms(now - t0) or 1
+print(f"Boot profile: {len(records)} spans over {total:.3f} ms, "
+      f"starting {ms(t0):.3f} ms after power on")
+if hdr.dropped:
+    print(f"  ({hdr.dropped} spans dropped, the buffer was full)")
+print()
+
+print(f"{'start':>10} {'duration':>10} {'cpu':>3}  {'span':40} timeline")
+for r in sorted(records, key=lambda r: (r["start_ms"], r["depth"])):
+    a = int(r["start_ms"] / total * args.width)
+    b = max(a + 1, int((r["start_ms"] + r["duration_ms"]) / total * args.width))
+    bar = " " * a + "#" * (b - a)
+    name = "  " * r["depth"] + r["name"] + (" (open)" if r["open"] else "")
+    line = f"{r['start_ms']:10.3f} {r['duration_ms']:10.3f} {r['cpu']:3d}  {name:40} |{bar:{args.width}}|"
+
+    base = baseline.get((r["name"], r["depth"]))
+    if base is not None:
+        line += f" {r['duration_ms'] - base:+.3f}"
+    print(line)
@@ -10,11 +10,13 @@ parser = argparse.ArgumentParser(description='(Linux) kernel loader for m1n1')
 parser.add_argument('payload', type=pathlib.Path)
 parser.add_argument('dtb', type=pathlib.Path)
 parser.add_argument('initramfs', nargs='?', type=pathlib.Path)
-parser.add_argument('--compression', choices=['auto', 'none', 'gz', 'xz'], default='auto')
+parser.add_argument('--compression', choices=['auto', 'none', 'gz', 'xz', 'zstd', 'lz4'], default='auto')
 parser.add_argument('-b', '--bootargs', type=str, metavar='"boot arguments"')
 parser.add_argument('-t', '--tty', type=str)
 parser.add_argument('-u', '--u-boot', type=pathlib.Path, help="load u-boot before linux")
 parser.add_argument('-T', '--tso', action="store_true", help="enable TSO")
+parser.add_argument('-P', '--boot-profile', action="store_true",
+                    help="export the m1n1 boot profile to /chosen/m1n1,boot-profile")
 args = parser.parse_args()
 
 from m1n1.setup import *
@@ -25,6 +27,10 @@ if args.compression == 'auto':
         args.compression = 'gz'
     elif suffix == '.xz':
         args.compression = 'xz'
+    elif suffix in ('.zst', '.zstd'):
+        args.compression = 'zstd'
+    elif suffix == '.lz4':
+        args.compression = 'lz4'
     else:
         raise ValueError('unknown compression for {}'.format(args.payload))
 
@@ -126,6 +132,9 @@ if args.tso:
             u.msr("ACTLR_EL1", actlr, call=lambda addr, *args: p.smp_call_sync(i, addr & ~REGION_RX_EL1, *args))
     p.kboot_set_chosen("apple,tso", "")
 
+if args.boot_profile:
+    p.bootprof_set_export(True)
+
 if p.kboot_prepare_dt(dtb_addr):
     print("DT prepare failed")
     sys.exit(1)
@@ -142,6 +151,12 @@ elif args.compression == 'gz':
 elif args.compression == 'xz':
     print("Uncompressing xz ...")
     kernel_size = p.xzdec(compressed_addr, compressed_size, kernel_base, kernel_size)
+elif args.compression == 'zstd':
+    print("Uncompressing zstd ...")
+    kernel_size = p.zstddec(compressed_addr, compressed_size, kernel_base, kernel_size)
+elif args.compression == 'lz4':
+    print("Uncompressing lz4 ...")
+    kernel_size = p.lz4dec(compressed_addr, compressed_size, kernel_base, kernel_size)
 else:
     raise ValueError('unsupported compression {}'.format(args.compression))
 
@@ -25,6 +25,8 @@ parser.add_argument('-v', '--volume', type=volumespec, action='append',
                     help='Attach a 9P virtio device for file export to the guest. The argument is a host path to the '
                          'exported tree, joined by colon (\':\') with a tag under which the tree will be advertised '
                          'on the guest side.')
+parser.add_argument('--virtio-console', action="store_true",
+                    help='Attach a virtio console (hvc0 on Linux) on the vUART\'s USB pipe')
 parser.add_argument('payload', type=pathlib.Path)
 parser.add_argument('boot_args', default=[], nargs="*")
 args = parser.parse_args()
@@ -34,7 +36,7 @@ from m1n1.proxyutils import *
 from m1n1.utils import *
 from m1n1.shell import run_shell
 from m1n1.hv import HV
-from m1n1.hv.virtio import Virtio9PTransport
+from m1n1.hv.virtio import Virtio9PTransport, VirtioConsole
 from m1n1.hw.pmu import PMU
 
 iface = UartInterface()
@@ -67,6 +69,9 @@ if args.volume:
     for path, tag in args.volume:
         hv.attach_virtio(Virtio9PTransport(root=path, tag=tag))
 
+if args.virtio_console:
+    hv.attach_virtio(VirtioConsole())
+
 if args.logfile:
     hv.set_logfile(args.logfile.open("w"))
 
@@ -6,10 +6,21 @@ use crate::gpt;
 use crate::nvme;
 use crate::println;
 use alloc::vec::Vec;
+use core::arch::asm;
 use core::ffi::{c_char, c_int, c_void, CStr};
 use fatfs::{FileSystem, FsOptions, Read, Seek, SeekFrom};
 use uuid::Uuid;
 
+extern "C" {
+    fn ticks_to_usecs(ticks: u64) -> u64;
+}
+
+const NSID: u32 = 1;
+
+// Sectors cached for GPT and FAT metadata, and how far sequential misses read ahead
+const CACHE_SECTORS: usize = 256;
+const CACHE_READAHEAD: usize = 16;
+
 #[derive(Debug)]
 pub enum Error {
     FATError(fatfs::Error<nvme::Error>),
@@ -31,7 +42,59 @@ impl From<gpt::Error<nvme::Error>> for Error {
     }
 }
 
-fn load_image(spec: &str) -> Result<Vec<u8>, Error> {
+/// A loaded image: `size` bytes starting at `start` within `buf`, which may be over-allocated
+/// so the data can start on a sector boundary.
+struct Image {
+    buf: Vec<u8>,
+    start: usize,
+    size: usize,
+}
+
+/// A run of whole sectors on the partition, holding `size` bytes of the file.
+struct Extent {
+    lba: u64,
+    size: usize,
+}
+
+fn ticks() -> u64 {
+    let val: u64;
+    unsafe { asm!("mrs {}, cntpct_el0", out(reg) val) };
+    val
+}
+
+fn round_up(val: usize) -> usize {
+    (val + nvme::SECTOR_SIZE - 1) / nvme::SECTOR_SIZE * nvme::SECTOR_SIZE
+}
+
+/// Resolve the file's cluster chain into runs of contiguous sectors. Returns None if the data
+/// is not sector aligned on disk, in which case it has to be read through the filesystem.
+fn file_extents<T: fatfs::ReadWriteSeek>(
+    file: &mut fatfs::File<'_, T, impl fatfs::TimeProvider, impl fatfs::OemCpConverter>,
+) -> Result<Option<Vec<Extent>>, fatfs::Error<T::Error>> {
+    let mut extents: Vec<Extent> = Vec::new();
+
+    for extent in file.extents() {
+        let extent = extent?;
+        let size = extent.size as usize;
+
+        if extent.offset % nvme::SECTOR_SIZE as u64 != 0 {
+            return Ok(None);
+        }
+        let lba = extent.offset / nvme::SECTOR_SIZE as u64;
+
+        // Clusters are whole sectors, so only the file's last extent can end mid-sector
+        match extents.last_mut() {
+            Some(last) if last.lba + (last.size / nvme::SECTOR_SIZE) as u64 == lba => {
+                last.size += size
+            }
+            _ => extents.push(Extent { lba, size }),
+        }
+    }
+
+    Ok(Some(extents))
+}
+
+fn load_image(spec: &str) -> Result<Image, Error> {
     println!("Chainloading {}", spec);
 
     let mut args = spec.split(';');
@@ -39,8 +102,10 @@ fn load_image(spec: &str) -> Result<Vec<u8>, Error> {
     let uuid = Uuid::parse_str(args.next().ok_or(Error::BadArgs)?).or(Err(Error::BadArgs))?;
     let path = args.next().ok_or(Error::BadArgs)?;
 
+    let cache = nvme::BlockCache::new(NSID, CACHE_SECTORS, CACHE_READAHEAD);
+
     let part = {
-        let storage = nvme::NVMEStorage::new(1, 0);
+        let storage = nvme::NVMEStorage::new(&cache, 0);
         let mut pt = gpt::GPT::new(storage)?;
 
         //println!("Partitions:");
@@ -54,7 +119,7 @@ fn load_image(spec: &str) -> Result<Vec<u8>, Error> {
 
     println!("Partition offset: {}", offset);
 
-    let storage = nvme::NVMEStorage::new(1, offset);
+    let storage = nvme::NVMEStorage::new(&cache, offset);
     let opts = FsOptions::new().update_accessed_date(false);
 
     let fs = FileSystem::new(storage, opts)?;
@@ -65,15 +130,49 @@ fn load_image(spec: &str) -> Result<Vec<u8>, Error> {
 
     println!("File size: {}", size);
 
-    let mut buf: Vec<u8> = vec![0; size];
-    let mut slice = &mut buf[..];
-    while !slice.is_empty() {
-        let read = file.read(slice)?;
-        slice = &mut slice[read..];
+    // Room to align the start and to DMA the final partial sector
+    let mut buf: Vec<u8> = vec![0; round_up(size) + nvme::SECTOR_SIZE];
+    let start = buf.as_ptr().align_offset(nvme::SECTOR_SIZE);
+    let data = &mut buf[start..start + round_up(size)];
+
+    let t = ticks();
+    match file_extents(&mut file)? {
+        Some(extents) => {
+            // Read each run of sectors with one large transfer, straight into place
+            let mut pos = 0;
+            for extent in &extents {
+                let len = round_up(extent.size);
+                nvme::read_blocks(NSID, offset + extent.lba, &mut data[pos..pos + len])
+                    .or(Err(Error::Unknown))?;
+                pos += extent.size;
+            }
+            if pos != size {
+                println!("File extents cover {} bytes, expected {}", pos, size);
+                return Err(Error::Unknown);
+            }
+
+            let usecs = unsafe { ticks_to_usecs(ticks() - t) }.max(1);
+            println!(
+                "Read {} bytes in {} extents in {} ms ({} MB/s)",
+                size,
+                extents.len(),
+                usecs / 1000,
+                size as u64 / usecs
+            );
+        }
+        None => {
+            println!("File is not sector aligned, reading through the filesystem");
+            let mut slice = &mut data[..size];
+            while !slice.is_empty() {
+                let read = file.read(slice)?;
+                slice = &mut slice[read..];
+            }
+        }
     }
     println!("File read successfully");
+    cache.borrow().print_stats();
 
-    Ok(buf)
+    Ok(Image { buf, start, size })
 }
 
 #[no_mangle]
@@ -85,10 +184,10 @@ pub unsafe extern "C" fn rust_load_image(
     let spec = unsafe { CStr::from_ptr(raw_spec).to_str().unwrap() };
 
     match load_image(spec) {
-        Ok(buf) => {
+        Ok(img) => {
             unsafe {
-                *size = buf.len();
-                *image = buf.leak().as_mut_ptr() as *mut c_void;
+                *size = img.size;
+                *image = img.buf.leak().as_mut_ptr().add(img.start) as *mut c_void;
             }
             0
         }
@@ -1,18 +1,37 @@
 // SPDX-License-Identifier: MIT
 use crate::println;
 use alloc::boxed::Box;
+use alloc::collections::BTreeMap;
+use alloc::rc::Rc;
+use alloc::vec::Vec;
+use core::cell::RefCell;
 use core::cmp::min;
 use core::ffi::c_void;
 use fatfs::SeekFrom;
 
 extern "C" {
-    fn nvme_read(nsid: u32, lba: u64, buffer: *mut c_void) -> bool;
+    fn nvme_read_blocks(nsid: u32, lba: u64, count: u32, buffer: *mut c_void) -> bool;
 }
 
-const SECTOR_SIZE: usize = 4096;
+pub const SECTOR_SIZE: usize = 4096;
 
 pub type Error = ();
 
+/// Read whole sectors straight into `buf` with as few, as large commands as possible.
+/// `buf` must be sector aligned, both in address and length.
+pub fn read_blocks(nsid: u32, lba: u64, buf: &mut [u8]) -> Result<(), Error> {
+    if buf.as_ptr().align_offset(SECTOR_SIZE) != 0 || buf.len() % SECTOR_SIZE != 0 {
+        return Err(());
+    }
+
+    let count = (buf.len() / SECTOR_SIZE) as u32;
+    if !unsafe { nvme_read_blocks(nsid, lba, count, buf.as_mut_ptr() as *mut c_void) } {
+        println!("nvme_read_blocks({}, {}, {}) failed", nsid, lba, count);
+        return Err(());
+    }
+    Ok(())
+}
+
 #[repr(C, align(4096))]
 struct SectorBuffer([u8; SECTOR_SIZE]);
 
@@ -22,21 +41,167 @@ fn alloc_sector_buf() -> Box<SectorBuffer> {
     p
 }
 
-pub struct NVMEStorage {
+struct CacheEntry {
+    lba: u64,
+    last_use: u64,
+    buf: Box<SectorBuffer>,
+}
+
+/// An LRU cache of NVMe sectors, shared by every `NVMEStorage` on a namespace so that
+/// GPT and FAT metadata is only read once. Misses that continue a sequential run read ahead
+/// up to `readahead` sectors with a single command.
+pub struct BlockCache {
     nsid: u32,
+    entries: Vec<CacheEntry>,
+    index: BTreeMap<u64, usize>,
+    capacity: usize,
+    readahead: usize,
+    staging: Vec<SectorBuffer>,
+    clock: u64,
+    next_lba: Option<u64>,
+    hits: u64,
+    misses: u64,
+    commands: u64,
+    sectors: u64,
+}
+
+impl BlockCache {
+    pub fn new(nsid: u32, capacity: usize, readahead: usize) -> Rc<RefCell<BlockCache>> {
+        let capacity = capacity.max(1);
+        let readahead = readahead.clamp(1, capacity);
+
+        let mut staging = Vec::with_capacity(readahead);
+        staging.resize_with(readahead, || SectorBuffer([0; SECTOR_SIZE]));
+
+        Rc::new(RefCell::new(BlockCache {
+            nsid,
+            entries: Vec::with_capacity(capacity),
+            index: BTreeMap::new(),
+            capacity,
+            readahead,
+            staging,
+            clock: 0,
+            next_lba: None,
+            hits: 0,
+            misses: 0,
+            commands: 0,
+            sectors: 0,
+        }))
+    }
+
+    fn insert(&mut self, lba: u64, data: &SectorBuffer) -> usize {
+        let slot = if self.entries.len() < self.capacity {
+            self.entries.push(CacheEntry {
+                lba,
+                last_use: 0,
+                buf: alloc_sector_buf(),
+            });
+            self.entries.len() - 1
+        } else {
+            // Evictions only happen on a miss, which costs far more than this scan
+            let (slot, victim) = self
+                .entries
+                .iter()
+                .enumerate()
+                .min_by_key(|(_, e)| e.last_use)
+                .unwrap();
+            self.index.remove(&victim.lba);
+            slot
+        };
+
+        // Read-ahead sectors count as freshly used, or they would be the first to go
+        self.clock += 1;
+        let entry = &mut self.entries[slot];
+        entry.lba = lba;
+        entry.last_use = self.clock;
+        entry.buf.0.copy_from_slice(&data.0);
+        self.index.insert(lba, slot);
+        slot
+    }
+
+    fn fill(&mut self, lba: u64) -> Result<usize, Error> {
+        // Only read ahead while the access pattern looks sequential, and stop at the first
+        // sector that is already cached
+        let mut count = 1;
+        if self.next_lba == Some(lba) {
+            while count < self.readahead && !self.index.contains_key(&(lba + count as u64)) {
+                count += 1;
+            }
+        }
+
+        let ok = unsafe {
+            nvme_read_blocks(
+                self.nsid,
+                lba,
+                count as u32,
+                self.staging.as_mut_ptr() as *mut c_void,
+            )
+        };
+        if !ok {
+            println!("nvme_read_blocks({}, {}, {}) failed", self.nsid, lba, count);
+            return Err(());
+        }
+        self.commands += 1;
+        self.sectors += count as u64;
+
+        let staging = core::mem::take(&mut self.staging);
+        for (i, data) in staging[1..count].iter().enumerate() {
+            self.insert(lba + 1 + i as u64, data);
+        }
+        // The requested sector goes in last, so the read-ahead cannot evict it
+        let slot = self.insert(lba, &staging[0]);
+        self.staging = staging;
+
+        Ok(slot)
+    }
+
+    /// Copy `buf.len()` bytes starting at byte `off` of sector `lba`, which must not cross
+    /// the end of the sector.
+    pub fn read(&mut self, lba: u64, off: usize, buf: &mut [u8]) -> Result<(), Error> {
+        let slot = match self.index.get(&lba) {
+            Some(&slot) => {
+                self.hits += 1;
+                slot
+            }
+            None => {
+                self.misses += 1;
+                self.fill(lba)?
+            }
+        };
+
+        self.clock += 1;
+        let entry = &mut self.entries[slot];
+        entry.last_use = self.clock;
+        buf.copy_from_slice(&entry.buf.0[off..off + buf.len()]);
+
+        self.next_lba = Some(lba + 1);
+        Ok(())
+    }
+
+    pub fn print_stats(&self) {
+        let total = (self.hits + self.misses).max(1);
+        println!(
+            "Block cache: {} hits, {} misses ({}% hit rate), {} sectors in {} reads",
+            self.hits,
+            self.misses,
+            self.hits * 100 / total,
+            self.sectors,
+            self.commands
+        );
+    }
+}
+
+pub struct NVMEStorage {
+    cache: Rc<RefCell<BlockCache>>,
     offset: u64,
-    lba: Option<u64>,
-    buf: Box<SectorBuffer>,
     pos: u64,
 }
 
 impl NVMEStorage {
-    pub fn new(nsid: u32, offset: u64) -> NVMEStorage {
+    pub fn new(cache: &Rc<RefCell<BlockCache>>, offset: u64) -> NVMEStorage {
         NVMEStorage {
-            nsid: nsid,
+            cache: cache.clone(),
             offset: offset,
-            lba: None,
-            buf: alloc_sector_buf(),
             pos: 0,
         }
     }
@@ -49,21 +214,14 @@ impl fatfs::IoBase for NVMEStorage {
 impl fatfs::Read for NVMEStorage {
     fn read(&mut self, mut buf: &mut [u8]) -> Result<usize, Self::Error> {
         let mut read = 0;
+        let mut cache = self.cache.borrow_mut();
 
         while !buf.is_empty() {
             let lba = self.pos / SECTOR_SIZE as u64;
             let off = self.pos as usize % SECTOR_SIZE;
 
-            if Some(lba) != self.lba {
-                self.lba = Some(lba);
-                let lba = lba + self.offset;
-                if !unsafe { nvme_read(self.nsid, lba, self.buf.0.as_mut_ptr() as *mut c_void) } {
-                    println!("nvme_read({}, {}) failed", self.nsid, lba);
-                    return Err(());
-                }
-            }
             let copy_len = min(SECTOR_SIZE - off, buf.len());
-            buf[..copy_len].copy_from_slice(&self.buf.0[off..off + copy_len]);
+            cache.read(lba + self.offset, off, &mut buf[..copy_len])?;
             buf = &mut buf[copy_len..];
             read += copy_len;
             self.pos += copy_len as u64;
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: (GPL-2.0-or-later OR BSD-2-Clause) */
 
 #include "adt.h"
+#include "malloc.h"
 #include "string.h"
 
 /* This API is designed to match libfdt's read-only API */
@@ -23,6 +24,57 @@
     } while (0)
 #endif
 
+/*
+ * Optional lookup index, built once by adt_index_build(). Nodes are stored in tree order, which
+ * is also offset order, so a node is found by binary search on its offset. Each node keeps its
+ * subtree bounds and its properties' name hashes, which turns sibling walks and property lookups
+ * into array scans instead of walks over the blob.
+ */
+struct adt_index_node {
+    u32 offset;
+    u32 first_child;  // offset past the properties
+    u32 next_sibling; // offset past the whole subtree
+    u32 parent;       // node index, or ADT_INDEX_NONE for the root
+    u32 descendants;
+    u32 name_hash; // up to any '@'
+    u32 prop_start;
+    u32 prop_count;
+};
+
+struct adt_index_prop {
+    u32 name_hash;
+    u32 offset;
+};
+
+#define ADT_INDEX_NONE 0xffffffff
+
+static struct {
+    const void *adt;
+    u32 node_count;
+    u32 prop_count;
+    struct adt_index_node *nodes;
+    struct adt_index_prop *props;
+} adt_index;
+
+static u32 adt_hash(const char *s, size_t len)
+{
+    u32 hash = 0x811c9dc5;
+
+    while (len-- && *s) {
+        hash ^= (u8)*s++;
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+static u32 adt_nodename_hash(const char *name, size_t len)
+{
+    const char *at = memchr(name, '@', len);
+
+    return adt_hash(name, at ? (size_t)(at - name) : len);
+}
+
 int _adt_check_node_offset(const void *adt, int offset)
 {
     if ((offset < 0) || (offset % ADT_ALIGN))
@@ -55,6 +107,122 @@ int adt_check_header(const void *adt)
     return _adt_check_node_offset(adt, 0);
 }
 
+static const struct adt_index_node *adt_index_find(const void *adt, int offset)
+{
+    if (adt != adt_index.adt)
+        return NULL;
+
+    u32 lo = 0, hi = adt_index.node_count;
+
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+
+        if (adt_index.nodes[mid].offset < (u32)offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < adt_index.node_count && adt_index.nodes[lo].offset == (u32)offset)
+        return &adt_index.nodes[lo];
+
+    return NULL;
+}
+
+/*
+ * Walks the subtree at offset, bounds checking everything against size. With fill unset it only
+ * counts nodes and properties. Returns the offset past the subtree, or an error.
+ */
+static int adt_index_walk(const void *adt, size_t size, int offset, u32 parent, u32 *node_count,
+                          u32 *prop_count, bool fill)
+{
+    if (_adt_check_node_offset(adt, offset) || offset + sizeof(struct adt_node_hdr) > size)
+        return -ADT_ERR_BADOFFSET;
+
+    u32 idx = (*node_count)++;
+    u32 prop_start = *prop_count;
+    u32 name_hash = 0;
+    int poff = adt_first_property_offset(adt, offset);
+
+    for (u32 i = 0; i < (u32)adt_get_property_count(adt, offset); i++) {
+        if (_adt_check_prop_offset(adt, poff) || poff + sizeof(struct adt_property) > size)
+            return -ADT_ERR_BADOFFSET;
+
+        const struct adt_property *prop = ADT_PROP(adt, poff);
+        int next = adt_next_property_offset(adt, poff);
+        if ((size_t)next > size)
+            return -ADT_ERR_BADOFFSET;
+
+        if (fill) {
+            adt_index.props[*prop_count].name_hash = adt_hash(prop->name, sizeof(prop->name));
+            adt_index.props[*prop_count].offset = poff;
+            if (!strcmp(prop->name, "name"))
+                name_hash = adt_nodename_hash((const char *)prop->value, prop->size);
+        }
+        (*prop_count)++;
+        poff = next;
+    }
+
+    int first_child = poff;
+    int end = poff;
+
+    for (u32 i = 0; i < (u32)adt_get_child_count(adt, offset); i++) {
+        end = adt_index_walk(adt, size, end, idx, node_count, prop_count, fill);
+        if (end < 0)
+            return end;
+    }
+
+    if (fill) {
+        struct adt_index_node *node = &adt_index.nodes[idx];
+
+        node->offset = offset;
+        node->first_child = first_child;
+        node->next_sibling = end;
+        node->parent = parent;
+        node->descendants = *node_count - idx - 1;
+        node->name_hash = name_hash;
+        node->prop_start = prop_start;
+        node->prop_count = adt_get_property_count(adt, offset);
+    }
+
+    return end;
+}
+
+int adt_index_build(const void *adt, size_t size)
+{
+    u32 nodes = 0, props = 0;
+
+    adt_index_drop();
+
+    int ret = adt_index_walk(adt, size, 0, ADT_INDEX_NONE, &nodes, &props, false);
+    if (ret < 0)
+        return ret;
+
+    adt_index.nodes = malloc(nodes * sizeof(*adt_index.nodes));
+    adt_index.props = malloc(props * sizeof(*adt_index.props));
+    if (!adt_index.nodes || !adt_index.props) {
+        adt_index_drop();
+        return -ADT_ERR_NOTFOUND;
+    }
+
+    adt_index.node_count = adt_index.prop_count = 0;
+    adt_index_walk(adt, size, 0, ADT_INDEX_NONE, &adt_index.node_count, &adt_index.prop_count,
+                   true);
+    adt_index.adt = adt;
+
+    return nodes;
+}
+
+void adt_index_drop(void)
+{
+    adt_index.adt = NULL;
+    free(adt_index.nodes);
+    free(adt_index.props);
+    adt_index.nodes = NULL;
+    adt_index.props = NULL;
+    adt_index.node_count = adt_index.prop_count = 0;
+}
+
 static int _adt_string_eq(const char *a, const char *b, size_t len)
 {
     return (strlen(a) == len) && (memcmp(a, b, len) == 0);
@@ -78,6 +246,20 @@ const struct adt_property *adt_get_property_namelen(const void *adt, int offset,
 {
     dprintf("adt_get_property_namelen(%p, %d, \"%s\", %u)\n", adt, offset, name, namelen);
 
+    const struct adt_index_node *node = adt_index_find(adt, offset);
+    if (node) {
+        u32 hash = adt_hash(name, namelen);
+        const struct adt_index_prop *iprop = &adt_index.props[node->prop_start];
+
+        for (u32 i = 0; i < node->prop_count; i++, iprop++) {
+            const struct adt_property *prop = ADT_PROP(adt, iprop->offset);
+            if (iprop->name_hash == hash && _adt_string_eq(prop->name, name, namelen))
+                return prop;
+        }
+
+        return NULL;
+    }
+
     ADT_FOREACH_PROPERTY(adt, offset, prop)
     {
         dprintf(" off=0x%x name=\"%s\"\n", offset, prop->name);
@@ -161,6 +343,10 @@ int adt_getprop_copy(const void *adt, int nodeoffset, const char *name, void *ou
 
 int adt_first_child_offset(const void *adt, int offset)
 {
+    const struct adt_index_node *inode = adt_index_find(adt, offset);
+    if (inode)
+        return inode->first_child;
+
     const struct adt_node_hdr *node = ADT_NODE(adt, offset);
 
     u32 cnt = node->property_count;
@@ -175,6 +361,10 @@ int adt_first_child_offset(const void *adt, int offset)
 
 int adt_next_sibling_offset(const void *adt, int offset)
 {
+    const struct adt_index_node *inode = adt_index_find(adt, offset);
+    if (inode)
+        return inode->next_sibling;
+
     const struct adt_node_hdr *node = ADT_NODE(adt, offset);
 
     u32 cnt = node->child_count;
@@ -191,6 +381,21 @@ int adt_subnode_offset_namelen(const void *adt, int offset, const char *name, si
 {
     ADT_CHECK_HEADER(adt);
 
+    const struct adt_index_node *node = adt_index_find(adt, offset);
+    if (node) {
+        u32 hash = adt_nodename_hash(name, namelen);
+        const struct adt_index_node *end = node + node->descendants + 1;
+
+        for (const struct adt_index_node *child = node + 1; child < end;
+             child += child->descendants + 1) {
+            if (child->name_hash == hash &&
+                _adt_nodename_eq(adt_get_name(adt, child->offset), name, namelen))
+                return child->offset;
+        }
+
+        return -ADT_ERR_NOTFOUND;
+    }
+
     ADT_FOREACH_CHILD(adt, offset)
     {
         const char *cname = adt_get_name(adt, offset);
@@ -247,6 +452,38 @@ int adt_path_offset_trace(const void *adt, const char *path, int *offsets)
     return offset;
 }
 
+int adt_parent_offset(const void *adt, int nodeoffset)
+{
+    ADT_CHECK_HEADER(adt);
+
+    if (!nodeoffset)
+        return -ADT_ERR_NOTFOUND;
+
+    const struct adt_index_node *node = adt_index_find(adt, nodeoffset);
+    if (node)
+        return adt_index.nodes[node->parent].offset;
+
+    // Descend through the child whose subtree contains the node
+    int offset = 0;
+    while (true) {
+        int parent = offset, next = -1;
+
+        ADT_FOREACH_CHILD(adt, offset)
+        {
+            if (offset == nodeoffset)
+                return parent;
+            if (offset < nodeoffset && nodeoffset < adt_next_sibling_offset(adt, offset)) {
+                next = offset;
+                break;
+            }
+        }
+
+        if (next < 0)
+            return -ADT_ERR_BADOFFSET;
+        offset = next;
+    }
+}
+
 const char *adt_get_name(const void *adt, int nodeoffset)
 {
     return adt_getprop(adt, nodeoffset, "name", NULL);
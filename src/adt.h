@@ -39,6 +39,13 @@ struct adt_node_hdr {
 /* Basic sanity check */
 int adt_check_header(const void *adt);
 
+/*
+ * Build a lookup index for this ADT, which the functions below then use transparently. The ADT
+ * must not change shape while the index exists (adt_setprop() is fine). Returns the node count.
+ */
+int adt_index_build(const void *adt, size_t size);
+void adt_index_drop(void);
+
 static inline int adt_get_property_count(const void *adt, int offset)
 {
     return ADT_NODE(adt, offset)->property_count;
@@ -73,6 +80,7 @@ int adt_subnode_offset_namelen(const void *adt, int parentoffset, const char *na
 int adt_subnode_offset(const void *adt, int parentoffset, const char *name);
 int adt_path_offset(const void *adt, const char *path);
 int adt_path_offset_trace(const void *adt, const char *path, int *offsets);
+int adt_parent_offset(const void *adt, int nodeoffset);
 
 const char *adt_get_name(const void *adt, int nodeoffset);
 const struct adt_property *adt_get_property_namelen(const void *adt, int nodeoffset,
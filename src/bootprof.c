@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "bootprof.h"
+#include "memory.h"
+#include "smp.h"
+#include "string.h"
+#include "utils.h"
+
+struct bootprof_stack {
+    u16 ids[BOOTPROF_MAX_DEPTH];
+    u32 depth;
+};
+
+static struct bootprof_report report = {
+    .magic = BOOTPROF_MAGIC,
+    .version = BOOTPROF_VERSION,
+    .span_size = sizeof(struct bootprof_span),
+};
+
+static u32 next_slot;
+static bool export_dt;
+
+// The boot CPU gets its own stack, since its TPIDR is only set up once smp finds its index
+static struct bootprof_stack boot_stack;
+static struct bootprof_stack cpu_stacks[MAX_CPUS];
+
+static struct bootprof_stack *get_stack(int *cpu)
+{
+    if (is_boot_cpu()) {
+        *cpu = boot_cpu_idx == -1 ? 0 : boot_cpu_idx;
+        return &boot_stack;
+    }
+
+    *cpu = smp_id();
+    if (*cpu < 0 || *cpu >= MAX_CPUS)
+        return NULL;
+    return &cpu_stacks[*cpu];
+}
+
+static int claim_slot(void)
+{
+    u32 slot;
+
+    // Exclusives need the MMU on. Before that, only the boot CPU runs m1n1 code.
+    if (mmu_active())
+        slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED);
+    else if (is_boot_cpu())
+        slot = next_slot++;
+    else
+        return -1;
+
+    if (slot >= BOOTPROF_MAX_SPANS) {
+        if (mmu_active())
+            __atomic_fetch_add(&report.dropped, 1, __ATOMIC_RELAXED);
+        else
+            report.dropped++;
+        return -1;
+    }
+
+    return slot;
+}
+
+int bootprof_begin(const char *name)
+{
+    u64 start = get_ticks();
+    int cpu;
+
+    struct bootprof_stack *stack = get_stack(&cpu);
+    if (!stack)
+        return -1;
+
+    int id = claim_slot();
+    if (id < 0)
+        return -1;
+
+    struct bootprof_span *span = &report.spans[id];
+    strncpy(span->name, name, BOOTPROF_NAME_LEN - 1);
+    span->name[BOOTPROF_NAME_LEN - 1] = 0;
+    span->start = start;
+    span->end = 0;
+    span->cpu = cpu;
+    span->depth = stack->depth;
+    span->parent = stack->depth ? stack->ids[stack->depth - 1] : BOOTPROF_NO_PARENT;
+
+    // Spans nested too deeply are still recorded, they just cannot be parents themselves
+    if (stack->depth < BOOTPROF_MAX_DEPTH)
+        stack->ids[stack->depth++] = id;
+
+    return id;
+}
+
+void bootprof_end(int id)
+{
+    u64 end = get_ticks();
+    int cpu;
+
+    if (id < 0 || id >= BOOTPROF_MAX_SPANS)
+        return;
+
+    report.spans[id].end = end;
+
+    struct bootprof_stack *stack = get_stack(&cpu);
+    if (stack && stack->depth && stack->ids[stack->depth - 1] == id)
+        stack->depth--;
+}
+
+struct bootprof_report *bootprof_report(size_t *size)
+{
+    u32 count = min(next_slot, BOOTPROF_MAX_SPANS);
+
+    report.freq = mrs(CNTFRQ_EL0);
+    report.count = count;
+
+    if (size)
+        *size = offsetof(struct bootprof_report, spans) + count * sizeof(struct bootprof_span);
+
+    return &report;
+}
+
+void bootprof_set_export(bool enable)
+{
+    export_dt = enable;
+}
+
+bool bootprof_export_enabled(void)
+{
+    return export_dt;
+}
@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef BOOTPROF_H
+#define BOOTPROF_H
+
+#include "types.h"
+
+#define BOOTPROF_MAGIC     0x666f7270746f6f62 // "bootprof"
+#define BOOTPROF_VERSION   1
+#define BOOTPROF_MAX_SPANS 256
+#define BOOTPROF_MAX_DEPTH 16
+#define BOOTPROF_NAME_LEN  32
+#define BOOTPROF_NO_PARENT 0xffff
+
+/*
+ * The report is kept in this exact layout so the host can read it straight out of memory (via
+ * P_BOOTPROF_GET) or out of the /chosen/m1n1,boot-profile property of the Linux devicetree.
+ * Timestamps are raw CNTPCT_EL0 values, which count from power on, so spans from an earlier
+ * chainloaded stage line up with ours. end is 0 for spans that were still open at readout.
+ */
+struct bootprof_span {
+    char name[BOOTPROF_NAME_LEN];
+    u64 start;
+    u64 end;
+    u16 parent;
+    u8 cpu;
+    u8 depth;
+    u32 pad;
+};
+
+struct bootprof_report {
+    u64 magic;
+    u32 version;
+    u32 span_size;
+    u64 freq;
+    u32 count;
+    u32 dropped;
+    struct bootprof_span spans[BOOTPROF_MAX_SPANS];
+};
+
+int bootprof_begin(const char *name);
+void bootprof_end(int id);
+
+struct bootprof_report *bootprof_report(size_t *size);
+
+void bootprof_set_export(bool enable);
+bool bootprof_export_enabled(void);
+
+#define BOOTPROF(name, stmt)                                                                       \
+    do {                                                                                           \
+        int __bp = bootprof_begin(name);                                                           \
+        stmt;                                                                                      \
+        bootprof_end(__bp);                                                                        \
+    } while (0)
+
+#define BOOTPROF_RET(name, expr)                                                                   \
+    ({                                                                                             \
+        int __bp = bootprof_begin(name);                                                           \
+        __typeof__(expr) __ret = (expr);                                                           \
+        bootprof_end(__bp);                                                                        \
+        __ret;                                                                                     \
+    })
+
+#endif
@@ -4,6 +4,7 @@
 #include "adt.h"
 #include "assert.h"
 #include "devicetree.h"
+#include "extent_tree.h"
 #include "malloc.h"
 #include "memory.h"
 #include "string.h"
@@ -86,6 +87,12 @@
 
 #define DART_MAX_TTBR_COUNT 4
 
+#define DART_PAGE_SIZE    SZ_16K
+#define DART_TTBR_SPACE   (1UL << 36)
+#define DART_RMAP_MIN     256
+#define DART_RMAP_FREE    (~0UL)
+#define DART_RMAP_DELETED (~1UL)
+
 #define DART_TCR(dart) (dart->regs + dart->params->tcr_off + 4 * dart->device)
 #define DART_TTBR(dart, idx)                                                                       \
     (dart->regs + dart->params->ttbr_off + 4 * dart->params->ttbr_count * dart->device + 4 * idx)
@@ -109,6 +116,11 @@ struct dart_params {
     void (*tlb_invalidate)(dart_dev_t *dart);
 };
 
+struct dart_rmap_entry {
+    u64 paddr;
+    u64 iova;
+};
+
 struct dart_dev {
     bool locked;
     bool keep;
@@ -119,6 +131,18 @@ struct dart_dev {
     u64 vm_base;
 
     u64 *l1[DART_MAX_TTBR_COUNT];
+
+    /*
+     * Lookup indices, built from the page tables on first use and then kept up to date by
+     * map/unmap: a PA -> IOVA hash for dart_search() and the set of unmapped IOVA ranges for
+     * dart_find_iova(). Locked and keep_pts DARTs get them too, built from whatever the
+     * firmware left in the tables: from then on, only m1n1 changes those tables.
+     */
+    bool index_valid;
+    struct dart_rmap_entry *rmap;
+    u64 rmap_size;
+    u64 rmap_used;
+    struct extent_tree free_iova;
 };
 
 static void dart_t8020_tlb_invalidate(dart_dev_t *dart)
@@ -236,6 +260,7 @@ dart_dev_t *dart_init(uintptr_t base, u8 device, bool keep_pts, enum dart_type_t
     }
 
     dart->keep = keep_pts;
+    extent_tree_init(&dart->free_iova);
 
     if (dart->locked || keep_pts) {
         for (int i = 0; i < dart->params->ttbr_count; i++) {
@@ -367,9 +392,9 @@ void dart_lock_adt(const char *path, int instance)
     }
 }
 
-dart_dev_t *dart_init_fdt(void *dt, u32 phandle, int device, bool keep_pts)
+dart_dev_t *dart_init_fdt(dtree_t *dt, u32 phandle, int device, bool keep_pts)
 {
-    int node = fdt_node_offset_by_phandle(dt, phandle);
+    int node = dtree_node_offset_by_phandle(dt, phandle);
     if (node < 0) {
         printf("FDT: node for phandle %u not found\n", phandle);
         return NULL;
@@ -381,15 +406,15 @@ dart_dev_t *dart_init_fdt(void *dt, u32 phandle, int device, bool keep_pts)
 
     enum dart_type_t type;
     const char *type_s;
-    const char *name = fdt_get_name(dt, node, NULL);
+    const char *name = dtree_get_name(dt, node, NULL);
 
-    if (fdt_node_check_compatible(dt, node, "apple,t8103-dart") == 0) {
+    if (dtree_node_check_compatible(dt, node, "apple,t8103-dart") == 0) {
         type = DART_T8020;
         type_s = "t8020";
-    } else if (fdt_node_check_compatible(dt, node, "apple,t6000-dart") == 0) {
+    } else if (dtree_node_check_compatible(dt, node, "apple,t6000-dart") == 0) {
         type = DART_T6000;
         type_s = "t6000";
-    } else if (fdt_node_check_compatible(dt, node, "apple,t8110-dart") == 0) {
+    } else if (dtree_node_check_compatible(dt, node, "apple,t8110-dart") == 0) {
         type = DART_T8110;
         type_s = "t8110";
     } else {
@@ -516,6 +541,171 @@ static u64 *dart_get_l2(dart_dev_t *dart, u32 idx)
     return tbl;
 }
 
+static inline u64 dart_pte_addr(dart_dev_t *dart, u64 pte)
+{
+    return FIELD_GET(dart->params->offset_mask, pte) << DART_PTE_OFFSET_SHIFT;
+}
+
+static inline u64 dart_rmap_slot(dart_dev_t *dart, u64 paddr)
+{
+    return ((paddr >> 14) * 0x9e3779b97f4a7c15UL) & (dart->rmap_size - 1);
+}
+
+static void dart_index_drop(dart_dev_t *dart)
+{
+    free(dart->rmap);
+    dart->rmap = NULL;
+    dart->rmap_size = dart->rmap_used = 0;
+    extent_tree_clear(&dart->free_iova);
+    dart->index_valid = false;
+}
+
+static bool dart_rmap_resize(dart_dev_t *dart, u64 size)
+{
+    struct dart_rmap_entry *old = dart->rmap;
+    u64 old_size = dart->rmap_size;
+
+    dart->rmap = malloc(size * sizeof(*dart->rmap));
+    if (!dart->rmap) {
+        dart->rmap = old;
+        return false;
+    }
+
+    dart->rmap_size = size;
+    dart->rmap_used = 0;
+    for (u64 i = 0; i < size; i++)
+        dart->rmap[i].iova = DART_RMAP_FREE;
+
+    for (u64 i = 0; i < old_size; i++) {
+        if (old[i].iova >= DART_RMAP_DELETED)
+            continue;
+
+        u64 slot = dart_rmap_slot(dart, old[i].paddr);
+        while (dart->rmap[slot].iova != DART_RMAP_FREE)
+            slot = (slot + 1) & (size - 1);
+        dart->rmap[slot] = old[i];
+        dart->rmap_used++;
+    }
+
+    free(old);
+    return true;
+}
+
+static bool dart_rmap_insert(dart_dev_t *dart, u64 paddr, u64 iova)
+{
+    // Keep the load (including deleted slots) under 3/4, so probe sequences stay short
+    if ((dart->rmap_used + 1) * 4 > dart->rmap_size * 3) {
+        u64 size = max(dart->rmap_size, DART_RMAP_MIN);
+        if ((dart->rmap_used + 1) * 2 > size)
+            size *= 2;
+        if (!dart_rmap_resize(dart, size))
+            return false;
+    }
+
+    u64 slot = dart_rmap_slot(dart, paddr);
+    while (dart->rmap[slot].iova < DART_RMAP_DELETED)
+        slot = (slot + 1) & (dart->rmap_size - 1);
+
+    if (dart->rmap[slot].iova == DART_RMAP_FREE)
+        dart->rmap_used++;
+    dart->rmap[slot].paddr = paddr;
+    dart->rmap[slot].iova = iova;
+    return true;
+}
+
+static void dart_rmap_remove(dart_dev_t *dart, u64 paddr, u64 iova)
+{
+    if (!dart->rmap_size)
+        return;
+
+    u64 slot = dart_rmap_slot(dart, paddr);
+    while (dart->rmap[slot].iova != DART_RMAP_FREE) {
+        if (dart->rmap[slot].iova == iova && dart->rmap[slot].paddr == paddr) {
+            dart->rmap[slot].iova = DART_RMAP_DELETED;
+            return;
+        }
+        slot = (slot + 1) & (dart->rmap_size - 1);
+    }
+}
+
+/* Lowest IOVA mapping paddr, like a scan of the page tables in order would find */
+static u64 dart_rmap_lookup(dart_dev_t *dart, u64 paddr)
+{
+    u64 iova = DART_PTR_ERR;
+
+    if (!dart->rmap_size)
+        return iova;
+
+    u64 slot = dart_rmap_slot(dart, paddr);
+    while (dart->rmap[slot].iova != DART_RMAP_FREE) {
+        if (dart->rmap[slot].iova < DART_RMAP_DELETED && dart->rmap[slot].paddr == paddr)
+            iova = min(iova, dart->rmap[slot].iova);
+        slot = (slot + 1) & (dart->rmap_size - 1);
+    }
+
+    return iova;
+}
+
+static bool dart_index_build(dart_dev_t *dart)
+{
+    u64 next_free = 0;
+
+    dart_index_drop(dart);
+
+    for (int ttbr = 0; ttbr < dart->params->ttbr_count; ttbr++) {
+        if (!dart->l1[ttbr])
+            continue;
+
+        for (u32 l1_index = 0; l1_index < 2048; l1_index++) {
+            if (!(dart->l1[ttbr][l1_index] & DART_PTE_VALID))
+                continue;
+
+            u64 *l2 = (u64 *)dart_pte_addr(dart, dart->l1[ttbr][l1_index]);
+            for (u32 l2_index = 0; l2_index < 2048; l2_index++) {
+                if (!(l2[l2_index] & DART_PTE_VALID))
+                    continue;
+
+                u64 iova = ((u64)ttbr << 36) | ((u64)l1_index << 25) | ((u64)l2_index << 14);
+                if (!dart_rmap_insert(dart, dart_pte_addr(dart, l2[l2_index]), iova))
+                    goto fail;
+                if (iova > next_free && !extent_add(&dart->free_iova, next_free, iova - next_free))
+                    goto fail;
+                next_free = iova + DART_PAGE_SIZE;
+            }
+        }
+    }
+
+    u64 end = dart->params->ttbr_count * DART_TTBR_SPACE;
+    if (end > next_free && !extent_add(&dart->free_iova, next_free, end - next_free))
+        goto fail;
+
+    dart->index_valid = true;
+    return true;
+
+fail:
+    printf("dart: out of memory building lookup indices\n");
+    dart_index_drop(dart);
+    return false;
+}
+
+static bool dart_index_get(dart_dev_t *dart)
+{
+    return dart->index_valid || dart_index_build(dart);
+}
+
+/* A failed update leaves the indices inconsistent, so drop them and rebuild on the next lookup */
+static void dart_index_map(dart_dev_t *dart, uintptr_t iova, size_t len)
+{
+    if (dart->index_valid && !extent_remove(&dart->free_iova, iova, len))
+        dart_index_drop(dart);
+}
+
+static void dart_index_unmap(dart_dev_t *dart, uintptr_t iova, size_t len)
+{
+    if (dart->index_valid && !extent_add(&dart->free_iova, iova, len))
+        dart_index_drop(dart);
+}
+
 static int dart_map_page(dart_dev_t *dart, uintptr_t iova, uintptr_t paddr, u32 flags)
 {
     u32 l1_index = (iova >> 25) & 0x1fff;
@@ -536,52 +726,143 @@ static int dart_map_page(dart_dev_t *dart, uintptr_t iova, uintptr_t paddr, u32
 
     l2[l2_index] = offset | dart->params->pte_flags | flags;
 
+    if (dart->index_valid && !dart_rmap_insert(dart, paddr, iova))
+        dart_index_drop(dart);
+
     return 0;
 }
 
-int dart_map_flags(dart_dev_t *dart, uintptr_t iova, void *bfr, size_t len, u32 flags)
+static void dart_unmap_page(dart_dev_t *dart, uintptr_t iova)
 {
-    uintptr_t paddr = (uintptr_t)bfr;
-    u64 offset = 0;
+    u32 ttbr = (iova >> 36) & 0x3;
+    u32 l1_index = (iova >> 25) & 0x7ff;
+    u32 l2_index = (iova >> 14) & 0x7ff;
+
+    if (!(dart->l1[ttbr][l1_index] & DART_PTE_VALID))
+        return;
 
+    u64 *l2 = dart_get_l2(dart, l1_index);
+    if (!(l2[l2_index] & DART_PTE_VALID))
+        return;
+
+    if (dart->index_valid) {
+        dart_rmap_remove(dart, dart_pte_addr(dart, l2[l2_index]), iova);
+        dart_index_unmap(dart, iova, SZ_16K);
+    }
+
+    l2[l2_index] = 0;
+}
+
+static void dart_unmap_range(dart_dev_t *dart, uintptr_t iova, size_t len)
+{
+    while (len) {
+        dart_unmap_page(dart, iova);
+
+        len -= SZ_16K;
+        iova += SZ_16K;
+    }
+}
+
+static bool dart_check_range(dart_dev_t *dart, uintptr_t iova, uintptr_t paddr, size_t len)
+{
     if (len % SZ_16K)
-        return -1;
+        return false;
     if (paddr % SZ_16K)
-        return -1;
+        return false;
     if (iova % SZ_16K)
-        return -1;
+        return false;
+    if (len && ((iova + len - 1) >> 36) >= (u64)dart->params->ttbr_count)
+        return false;
+
+    return true;
+}
+
+/* Make sure every L2 table covering the range exists before any PTE is written */
+static int dart_prealloc_l2(dart_dev_t *dart, uintptr_t iova, size_t len)
+{
+    if (!len)
+        return 0;
+
+    for (u64 idx = iova >> 25; idx <= (iova + len - 1) >> 25; idx++) {
+        if (!dart_get_l2(dart, idx)) {
+            printf("dart: couldn't create l2 for iova %lx\n", idx << 25);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Map a range without invalidating the TLB. On failure, nothing of the range is left mapped. */
+static int dart_map_range(dart_dev_t *dart, uintptr_t iova, uintptr_t paddr, size_t len, u32 flags)
+{
+    u64 offset = 0;
 
     while (offset < len) {
         int ret = dart_map_page(dart, iova + offset, paddr + offset, flags);
 
         if (ret) {
-            dart_unmap(dart, iova, offset);
+            dart_unmap_range(dart, iova, offset);
             return ret;
         }
 
+        // Claim the range page by page, so the unmap above puts back exactly what was taken
+        dart_index_map(dart, iova + offset, SZ_16K);
         offset += SZ_16K;
     }
 
-    dart->params->tlb_invalidate(dart);
     return 0;
 }
 
-int dart_map(dart_dev_t *dart, uintptr_t iova, void *bfr, size_t len)
+int dart_map_flags(dart_dev_t *dart, uintptr_t iova, void *bfr, size_t len, u32 flags)
 {
-    return dart_map_flags(dart, iova, bfr, len, 0);
+    uintptr_t paddr = (uintptr_t)bfr;
+
+    if (!dart_check_range(dart, iova, paddr, len))
+        return -1;
+
+    int ret = dart_map_range(dart, iova, paddr, len, flags);
+
+    dart->params->tlb_invalidate(dart);
+    return ret;
 }
 
-static void dart_unmap_page(dart_dev_t *dart, uintptr_t iova)
+int dart_map_batch(dart_dev_t *dart, const struct dart_map_entry *maps, size_t count)
 {
-    u32 ttbr = (iova >> 36) & 0x3;
-    u32 l1_index = (iova >> 25) & 0x7ff;
-    u32 l2_index = (iova >> 14) & 0x7ff;
+    for (size_t i = 0; i < count; i++) {
+        if (!dart_check_range(dart, maps[i].iova, maps[i].paddr, maps[i].len)) {
+            printf("dart: bad batch entry #%lu: %lx -> %lx [%lx]\n", i, maps[i].iova,
+                   maps[i].paddr, maps[i].len);
+            return -1;
+        }
+    }
 
-    if (!(dart->l1[ttbr][l1_index] & DART_PTE_VALID))
-        return;
+    for (size_t i = 0; i < count; i++)
+        if (dart_prealloc_l2(dart, maps[i].iova, maps[i].len))
+            return -1;
 
-    u64 *l2 = dart_get_l2(dart, l1_index);
-    l2[l2_index] = 0;
+    int ret = 0;
+    size_t mapped;
+
+    for (mapped = 0; mapped < count; mapped++) {
+        ret = dart_map_range(dart, maps[mapped].iova, maps[mapped].paddr, maps[mapped].len,
+                             maps[mapped].flags);
+        if (ret)
+            break;
+    }
+
+    // All or nothing: undo the entries that went in before the failing one
+    if (ret)
+        while (mapped--)
+            dart_unmap_range(dart, maps[mapped].iova, maps[mapped].len);
+
+    dart->params->tlb_invalidate(dart);
+    return ret;
+}
+
+int dart_map(dart_dev_t *dart, uintptr_t iova, void *bfr, size_t len)
+{
+    return dart_map_flags(dart, iova, bfr, len, 0);
 }
 
 void dart_unmap(dart_dev_t *dart, uintptr_t iova, size_t len)
@@ -591,13 +872,7 @@ void dart_unmap(dart_dev_t *dart, uintptr_t iova, size_t len)
     if (iova % SZ_16K)
         return;
 
-    while (len) {
-        dart_unmap_page(dart, iova);
-
-        len -= SZ_16K;
-        iova += SZ_16K;
-    }
-
+    dart_unmap_range(dart, iova, len);
     dart->params->tlb_invalidate(dart);
 }
 
@@ -676,7 +951,7 @@ void *dart_translate_silent(dart_dev_t *dart, uintptr_t iova)
     return dart_translate_internal(dart, iova, 1);
 }
 
-u64 dart_search(dart_dev_t *dart, void *paddr)
+static u64 dart_search_scan(dart_dev_t *dart, void *paddr)
 {
     for (int ttbr = 0; ttbr < dart->params->ttbr_count; ++ttbr) {
         if (!dart->l1[ttbr])
@@ -701,16 +976,16 @@ u64 dart_search(dart_dev_t *dart, void *paddr)
     return DART_PTR_ERR;
 }
 
-u64 dart_find_iova(dart_dev_t *dart, s64 start, size_t len)
+u64 dart_search(dart_dev_t *dart, void *paddr)
 {
-    if (len % SZ_16K)
-        return -1;
-    if (start < 0 || start % SZ_16K)
-        return -1;
+    if (!dart_index_get(dart))
+        return dart_search_scan(dart, paddr);
 
-    uintptr_t end = 1LLU << 36;
-    uintptr_t iova = start;
+    return dart_rmap_lookup(dart, (u64)paddr);
+}
 
+static u64 dart_find_iova_scan(dart_dev_t *dart, uintptr_t iova, uintptr_t end, size_t len)
+{
     while (iova + len <= end) {
 
         if (dart_translate_internal(dart, iova, 1) == NULL) {
@@ -730,6 +1005,25 @@ u64 dart_find_iova(dart_dev_t *dart, s64 start, size_t len)
     return DART_PTR_ERR;
 }
 
+u64 dart_find_iova(dart_dev_t *dart, s64 start, size_t len)
+{
+    if (len % SZ_16K)
+        return -1;
+    if (start < 0 || start % SZ_16K)
+        return -1;
+
+    uintptr_t end = 1LLU << 36;
+
+    if (!dart_index_get(dart))
+        return dart_find_iova_scan(dart, start, end, len);
+
+    u64 iova = extent_find(&dart->free_iova, start, max(len, SZ_16K), SZ_16K);
+    if (iova == EXTENT_NONE || iova + len > end)
+        return DART_PTR_ERR;
+
+    return iova;
+}
+
 void dart_shutdown(dart_dev_t *dart)
 {
     if (!dart->locked && !dart->keep)
@@ -756,6 +1050,7 @@ void dart_shutdown(dart_dev_t *dart)
     for (int i = 0; i < dart->params->ttbr_count; ++i)
         if (is_heap(dart->l1[i]))
             free(dart->l1[i]);
+    dart_index_drop(dart);
     free(dart);
 }
 
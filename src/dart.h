@@ -3,6 +3,7 @@
 #ifndef DART_H
 #define DART_H
 
+#include "dtree.h"
 #include "types.h"
 
 #define DART_PTR_ERR     BIT(63)
@@ -16,13 +17,23 @@ enum dart_type_t {
     DART_T6000,
 };
 
+/* Layout shared with P_DART_MAP_BATCH */
+struct dart_map_entry {
+    u64 iova;
+    u64 paddr;
+    u64 len;
+    u32 flags;
+    u32 pad;
+};
+
 dart_dev_t *dart_init(uintptr_t base, u8 device, bool keep_pts, enum dart_type_t type);
 dart_dev_t *dart_init_adt(const char *path, int instance, int device, bool keep_pts);
 void dart_lock_adt(const char *path, int instance);
-dart_dev_t *dart_init_fdt(void *dt, u32 phandle, int device, bool keep_pts);
+dart_dev_t *dart_init_fdt(dtree_t *dt, u32 phandle, int device, bool keep_pts);
 int dart_setup_pt_region(dart_dev_t *dart, const char *path, int device, u64 vm_base);
 int dart_map(dart_dev_t *dart, uintptr_t iova, void *bfr, size_t len);
 int dart_map_flags(dart_dev_t *dart, uintptr_t iova, void *bfr, size_t len, u32 flags);
+int dart_map_batch(dart_dev_t *dart, const struct dart_map_entry *maps, size_t count);
 void dart_unmap(dart_dev_t *dart, uintptr_t iova, size_t len);
 void dart_free_l2(dart_dev_t *dart, uintptr_t iova);
 void *dart_translate(dart_dev_t *dart, uintptr_t iova);
@@ -126,6 +126,10 @@ static int dcp_create_firmware_mappings(const display_config_t *cfg, dcp_dev_t *
     seg = adt_getprop(adt, node, "segment-ranges", &segments_len);
     unsigned int count = segments_len / sizeof(*seg);
 
+    struct dart_map_entry *maps = calloc(count, sizeof(*maps));
+    if (count && !maps)
+        return -1;
+
     for (unsigned int i = 0; i < count; i++) {
         u64 iova = seg[i].remap & ~asc_dram_mask;
         if (dart_translate_silent(dcp->dart_dcp, iova))
@@ -134,13 +138,21 @@ static int dcp_create_firmware_mappings(const display_config_t *cfg, dcp_dev_t *
         size_t len = ALIGN_UP(seg[i].size, SZ_16K);
         u32 flags = i == 0 ? 0b0100 : 0; // TEXT gets this bit set?
         printf("dcp: Mapping segment #%u %lx -> %lx [%lx]\n", i, iova, seg[i].phys, len);
-        if (dart_map_flags(dcp->dart_dcp, iova, (void *)seg[i].phys, len, flags)) {
-            printf("dcp: Failed to map segment\n");
-            return -1;
-        }
-        created++;
+        maps[created++] = (struct dart_map_entry){
+            .iova = iova,
+            .paddr = seg[i].phys,
+            .len = len,
+            .flags = flags,
+        };
+    }
+
+    // One TLB invalidate for all segments instead of one per segment
+    if (created && dart_map_batch(dcp->dart_dcp, maps, created)) {
+        printf("dcp: Failed to map segments\n");
+        created = -1;
     }
 
+    free(maps);
     return created;
 }
 
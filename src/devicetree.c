@@ -2,19 +2,17 @@
 
 #include "devicetree.h"
 
-#include "libfdt/libfdt.h"
-
-void dt_parse_ranges(void *dt, int node, struct dt_ranges_tbl *ranges)
+void dt_parse_ranges(dtree_t *dt, int node, struct dt_ranges_tbl *ranges)
 {
     int len;
-    const struct fdt_property *ranges_prop = fdt_get_property(dt, node, "ranges", &len);
+    const fdt64_t *ranges_prop = dtree_getprop(dt, node, "ranges", &len);
     if (ranges_prop && len > 0) {
         int idx = 0;
         int num_entries = len / sizeof(fdt64_t);
         if (num_entries > DT_MAX_RANGES)
             num_entries = DT_MAX_RANGES;
 
-        const fdt64_t *entry = (const fdt64_t *)ranges_prop->data;
+        const fdt64_t *entry = ranges_prop;
         for (int i = 0; i < num_entries; ++i) {
             u64 start = fdt64_ld(entry++);
             u64 parent = fdt64_ld(entry++);
@@ -42,16 +40,16 @@ u64 dt_translate(struct dt_ranges_tbl *ranges, const fdt64_t *reg)
     return addr;
 }
 
-u64 dt_get_address(void *dt, int node)
+u64 dt_get_address(dtree_t *dt, int node)
 {
-    int parent = fdt_parent_offset(dt, node);
+    int parent = dtree_parent_offset(dt, node);
 
     // find parent with "ranges" property
     while (parent >= 0) {
-        if (fdt_getprop(dt, parent, "ranges", NULL))
+        if (dtree_getprop(dt, parent, "ranges", NULL))
             break;
 
-        parent = fdt_parent_offset(dt, parent);
+        parent = dtree_parent_offset(dt, parent);
     }
 
     if (parent < 0)
@@ -61,7 +59,7 @@ u64 dt_get_address(void *dt, int node)
     struct dt_ranges_tbl ranges[DT_MAX_RANGES] = {0};
     dt_parse_ranges(dt, parent, ranges);
 
-    const fdt64_t *reg = fdt_getprop(dt, node, "reg", NULL);
+    const fdt64_t *reg = dtree_getprop(dt, node, "reg", NULL);
     if (!reg)
         return 0;
 
@@ -3,10 +3,9 @@
 #ifndef DEVICETREE_H
 #define DEVICETREE_H
 
+#include "dtree.h"
 #include "types.h"
 
-#include "libfdt/libfdt.h"
-
 #define DT_MAX_RANGES 8
 
 struct dt_ranges_tbl {
@@ -15,8 +14,8 @@ struct dt_ranges_tbl {
     u64 size;
 };
 
-void dt_parse_ranges(void *dt, int node, struct dt_ranges_tbl *ranges);
+void dt_parse_ranges(dtree_t *dt, int node, struct dt_ranges_tbl *ranges);
 u64 dt_translate(struct dt_ranges_tbl *ranges, const fdt64_t *reg);
-u64 dt_get_address(void *dt, int node);
+u64 dt_get_address(dtree_t *dt, int node);
 
 #endif
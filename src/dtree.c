@@ -0,0 +1,906 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "dtree.h"
+#include "malloc.h"
+#include "string.h"
+#include "utils.h"
+
+#define DTREE_CHUNK_SIZE SZ_16K
+#define DTREE_MAX_DEPTH  64
+#define DTREE_NO_STROFF  0xffffffff
+
+struct dtree_chunk {
+    struct dtree_chunk *next;
+    u8 data[];
+};
+
+struct dtree_prop {
+    struct dtree_prop *next;
+    u32 name_id;
+    u32 len;
+    u32 cap; // 0 while data still points into the source FDT
+    void *data;
+};
+
+struct dtree_node {
+    const char *name;
+    struct dtree_prop *props;
+    int parent;
+    int first_child;
+    int next_sibling;
+    bool deleted;
+};
+
+/* Property names are interned, so lookups compare ids and the string table is deduplicated */
+struct dtree_name {
+    const char *str;
+    u32 hash;
+    u32 stroff;
+};
+
+struct dtree {
+    struct dtree_node *nodes;
+    int node_count;
+    int node_cap;
+
+    struct dtree_name *names;
+    u32 name_count;
+    u32 name_cap;
+    u32 *name_index; // name id + 1, 0 for empty slots
+    u32 name_index_size;
+
+    struct fdt_reserve_entry *rsv;
+    int rsv_count;
+    int rsv_cap;
+
+    u32 boot_cpuid_phys;
+
+    struct dtree_chunk *chunks;
+    u8 *arena;
+    size_t arena_left;
+};
+
+static void *dtree_alloc(dtree_t *t, size_t size)
+{
+    size = ALIGN_UP(size, 8);
+
+    if (size > t->arena_left) {
+        size_t chunk_size = max(size, (size_t)DTREE_CHUNK_SIZE);
+        struct dtree_chunk *chunk = malloc(sizeof(*chunk) + chunk_size);
+        if (!chunk)
+            return NULL;
+
+        chunk->next = t->chunks;
+        t->chunks = chunk;
+        t->arena = chunk->data;
+        t->arena_left = chunk_size;
+    }
+
+    void *p = t->arena;
+    t->arena += size;
+    t->arena_left -= size;
+    return p;
+}
+
+static const char *dtree_strdup(dtree_t *t, const char *s, size_t len)
+{
+    char *p = dtree_alloc(t, len + 1);
+    if (!p)
+        return NULL;
+
+    memcpy(p, s, len);
+    p[len] = 0;
+    return p;
+}
+
+static u32 dtree_hash(const char *s, size_t len)
+{
+    u32 hash = 0x811c9dc5;
+
+    while (len--) {
+        hash ^= (u8)*s++;
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+static int dtree_name_lookup(dtree_t *t, const char *name, size_t len, u32 hash)
+{
+    if (!t->name_index_size)
+        return -FDT_ERR_NOTFOUND;
+
+    u32 mask = t->name_index_size - 1;
+
+    for (u32 slot = hash & mask; t->name_index[slot]; slot = (slot + 1) & mask) {
+        const struct dtree_name *n = &t->names[t->name_index[slot] - 1];
+        if (n->hash == hash && !strncmp(n->str, name, len) && !n->str[len])
+            return t->name_index[slot] - 1;
+    }
+
+    return -FDT_ERR_NOTFOUND;
+}
+
+static int dtree_name_grow(dtree_t *t)
+{
+    u32 cap = t->name_cap ? 2 * t->name_cap : 256;
+    struct dtree_name *names = realloc(t->names, cap * sizeof(*names));
+    if (!names)
+        return -FDT_ERR_NOSPACE;
+    t->names = names;
+    t->name_cap = cap;
+
+    u32 size = 2 * cap;
+    u32 *index = calloc(size, sizeof(*index));
+    if (!index)
+        return -FDT_ERR_NOSPACE;
+
+    for (u32 id = 0; id < t->name_count; id++) {
+        u32 slot = t->names[id].hash & (size - 1);
+        while (index[slot])
+            slot = (slot + 1) & (size - 1);
+        index[slot] = id + 1;
+    }
+
+    free(t->name_index);
+    t->name_index = index;
+    t->name_index_size = size;
+    return 0;
+}
+
+/* str must stay valid for the lifetime of the tree */
+static int dtree_name_intern(dtree_t *t, const char *str, size_t len)
+{
+    u32 hash = dtree_hash(str, len);
+    int id = dtree_name_lookup(t, str, len, hash);
+    if (id >= 0)
+        return id;
+
+    if (t->name_count == t->name_cap) {
+        int ret = dtree_name_grow(t);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (str[len]) {
+        str = dtree_strdup(t, str, len);
+        if (!str)
+            return -FDT_ERR_NOSPACE;
+    }
+
+    id = t->name_count++;
+    t->names[id].str = str;
+    t->names[id].hash = hash;
+    t->names[id].stroff = DTREE_NO_STROFF;
+
+    u32 mask = t->name_index_size - 1;
+    u32 slot = hash & mask;
+    while (t->name_index[slot])
+        slot = (slot + 1) & mask;
+    t->name_index[slot] = id + 1;
+
+    return id;
+}
+
+static struct dtree_node *dtree_node(dtree_t *t, int node)
+{
+    if (node < 0 || node >= t->node_count || t->nodes[node].deleted)
+        return NULL;
+
+    return &t->nodes[node];
+}
+
+static int dtree_new_node(dtree_t *t, const char *name, int parent)
+{
+    if (t->node_count == t->node_cap) {
+        int cap = t->node_cap ? 2 * t->node_cap : 1024;
+        struct dtree_node *nodes = realloc(t->nodes, cap * sizeof(*nodes));
+        if (!nodes)
+            return -FDT_ERR_NOSPACE;
+        t->nodes = nodes;
+        t->node_cap = cap;
+    }
+
+    int idx = t->node_count++;
+    struct dtree_node *node = &t->nodes[idx];
+
+    node->name = name;
+    node->props = NULL;
+    node->parent = parent;
+    node->first_child = -1;
+    node->next_sibling = -1;
+    node->deleted = false;
+
+    return idx;
+}
+
+static struct dtree_prop *dtree_find_prop(dtree_t *t, int node, const char *name, size_t len,
+                                          struct dtree_prop ***link)
+{
+    int id = dtree_name_lookup(t, name, len, dtree_hash(name, len));
+    if (id < 0)
+        return NULL;
+
+    struct dtree_prop **pp = &t->nodes[node].props;
+    for (; *pp; pp = &(*pp)->next) {
+        if ((*pp)->name_id == (u32)id) {
+            if (link)
+                *link = pp;
+            return *pp;
+        }
+    }
+
+    return NULL;
+}
+
+int dtree_add_mem_rsv(dtree_t *t, u64 address, u64 size)
+{
+    if (t->rsv_count == t->rsv_cap) {
+        int cap = t->rsv_cap ? 2 * t->rsv_cap : 16;
+        struct fdt_reserve_entry *rsv = realloc(t->rsv, cap * sizeof(*rsv));
+        if (!rsv)
+            return -FDT_ERR_NOSPACE;
+        t->rsv = rsv;
+        t->rsv_cap = cap;
+    }
+
+    t->rsv[t->rsv_count].address = cpu_to_fdt64(address);
+    t->rsv[t->rsv_count].size = cpu_to_fdt64(size);
+    t->rsv_count++;
+    return 0;
+}
+
+static int dtree_parse(dtree_t *t, const void *fdt)
+{
+    int stack[DTREE_MAX_DEPTH];
+    int last_child[DTREE_MAX_DEPTH];
+    struct dtree_prop *last_prop[DTREE_MAX_DEPTH];
+    int depth = -1;
+    int offset = 0, next;
+
+    while (true) {
+        u32 tag = fdt_next_tag(fdt, offset, &next);
+
+        switch (tag) {
+            case FDT_BEGIN_NODE: {
+                if (depth + 1 >= DTREE_MAX_DEPTH)
+                    return -FDT_ERR_BADSTRUCTURE;
+
+                const char *name = fdt_get_name(fdt, offset, NULL);
+                int parent = depth >= 0 ? stack[depth] : -1;
+                int idx = dtree_new_node(t, name ? name : "", parent);
+                if (idx < 0)
+                    return idx;
+
+                if (depth >= 0) {
+                    if (last_child[depth] >= 0)
+                        t->nodes[last_child[depth]].next_sibling = idx;
+                    else
+                        t->nodes[parent].first_child = idx;
+                    last_child[depth] = idx;
+                } else if (idx != 0) {
+                    return -FDT_ERR_BADSTRUCTURE;
+                }
+
+                depth++;
+                stack[depth] = idx;
+                last_child[depth] = -1;
+                last_prop[depth] = NULL;
+                break;
+            }
+
+            case FDT_PROP: {
+                if (depth < 0)
+                    return -FDT_ERR_BADSTRUCTURE;
+
+                int len;
+                const struct fdt_property *fprop = fdt_get_property_by_offset(fdt, offset, &len);
+                if (!fprop)
+                    return len;
+
+                const char *name = fdt_string(fdt, fdt32_ld(&fprop->nameoff));
+                if (!name)
+                    return -FDT_ERR_BADSTRUCTURE;
+
+                int id = dtree_name_intern(t, name, strlen(name));
+                if (id < 0)
+                    return id;
+
+                struct dtree_prop *prop = dtree_alloc(t, sizeof(*prop));
+                if (!prop)
+                    return -FDT_ERR_NOSPACE;
+
+                prop->next = NULL;
+                prop->name_id = id;
+                prop->len = len;
+                prop->cap = 0;
+                prop->data = (void *)fprop->data;
+
+                if (last_prop[depth])
+                    last_prop[depth]->next = prop;
+                else
+                    t->nodes[stack[depth]].props = prop;
+                last_prop[depth] = prop;
+                break;
+            }
+
+            case FDT_END_NODE:
+                if (depth < 0)
+                    return -FDT_ERR_BADSTRUCTURE;
+                depth--;
+                break;
+
+            case FDT_NOP:
+                break;
+
+            case FDT_END:
+                return depth == -1 && t->node_count ? 0 : -FDT_ERR_BADSTRUCTURE;
+
+            default:
+                return -FDT_ERR_BADSTRUCTURE;
+        }
+
+        if (next < 0)
+            return next;
+        offset = next;
+    }
+}
+
+dtree_t *dtree_from_fdt(const void *fdt)
+{
+    if (fdt_check_header(fdt))
+        return NULL;
+
+    dtree_t *t = calloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+
+    t->boot_cpuid_phys = fdt_boot_cpuid_phys(fdt);
+
+    for (int i = 0; i < fdt_num_mem_rsv(fdt); i++) {
+        u64 address, size;
+        if (fdt_get_mem_rsv(fdt, i, &address, &size) || dtree_add_mem_rsv(t, address, size))
+            goto err;
+    }
+
+    int ret = dtree_parse(t, fdt);
+    if (ret < 0) {
+        printf("dtree: failed to parse FDT: %s\n", fdt_strerror(ret));
+        goto err;
+    }
+
+    return t;
+
+err:
+    dtree_free(t);
+    return NULL;
+}
+
+void dtree_free(dtree_t *t)
+{
+    if (!t)
+        return;
+
+    while (t->chunks) {
+        struct dtree_chunk *next = t->chunks->next;
+        free(t->chunks);
+        t->chunks = next;
+    }
+
+    free(t->nodes);
+    free(t->names);
+    free(t->name_index);
+    free(t->rsv);
+    free(t);
+}
+
+int dtree_subnode_offset_namelen(dtree_t *t, int parent, const char *name, int namelen)
+{
+    struct dtree_node *node = dtree_node(t, parent);
+    if (!node)
+        return -FDT_ERR_BADOFFSET;
+
+    // Same rules as libfdt: "foo" also matches "foo@unit"
+    for (int child = node->first_child; child >= 0; child = t->nodes[child].next_sibling) {
+        const char *cname = t->nodes[child].name;
+
+        if (memcmp(cname, name, namelen))
+            continue;
+        if (!cname[namelen] || (cname[namelen] == '@' && !memchr(name, '@', namelen)))
+            return child;
+    }
+
+    return -FDT_ERR_NOTFOUND;
+}
+
+int dtree_subnode_offset(dtree_t *t, int parent, const char *name)
+{
+    return dtree_subnode_offset_namelen(t, parent, name, strlen(name));
+}
+
+static const char *dtree_get_alias_namelen(dtree_t *t, const char *name, int namelen)
+{
+    int aliases = dtree_subnode_offset(t, 0, "aliases");
+    if (aliases < 0)
+        return NULL;
+
+    struct dtree_prop *prop = dtree_find_prop(t, aliases, name, namelen, NULL);
+    return prop ? prop->data : NULL;
+}
+
+const char *dtree_get_alias(dtree_t *t, const char *name)
+{
+    return dtree_get_alias_namelen(t, name, strlen(name));
+}
+
+int dtree_path_offset(dtree_t *t, const char *path)
+{
+    const char *end = path + strlen(path);
+    const char *p = path;
+    int offset = 0;
+
+    if (*path != '/') {
+        const char *q = memchr(path, '/', end - p);
+        if (!q)
+            q = end;
+
+        p = dtree_get_alias_namelen(t, p, q - p);
+        if (!p)
+            return -FDT_ERR_BADPATH;
+        offset = dtree_path_offset(t, p);
+        if (offset < 0)
+            return offset;
+
+        p = q;
+    }
+
+    while (p < end) {
+        while (*p == '/') {
+            p++;
+            if (p == end)
+                return offset;
+        }
+
+        const char *q = memchr(p, '/', end - p);
+        if (!q)
+            q = end;
+
+        offset = dtree_subnode_offset_namelen(t, offset, p, q - p);
+        if (offset < 0)
+            return offset;
+
+        p = q;
+    }
+
+    return offset;
+}
+
+int dtree_first_subnode(dtree_t *t, int node)
+{
+    struct dtree_node *n = dtree_node(t, node);
+    if (!n)
+        return -FDT_ERR_BADOFFSET;
+
+    return n->first_child >= 0 ? n->first_child : -FDT_ERR_NOTFOUND;
+}
+
+int dtree_next_subnode(dtree_t *t, int node)
+{
+    // Deleted nodes keep their link, so iteration can continue past a node that was just removed
+    if (node < 0 || node >= t->node_count)
+        return -FDT_ERR_BADOFFSET;
+
+    int next = t->nodes[node].next_sibling;
+    return next >= 0 ? next : -FDT_ERR_NOTFOUND;
+}
+
+int dtree_parent_offset(dtree_t *t, int node)
+{
+    struct dtree_node *n = dtree_node(t, node);
+    if (!n)
+        return -FDT_ERR_BADOFFSET;
+
+    return n->parent >= 0 ? n->parent : -FDT_ERR_NOTFOUND;
+}
+
+const char *dtree_get_name(dtree_t *t, int node, int *lenp)
+{
+    struct dtree_node *n = dtree_node(t, node);
+    if (!n) {
+        if (lenp)
+            *lenp = -FDT_ERR_BADOFFSET;
+        return NULL;
+    }
+
+    if (lenp)
+        *lenp = strlen(n->name);
+    return n->name;
+}
+
+const void *dtree_getprop(dtree_t *t, int node, const char *name, int *lenp)
+{
+    int err = -FDT_ERR_NOTFOUND;
+
+    if (dtree_node(t, node)) {
+        struct dtree_prop *prop = dtree_find_prop(t, node, name, strlen(name), NULL);
+        if (prop) {
+            if (lenp)
+                *lenp = prop->len;
+            return prop->data;
+        }
+    } else {
+        err = -FDT_ERR_BADOFFSET;
+    }
+
+    if (lenp)
+        *lenp = err;
+    return NULL;
+}
+
+u32 dtree_get_phandle(dtree_t *t, int node)
+{
+    int len;
+    const fdt32_t *php = dtree_getprop(t, node, "phandle", &len);
+
+    if (!php || len != sizeof(*php)) {
+        php = dtree_getprop(t, node, "linux,phandle", &len);
+        if (!php || len != sizeof(*php))
+            return 0;
+    }
+
+    return fdt32_ld(php);
+}
+
+/* Next node in tree order, like fdt_next_node() */
+static int dtree_next_node(dtree_t *t, int node)
+{
+    if (node < 0)
+        return t->node_count ? 0 : -FDT_ERR_NOTFOUND;
+
+    if (t->nodes[node].first_child >= 0)
+        return t->nodes[node].first_child;
+
+    for (; node >= 0; node = t->nodes[node].parent)
+        if (t->nodes[node].next_sibling >= 0)
+            return t->nodes[node].next_sibling;
+
+    return -FDT_ERR_NOTFOUND;
+}
+
+int dtree_node_offset_by_phandle(dtree_t *t, u32 phandle)
+{
+    if (phandle == 0 || phandle == (u32)-1)
+        return -FDT_ERR_BADPHANDLE;
+
+    for (int node = 0; node >= 0; node = dtree_next_node(t, node))
+        if (dtree_get_phandle(t, node) == phandle)
+            return node;
+
+    return -FDT_ERR_NOTFOUND;
+}
+
+int dtree_find_max_phandle(dtree_t *t, u32 *phandle)
+{
+    u32 max = 0;
+
+    for (int node = 0; node >= 0; node = dtree_next_node(t, node)) {
+        u32 value = dtree_get_phandle(t, node);
+        if (value == (u32)-1)
+            return -FDT_ERR_BADPHANDLE;
+        max = max(max, value);
+    }
+
+    if (phandle)
+        *phandle = max;
+    return 0;
+}
+
+int dtree_generate_phandle(dtree_t *t, u32 *phandle)
+{
+    u32 max;
+    int ret = dtree_find_max_phandle(t, &max);
+    if (ret < 0)
+        return ret;
+
+    if (max == FDT_MAX_PHANDLE)
+        return -FDT_ERR_NOPHANDLES;
+
+    if (phandle)
+        *phandle = max + 1;
+    return 0;
+}
+
+int dtree_node_check_compatible(dtree_t *t, int node, const char *compatible)
+{
+    int len;
+    const void *prop = dtree_getprop(t, node, "compatible", &len);
+
+    if (!prop)
+        return len;
+
+    return !fdt_stringlist_contains(prop, len, compatible);
+}
+
+int dtree_node_offset_by_compatible(dtree_t *t, int start, const char *compatible)
+{
+    if (start >= 0 && !dtree_node(t, start))
+        return -FDT_ERR_BADOFFSET;
+
+    for (int node = dtree_next_node(t, start); node >= 0; node = dtree_next_node(t, node))
+        if (!dtree_node_check_compatible(t, node, compatible))
+            return node;
+
+    return -FDT_ERR_NOTFOUND;
+}
+
+static int dtree_set_data(dtree_t *t, struct dtree_prop *prop, const void *val, int len)
+{
+    // Empty properties still need a non-NULL value, so getprop() can tell them from missing ones
+    if (!prop->data || (u32)len > prop->cap) {
+        void *data = dtree_alloc(t, max(len, 1));
+        if (!data)
+            return -FDT_ERR_NOSPACE;
+        prop->data = data;
+        prop->cap = ALIGN_UP(len, 8);
+    }
+
+    if (len)
+        memmove(prop->data, val, len);
+    prop->len = len;
+    return 0;
+}
+
+int dtree_setprop(dtree_t *t, int node, const char *name, const void *val, int len)
+{
+    if (!dtree_node(t, node))
+        return -FDT_ERR_BADOFFSET;
+    if (len < 0)
+        return -FDT_ERR_BADVALUE;
+
+    struct dtree_prop *prop = dtree_find_prop(t, node, name, strlen(name), NULL);
+
+    if (!prop) {
+        int id = dtree_name_intern(t, name, strlen(name));
+        if (id < 0)
+            return id;
+
+        prop = dtree_alloc(t, sizeof(*prop));
+        if (!prop)
+            return -FDT_ERR_NOSPACE;
+
+        // New properties go first, like libfdt puts them
+        prop->name_id = id;
+        prop->len = 0;
+        prop->cap = 0;
+        prop->data = NULL;
+        prop->next = t->nodes[node].props;
+        t->nodes[node].props = prop;
+    }
+
+    return dtree_set_data(t, prop, val, len);
+}
+
+int dtree_setprop_inplace(dtree_t *t, int node, const char *name, const void *val, int len)
+{
+    int proplen;
+
+    if (!dtree_getprop(t, node, name, &proplen))
+        return proplen;
+    if (proplen != len)
+        return -FDT_ERR_NOSPACE;
+
+    return dtree_setprop(t, node, name, val, len);
+}
+
+int dtree_appendprop(dtree_t *t, int node, const char *name, const void *val, int len)
+{
+    if (!dtree_node(t, node))
+        return -FDT_ERR_BADOFFSET;
+    if (len < 0)
+        return -FDT_ERR_BADVALUE;
+
+    struct dtree_prop *prop = dtree_find_prop(t, node, name, strlen(name), NULL);
+    if (!prop)
+        return dtree_setprop(t, node, name, val, len);
+
+    u32 total = prop->len + len;
+
+    // Appends tend to come in runs, so grow geometrically
+    if (total > prop->cap) {
+        u32 cap = ALIGN_UP(max(total, max(2 * prop->len, 16u)), 8);
+        void *data = dtree_alloc(t, cap);
+        if (!data)
+            return -FDT_ERR_NOSPACE;
+
+        memcpy(data, prop->data, prop->len);
+        prop->data = data;
+        prop->cap = cap;
+    }
+
+    memcpy((u8 *)prop->data + prop->len, val, len);
+    prop->len = total;
+    return 0;
+}
+
+int dtree_delprop(dtree_t *t, int node, const char *name)
+{
+    struct dtree_prop **link;
+
+    if (!dtree_node(t, node))
+        return -FDT_ERR_BADOFFSET;
+
+    struct dtree_prop *prop = dtree_find_prop(t, node, name, strlen(name), &link);
+    if (!prop)
+        return -FDT_ERR_NOTFOUND;
+
+    *link = prop->next;
+    return 0;
+}
+
+int dtree_add_subnode(dtree_t *t, int parent, const char *name)
+{
+    size_t len = strlen(name);
+    int ret = dtree_subnode_offset_namelen(t, parent, name, len);
+
+    if (ret >= 0)
+        return -FDT_ERR_EXISTS;
+    if (ret != -FDT_ERR_NOTFOUND)
+        return ret;
+
+    const char *copy = dtree_strdup(t, name, len);
+    if (!copy)
+        return -FDT_ERR_NOSPACE;
+
+    int idx = dtree_new_node(t, copy, parent);
+    if (idx < 0)
+        return idx;
+
+    // New nodes go right after the parent's properties, like libfdt puts them
+    t->nodes[idx].next_sibling = t->nodes[parent].first_child;
+    t->nodes[parent].first_child = idx;
+
+    return idx;
+}
+
+int dtree_set_name(dtree_t *t, int node, const char *name)
+{
+    if (!dtree_node(t, node))
+        return -FDT_ERR_BADOFFSET;
+
+    const char *copy = dtree_strdup(t, name, strlen(name));
+    if (!copy)
+        return -FDT_ERR_NOSPACE;
+
+    t->nodes[node].name = copy;
+    return 0;
+}
+
+static void dtree_mark_deleted(dtree_t *t, int node)
+{
+    t->nodes[node].deleted = true;
+
+    for (int child = t->nodes[node].first_child; child >= 0; child = t->nodes[child].next_sibling)
+        dtree_mark_deleted(t, child);
+}
+
+int dtree_nop_node(dtree_t *t, int node)
+{
+    struct dtree_node *n = dtree_node(t, node);
+    if (!n || n->parent < 0)
+        return -FDT_ERR_BADOFFSET;
+
+    int *link = &t->nodes[n->parent].first_child;
+    while (*link != node)
+        link = &t->nodes[*link].next_sibling;
+    *link = n->next_sibling;
+
+    dtree_mark_deleted(t, node);
+    return 0;
+}
+
+static void dtree_measure(dtree_t *t, int node, u32 *struct_size, u32 *strings_size)
+{
+    struct dtree_node *n = &t->nodes[node];
+
+    *struct_size += sizeof(struct fdt_node_header) + ALIGN_UP(strlen(n->name) + 1, FDT_TAGSIZE);
+
+    for (struct dtree_prop *prop = n->props; prop; prop = prop->next) {
+        struct dtree_name *name = &t->names[prop->name_id];
+
+        if (name->stroff == DTREE_NO_STROFF) {
+            name->stroff = *strings_size;
+            *strings_size += strlen(name->str) + 1;
+        }
+        *struct_size += sizeof(struct fdt_property) + ALIGN_UP(prop->len, FDT_TAGSIZE);
+    }
+
+    for (int child = n->first_child; child >= 0; child = t->nodes[child].next_sibling)
+        dtree_measure(t, child, struct_size, strings_size);
+
+    *struct_size += FDT_TAGSIZE; // FDT_END_NODE
+}
+
+static u8 *dtree_emit(dtree_t *t, int node, u8 *p)
+{
+    struct dtree_node *n = &t->nodes[node];
+    size_t namelen = strlen(n->name) + 1;
+
+    fdt32_st(p, FDT_BEGIN_NODE);
+    p += FDT_TAGSIZE;
+    memcpy(p, n->name, namelen);
+    memset(p + namelen, 0, ALIGN_UP(namelen, FDT_TAGSIZE) - namelen);
+    p += ALIGN_UP(namelen, FDT_TAGSIZE);
+
+    for (struct dtree_prop *prop = n->props; prop; prop = prop->next) {
+        fdt32_st(p, FDT_PROP);
+        fdt32_st(p + 4, prop->len);
+        fdt32_st(p + 8, t->names[prop->name_id].stroff);
+        p += sizeof(struct fdt_property);
+
+        if (prop->len)
+            memcpy(p, prop->data, prop->len);
+        memset(p + prop->len, 0, ALIGN_UP(prop->len, FDT_TAGSIZE) - prop->len);
+        p += ALIGN_UP(prop->len, FDT_TAGSIZE);
+    }
+
+    for (int child = n->first_child; child >= 0; child = t->nodes[child].next_sibling)
+        p = dtree_emit(t, child, p);
+
+    fdt32_st(p, FDT_END_NODE);
+    return p + FDT_TAGSIZE;
+}
+
+void *dtree_to_fdt(dtree_t *t, size_t align, bool reserve_self)
+{
+    // Add the reservation up front, so the blob's size accounts for it
+    if (reserve_self && dtree_add_mem_rsv(t, 0, 0))
+        return NULL;
+
+    for (u32 id = 0; id < t->name_count; id++)
+        t->names[id].stroff = DTREE_NO_STROFF;
+
+    u32 struct_size = FDT_TAGSIZE; // FDT_END
+    u32 strings_size = 0;
+    dtree_measure(t, 0, &struct_size, &strings_size);
+
+    u32 rsv_off = ALIGN_UP(sizeof(struct fdt_header), 8);
+    u32 struct_off = rsv_off + (t->rsv_count + 1) * sizeof(struct fdt_reserve_entry);
+    u32 strings_off = struct_off + struct_size;
+    u32 total = strings_off + strings_size;
+
+    u8 *blob = memalign(align, total);
+    if (!blob) {
+        if (reserve_self)
+            t->rsv_count--;
+        return NULL;
+    }
+
+    if (reserve_self) {
+        t->rsv[t->rsv_count - 1].address = cpu_to_fdt64((u64)blob);
+        t->rsv[t->rsv_count - 1].size = cpu_to_fdt64(total);
+    }
+
+    memset(blob, 0, struct_off);
+    fdt_set_magic(blob, FDT_MAGIC);
+    fdt_set_totalsize(blob, total);
+    fdt_set_off_dt_struct(blob, struct_off);
+    fdt_set_off_dt_strings(blob, strings_off);
+    fdt_set_off_mem_rsvmap(blob, rsv_off);
+    fdt_set_version(blob, FDT_LAST_SUPPORTED_VERSION);
+    fdt_set_last_comp_version(blob, FDT_FIRST_SUPPORTED_VERSION);
+    fdt_set_boot_cpuid_phys(blob, t->boot_cpuid_phys);
+    fdt_set_size_dt_strings(blob, strings_size);
+    fdt_set_size_dt_struct(blob, struct_size);
+
+    memcpy(blob + rsv_off, t->rsv, t->rsv_count * sizeof(*t->rsv));
+
+    u8 *p = dtree_emit(t, 0, blob + struct_off);
+    fdt32_st(p, FDT_END);
+
+    for (u32 id = 0; id < t->name_count; id++)
+        if (t->names[id].stroff != DTREE_NO_STROFF)
+            memcpy(blob + strings_off + t->names[id].stroff, t->names[id].str,
+                   strlen(t->names[id].str) + 1);
+
+    return blob;
+}
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef DTREE_H
+#define DTREE_H
+
+#include "types.h"
+
+#include "libfdt/libfdt.h"
+
+/*
+ * An editable in-memory devicetree. kboot loads the payload FDT into one of these, all the
+ * dt_set_* steps edit it, and it is serialized into a flat blob exactly once at the end. Edits
+ * are cheap (no memmove of the rest of the blob) and there is no fixed headroom to run out of.
+ *
+ * The API mirrors libfdt's: nodes are ints, errors are -FDT_ERR_* codes, and properties are
+ * returned as pointers to big endian data. Unlike libfdt offsets, node handles stay valid across
+ * every edit. Node names and unmodified property values point into the source FDT, so it must
+ * outlive the tree.
+ */
+typedef struct dtree dtree_t;
+
+dtree_t *dtree_from_fdt(const void *fdt);
+void dtree_free(dtree_t *t);
+
+/*
+ * Serialize into a newly allocated blob of exactly the right size. With reserve_self, the blob
+ * also carries a memory reservation for itself.
+ */
+void *dtree_to_fdt(dtree_t *t, size_t align, bool reserve_self);
+
+int dtree_add_mem_rsv(dtree_t *t, u64 address, u64 size);
+
+int dtree_path_offset(dtree_t *t, const char *path);
+int dtree_subnode_offset_namelen(dtree_t *t, int parent, const char *name, int namelen);
+int dtree_subnode_offset(dtree_t *t, int parent, const char *name);
+int dtree_first_subnode(dtree_t *t, int node);
+int dtree_next_subnode(dtree_t *t, int node);
+int dtree_parent_offset(dtree_t *t, int node);
+int dtree_node_offset_by_phandle(dtree_t *t, u32 phandle);
+int dtree_node_offset_by_compatible(dtree_t *t, int start, const char *compatible);
+int dtree_node_check_compatible(dtree_t *t, int node, const char *compatible);
+const char *dtree_get_name(dtree_t *t, int node, int *lenp);
+const char *dtree_get_alias(dtree_t *t, const char *name);
+u32 dtree_get_phandle(dtree_t *t, int node);
+int dtree_find_max_phandle(dtree_t *t, u32 *phandle);
+int dtree_generate_phandle(dtree_t *t, u32 *phandle);
+
+const void *dtree_getprop(dtree_t *t, int node, const char *name, int *lenp);
+int dtree_setprop(dtree_t *t, int node, const char *name, const void *val, int len);
+int dtree_setprop_inplace(dtree_t *t, int node, const char *name, const void *val, int len);
+int dtree_appendprop(dtree_t *t, int node, const char *name, const void *val, int len);
+int dtree_delprop(dtree_t *t, int node, const char *name);
+
+int dtree_add_subnode(dtree_t *t, int parent, const char *name);
+int dtree_set_name(dtree_t *t, int node, const char *name);
+int dtree_nop_node(dtree_t *t, int node);
+
+#define dtree_for_each_subnode(node, t, parent)                                                    \
+    for (node = dtree_first_subnode(t, parent); node >= 0; node = dtree_next_subnode(t, node))
+
+static inline int dtree_setprop_u32(dtree_t *t, int node, const char *name, u32 val)
+{
+    fdt32_t tmp = cpu_to_fdt32(val);
+    return dtree_setprop(t, node, name, &tmp, sizeof(tmp));
+}
+
+static inline int dtree_setprop_u64(dtree_t *t, int node, const char *name, u64 val)
+{
+    fdt64_t tmp = cpu_to_fdt64(val);
+    return dtree_setprop(t, node, name, &tmp, sizeof(tmp));
+}
+
+static inline int dtree_setprop_string(dtree_t *t, int node, const char *name, const char *str)
+{
+    return dtree_setprop(t, node, name, str, strlen(str) + 1);
+}
+
+static inline int dtree_setprop_empty(dtree_t *t, int node, const char *name)
+{
+    return dtree_setprop(t, node, name, NULL, 0);
+}
+
+static inline int dtree_setprop_inplace_u32(dtree_t *t, int node, const char *name, u32 val)
+{
+    fdt32_t tmp = cpu_to_fdt32(val);
+    return dtree_setprop_inplace(t, node, name, &tmp, sizeof(tmp));
+}
+
+static inline int dtree_setprop_inplace_u64(dtree_t *t, int node, const char *name, u64 val)
+{
+    fdt64_t tmp = cpu_to_fdt64(val);
+    return dtree_setprop_inplace(t, node, name, &tmp, sizeof(tmp));
+}
+
+static inline int dtree_appendprop_u32(dtree_t *t, int node, const char *name, u32 val)
+{
+    fdt32_t tmp = cpu_to_fdt32(val);
+    return dtree_appendprop(t, node, name, &tmp, sizeof(tmp));
+}
+
+static inline int dtree_appendprop_u64(dtree_t *t, int node, const char *name, u64 val)
+{
+    fdt64_t tmp = cpu_to_fdt64(val);
+    return dtree_appendprop(t, node, name, &tmp, sizeof(tmp));
+}
+
+static inline int dtree_appendprop_string(dtree_t *t, int node, const char *name, const char *str)
+{
+    return dtree_appendprop(t, node, name, str, strlen(str) + 1);
+}
+
+#endif
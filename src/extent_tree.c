@@ -0,0 +1,454 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "extent_tree.h"
+#include "malloc.h"
+#include "utils.h"
+
+static inline int height(const struct extent *e)
+{
+    return e ? e->height : 0;
+}
+
+static inline u64 max_size(const struct extent *e)
+{
+    return e ? e->max_size : 0;
+}
+
+static void update(struct extent *e)
+{
+    e->height = 1 + max(height(e->left), height(e->right));
+    e->max_size = max(e->size, max(max_size(e->left), max_size(e->right)));
+}
+
+static struct extent *rotate_right(struct extent *e)
+{
+    struct extent *l = e->left;
+
+    e->left = l->right;
+    l->right = e;
+    update(e);
+    update(l);
+    return l;
+}
+
+static struct extent *rotate_left(struct extent *e)
+{
+    struct extent *r = e->right;
+
+    e->right = r->left;
+    r->left = e;
+    update(e);
+    update(r);
+    return r;
+}
+
+static struct extent *rebalance(struct extent *e)
+{
+    update(e);
+
+    int balance = height(e->left) - height(e->right);
+
+    if (balance > 1) {
+        if (height(e->left->left) < height(e->left->right))
+            e->left = rotate_left(e->left);
+        return rotate_right(e);
+    } else if (balance < -1) {
+        if (height(e->right->right) < height(e->right->left))
+            e->right = rotate_right(e->right);
+        return rotate_left(e);
+    }
+
+    return e;
+}
+
+static struct extent *insert_node(struct extent *root, struct extent *e)
+{
+    if (!root)
+        return e;
+
+    if (e->start < root->start)
+        root->left = insert_node(root->left, e);
+    else
+        root->right = insert_node(root->right, e);
+
+    return rebalance(root);
+}
+
+static struct extent *unlink_min(struct extent *root, struct extent **min)
+{
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = unlink_min(root->left, min);
+    return rebalance(root);
+}
+
+static struct extent *remove_node(struct extent *root, struct extent *e)
+{
+    if (root == e) {
+        if (!e->left || !e->right)
+            return e->left ? e->left : e->right;
+
+        struct extent *succ;
+        e->right = unlink_min(e->right, &succ);
+        succ->left = e->left;
+        succ->right = e->right;
+        return rebalance(succ);
+    }
+
+    if (e->start < root->start)
+        root->left = remove_node(root->left, e);
+    else
+        root->right = remove_node(root->right, e);
+
+    return rebalance(root);
+}
+
+/* The size-ordered tree, keyed by (size, start) */
+
+static inline int size_height(const struct extent *e)
+{
+    return e ? e->size_height : 0;
+}
+
+static inline bool size_before(const struct extent *a, u64 size, u64 start)
+{
+    return a->size < size || (a->size == size && a->start < start);
+}
+
+static inline void size_update(struct extent *e)
+{
+    e->size_height = 1 + max(size_height(e->size_left), size_height(e->size_right));
+}
+
+static struct extent *size_rotate_right(struct extent *e)
+{
+    struct extent *l = e->size_left;
+
+    e->size_left = l->size_right;
+    l->size_right = e;
+    size_update(e);
+    size_update(l);
+    return l;
+}
+
+static struct extent *size_rotate_left(struct extent *e)
+{
+    struct extent *r = e->size_right;
+
+    e->size_right = r->size_left;
+    r->size_left = e;
+    size_update(e);
+    size_update(r);
+    return r;
+}
+
+static struct extent *size_rebalance(struct extent *e)
+{
+    size_update(e);
+
+    int balance = size_height(e->size_left) - size_height(e->size_right);
+
+    if (balance > 1) {
+        if (size_height(e->size_left->size_left) < size_height(e->size_left->size_right))
+            e->size_left = size_rotate_left(e->size_left);
+        return size_rotate_right(e);
+    } else if (balance < -1) {
+        if (size_height(e->size_right->size_right) < size_height(e->size_right->size_left))
+            e->size_right = size_rotate_right(e->size_right);
+        return size_rotate_left(e);
+    }
+
+    return e;
+}
+
+static struct extent *size_insert_node(struct extent *root, struct extent *e)
+{
+    if (!root)
+        return e;
+
+    if (size_before(e, root->size, root->start))
+        root->size_left = size_insert_node(root->size_left, e);
+    else
+        root->size_right = size_insert_node(root->size_right, e);
+
+    return size_rebalance(root);
+}
+
+static struct extent *size_unlink_min(struct extent *root, struct extent **min)
+{
+    if (!root->size_left) {
+        *min = root;
+        return root->size_right;
+    }
+
+    root->size_left = size_unlink_min(root->size_left, min);
+    return size_rebalance(root);
+}
+
+static struct extent *size_remove_node(struct extent *root, struct extent *e)
+{
+    if (root == e) {
+        if (!e->size_left || !e->size_right)
+            return e->size_left ? e->size_left : e->size_right;
+
+        struct extent *succ;
+        e->size_right = size_unlink_min(e->size_right, &succ);
+        succ->size_left = e->size_left;
+        succ->size_right = e->size_right;
+        return size_rebalance(succ);
+    }
+
+    if (size_before(e, root->size, root->start))
+        root->size_left = size_remove_node(root->size_left, e);
+    else
+        root->size_right = size_remove_node(root->size_right, e);
+
+    return size_rebalance(root);
+}
+
+/* First extent whose (size, start) is not before (size, start) */
+static struct extent *size_lower_bound(const struct extent_tree *t, u64 size, u64 start)
+{
+    struct extent *e = t->size_root, *best = NULL;
+
+    while (e) {
+        if (size_before(e, size, start)) {
+            e = e->size_right;
+        } else {
+            best = e;
+            e = e->size_left;
+        }
+    }
+
+    return best;
+}
+
+static void free_nodes(struct extent *e)
+{
+    if (!e)
+        return;
+
+    free_nodes(e->left);
+    free_nodes(e->right);
+    free(e);
+}
+
+void extent_tree_init(struct extent_tree *t)
+{
+    t->root = NULL;
+    t->size_root = NULL;
+    t->total = 0;
+    t->count = 0;
+}
+
+void extent_tree_clear(struct extent_tree *t)
+{
+    free_nodes(t->root);
+    extent_tree_init(t);
+}
+
+/* Last extent starting at or before addr */
+static struct extent *floor_node(const struct extent_tree *t, u64 addr)
+{
+    struct extent *e = t->root, *best = NULL;
+
+    while (e) {
+        if (e->start <= addr) {
+            best = e;
+            e = e->right;
+        } else {
+            e = e->left;
+        }
+    }
+
+    return best;
+}
+
+/* First extent starting after addr */
+static struct extent *higher_node(const struct extent_tree *t, u64 addr)
+{
+    struct extent *e = t->root, *best = NULL;
+
+    while (e) {
+        if (e->start > addr) {
+            best = e;
+            e = e->left;
+        } else {
+            e = e->right;
+        }
+    }
+
+    return best;
+}
+
+static void unlink_extent(struct extent_tree *t, struct extent *e)
+{
+    t->root = remove_node(t->root, e);
+    t->size_root = size_remove_node(t->size_root, e);
+    t->total -= e->size;
+    t->count--;
+}
+
+static void link_extent(struct extent_tree *t, struct extent *e)
+{
+    e->left = e->right = NULL;
+    e->size_left = e->size_right = NULL;
+    update(e);
+    size_update(e);
+    t->root = insert_node(t->root, e);
+    t->size_root = size_insert_node(t->size_root, e);
+    t->total += e->size;
+    t->count++;
+}
+
+bool extent_add(struct extent_tree *t, u64 start, u64 size)
+{
+    if (!size)
+        return true;
+    if (start + size < start)
+        return false;
+
+    struct extent *prev = floor_node(t, start);
+    struct extent *next = higher_node(t, start);
+
+    if (prev && prev->start + prev->size > start)
+        return false;
+    if (next && start + size > next->start)
+        return false;
+
+    struct extent *e = NULL;
+
+    if (prev && prev->start + prev->size == start) {
+        unlink_extent(t, prev);
+        start = prev->start;
+        size += prev->size;
+        e = prev;
+    }
+    if (next && start + size == next->start) {
+        unlink_extent(t, next);
+        size += next->size;
+        if (e)
+            free(next);
+        else
+            e = next;
+    }
+
+    if (!e) {
+        e = malloc(sizeof(*e));
+        if (!e)
+            return false;
+    }
+
+    e->start = start;
+    e->size = size;
+    link_extent(t, e);
+    return true;
+}
+
+bool extent_remove(struct extent_tree *t, u64 start, u64 size)
+{
+    if (!size)
+        return true;
+    if (start + size < start)
+        return false;
+
+    struct extent *e = floor_node(t, start);
+    if (!e || start + size > e->start + e->size)
+        return false;
+
+    u64 head = start - e->start;
+    u64 tail = e->start + e->size - (start + size);
+
+    unlink_extent(t, e);
+
+    if (head && tail) {
+        struct extent *split = malloc(sizeof(*split));
+        if (!split) {
+            link_extent(t, e);
+            return false;
+        }
+        split->start = start + size;
+        split->size = tail;
+        link_extent(t, split);
+    }
+
+    if (head) {
+        e->size = head;
+        link_extent(t, e);
+    } else if (tail) {
+        e->start = start + size;
+        e->size = tail;
+        link_extent(t, e);
+    } else {
+        free(e);
+    }
+
+    return true;
+}
+
+const struct extent *extent_lookup(const struct extent_tree *t, u64 addr)
+{
+    struct extent *e = floor_node(t, addr);
+
+    if (e && addr - e->start < e->size)
+        return e;
+    return NULL;
+}
+
+static u64 fit(const struct extent *e, u64 from, u64 size, u64 align)
+{
+    u64 addr = ALIGN_UP(max(e->start, from), align);
+
+    if (addr < e->start || addr - e->start > e->size || e->size - (addr - e->start) < size)
+        return EXTENT_NONE;
+    return addr;
+}
+
+static u64 find(const struct extent *e, u64 from, u64 size, u64 align)
+{
+    if (!e || e->max_size < size)
+        return EXTENT_NONE;
+
+    // Everything in the left subtree ends before e starts, so it only matters if e is past from
+    if (e->start > from) {
+        u64 addr = find(e->left, from, size, align);
+        if (addr != EXTENT_NONE)
+            return addr;
+    }
+
+    if (e->size >= size) {
+        u64 addr = fit(e, from, size, align);
+        if (addr != EXTENT_NONE)
+            return addr;
+    }
+
+    return find(e->right, from, size, align);
+}
+
+u64 extent_find(const struct extent_tree *t, u64 from, u64 size, u64 align)
+{
+    if (!size)
+        return EXTENT_NONE;
+
+    return find(t->root, from, size, align ? align : 1);
+}
+
+u64 extent_find_best(const struct extent_tree *t, u64 size, u64 align)
+{
+    if (!size)
+        return EXTENT_NONE;
+    if (!align)
+        align = 1;
+
+    for (struct extent *e = size_lower_bound(t, size, 0); e;
+         e = size_lower_bound(t, e->size, e->start + 1)) {
+        u64 addr = fit(e, 0, size, align);
+        if (addr != EXTENT_NONE)
+            return addr;
+    }
+
+    return EXTENT_NONE;
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef EXTENT_TREE_H
+#define EXTENT_TREE_H
+
+#include "types.h"
+
+#define EXTENT_NONE (~0UL)
+
+/*
+ * A set of disjoint [start, start + size) ranges, kept in an AVL tree ordered by address. Each
+ * node also tracks the largest range in its subtree, so first-fit searches skip every subtree
+ * that cannot hold the request and run in O(log n). Adjacent ranges are always merged.
+ *
+ * The same nodes are also linked into a second AVL tree ordered by (size, start), which serves
+ * best-fit searches.
+ */
+struct extent {
+    u64 start;
+    u64 size;
+    u64 max_size;
+    struct extent *left, *right;
+    int height;
+    struct extent *size_left, *size_right;
+    int size_height;
+};
+
+struct extent_tree {
+    struct extent *root;
+    struct extent *size_root;
+    u64 total;
+    u64 count;
+};
+
+void extent_tree_init(struct extent_tree *t);
+void extent_tree_clear(struct extent_tree *t);
+
+/* Add a range, merging it with its neighbours. Fails if it overlaps the set. */
+bool extent_add(struct extent_tree *t, u64 start, u64 size);
+/* Remove a range. Fails unless all of it is contained in a single extent. */
+bool extent_remove(struct extent_tree *t, u64 start, u64 size);
+/* Return the extent containing addr, or NULL */
+const struct extent *extent_lookup(const struct extent_tree *t, u64 addr);
+/*
+ * Return the lowest address >= from, aligned to align (a power of two), such that
+ * [addr, addr + size) is inside the set, or EXTENT_NONE.
+ */
+u64 extent_find(const struct extent_tree *t, u64 from, u64 size, u64 align);
+/*
+ * Like extent_find(), but pick the smallest extent that can hold the request (lowest address
+ * among equals). O(log n) when every extent is aligned to align already; otherwise extents that
+ * are long enough but cannot hold an aligned range are skipped one by one.
+ */
+u64 extent_find_best(const struct extent_tree *t, u64 size, u64 align);
+
+static inline u64 extent_largest(const struct extent_tree *t)
+{
+    return t->root ? t->root->max_size : 0;
+}
+
+#endif
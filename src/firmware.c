@@ -45,7 +45,7 @@ const struct fw_version_info fw_versions[NUM_FW_VERSIONS] = {
     // clang-format on
 };
 
-int firmware_set_fdt(void *fdt, int node, const char *prop, const struct fw_version_info *ver)
+int firmware_set_fdt(dtree_t *dt, int node, const char *prop, const struct fw_version_info *ver)
 {
     fdt32_t data[ARRAY_SIZE(ver->num)];
 
@@ -53,7 +53,7 @@ int firmware_set_fdt(void *fdt, int node, const char *prop, const struct fw_vers
         data[i] = cpu_to_fdt32(ver->num[i]);
     }
 
-    if (fdt_setprop(fdt, node, prop, data, ver->num_length * sizeof(u32)))
+    if (dtree_setprop(dt, node, prop, data, ver->num_length * sizeof(u32)))
         bail("FDT: couldn't set %s property to firmware info", prop);
     return 0;
 }
@@ -3,6 +3,7 @@
 #ifndef __FIRMWARE_H__
 #define __FIRMWARE_H__
 
+#include "dtree.h"
 #include "types.h"
 
 /* macOS */
@@ -48,7 +49,7 @@ extern struct fw_version_info system_firmware;
 extern const struct fw_version_info fw_versions[NUM_FW_VERSIONS];
 
 int firmware_init(void);
-int firmware_set_fdt(void *fdt, int node, const char *prop, const struct fw_version_info *ver);
+int firmware_set_fdt(dtree_t *dt, int node, const char *prop, const struct fw_version_info *ver);
 bool firmware_iboot_in_range(u32 min[IBOOT_VER_COMP], u32 max[IBOOT_VER_COMP],
                              u32 this[IBOOT_VER_COMP]);
 bool firmware_sfw_in_range(enum fw_version lower_bound, enum fw_version upper_bound);
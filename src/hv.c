@@ -13,6 +13,7 @@
 #include "utils.h"
 
 #define HV_TICK_RATE      1000
+#define HV_IDLE_TICK_RATE 50
 #define HV_SLOW_TICK_RATE 1
 
 DECLARE_SPINLOCK(bhl);
@@ -24,6 +25,17 @@ extern char _hv_vectors_start[0];
 
 u64 hv_tick_interval;
 u64 hv_secondary_tick_interval;
+extern u64 hv_sample_interval;
+
+/*
+ * The interruptible CPU polls at HV_TICK_RATE while there is proxy or console traffic, and
+ * doubles its interval on every tick that finds nothing to do, down to HV_IDLE_TICK_RATE - but
+ * only where that can't hold up guest timer interrupts (see hv_tick_may_back_off()).
+ */
+static u64 hv_tick_cur, hv_tick_max;
+static u64 hv_last_tick;
+static bool hv_tick_busy;
+static struct hv_tick_stats hv_tick_stats;
 
 int hv_pinned_cpu;
 int hv_want_cpu;
@@ -64,6 +76,7 @@ void hv_init(void)
     hv_wdt_init();
 
     hv_pt_init();
+    hv_exc_init_sysregs();
 
     // Configure hypervisor defaults
 
@@ -107,6 +120,10 @@ void hv_init(void)
 
     // Compute tick interval
     hv_tick_interval = mrs(CNTFRQ_EL0) / HV_TICK_RATE;
+    hv_tick_max = mrs(CNTFRQ_EL0) / HV_IDLE_TICK_RATE;
+    hv_tick_cur = hv_tick_interval;
+    hv_last_tick = mrs(CNTPCT_EL0);
+    memset(&hv_tick_stats, 0, sizeof(hv_tick_stats));
 
     hv_has_ecv = mrs(ID_AA64MMFR0_EL1) & (0xfULL << 60);
 
@@ -393,13 +410,28 @@ void hv_set_elr(u64 val)
 
 void hv_arm_tick(bool secondary)
 {
-    if (secondary)
-        msr(CNTP_TVAL_EL0, hv_secondary_tick_interval);
-    else
-        msr(CNTP_TVAL_EL0, hv_tick_interval);
+    u64 interval = secondary ? hv_secondary_tick_interval : hv_tick_cur;
+    u64 sample_interval = __atomic_load_n(&hv_sample_interval, __ATOMIC_RELAXED);
+
+    // The sampling profiler rides on the tick
+    if (sample_interval)
+        interval = min(interval, sample_interval);
+
+    msr(CNTP_TVAL_EL0, interval);
     msr(CNTP_CTL_EL0, CNTx_CTL_ENABLE);
 }
 
+void hv_tick_kick(void)
+{
+    hv_tick_busy = true;
+}
+
+void hv_get_tick_stats(struct hv_tick_stats *stats)
+{
+    *stats = hv_tick_stats;
+    stats->interval = hv_tick_cur;
+}
+
 void hv_maybe_exit(void)
 {
     if (hv_should_exit[smp_id()]) {
@@ -407,15 +439,52 @@ void hv_maybe_exit(void)
     }
 }
 
+/*
+ * hv_update_fiq() masks a guest timer's FIQ while it's being delivered, and only an exit turns it
+ * back on. Without ECV the guest's timer writes don't trap, so that exit is often the next tick,
+ * and a backed off tick would delay the guest's next timer interrupt by up to its interval.
+ */
+static bool hv_tick_may_back_off(void)
+{
+    u64 ena = VM_TMR_FIQ_ENA_ENA_P | VM_TMR_FIQ_ENA_ENA_V;
+
+    return hv_has_ecv && (mrs(SYS_IMP_APL_VM_TMR_FIQ_ENA_EL2) & ena) == ena;
+}
+
 void hv_tick(struct exc_info *ctx)
 {
+    u64 now = mrs(CNTPCT_EL0);
+    bool busy = hv_tick_busy;
+
+    hv_tick_busy = false;
+    hv_tick_stats.ticks++;
+
     hv_wdt_pet();
     iodev_handle_events(uartproxy_iodev);
     if (iodev_can_read(uartproxy_iodev)) {
+        // The input arrived at some point since the last poll, so this is the worst case
+        u64 latency = now - hv_last_tick;
+        hv_tick_stats.user_interrupts++;
+        hv_tick_stats.latency_ticks += latency;
+        hv_tick_stats.latency_max = max(hv_tick_stats.latency_max, latency);
+        busy = true;
+
         printf("HV: User interrupt\n");
         iodev_console_flush();
         if (hv_pinned_cpu == -1 || hv_pinned_cpu == smp_id())
             hv_exc_proxy(ctx, START_HV, HV_USER_INTERRUPT, NULL);
     }
-    hv_vuart_poll();
+    busy |= hv_vuart_poll();
+    busy |= hv_virtio_poll();
+
+    if (busy) {
+        hv_tick_cur = hv_tick_interval;
+    } else {
+        hv_tick_stats.idle_ticks++;
+        if (hv_tick_may_back_off())
+            hv_tick_cur = min(hv_tick_cur * 2, hv_tick_max);
+        else
+            hv_tick_cur = hv_tick_interval;
+    }
+    hv_last_tick = mrs(CNTPCT_EL0);
 }
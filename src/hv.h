@@ -31,6 +31,95 @@ struct hv_evt_irqtrace {
     u16 num;
 };
 
+/* Per-SPI counters for AIC interrupts injected by the vGIC, in CNTPCT ticks */
+struct hv_vgic_irq_stats {
+    u64 count;
+    u64 inject_ticks;   // AIC ack -> loaded into a list register, summed
+    u64 inject_max;
+    u64 complete_ticks; // AIC ack -> deactivated by the guest, summed
+    u64 complete_max;
+};
+
+/* Polling by the interruptible CPU's tick; durations in CNTPCT ticks */
+struct hv_tick_stats {
+    u64 ticks;
+    u64 idle_ticks;      // ticks that found nothing to do
+    u64 user_interrupts; // proxy input that interrupted the guest
+    u64 latency_ticks;   // previous poll -> input seen, summed
+    u64 latency_max;
+    u64 interval;        // current tick interval
+};
+
+/* Guest exits, by what the HV did to handle them */
+enum hv_exit_class {
+    HV_EXIT_SYSREG_FAST, // sysreg traps handled without taking the HV lock
+    HV_EXIT_SMC,         // SMC (PSCI) calls
+    HV_EXIT_SYSREG,
+    HV_EXIT_DABORT,
+    HV_EXIT_SYNC,        // other synchronous exceptions
+    HV_EXIT_IRQ,
+    HV_EXIT_FIQ_FAST,    // timer ticks on CPUs that do not poll
+    HV_EXIT_FIQ_TICK,    // the interruptible CPU's polling tick
+    HV_EXIT_FIQ,
+    HV_EXIT_SERROR,
+    HV_EXIT_PROXY,       // proxyclient round trips, also counted in the exit that made them
+    HV_EXIT_CLASSES,
+};
+
+/* Bucket n counts durations of [2^(n-1), 2^n) CNTPCT ticks */
+#define HV_PROF_BUCKETS 32
+
+struct hv_prof_stats {
+    u64 count;
+    u64 ticks;
+    u64 max;
+    u32 hist[HV_PROF_BUCKETS];
+};
+
+struct hv_prof_hdr {
+    u32 ncpus;
+    u32 nclasses;
+    u32 nbuckets;
+    u32 npages;
+    u64 freq;
+    u64 dropped_pages; // data aborts on pages that did not fit in the table
+};
+
+#define HV_SAMPLE_DEPTH 16
+
+struct hv_sample {
+    u64 time;
+    u64 pc;
+    u64 spsr;
+    u64 ttbr0;
+    u32 cpu;
+    u32 depth;                   // valid entries in frames
+    u64 frames[HV_SAMPLE_DEPTH]; // return addresses from the frame pointer chain, innermost first
+};
+
+/* Trapped system registers are keyed by their MRS/MSR instruction bits [20:5] */
+#define _SYSREG_ENC(_1, _2, op0, op1, CRn, CRm, op2)                                               \
+    (((op0) << 14) | ((op1) << 11) | ((CRn) << 7) | ((CRm) << 3) | (op2))
+#define SYSREG_ENC(...) _SYSREG_ENC(__VA_ARGS__)
+
+#define HV_SYSREG_UNLOCKED BIT(0) // handled in the fast path, without taking the HV lock
+#define HV_SYSREG_RAZ_WI   BIT(1) // reads as zero, writes are ignored
+
+/* Returns false to leave the access to the proxy */
+typedef bool hv_sysreg_handler_t(struct exc_info *ctx, u64 rt, bool is_read);
+
+/* A run of guest VA pages translated to contiguous PAs, or faulting if pa is 0 */
+struct hv_xlate_extent {
+    u64 pa;
+    u64 size;
+};
+
+struct hv_sysreg_stats {
+    u32 enc;
+    u32 flags;
+    u64 count;
+};
+
 #define HV_MAX_RW_SIZE  64
 #define HV_MAX_RW_WORDS (HV_MAX_RW_SIZE >> 3)
 
@@ -60,6 +149,10 @@ int hv_map_hw(u64 from, u64 to, u64 size);
 int hv_map_sw(u64 from, u64 to, u64 size);
 int hv_map_hook(u64 from, hv_hook_t *hook, u64 size);
 u64 hv_translate(u64 addr, bool s1only, bool w, u64 *par_out);
+size_t hv_translate_range(u64 va, u64 size, bool s1, bool w, struct hv_xlate_extent *ext,
+                          size_t count);
+size_t hv_gather(void *dst, const struct hv_xlate_extent *ext, size_t count);
+size_t hv_scatter(const void *src, const struct hv_xlate_extent *ext, size_t count);
 u64 hv_pt_walk(u64 addr);
 bool hv_handle_dabort(struct exc_info *ctx);
 bool hv_pa_write(struct exc_info *ctx, u64 addr, u64 *val, int width);
@@ -70,16 +163,39 @@ bool hv_pa_rw(struct exc_info *ctx, u64 addr, u64 *val, bool write, int width);
 bool hv_trace_irq(u32 type, u32 num, u32 count, u32 flags);
 
 /* Virtual peripherals */
-void hv_vuart_poll(void);
+bool hv_vuart_poll(void);
 void hv_map_vuart(u64 base, int irq, iodev_id_t iodev);
 struct virtio_conf;
 void hv_map_virtio(u64 base, struct virtio_conf *conf);
+bool hv_virtio_poll(void);
 void virtio_put_buffer(u64 base, int qu, u32 id, u32 len);
 
 /* Exceptions */
 void hv_exc_proxy(struct exc_info *ctx, uartproxy_boot_reason_t reason, u32 type, void *extra);
 void hv_set_time_stealing(bool enabled, bool reset);
 void hv_add_time(s64 time);
+void hv_exc_init_sysregs(void);
+
+/* System register traps */
+void hv_sysreg_init(void);
+int hv_sysreg_register(u32 enc, u32 flags, hv_sysreg_handler_t *handler);
+int hv_sysreg_map(u32 enc, u32 to, u32 flags);
+void hv_sysreg_unregister(u32 enc);
+bool hv_sysreg_dispatch(struct exc_info *ctx, u64 iss, bool locked);
+size_t hv_sysreg_get_stats(struct hv_sysreg_stats *stats, size_t count, bool reset);
+
+/* Exit profiler */
+u64 hv_prof_start(void);
+void hv_prof_dabort(u64 ipa);
+void hv_prof_exit(enum hv_exit_class cls, u64 start);
+void hv_prof_enable(bool enable, bool reset);
+size_t hv_prof_dump(void *buf, size_t size);
+
+/* Guest sampling profiler */
+void hv_sample(struct exc_info *ctx);
+int hv_sample_start(u64 rate, u32 depth, u32 size);
+u64 hv_sample_stop(void);
+size_t hv_sample_drain(struct hv_sample *buf, size_t count);
 
 /* WDT */
 void hv_wdt_pet(void);
@@ -120,14 +236,21 @@ void hv_arm_tick(bool secondary);
 void hv_rearm(void);
 void hv_maybe_exit(void);
 void hv_tick(struct exc_info *ctx);
+void hv_tick_kick(void);
+void hv_get_tick_stats(struct hv_tick_stats *stats);
 
 //
 // PSCI init
 //
 
 void hv_psci_init(void);
+int hv_vgicv3_route_aic_irq(u32 irq, u32 spi);
+int hv_vgicv3_get_irq_stats(u32 spi, struct hv_vgic_irq_stats *stats);
 #ifdef ENABLE_VGIC_MODULE
 void hv_vgicv3_init(void);
+void hv_vgicv3_refill_list_registers(void);
+u32 hv_vgicv3_handle_aic_events(void);
+void hv_vgicv3_aic_event_done(u32 event);
 #endif
 bool hv_handle_psci_smc(struct exc_info *ctx);
 int hv_handle_psci_smc_python_entry(uint64_t regs[4]);
@@ -18,12 +18,6 @@
 extern bool vgic_inited;
 extern spinlock_t bhl;
 
-#define _SYSREG_ISS(_1, _2, op0, op1, CRn, CRm, op2)                                               \
-    (((op0) << ESR_ISS_MSR_OP0_SHIFT) | ((op1) << ESR_ISS_MSR_OP1_SHIFT) |                         \
-     ((CRn) << ESR_ISS_MSR_CRn_SHIFT) | ((CRm) << ESR_ISS_MSR_CRm_SHIFT) |                         \
-     ((op2) << ESR_ISS_MSR_OP2_SHIFT))
-#define SYSREG_ISS(...) _SYSREG_ISS(__VA_ARGS__)
-
 #define PERCPU(x) pcpu[mrs(TPIDR_EL2)].x
 
 struct hv_pcpu_data {
@@ -74,9 +68,11 @@ static void _hv_exc_proxy(struct exc_info *ctx, uartproxy_boot_reason_t reason,
         .info = ctx,
     };
 
+    u64 prof_start = hv_prof_start();
     hv_wdt_suspend();
     int ret = uartproxy_run(&start);
     hv_wdt_resume();
+    hv_prof_exit(HV_EXIT_PROXY, prof_start);
 
     switch (ret) {
         case EXC_RET_HANDLED:
@@ -186,654 +182,690 @@ static void hv_update_fiq(void)
     }
 }
 
-#define SYSREG_MAP(sr, to)                                                                         \
-    case SYSREG_ISS(sr):                                                                           \
-        if (is_read)                                                                               \
-            regs[rt] = _mrs(sr_tkn(to));                                                           \
-        else                                                                                       \
-            _msr(sr_tkn(to), regs[rt]);                                                            \
-        return true;
-
-#define SYSREG_PASS(sr)                                                                            \
-    case SYSREG_ISS(sr):                                                                           \
-        if (is_read)                                                                               \
-            regs[rt] = _mrs(sr_tkn(sr));                                                           \
-        else                                                                                       \
-            _msr(sr_tkn(sr), regs[rt]);                                                            \
-        return true;
-
-static bool hv_handle_msr_unlocked(struct exc_info *ctx, u64 iss)
+/* m1n1_windows change - Trap the ARM standard PMU regs */
+static bool sysreg_pmcr_el0(struct exc_info *ctx, u64 rt, bool is_read)
 {
-    u64 reg = iss & (ESR_ISS_MSR_OP0 | ESR_ISS_MSR_OP2 | ESR_ISS_MSR_OP1 | ESR_ISS_MSR_CRn |
-                     ESR_ISS_MSR_CRm);
-    u64 rt = FIELD_GET(ESR_ISS_MSR_Rt, iss);
-    bool is_read = iss & ESR_ISS_MSR_DIR;
+    u64 *regs = ctx->regs;
 
+    if(is_read) {
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 calculated = 0;
+        u64 pmi_mask = PMCR0_IMODE_MASK;
+        //
+        // Are PMIs enabled? (affects bit 0 of PMCR equivalently)
+        //
+        if((pmcr0_value & pmi_mask) == (PMCR0_IMODE_FIQ)) {
+            calculated |= PMCR_E;
+        }
+        //
+        // Bits 5:1 are 0 for now,  bits 6 and 7 are on always (long events always on)
+        // and bit 9 is checked by PMCR0[20] (since it deals with freeze/overflow)
+        //
+        if((pmcr0_value & BIT(20)) != 0) {
+            calculated |= PMCR_FZO;
+        }
+        calculated |= ((BIT(6)) | (BIT(7)));
+        printf("HV PMUv3 Redirect: mrs x%ld, PMCR_EL0 = 0x%lx\n", rt, calculated);
+        regs[rt] = calculated;
+    }
+    else {
+        //
+        // Bits [63:10] will have writes discarded (mostly ARM spec, bit 32 due to lack of support)
+        //
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        int cycle_reset_requested = 0;
+        //
+        // Bit 9 (stop count on overflow) writes affect bit 20 of APL_PMCR0
+        //
+        if((regs[rt] & BIT(9)) != 0) {
+            pmcr0_value |= BIT(20);
+        }
+        else {
+            pmcr0_value &= ~(BIT(20));
+        }
+
+        //
+        // Writes to bits [6:3] unsupported since no way of expressing either with Apple PMUs.
+        //
+        // Writing bit 2 (cycle counter reset) implies setting PMC0 to 0, so check if that's the case.
+        //
+        if((regs[rt] & PMCR_C) != 0) {
+            cycle_reset_requested = 1;
+        }
+        //
+        // Bit 1 is the same as bit 2 but for event counters, unimplemented for now.
+        //
+        // Bit 0 controls whether event counters are enabled globally, if this is being set,
+        // the closest thing on Apple platforms is the IRQ mode so set that if bit 0 is requested.
+        //
+        if((regs[rt] & PMCR_E) != 0) {
+            pmcr0_value &= ~(PMCR0_IMODE_MASK);
+            pmcr0_value |= PMCR0_IMODE_FIQ;
+        }
+        else {
+            pmcr0_value &= ~(PMCR0_IMODE_MASK);
+            pmcr0_value |= PMCR0_IMODE_OFF;
+        }
+        sysop("isb");
+        if(cycle_reset_requested == 1) {
+            pmcr0_value &= ~(BIT(12));
+            pmcr0_value &= ~(BIT(0));
+        }
+        msr(SYS_IMP_APL_PMCR0, pmcr0_value);
+        sysop("isb");
+        if(cycle_reset_requested == 1) {
+            sysop("isb");
+            msr(SYS_IMP_APL_PMC0, 0);
+            sysop("isb");
+            pmcr0_value |= BIT(12);
+            pmcr0_value |= BIT(0);
+            sysop("isb");
+            msr(SYS_IMP_APL_PMCR0, pmcr0_value);
+            sysop("isb");
+        }
+        printf("HV PMUv3 Redirect (OK): msr PMCR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+    }
+    return true;
+}
+
+static bool sysreg_pmccfiltr_el0(struct exc_info *ctx, u64 rt, bool is_read)
+{
     u64 *regs = ctx->regs;
 
-    regs[31] = 0;
-
-    switch (reg) {
-        SYSREG_PASS(SYS_IMP_APL_CORE_NRG_ACC_DAT);
-        SYSREG_PASS(SYS_IMP_APL_CORE_SRM_NRG_ACC_DAT);
-        /* Architectural timer, for ECV */
-        SYSREG_MAP(SYS_CNTV_CTL_EL0, SYS_CNTV_CTL_EL02)
-        SYSREG_MAP(SYS_CNTV_CVAL_EL0, SYS_CNTV_CVAL_EL02)
-        SYSREG_MAP(SYS_CNTV_TVAL_EL0, SYS_CNTV_TVAL_EL02)
-        SYSREG_MAP(SYS_CNTP_CTL_EL0, SYS_CNTP_CTL_EL02)
-        SYSREG_MAP(SYS_CNTP_CVAL_EL0, SYS_CNTP_CVAL_EL02)
-        SYSREG_MAP(SYS_CNTP_TVAL_EL0, SYS_CNTP_TVAL_EL02)
-        /* Spammy stuff seen on t600x p-cores */
-        /* These are PMU/PMC registers */
-        SYSREG_PASS(sys_reg(3, 2, 15, 12, 0));
-        SYSREG_PASS(sys_reg(3, 2, 15, 13, 0));
-        SYSREG_PASS(sys_reg(3, 2, 15, 14, 0));
-        SYSREG_PASS(sys_reg(3, 2, 15, 15, 0));
-        SYSREG_PASS(sys_reg(3, 1, 15, 7, 0));
-        SYSREG_PASS(sys_reg(3, 1, 15, 8, 0));
-        SYSREG_PASS(sys_reg(3, 1, 15, 9, 0));
-        SYSREG_PASS(sys_reg(3, 1, 15, 10, 0));
-        /* Noisy traps */
-        SYSREG_PASS(SYS_IMP_APL_HID4)
-        SYSREG_PASS(SYS_IMP_APL_EHID4)
-        /* We don't normally trap these, but if we do, they're noisy */
-        SYSREG_PASS(SYS_IMP_APL_GXF_STATUS_EL1)
-        SYSREG_PASS(SYS_IMP_APL_CNTVCT_ALIAS_EL0)
-        SYSREG_PASS(SYS_IMP_APL_TPIDR_GL1)
-        SYSREG_MAP(SYS_IMP_APL_SPSR_GL1, SYS_IMP_APL_SPSR_GL12)
-        SYSREG_MAP(SYS_IMP_APL_ASPSR_GL1, SYS_IMP_APL_ASPSR_GL12)
-        SYSREG_MAP(SYS_IMP_APL_ELR_GL1, SYS_IMP_APL_ELR_GL12)
-        SYSREG_MAP(SYS_IMP_APL_ESR_GL1, SYS_IMP_APL_ESR_GL12)
-        SYSREG_MAP(SYS_IMP_APL_SPRR_PERM_EL1, SYS_IMP_APL_SPRR_PERM_EL12)
-        SYSREG_MAP(SYS_IMP_APL_APCTL_EL1, SYS_IMP_APL_APCTL_EL12)
-        SYSREG_MAP(SYS_IMP_APL_AMX_CTL_EL1, SYS_IMP_APL_AMX_CTL_EL12)
-        /* FIXME:Might be wrong */
-        SYSREG_PASS(SYS_IMP_APL_AMX_STATE_T)
-        /* pass through PMU handling */
-        SYSREG_PASS(SYS_IMP_APL_PMCR1)
-        SYSREG_PASS(SYS_IMP_APL_PMCR2)
-        SYSREG_PASS(SYS_IMP_APL_PMCR3)
-        SYSREG_PASS(SYS_IMP_APL_PMCR4)
-        SYSREG_PASS(SYS_IMP_APL_PMESR0)
-        SYSREG_PASS(SYS_IMP_APL_PMESR1)
-        SYSREG_PASS(SYS_IMP_APL_PMSR)
-#ifndef DEBUG_PMU_IRQ
-        SYSREG_PASS(SYS_IMP_APL_PMC0)
-#endif
-        SYSREG_PASS(SYS_IMP_APL_PMC1)
-        SYSREG_PASS(SYS_IMP_APL_PMC2)
-        SYSREG_PASS(SYS_IMP_APL_PMC3)
-        SYSREG_PASS(SYS_IMP_APL_PMC4)
-        SYSREG_PASS(SYS_IMP_APL_PMC5)
-        SYSREG_PASS(SYS_IMP_APL_PMC6)
-        SYSREG_PASS(SYS_IMP_APL_PMC7)
-        SYSREG_PASS(SYS_IMP_APL_PMC8)
-        SYSREG_PASS(SYS_IMP_APL_PMC9)
-        /* m1n1_windows change - Trap the ARM standard PMU regs */
-        case SYSREG_ISS(SYS_PMCR_EL0):
-            if(is_read) {
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 calculated = 0;
-                u64 pmi_mask = PMCR0_IMODE_MASK;
-                //
-                // Are PMIs enabled? (affects bit 0 of PMCR equivalently)
-                //
-                if((pmcr0_value & pmi_mask) == (PMCR0_IMODE_FIQ)) {
-                    calculated |= PMCR_E;
-                }
-                //
-                // Bits 5:1 are 0 for now,  bits 6 and 7 are on always (long events always on)
-                // and bit 9 is checked by PMCR0[20] (since it deals with freeze/overflow)
-                //
-                if((pmcr0_value & BIT(20)) != 0) {
-                    calculated |= PMCR_FZO;
-                }
-                calculated |= ((BIT(6)) | (BIT(7)));
-                printf("HV PMUv3 Redirect: mrs x%ld, PMCR_EL0 = 0x%lx\n", rt, calculated);
-                regs[rt] = calculated;
-            }
-            else {
-                //
-                // Bits [63:10] will have writes discarded (mostly ARM spec, bit 32 due to lack of support)
-                //
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                int cycle_reset_requested = 0;
-                //
-                // Bit 9 (stop count on overflow) writes affect bit 20 of APL_PMCR0
-                //
-                if((regs[rt] & BIT(9)) != 0) {
-                    pmcr0_value |= BIT(20);
-                }
-                else {
-                    pmcr0_value &= ~(BIT(20));
-                }
-                
-                //
-                // Writes to bits [6:3] unsupported since no way of expressing either with Apple PMUs.
-                //
-                // Writing bit 2 (cycle counter reset) implies setting PMC0 to 0, so check if that's the case.
-                //
-                if((regs[rt] & PMCR_C) != 0) {
-                    cycle_reset_requested = 1;
-                }
-                //
-                // Bit 1 is the same as bit 2 but for event counters, unimplemented for now.
-                //
-                // Bit 0 controls whether event counters are enabled globally, if this is being set,
-                // the closest thing on Apple platforms is the IRQ mode so set that if bit 0 is requested.
-                //
-                if((regs[rt] & PMCR_E) != 0) {
-                    pmcr0_value &= ~(PMCR0_IMODE_MASK);
-                    pmcr0_value |= PMCR0_IMODE_FIQ;
-                }
-                else {
-                    pmcr0_value &= ~(PMCR0_IMODE_MASK);
-                    pmcr0_value |= PMCR0_IMODE_OFF;
-                }
-                sysop("isb");
-                if(cycle_reset_requested == 1) {
-                    pmcr0_value &= ~(BIT(12));
-                    pmcr0_value &= ~(BIT(0));
-                }
-                msr(SYS_IMP_APL_PMCR0, pmcr0_value);
-                sysop("isb");
-                if(cycle_reset_requested == 1) {
-                    sysop("isb");
-                    msr(SYS_IMP_APL_PMC0, 0);
-                    sysop("isb");
-                    pmcr0_value |= BIT(12);
-                    pmcr0_value |= BIT(0);
-                    sysop("isb");
-                    msr(SYS_IMP_APL_PMCR0, pmcr0_value);
-                    sysop("isb");
-                }
-                printf("HV PMUv3 Redirect (OK): msr PMCR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
-            }
-            return true;
-        SYSREG_MAP(SYS_PMCCNTR_EL0, SYS_IMP_APL_PMC0)
-        case SYSREG_ISS(SYS_PMCCFILTR_EL0):
-            if(is_read) {
-                u64 pmcr1_value = mrs(SYS_IMP_APL_PMCR1);
-                u64 calculated_value = 0;
-                //
-                // If EL0/EL1 counting is disabled, set bit 30 of PMCCFILTR to 1.
-                // (This is backwards from how I would've done it but okay I suppose...)
-                //
-                if((pmcr1_value & BIT(8)) == 0) {
-                    calculated_value |= BIT(30);
-                }
-                if((pmcr1_value & BIT(16)) == 0) {
-                    calculated_value |= BIT(31);
-                }
-                //
-                // EL2 counting always happens as far as is known, so bit 27 is always set to 1
-                // (bit set to 1 in this case means disable filtering...not sure why it's backwards.)
-                //
-                calculated_value |= BIT(27);
-                printf("HV PMUv3 Redirect: mrs x%ld, PMCCFILTR_EL0 = 0x%lx\n", rt, calculated_value);
-                regs[rt] = calculated_value;
+    if(is_read) {
+        u64 pmcr1_value = mrs(SYS_IMP_APL_PMCR1);
+        u64 calculated_value = 0;
+        //
+        // If EL0/EL1 counting is disabled, set bit 30 of PMCCFILTR to 1.
+        // (This is backwards from how I would've done it but okay I suppose...)
+        //
+        if((pmcr1_value & BIT(8)) == 0) {
+            calculated_value |= BIT(30);
+        }
+        if((pmcr1_value & BIT(16)) == 0) {
+            calculated_value |= BIT(31);
+        }
+        //
+        // EL2 counting always happens as far as is known, so bit 27 is always set to 1
+        // (bit set to 1 in this case means disable filtering...not sure why it's backwards.)
+        //
+        calculated_value |= BIT(27);
+        printf("HV PMUv3 Redirect: mrs x%ld, PMCCFILTR_EL0 = 0x%lx\n", rt, calculated_value);
+        regs[rt] = calculated_value;
+    }
+    else {
+        u64 pmcr1_value = mrs(SYS_IMP_APL_PMCR1);
+        //
+        // If we're being asked to disable counting cycles for a given EL, set the appropriate bit for
+        // PMCR1 respectively.
+        //
+        if((regs[rt] & PMCCFILTR_P) == 0) {
+            pmcr1_value |= BIT(16);
+        }
+        else {
+            pmcr1_value &= ~(BIT(16));
+        }
+        if((regs[rt] & PMCCFILTR_U) == 0) {
+            pmcr1_value |= BIT(8);
+        }
+        else {
+            pmcr1_value &= ~(BIT(16));
+        }
+        sysop("isb");
+        msr(SYS_IMP_APL_PMCR1, pmcr1_value);
+        sysop("isb");
+        printf("HV PMUv3 Redirect (OK): msr PMCCFILTR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+    }
+    return true;
+}
+
+static bool sysreg_pmceid0_el0(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    //
+    // Unimplemented for now, return 0 for a read, discard writes.
+    //
+    if(is_read) {
+        regs[rt] = 0;
+        printf("HV PMUv3 Redirect: mrs x%ld, PMCEID0_EL0 = 0x%lx\n", rt, regs[rt]);
+    }
+    else {
+        //
+        // Do nothing here.
+        //
+        printf("HV PMUv3 Redirect (skipped write): msr PMCEID0_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+    }
+    return true;
+}
+
+static bool sysreg_pmceid1_el0(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    //
+    // Unimplemented for now, return 0 for a read, discard writes.
+    //
+    if(is_read) {
+        regs[rt] = 0;
+        printf("HV PMUv3 Redirect: mrs x%ld, PMCEID1_EL0 = 0x%lx\n", rt, regs[rt]);
+    }
+    else {
+        printf("HV PMUv3 Redirect (skipped write): msr PMCEID1_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+    }
+    return true;
+}
+
+static bool sysreg_pmcntenclr_el0(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if(is_read) {
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 calculated_value = 0;
+        //
+        // check what perf counters are enabled in PMCR0, and reflect that in the returned PMCNTENCLR/PMCNTENSET value
+        //
+        if((pmcr0_value & BIT(0)) != 0) {
+            calculated_value |= BIT(31);
+        }
+        printf("HV PMUv3 Redirect: mrs x%ld, PMCNTENCLR_EL0 = 0x%lx\n", rt, calculated_value);
+        regs[rt] = calculated_value;
+    }
+    else {
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 counters_disable_mask = GENMASK(31,0);
+        //
+        // check if any counters are being requested to be disabled (cycle counter only for now)
+        // and deal with those here.
+        //
+        if((regs[rt] & counters_disable_mask) != 0) {
+            if((regs[rt] & BIT(31)) != 0) {
+                pmcr0_value &= ~(BIT(0));
             }
-            else {
-                u64 pmcr1_value = mrs(SYS_IMP_APL_PMCR1);
-                //
-                // If we're being asked to disable counting cycles for a given EL, set the appropriate bit for
-                // PMCR1 respectively.
-                //
-                if((regs[rt] & PMCCFILTR_P) == 0) {
-                    pmcr1_value |= BIT(16);
-                }
-                else {
-                    pmcr1_value &= ~(BIT(16));
-                }
-                if((regs[rt] & PMCCFILTR_U) == 0) {
-                    pmcr1_value |= BIT(8);
-                }
-                else {
-                    pmcr1_value &= ~(BIT(16));
-                }
-                sysop("isb");
-                msr(SYS_IMP_APL_PMCR1, pmcr1_value);
-                sysop("isb");
-                printf("HV PMUv3 Redirect (OK): msr PMCCFILTR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+            sysop("isb");
+            msr(SYS_IMP_APL_PMCR0, pmcr0_value);
+            sysop("isb");
+            printf("HV PMUv3 Redirect (OK): msr PMCNTENCLR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+        }
+    }
+    return true;
+}
+
+static bool sysreg_pmcntenset_el0(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if(is_read) {
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 calculated_value = 0;
+        //
+        // check what perf counters are enabled in PMCR0, and reflect that in the returned PMCNTENCLR/PMCNTENSET value
+        //
+        if((pmcr0_value & BIT(0)) != 0) {
+            calculated_value |= BIT(31);
+        }
+        printf("HV PMUv3 Redirect: mrs x%ld, PMCNTENSET_EL0 = 0x%lx\n", rt, calculated_value);
+        regs[rt] = calculated_value;
+    }
+    else {
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 counters_enable_mask = GENMASK(31,0);
+        //
+        // check if any counters are being requested to be disabled (cycle counter only for now)
+        // and deal with those here.
+        //
+        if((regs[rt] & counters_enable_mask) != 0) {
+            if((regs[rt] & BIT(31)) != 0) {
+                pmcr0_value |= BIT(0);
             }
-            return true;
-        case SYSREG_ISS(SYS_PMCEID0_EL0):
-            //
-            // Unimplemented for now, return 0 for a read, discard writes.
-            //
-            if(is_read) {
-                regs[rt] = 0;
-                printf("HV PMUv3 Redirect: mrs x%ld, PMCEID0_EL0 = 0x%lx\n", rt, regs[rt]);
+            sysop("isb");
+            msr(SYS_IMP_APL_PMCR0, pmcr0_value);
+            sysop("isb");
+            printf("HV PMUv3 Redirect (OK): msr PMCNTENSET_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+        }
+    }
+    return true;
+}
+
+static bool sysreg_pmintenclr_el1(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if(is_read) {
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 calculated_value = 0;
+        //
+        // As before, cycle counter only for now. (bit 12 = PMI enabled for cycle counter)
+        //
+        if((pmcr0_value & BIT(12)) != 0) {
+            calculated_value |= BIT(31);
+        }
+        printf("HV PMUv3 Redirect: mrs x%ld, PMINTENCLR_EL1 = 0x%lx\n", rt, calculated_value);
+        regs[rt] = calculated_value;
+    }
+    else {
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 counter_irqs_disabled_mask = GENMASK(31,0);
+        //
+        // Cycle counter only for now (bits 19:12 control all PMIs for the PMUs)
+        //
+        if((regs[rt] & counter_irqs_disabled_mask) != 0) {
+            if((regs[rt] & (BIT(31))) != 0) {
+                pmcr0_value &= ~(BIT(12));
             }
-            else {
-                //
-                // Do nothing here.
-                //
-                printf("HV PMUv3 Redirect (skipped write): msr PMCEID0_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+            sysop("isb");
+            msr(SYS_IMP_APL_PMCR0, pmcr0_value);
+            sysop("isb");
+            printf("HV PMUv3 Redirect (OK): msr PMINTENCLR_EL1, x%ld = 0x%lx\n", rt, regs[rt]);
+        }
+
+    }
+    return true;
+}
+
+static bool sysreg_pmintenset_el1(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if(is_read) {
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 calculated_value = 0;
+        //
+        // As before, cycle counter only for now. (bit 12 = PMI enabled for cycle counter)
+        //
+        if((pmcr0_value & BIT(12)) != 0) {
+            calculated_value |= BIT(31);
+        }
+        printf("HV PMUv3 Redirect: mrs x%ld, PMINTENSET_EL1 = 0x%lx\n", rt, calculated_value);
+        regs[rt] = calculated_value;
+    }
+    else {
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 counter_irqs_enabled_mask = GENMASK(31,0);
+        //
+        // Cycle counter only for now (bits 19:12 control all PMIs for the PMUs)
+        //
+        if((regs[rt] & counter_irqs_enabled_mask) != 0) {
+            if((regs[rt] & BIT(31)) != 0) {
+                pmcr0_value |= BIT(12);
             }
-            return true;
-        case SYSREG_ISS(SYS_PMCEID1_EL0):
+            sysop("isb");
+            msr(SYS_IMP_APL_PMCR0, pmcr0_value);
+            sysop("isb");
+            printf("HV PMUv3 Redirect (OK): msr PMINTENSET_EL1, x%ld = 0x%lx\n", rt, regs[rt]);
+        }
+    }
+    return true;
+}
+
+static bool sysreg_pmmir_el1(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    //
+    // return 0 for now, discard writes.
+    //
+    if(is_read) {
+        regs[rt] = 0;
+        printf("HV PMUv3 Redirect: mrs x%ld, PMMIR_EL1 = 0x%lx\n", rt, regs[rt]);
+    }
+    else {
+        printf("HV PMUv3 Redirect (skipped write): msr PMMIR_EL1, x%ld = 0x%lx\n", rt, regs[rt]);
+    }
+    return true;
+}
+
+static bool sysreg_pmovsclr_el0(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if(is_read) {
+        //
+        // Read the state of the PMSR register to see if a PMU has overflowed.
+        // Cycle counter only for now.
+        //
+        u64 pmsr_value = mrs(SYS_IMP_APL_PMSR);
+        u64 calculated_value = 0;
+        u64 pmu_overflowed_mask = GENMASK(9, 0);
+        if((pmsr_value & pmu_overflowed_mask) != 0) {
             //
-            // Unimplemented for now, return 0 for a read, discard writes.
+            // bit 0 is for PMC 0
             //
-            if(is_read) {
-                regs[rt] = 0;
-                printf("HV PMUv3 Redirect: mrs x%ld, PMCEID1_EL0 = 0x%lx\n", rt, regs[rt]);
-            }
-            else {
-                printf("HV PMUv3 Redirect (skipped write): msr PMCEID1_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
-            }
-            return true;
-        case SYSREG_ISS(SYS_PMCNTENCLR_EL0):
-            if(is_read) {
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 calculated_value = 0;
-                //
-                // check what perf counters are enabled in PMCR0, and reflect that in the returned PMCNTENCLR/PMCNTENSET value
-                //
-                if((pmcr0_value & BIT(0)) != 0) {
-                    calculated_value |= BIT(31);
-                }
-                printf("HV PMUv3 Redirect: mrs x%ld, PMCNTENCLR_EL0 = 0x%lx\n", rt, calculated_value);
-                regs[rt] = calculated_value;
-            }
-            else {
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 counters_disable_mask = GENMASK(31,0);
-                //
-                // check if any counters are being requested to be disabled (cycle counter only for now)
-                // and deal with those here.
-                //
-                if((regs[rt] & counters_disable_mask) != 0) {
-                    if((regs[rt] & BIT(31)) != 0) {
-                        pmcr0_value &= ~(BIT(0));
-                    }
-                    sysop("isb");
-                    msr(SYS_IMP_APL_PMCR0, pmcr0_value);
-                    sysop("isb");
-                    printf("HV PMUv3 Redirect (OK): msr PMCNTENCLR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
-                }
-            }
-            return true;
-        case SYSREG_ISS(SYS_PMCNTENSET_EL0):
-            if(is_read) {
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 calculated_value = 0;
-                //
-                // check what perf counters are enabled in PMCR0, and reflect that in the returned PMCNTENCLR/PMCNTENSET value
-                //
-                if((pmcr0_value & BIT(0)) != 0) {
-                    calculated_value |= BIT(31);
-                }
-                printf("HV PMUv3 Redirect: mrs x%ld, PMCNTENSET_EL0 = 0x%lx\n", rt, calculated_value);
-                regs[rt] = calculated_value;
+            if((pmsr_value & BIT(0)) != 0) {
+                calculated_value |= BIT(31);
             }
-            else {
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 counters_enable_mask = GENMASK(31,0);
-                //
-                // check if any counters are being requested to be disabled (cycle counter only for now)
-                // and deal with those here.
-                //
-                if((regs[rt] & counters_enable_mask) != 0) {
-                    if((regs[rt] & BIT(31)) != 0) {
-                        pmcr0_value |= BIT(0);
-                    }
-                    sysop("isb");
-                    msr(SYS_IMP_APL_PMCR0, pmcr0_value);
-                    sysop("isb");
-                    printf("HV PMUv3 Redirect (OK): msr PMCNTENSET_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
-                }
-            }
-            return true;
-        SYSREG_MAP(SYS_PMEVCNTR0_EL0, SYS_IMP_APL_PMC2)
-        // case SYSREG_ISS(SYS_PMEVTYPER0_EL0):
-        //     if(is_read) {
-        //         printf("mrs(PMEVTYPER0_EL0)\n");
-        //         regs[rt] = 0;
-        //         int value = mrs(SYS_IMP_APL_PMCR1);
-        //         if(value & GENMASK(23, 16)) {
-        //             regs[rt] |= BIT(31); //privileged bit
-        //         }
-        //         if(value & GENMASK(15, 8)) {
-        //             regs[rt] |= BIT(30); //user filter bit
-        //         }
-        //         regs[rt] |= (mrs(SYS_IMP_APL_PMESR0) & GENMASK(7, 0));
-        //     }
-        //     else {
-        //         int val = mrs(SYS_IMP_APL_PMCR1);
-        //         int event = mrs(SYS_IMP_APL_PMESR0) & GENMASK(7, 0);
-        //         if(regs[rt] & PMEVTYPER_P) {
-        //             printf("msr(PMEVTYPER0_EL0, 0x%08lx): enabling el1 counting of event\n", regs[rt]);
-        //             val |= BIT(16);
-        //         }
-        //         if(regs[rt] & GENMASK(7, 0)) {
-        //             printf("msr(PMEVTYPER0_EL0, 0x%08lx): setting event\n", regs[rt]);
-        //             event |= regs[rt] & GENMASK(7, 0);
-        //             msr(SYS_IMP_APL_PMESR0, event);
-        //         }
-        //         msr(SYS_IMP_APL_PMCR1, val);
-        //     }
-        //     return true;
-        case SYSREG_ISS(SYS_PMINTENCLR_EL1):
-            if(is_read) {
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 calculated_value = 0;
-                //
-                // As before, cycle counter only for now. (bit 12 = PMI enabled for cycle counter)
-                //
-                if((pmcr0_value & BIT(12)) != 0) {
-                    calculated_value |= BIT(31);
-                }
-                printf("HV PMUv3 Redirect: mrs x%ld, PMINTENCLR_EL1 = 0x%lx\n", rt, calculated_value);
-                regs[rt] = calculated_value;
+        }
+        printf("HV PMUv3 Redirect: mrs x%ld, PMOVSCLR_EL0 = 0x%lx\n", rt, calculated_value);
+        regs[rt] = calculated_value;
+    }
+    else {
+        //
+        // To clear the overflow bit requires a reset of the PMC (to clear PMSR)
+        // so we need to disable the counter and re-enable it with the bit set to 0.
+        //
+        u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
+        u64 counter_overflow_mask = GENMASK(31,0);
+        if((regs[rt] & counter_overflow_mask) != 0) {
+            if((regs[rt] & BIT(31)) != 0) {
+                pmcr0_value &= ~(BIT(12));
+                pmcr0_value &= ~(BIT(0));
+                sysop("isb");
+                msr(SYS_IMP_APL_PMCR0, pmcr0_value);
+                sysop("isb");
+                sysop("isb");
+                msr(SYS_IMP_APL_PMC0, 0);
+                sysop("isb");
+                pmcr0_value |= BIT(12);
+                pmcr0_value |= BIT(0);
+                sysop("isb");
+                msr(SYS_IMP_APL_PMCR0, pmcr0_value);
+                sysop("isb");
             }
-            else {
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 counter_irqs_disabled_mask = GENMASK(31,0);
-                //
-                // Cycle counter only for now (bits 19:12 control all PMIs for the PMUs)
-                //
-                if((regs[rt] & counter_irqs_disabled_mask) != 0) {
-                    if((regs[rt] & (BIT(31))) != 0) {
-                        pmcr0_value &= ~(BIT(12));
-                    }
-                    sysop("isb");
-                    msr(SYS_IMP_APL_PMCR0, pmcr0_value);
-                    sysop("isb");
-                    printf("HV PMUv3 Redirect (OK): msr PMINTENCLR_EL1, x%ld = 0x%lx\n", rt, regs[rt]);
-                }
+        printf("HV PMUv3 Redirect (OK): msr PMOVSCLR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+        }
+    }
+    return true;
+}
 
-            }
-            return true;
-        case SYSREG_ISS(SYS_PMINTENSET_EL1):
-            if(is_read) {
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 calculated_value = 0;
-                //
-                // As before, cycle counter only for now. (bit 12 = PMI enabled for cycle counter)
-                //
-                if((pmcr0_value & BIT(12)) != 0) {
-                    calculated_value |= BIT(31);
-                }
-                printf("HV PMUv3 Redirect: mrs x%ld, PMINTENSET_EL1 = 0x%lx\n", rt, calculated_value);
-                regs[rt] = calculated_value;
-            }
-            else {
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 counter_irqs_enabled_mask = GENMASK(31,0);
-                //
-                // Cycle counter only for now (bits 19:12 control all PMIs for the PMUs)
-                //
-                if((regs[rt] & counter_irqs_enabled_mask) != 0) {
-                    if((regs[rt] & BIT(31)) != 0) {
-                        pmcr0_value |= BIT(12);
-                    }
-                    sysop("isb");
-                    msr(SYS_IMP_APL_PMCR0, pmcr0_value);
-                    sysop("isb");
-                    printf("HV PMUv3 Redirect (OK): msr PMINTENSET_EL1, x%ld = 0x%lx\n", rt, regs[rt]);
-                }
-            }
-            return true;
-        case SYSREG_ISS(SYS_PMMIR_EL1):
+static bool sysreg_pmovsset_el0(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if(is_read) {
+        //
+        // Read the state of the PMSR register to see if a PMU has overflowed.
+        // Cycle counter only for now.
+        //
+        u64 pmsr_value = mrs(SYS_IMP_APL_PMSR);
+        u64 calculated_value = 0;
+        u64 pmu_overflowed_mask = GENMASK(9, 0);
+        if((pmsr_value & pmu_overflowed_mask) != 0) {
             //
-            // return 0 for now, discard writes.
+            // bit 0 is for PMC 0
             //
-            if(is_read) {
-                regs[rt] = 0;
-                printf("HV PMUv3 Redirect: mrs x%ld, PMMIR_EL1 = 0x%lx\n", rt, regs[rt]);
+            if((pmsr_value & BIT(0)) != 0) {
+                calculated_value |= BIT(31);
             }
-            else {
-                printf("HV PMUv3 Redirect (skipped write): msr PMMIR_EL1, x%ld = 0x%lx\n", rt, regs[rt]);
-            }
-            return true;
-        case SYSREG_ISS(SYS_PMOVSCLR_EL0):
-            if(is_read) {
-                //
-                // Read the state of the PMSR register to see if a PMU has overflowed.
-                // Cycle counter only for now.
-                //
-                u64 pmsr_value = mrs(SYS_IMP_APL_PMSR);
-                u64 calculated_value = 0;
-                u64 pmu_overflowed_mask = GENMASK(9, 0);
-                if((pmsr_value & pmu_overflowed_mask) != 0) {
-                    //
-                    // bit 0 is for PMC 0
-                    //
-                    if((pmsr_value & BIT(0)) != 0) {
-                        calculated_value |= BIT(31);
-                    }
-                }
-                printf("HV PMUv3 Redirect: mrs x%ld, PMOVSCLR_EL0 = 0x%lx\n", rt, calculated_value);
-                regs[rt] = calculated_value;
-            }
-            else {
-                //
-                // To clear the overflow bit requires a reset of the PMC (to clear PMSR)
-                // so we need to disable the counter and re-enable it with the bit set to 0.
-                //
-                u64 pmcr0_value = mrs(SYS_IMP_APL_PMCR0);
-                u64 counter_overflow_mask = GENMASK(31,0);
-                if((regs[rt] & counter_overflow_mask) != 0) {
-                    if((regs[rt] & BIT(31)) != 0) {
-                        pmcr0_value &= ~(BIT(12));
-                        pmcr0_value &= ~(BIT(0));
-                        sysop("isb");
-                        msr(SYS_IMP_APL_PMCR0, pmcr0_value);
-                        sysop("isb");
-                        sysop("isb");
-                        msr(SYS_IMP_APL_PMC0, 0);
-                        sysop("isb");
-                        pmcr0_value |= BIT(12);
-                        pmcr0_value |= BIT(0);
-                        sysop("isb");
-                        msr(SYS_IMP_APL_PMCR0, pmcr0_value);
-                        sysop("isb");
-                    }
-                printf("HV PMUv3 Redirect (OK): msr PMOVSCLR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
-                }
-            }
-            return true;
-        case SYSREG_ISS(SYS_PMOVSSET_EL0):
-            if(is_read) {
-                //
-                // Read the state of the PMSR register to see if a PMU has overflowed.
-                // Cycle counter only for now.
-                //
-                u64 pmsr_value = mrs(SYS_IMP_APL_PMSR);
-                u64 calculated_value = 0;
-                u64 pmu_overflowed_mask = GENMASK(9, 0);
-                if((pmsr_value & pmu_overflowed_mask) != 0) {
-                    //
-                    // bit 0 is for PMC 0
-                    //
-                    if((pmsr_value & BIT(0)) != 0) {
-                        calculated_value |= BIT(31);
-                    }
-                }
-                printf("HV PMUv3 Redirect: mrs x%ld, PMOVSSET_EL0 = 0x%lx\n", rt, calculated_value);
-                regs[rt] = calculated_value;
-            }
-            else {
-                //
-                // For now, don't set the overflow bit. If this needs to change, reuse the code from before.
-                //
-            }
-            return true;
-        case SYSREG_ISS(SYS_PMSELR_EL0):
-            //for now hardcode to set the cycle counter, this will very likely need to change
-            if(is_read) {
-                regs[rt] = 31;
-                printf("HV PMUv3 Redirect: mrs x%ld, PMSELR_EL0 = 0x%lx\n", rt, regs[rt]);
-            }
-            else {
-                printf("HV PMUv3 Redirect (skipped write): msr PMSELR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
-            }
-            return true;
-        //SYSREG_MAP(SYS_PMSWINC_EL0, SYS_IMP_APL_PMC3)
-        case SYSREG_ISS(SYS_PMUSERENR_EL0):
-            if(is_read) {
-                regs[rt] = 0;
-                printf("HV PMUv3 Redirect: mrs x%ld, PMUSERENR_EL0 = 0x%lx\n", rt, regs[rt]);
-            }
-            else {
-                printf("HV PMUv3 Redirect (skipped write): msr PMUSERENR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
-            }
-           return true;
-        // SYSREG_MAP(SYS_PMXEVCNTR_EL0, SYS_IMP_APL_PMC2)
-        // case SYSREG_ISS(SYS_PMXEVTYPER_EL0):
-        //     if(is_read) {
-        //         printf("mrs(PMXEVTYPER_EL0)\n");
-        //         regs[rt] = 0;
-        //         int value = mrs(SYS_IMP_APL_PMCR1);
-        //         if(value & GENMASK(23, 16)) {
-        //             regs[rt] |= BIT(31); //privileged bit
-        //         }
-        //         if(value & GENMASK(15, 8)) {
-        //             regs[rt] |= BIT(30); //user filter bit
-        //         }
-        //         regs[rt] |= (mrs(SYS_IMP_APL_PMESR0) & GENMASK(7, 0));
-        //     }
-        //     else {
-        //         int val = mrs(SYS_IMP_APL_PMCR1);
-        //         int event = mrs(SYS_IMP_APL_PMESR0) & GENMASK(7, 0);
-        //         if(regs[rt] & PMEVTYPER_P) {
-        //             printf("msr(PMEVTYPER0_EL0, 0x%08lx): enabling el1 counting of event\n", regs[rt]);
-        //             val |= BIT(16);
-        //         }
-        //         if(regs[rt] & GENMASK(7, 0)) {
-        //             printf("msr(PMEVTYPER0_EL0, 0x%08lx): setting event\n", regs[rt]);
-        //             event |= regs[rt] & GENMASK(7, 0);
-        //             msr(SYS_IMP_APL_PMESR0, event);
-        //         }
-        //         msr(SYS_IMP_APL_PMCR1, val);
-        //     }
-        //     return true;
-
-        /* Outer Sharable TLB maintenance instructions */
-        SYSREG_PASS(sys_reg(1, 0, 8, 1, 0)) // TLBI VMALLE1OS
-        SYSREG_PASS(sys_reg(1, 0, 8, 1, 1)) // TLBI VAE1OS
-        SYSREG_PASS(sys_reg(1, 0, 8, 1, 2)) // TLBI ASIDE1OS
-        SYSREG_PASS(sys_reg(1, 0, 8, 5, 1)) // TLBI RVAE1OS
-
-        case SYSREG_ISS(SYS_ACTLR_EL1):
-            if (is_read) {
-                if (cpufeat_actlr_el2)
-                    regs[rt] = mrs(SYS_ACTLR_EL12);
-                else
-                    regs[rt] = mrs(SYS_IMP_APL_ACTLR_EL12);
-            } else {
-                if (cpufeat_actlr_el2)
-                    msr(SYS_ACTLR_EL12, regs[rt]);
-                else
-                    msr(SYS_IMP_APL_ACTLR_EL12, regs[rt]);
-            }
-            return true;
+        }
+        printf("HV PMUv3 Redirect: mrs x%ld, PMOVSSET_EL0 = 0x%lx\n", rt, calculated_value);
+        regs[rt] = calculated_value;
+    }
+    else {
+        //
+        // For now, don't set the overflow bit. If this needs to change, reuse the code from before.
+        //
+    }
+    return true;
+}
 
-        case SYSREG_ISS(SYS_IMP_APL_IPI_SR_EL1):
-            if (is_read)
-                regs[rt] = PERCPU(ipi_pending) ? IPI_SR_PENDING : 0;
-            else if (regs[rt] & IPI_SR_PENDING)
-                PERCPU(ipi_pending) = false;
-            return true;
+static bool sysreg_pmselr_el0(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
 
-        /* shadow the interrupt mode and state flag */
-        case SYSREG_ISS(SYS_IMP_APL_PMCR0):
-            if (is_read) {
-                u64 val = (mrs(SYS_IMP_APL_PMCR0) & ~PMCR0_IMODE_MASK) | PERCPU(pmc_irq_mode);
-                regs[rt] = val | (PERCPU(pmc_pending) ? PMCR0_IACT : 0);
-            } else {
-                PERCPU(pmc_pending) = !!(regs[rt] & PMCR0_IACT);
-                PERCPU(pmc_irq_mode) = regs[rt] & PMCR0_IMODE_MASK;
-                msr(SYS_IMP_APL_PMCR0, regs[rt]);
-            }
-            return true;
+    //for now hardcode to set the cycle counter, this will very likely need to change
+    if(is_read) {
+        regs[rt] = 31;
+        printf("HV PMUv3 Redirect: mrs x%ld, PMSELR_EL0 = 0x%lx\n", rt, regs[rt]);
+    }
+    else {
+        printf("HV PMUv3 Redirect (skipped write): msr PMSELR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+    }
+    return true;
+}
 
-        /*
-         * Handle this one here because m1n1/Linux (will) use it for explicit cpuidle.
-         * We can pass it through; going into deep sleep doesn't break the HV since we
-         * don't do any wfis that assume otherwise in m1n1. However, don't het macOS
-         * disable WFI ret (when going into systemwide sleep), since that breaks things.
-         */
-        case SYSREG_ISS(SYS_IMP_APL_CYC_OVRD):
-            if (is_read) {
-                regs[rt] = mrs(SYS_IMP_APL_CYC_OVRD);
-            } else {
-                if (regs[rt] & (CYC_OVRD_DISABLE_WFI_RET | CYC_OVRD_FIQ_MODE_MASK))
-                    return false;
-                msr(SYS_IMP_APL_CYC_OVRD, regs[rt]);
-            }
-            return true;
-            /* clang-format off */
-        /* IPI handling */
-        SYSREG_PASS(SYS_IMP_APL_IPI_CR_EL1)
-        /* M1RACLES reg, handle here due to silly 12.0 "mitigation" */
-        case SYSREG_ISS(sys_reg(3, 5, 15, 10, 1)):
-            if (is_read)
-                regs[rt] = 0;
-            return true;
+static bool sysreg_pmuserenr_el0(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if(is_read) {
+        regs[rt] = 0;
+        printf("HV PMUv3 Redirect: mrs x%ld, PMUSERENR_EL0 = 0x%lx\n", rt, regs[rt]);
     }
-    return false;
+    else {
+        printf("HV PMUv3 Redirect (skipped write): msr PMUSERENR_EL0, x%ld = 0x%lx\n", rt, regs[rt]);
+    }
+    return true;
 }
 
-static bool hv_handle_smc(struct exc_info *ctx) {
-    printf("PSCI SMC DEBUG: handling PSCI request 0x%lx\n", ctx->regs[0]);
-    bool handled_smc = hv_handle_psci_smc(ctx);
-    return handled_smc;
+static bool sysreg_actlr_el1(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if (is_read) {
+        if (cpufeat_actlr_el2)
+            regs[rt] = mrs(SYS_ACTLR_EL12);
+        else
+            regs[rt] = mrs(SYS_IMP_APL_ACTLR_EL12);
+    } else {
+        if (cpufeat_actlr_el2)
+            msr(SYS_ACTLR_EL12, regs[rt]);
+        else
+            msr(SYS_IMP_APL_ACTLR_EL12, regs[rt]);
+    }
+    return true;
 }
 
-static bool hv_handle_msr(struct exc_info *ctx, u64 iss)
+static bool sysreg_ipi_sr_el1(struct exc_info *ctx, u64 rt, bool is_read)
 {
-    u64 reg = iss & (ESR_ISS_MSR_OP0 | ESR_ISS_MSR_OP2 | ESR_ISS_MSR_OP1 | ESR_ISS_MSR_CRn |
-                     ESR_ISS_MSR_CRm);
-    u64 rt = FIELD_GET(ESR_ISS_MSR_Rt, iss);
-    bool is_read = iss & ESR_ISS_MSR_DIR;
+    u64 *regs = ctx->regs;
 
+    if (is_read)
+        regs[rt] = PERCPU(ipi_pending) ? IPI_SR_PENDING : 0;
+    else if (regs[rt] & IPI_SR_PENDING)
+        PERCPU(ipi_pending) = false;
+    return true;
+}
+
+/* shadow the interrupt mode and state flag */
+static bool sysreg_pmcr0(struct exc_info *ctx, u64 rt, bool is_read)
+{
     u64 *regs = ctx->regs;
 
-    regs[31] = 0;
-
-    switch (reg) {
-        /* clang-format on */
-        case SYSREG_ISS(SYS_IMP_APL_IPI_RR_LOCAL_EL1): {
-            assert(!is_read);
-            u64 mpidr = (regs[rt] & 0xff) | (mrs(MPIDR_EL1) & 0xffff00);
-            for (int i = 0; i < MAX_CPUS; i++)
-                if (mpidr == smp_get_mpidr(i)) {
-                    pcpu[i].ipi_queued = true;
-                    msr(SYS_IMP_APL_IPI_RR_LOCAL_EL1, regs[rt]);
-                    return true;
-                }
+    if (is_read) {
+        u64 val = (mrs(SYS_IMP_APL_PMCR0) & ~PMCR0_IMODE_MASK) | PERCPU(pmc_irq_mode);
+        regs[rt] = val | (PERCPU(pmc_pending) ? PMCR0_IACT : 0);
+    } else {
+        PERCPU(pmc_pending) = !!(regs[rt] & PMCR0_IACT);
+        PERCPU(pmc_irq_mode) = regs[rt] & PMCR0_IMODE_MASK;
+        msr(SYS_IMP_APL_PMCR0, regs[rt]);
+    }
+    return true;
+}
+
+/*
+ * Handle this one here because m1n1/Linux (will) use it for explicit cpuidle.
+ * We can pass it through; going into deep sleep doesn't break the HV since we
+ * don't do any wfis that assume otherwise in m1n1. However, don't het macOS
+ * disable WFI ret (when going into systemwide sleep), since that breaks things.
+ */
+static bool sysreg_cyc_ovrd(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if (is_read) {
+        regs[rt] = mrs(SYS_IMP_APL_CYC_OVRD);
+    } else {
+        if (regs[rt] & (CYC_OVRD_DISABLE_WFI_RET | CYC_OVRD_FIQ_MODE_MASK))
             return false;
+        msr(SYS_IMP_APL_CYC_OVRD, regs[rt]);
+    }
+    return true;
+}
+
+static bool sysreg_ipi_rr_local_el1(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    assert(!is_read);
+    u64 mpidr = (regs[rt] & 0xff) | (mrs(MPIDR_EL1) & 0xffff00);
+    for (int i = 0; i < MAX_CPUS; i++)
+        if (mpidr == smp_get_mpidr(i)) {
+            pcpu[i].ipi_queued = true;
+            msr(SYS_IMP_APL_IPI_RR_LOCAL_EL1, regs[rt]);
+            return true;
         }
-        case SYSREG_ISS(SYS_IMP_APL_IPI_RR_GLOBAL_EL1):
-            assert(!is_read);
-            u64 mpidr = (regs[rt] & 0xff) | ((regs[rt] & 0xff0000) >> 8);
-            for (int i = 0; i < MAX_CPUS; i++) {
-                if (mpidr == (smp_get_mpidr(i) & 0xffff)) {
-                    pcpu[i].ipi_queued = true;
-                    msr(SYS_IMP_APL_IPI_RR_GLOBAL_EL1, regs[rt]);
-                    return true;
-                }
-            }
-            return false;
-#ifdef DEBUG_PMU_IRQ
-        case SYSREG_ISS(SYS_IMP_APL_PMC0):
-            if (is_read) {
-                regs[rt] = mrs(SYS_IMP_APL_PMC0);
-            } else {
-                msr(SYS_IMP_APL_PMC0, regs[rt]);
-                printf("msr(SYS_IMP_APL_PMC0, 0x%04lx_%08lx)\n", regs[rt] >> 32,
-                       regs[rt] & 0xFFFFFFFF);
-            }
+    return false;
+}
+
+static bool sysreg_ipi_rr_global_el1(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    assert(!is_read);
+    u64 mpidr = (regs[rt] & 0xff) | ((regs[rt] & 0xff0000) >> 8);
+    for (int i = 0; i < MAX_CPUS; i++) {
+        if (mpidr == (smp_get_mpidr(i) & 0xffff)) {
+            pcpu[i].ipi_queued = true;
+            msr(SYS_IMP_APL_IPI_RR_GLOBAL_EL1, regs[rt]);
             return true;
-#endif
+        }
     }
-
     return false;
 }
 
+#ifdef DEBUG_PMU_IRQ
+static bool sysreg_pmc0(struct exc_info *ctx, u64 rt, bool is_read)
+{
+    u64 *regs = ctx->regs;
+
+    if (is_read) {
+        regs[rt] = mrs(SYS_IMP_APL_PMC0);
+    } else {
+        msr(SYS_IMP_APL_PMC0, regs[rt]);
+        printf("msr(SYS_IMP_APL_PMC0, 0x%04lx_%08lx)\n", regs[rt] >> 32, regs[rt] & 0xFFFFFFFF);
+    }
+    return true;
+}
+#endif
+
+#define SYSREG_MAP(sr, to) {SYSREG_ENC(sr), SYSREG_ENC(to)},
+#define SYSREG_PASS(sr)    {SYSREG_ENC(sr), SYSREG_ENC(sr)},
+
+/* Registers passed through (or to their EL12/GL12 views) in the lockless fast path */
+static const struct {
+    u32 enc, to;
+} sysreg_pass[] = {
+    SYSREG_PASS(SYS_IMP_APL_CORE_NRG_ACC_DAT)
+    SYSREG_PASS(SYS_IMP_APL_CORE_SRM_NRG_ACC_DAT)
+    /* Architectural timer, for ECV */
+    SYSREG_MAP(SYS_CNTV_CTL_EL0, SYS_CNTV_CTL_EL02)
+    SYSREG_MAP(SYS_CNTV_CVAL_EL0, SYS_CNTV_CVAL_EL02)
+    SYSREG_MAP(SYS_CNTV_TVAL_EL0, SYS_CNTV_TVAL_EL02)
+    SYSREG_MAP(SYS_CNTP_CTL_EL0, SYS_CNTP_CTL_EL02)
+    SYSREG_MAP(SYS_CNTP_CVAL_EL0, SYS_CNTP_CVAL_EL02)
+    SYSREG_MAP(SYS_CNTP_TVAL_EL0, SYS_CNTP_TVAL_EL02)
+    /* Spammy stuff seen on t600x p-cores */
+    /* These are PMU/PMC registers */
+    SYSREG_PASS(sys_reg(3, 2, 15, 12, 0))
+    SYSREG_PASS(sys_reg(3, 2, 15, 13, 0))
+    SYSREG_PASS(sys_reg(3, 2, 15, 14, 0))
+    SYSREG_PASS(sys_reg(3, 2, 15, 15, 0))
+    SYSREG_PASS(sys_reg(3, 1, 15, 7, 0))
+    SYSREG_PASS(sys_reg(3, 1, 15, 8, 0))
+    SYSREG_PASS(sys_reg(3, 1, 15, 9, 0))
+    SYSREG_PASS(sys_reg(3, 1, 15, 10, 0))
+    /* Noisy traps */
+    SYSREG_PASS(SYS_IMP_APL_HID4)
+    SYSREG_PASS(SYS_IMP_APL_EHID4)
+    /* We don't normally trap these, but if we do, they're noisy */
+    SYSREG_PASS(SYS_IMP_APL_GXF_STATUS_EL1)
+    SYSREG_PASS(SYS_IMP_APL_CNTVCT_ALIAS_EL0)
+    SYSREG_PASS(SYS_IMP_APL_TPIDR_GL1)
+    SYSREG_MAP(SYS_IMP_APL_SPSR_GL1, SYS_IMP_APL_SPSR_GL12)
+    SYSREG_MAP(SYS_IMP_APL_ASPSR_GL1, SYS_IMP_APL_ASPSR_GL12)
+    SYSREG_MAP(SYS_IMP_APL_ELR_GL1, SYS_IMP_APL_ELR_GL12)
+    SYSREG_MAP(SYS_IMP_APL_ESR_GL1, SYS_IMP_APL_ESR_GL12)
+    SYSREG_MAP(SYS_IMP_APL_SPRR_PERM_EL1, SYS_IMP_APL_SPRR_PERM_EL12)
+    SYSREG_MAP(SYS_IMP_APL_APCTL_EL1, SYS_IMP_APL_APCTL_EL12)
+    SYSREG_MAP(SYS_IMP_APL_AMX_CTL_EL1, SYS_IMP_APL_AMX_CTL_EL12)
+    /* FIXME:Might be wrong */
+    SYSREG_PASS(SYS_IMP_APL_AMX_STATE_T)
+    /* pass through PMU handling */
+    SYSREG_PASS(SYS_IMP_APL_PMCR1)
+    SYSREG_PASS(SYS_IMP_APL_PMCR2)
+    SYSREG_PASS(SYS_IMP_APL_PMCR3)
+    SYSREG_PASS(SYS_IMP_APL_PMCR4)
+    SYSREG_PASS(SYS_IMP_APL_PMESR0)
+    SYSREG_PASS(SYS_IMP_APL_PMESR1)
+    SYSREG_PASS(SYS_IMP_APL_PMSR)
+#ifndef DEBUG_PMU_IRQ
+    SYSREG_PASS(SYS_IMP_APL_PMC0)
+#endif
+    SYSREG_PASS(SYS_IMP_APL_PMC1)
+    SYSREG_PASS(SYS_IMP_APL_PMC2)
+    SYSREG_PASS(SYS_IMP_APL_PMC3)
+    SYSREG_PASS(SYS_IMP_APL_PMC4)
+    SYSREG_PASS(SYS_IMP_APL_PMC5)
+    SYSREG_PASS(SYS_IMP_APL_PMC6)
+    SYSREG_PASS(SYS_IMP_APL_PMC7)
+    SYSREG_PASS(SYS_IMP_APL_PMC8)
+    SYSREG_PASS(SYS_IMP_APL_PMC9)
+    SYSREG_MAP(SYS_PMCCNTR_EL0, SYS_IMP_APL_PMC0)
+    SYSREG_MAP(SYS_PMEVCNTR0_EL0, SYS_IMP_APL_PMC2)
+    /* Outer Sharable TLB maintenance instructions */
+    SYSREG_PASS(sys_reg(1, 0, 8, 1, 0)) // TLBI VMALLE1OS
+    SYSREG_PASS(sys_reg(1, 0, 8, 1, 1)) // TLBI VAE1OS
+    SYSREG_PASS(sys_reg(1, 0, 8, 1, 2)) // TLBI ASIDE1OS
+    SYSREG_PASS(sys_reg(1, 0, 8, 5, 1)) // TLBI RVAE1OS
+    /* IPI handling */
+    SYSREG_PASS(SYS_IMP_APL_IPI_CR_EL1)
+};
+
+#define SYSREG_HANDLER(sr, flags, handler) {SYSREG_ENC(sr), flags, handler},
+
+static const struct {
+    u32 enc;
+    u32 flags;
+    hv_sysreg_handler_t *handler;
+} sysreg_handlers[] = {
+    SYSREG_HANDLER(SYS_PMCR_EL0, HV_SYSREG_UNLOCKED, sysreg_pmcr_el0)
+    SYSREG_HANDLER(SYS_PMCCFILTR_EL0, HV_SYSREG_UNLOCKED, sysreg_pmccfiltr_el0)
+    SYSREG_HANDLER(SYS_PMCEID0_EL0, HV_SYSREG_UNLOCKED, sysreg_pmceid0_el0)
+    SYSREG_HANDLER(SYS_PMCEID1_EL0, HV_SYSREG_UNLOCKED, sysreg_pmceid1_el0)
+    SYSREG_HANDLER(SYS_PMCNTENCLR_EL0, HV_SYSREG_UNLOCKED, sysreg_pmcntenclr_el0)
+    SYSREG_HANDLER(SYS_PMCNTENSET_EL0, HV_SYSREG_UNLOCKED, sysreg_pmcntenset_el0)
+    SYSREG_HANDLER(SYS_PMINTENCLR_EL1, HV_SYSREG_UNLOCKED, sysreg_pmintenclr_el1)
+    SYSREG_HANDLER(SYS_PMINTENSET_EL1, HV_SYSREG_UNLOCKED, sysreg_pmintenset_el1)
+    SYSREG_HANDLER(SYS_PMMIR_EL1, HV_SYSREG_UNLOCKED, sysreg_pmmir_el1)
+    SYSREG_HANDLER(SYS_PMOVSCLR_EL0, HV_SYSREG_UNLOCKED, sysreg_pmovsclr_el0)
+    SYSREG_HANDLER(SYS_PMOVSSET_EL0, HV_SYSREG_UNLOCKED, sysreg_pmovsset_el0)
+    SYSREG_HANDLER(SYS_PMSELR_EL0, HV_SYSREG_UNLOCKED, sysreg_pmselr_el0)
+    SYSREG_HANDLER(SYS_PMUSERENR_EL0, HV_SYSREG_UNLOCKED, sysreg_pmuserenr_el0)
+    SYSREG_HANDLER(SYS_ACTLR_EL1, HV_SYSREG_UNLOCKED, sysreg_actlr_el1)
+    SYSREG_HANDLER(SYS_IMP_APL_IPI_SR_EL1, HV_SYSREG_UNLOCKED, sysreg_ipi_sr_el1)
+    SYSREG_HANDLER(SYS_IMP_APL_PMCR0, HV_SYSREG_UNLOCKED, sysreg_pmcr0)
+    SYSREG_HANDLER(SYS_IMP_APL_CYC_OVRD, HV_SYSREG_UNLOCKED, sysreg_cyc_ovrd)
+    /* M1RACLES reg, handle here due to silly 12.0 "mitigation" */
+    SYSREG_HANDLER(sys_reg(3, 5, 15, 10, 1), HV_SYSREG_UNLOCKED | HV_SYSREG_RAZ_WI, NULL)
+    /* These need the HV lock */
+    SYSREG_HANDLER(SYS_IMP_APL_IPI_RR_LOCAL_EL1, 0, sysreg_ipi_rr_local_el1)
+    SYSREG_HANDLER(SYS_IMP_APL_IPI_RR_GLOBAL_EL1, 0, sysreg_ipi_rr_global_el1)
+#ifdef DEBUG_PMU_IRQ
+    SYSREG_HANDLER(SYS_IMP_APL_PMC0, 0, sysreg_pmc0)
+#endif
+};
+
+void hv_exc_init_sysregs(void)
+{
+    hv_sysreg_init();
+
+    for (u32 i = 0; i < ARRAY_SIZE(sysreg_pass); i++)
+        if (hv_sysreg_map(sysreg_pass[i].enc, sysreg_pass[i].to, HV_SYSREG_UNLOCKED))
+            printf("HV: failed to register sysreg 0x%x\n", sysreg_pass[i].enc);
+
+    for (u32 i = 0; i < ARRAY_SIZE(sysreg_handlers); i++)
+        if (hv_sysreg_register(sysreg_handlers[i].enc, sysreg_handlers[i].flags,
+                               sysreg_handlers[i].handler))
+            printf("HV: failed to register sysreg 0x%x\n", sysreg_handlers[i].enc);
+}
+
+static bool hv_handle_smc(struct exc_info *ctx) {
+    printf("PSCI SMC DEBUG: handling PSCI request 0x%lx\n", ctx->regs[0]);
+    bool handled_smc = hv_handle_psci_smc(ctx);
+    return handled_smc;
+}
+
 static void hv_get_context(struct exc_info *ctx)
 {
     ctx->spsr = hv_get_spsr();
@@ -873,6 +905,10 @@ static void hv_exc_exit(struct exc_info *ctx)
     /* reenable PMU counters */
     reg_set(SYS_IMP_APL_PMCR0, PERCPU(exc_entry_pmcr0_cnt));
     msr(CNTVOFF_EL2, stolen_time);
+#ifdef ENABLE_VGIC_MODULE
+    if (vgic_inited)
+        hv_vgicv3_refill_list_registers();
+#endif
     spin_unlock(&bhl);
     hv_maybe_exit();
     __atomic_or_fetch(&hv_cpus_in_guest, BIT(smp_id()), __ATOMIC_ACQUIRE);
@@ -885,15 +921,17 @@ static void hv_exc_exit(struct exc_info *ctx)
 
 void hv_exc_sync(struct exc_info *ctx)
 {
+    u64 prof_start = hv_prof_start();
     hv_wdt_breadcrumb('S');
     hv_get_context(ctx);
     bool handled = false;
+    bool smc = false;
     u32 ec = FIELD_GET(ESR_EC, ctx->esr);
 
     switch (ec) {
         case ESR_EC_MSR:
             hv_wdt_breadcrumb('m');
-            handled = hv_handle_msr_unlocked(ctx, FIELD_GET(ESR_ISS, ctx->esr));
+            handled = hv_sysreg_dispatch(ctx, FIELD_GET(ESR_ISS, ctx->esr), false);
             break;
         //
         // for Blizzard/Avalanche and later - we need to explicitly check for SMC EC to handle SMCs
@@ -901,6 +939,7 @@ void hv_exc_sync(struct exc_info *ctx)
         case ESR_EC_SMC:
             hv_wdt_breadcrumb('s');
             handled = hv_handle_smc(ctx);
+            smc = true;
             break;
         case ESR_EC_IMPDEF:
             hv_wdt_breadcrumb('a');
@@ -912,11 +951,12 @@ void hv_exc_sync(struct exc_info *ctx)
                  * requesting a PSCI service.
                 */
                 handled = hv_handle_smc(ctx);
+                smc = true;
                 break;
             }
             switch (FIELD_GET(ESR_ISS, ctx->esr)) {
                 case ESR_ISS_IMPDEF_MSR:
-                    handled = hv_handle_msr_unlocked(ctx, ctx->afsr1);
+                    handled = hv_sysreg_dispatch(ctx, ctx->afsr1, false);
                     break;
             }
             break;
@@ -928,25 +968,30 @@ void hv_exc_sync(struct exc_info *ctx)
         hv_set_elr(ctx->elr);
         hv_update_fiq();
         hv_wdt_breadcrumb('s');
+        hv_prof_exit(smc ? HV_EXIT_SMC : HV_EXIT_SYSREG_FAST, prof_start);
         return;
     }
 
     hv_exc_entry();
 
+    enum hv_exit_class cls = HV_EXIT_SYNC;
     switch (ec) {
         case ESR_EC_DABORT_LOWER:
             hv_wdt_breadcrumb('D');
+            cls = HV_EXIT_DABORT;
             handled = hv_handle_dabort(ctx);
             break;
         case ESR_EC_MSR:
             hv_wdt_breadcrumb('M');
-            handled = hv_handle_msr(ctx, FIELD_GET(ESR_ISS, ctx->esr));
+            cls = HV_EXIT_SYSREG;
+            handled = hv_sysreg_dispatch(ctx, FIELD_GET(ESR_ISS, ctx->esr), true);
             break;
         case ESR_EC_IMPDEF:
             hv_wdt_breadcrumb('A');
+            cls = HV_EXIT_SYSREG;
             switch (FIELD_GET(ESR_ISS, ctx->esr)) {
                 case ESR_ISS_IMPDEF_MSR:
-                    handled = hv_handle_msr(ctx, ctx->afsr1);
+                    handled = hv_sysreg_dispatch(ctx, ctx->afsr1, true);
                     break;
             }
             break;
@@ -966,20 +1011,38 @@ void hv_exc_sync(struct exc_info *ctx)
 
     hv_exc_exit(ctx);
     hv_wdt_breadcrumb('s');
+    hv_prof_exit(cls, prof_start);
 }
 
 void hv_exc_irq(struct exc_info *ctx)
 {
+    u64 prof_start = hv_prof_start();
     hv_wdt_breadcrumb('I');
     hv_get_context(ctx);
     hv_exc_entry();
+#ifdef ENABLE_VGIC_MODULE
+    if (vgic_inited) {
+        // Routed AIC IRQs are injected into the vGIC directly, the host only sees the rest
+        u32 event;
+        while ((event = hv_vgicv3_handle_aic_events())) {
+            hv_exc_proxy(ctx, START_EXCEPTION_LOWER, EXC_IRQ, &event);
+            hv_vgicv3_aic_event_done(event);
+        }
+        hv_exc_exit(ctx);
+        hv_wdt_breadcrumb('i');
+        hv_prof_exit(HV_EXIT_IRQ, prof_start);
+        return;
+    }
+#endif
     hv_exc_proxy(ctx, START_EXCEPTION_LOWER, EXC_IRQ, NULL);
     hv_exc_exit(ctx);
     hv_wdt_breadcrumb('i');
+    hv_prof_exit(HV_EXIT_IRQ, prof_start);
 }
 
 void hv_exc_fiq(struct exc_info *ctx)
 {
+    u64 prof_start = hv_prof_start();
     bool tick = false;
 
     hv_maybe_exit();
@@ -991,6 +1054,7 @@ void hv_exc_fiq(struct exc_info *ctx)
     if (mrs(CNTP_CTL_EL0) == (CNTx_CTL_ISTATUS | CNTx_CTL_ENABLE)) {
         msr(CNTP_CTL_EL0, CNTx_CTL_ISTATUS | CNTx_CTL_IMASK | CNTx_CTL_ENABLE);
         tick = true;
+        hv_sample(ctx);
     }
 
     int interruptible_cpu = hv_pinned_cpu;
@@ -1001,6 +1065,7 @@ void hv_exc_fiq(struct exc_info *ctx)
         // Non-interruptible CPU and it was just a timer tick (or spurious), so just update FIQs
         hv_update_fiq();
         hv_arm_tick(true);
+        hv_prof_exit(HV_EXIT_FIQ_FAST, prof_start);
         return;
     }
 
@@ -1010,8 +1075,10 @@ void hv_exc_fiq(struct exc_info *ctx)
     hv_exc_entry();
 
     // Only poll for HV events in the interruptible CPU
+    enum hv_exit_class cls = HV_EXIT_FIQ;
     if (tick) {
         if (smp_id() == interruptible_cpu) {
+            cls = HV_EXIT_FIQ_TICK;
             hv_tick(ctx);
             hv_arm_tick(false);
         } else {
@@ -1051,17 +1118,20 @@ void hv_exc_fiq(struct exc_info *ctx)
 
     hv_maybe_switch_cpu(ctx, START_HV, HV_CPU_SWITCH, NULL);
 
-    // Handles guest timers
+    // Handles guest timers, and vGIC maintenance interrupts (clearing EOI'd list registers)
     hv_exc_exit(ctx);
     hv_wdt_breadcrumb('f');
+    hv_prof_exit(cls, prof_start);
 }
 
 void hv_exc_serr(struct exc_info *ctx)
 {
+    u64 prof_start = hv_prof_start();
     hv_wdt_breadcrumb('E');
     hv_get_context(ctx);
     hv_exc_entry();
     hv_exc_proxy(ctx, START_EXCEPTION_LOWER, EXC_SERROR, NULL);
     hv_exc_exit(ctx);
     hv_wdt_breadcrumb('e');
+    hv_prof_exit(HV_EXIT_SERROR, prof_start);
 }
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "hv.h"
+#include "cpu_regs.h"
+#include "smp.h"
+#include "string.h"
+#include "utils.h"
+
+/*
+ * Guest exit profiler. Every exit is timed from the exception handler's entry to its return to
+ * the guest, and counted per CPU by exit class into a log2 histogram of CNTPCT ticks. Data aborts
+ * are also counted by the IPA page that faulted, in a small open addressed table shared by all
+ * CPUs. When the profiler is off, an exit costs a load and a branch.
+ */
+
+#define HV_PROF_PAGES      256
+#define HV_PROF_PAGE_SHIFT 14
+
+struct hv_prof_page {
+    u64 page; // IPA of the page, or 0 if the slot is free
+    struct hv_prof_stats stats;
+};
+
+static struct {
+    struct hv_prof_hdr hdr;
+    struct hv_prof_stats exits[MAX_CPUS][HV_EXIT_CLASSES];
+    struct hv_prof_page pages[HV_PROF_PAGES];
+} prof;
+
+static bool prof_enabled;
+static u64 dabort_ipa[MAX_CPUS];
+
+static DECLARE_SPINLOCK(prof_pages_lock);
+
+static void prof_count(struct hv_prof_stats *stats, u64 ticks)
+{
+    u32 bucket = ticks ? 64 - __builtin_clzl(ticks) : 0;
+
+    stats->count++;
+    stats->ticks += ticks;
+    stats->max = max(stats->max, ticks);
+    stats->hist[min(bucket, HV_PROF_BUCKETS - 1)]++;
+}
+
+static void prof_count_page(u64 ipa, u64 ticks)
+{
+    u64 page = ipa & ~((1UL << HV_PROF_PAGE_SHIFT) - 1);
+    u32 slot = (page >> HV_PROF_PAGE_SHIFT) % HV_PROF_PAGES;
+
+    spin_lock(&prof_pages_lock);
+
+    for (u32 i = 0; i < HV_PROF_PAGES; i++, slot = (slot + 1) % HV_PROF_PAGES) {
+        struct hv_prof_page *p = &prof.pages[slot];
+
+        if (!p->page)
+            p->page = page;
+        if (p->page == page) {
+            prof_count(&p->stats, ticks);
+            spin_unlock(&prof_pages_lock);
+            return;
+        }
+    }
+
+    prof.hdr.dropped_pages++;
+    spin_unlock(&prof_pages_lock);
+}
+
+u64 hv_prof_start(void)
+{
+    if (!prof_enabled)
+        return 0;
+
+    return mrs(CNTPCT_EL0);
+}
+
+void hv_prof_dabort(u64 ipa)
+{
+    dabort_ipa[smp_id()] = ipa;
+}
+
+void hv_prof_exit(enum hv_exit_class cls, u64 start)
+{
+    if (!start)
+        return;
+
+    int cpu = smp_id();
+    u64 ticks = mrs(CNTPCT_EL0) - start;
+
+    prof_count(&prof.exits[cpu][cls], ticks);
+
+    if (cls == HV_EXIT_DABORT && dabort_ipa[cpu]) {
+        prof_count_page(dabort_ipa[cpu], ticks);
+        dabort_ipa[cpu] = 0;
+    }
+}
+
+/* The header describes the layout, so it's valid even for a profile that was never enabled */
+static void hv_prof_fill_hdr(void)
+{
+    prof.hdr.ncpus = MAX_CPUS;
+    prof.hdr.nclasses = HV_EXIT_CLASSES;
+    prof.hdr.nbuckets = HV_PROF_BUCKETS;
+    prof.hdr.npages = HV_PROF_PAGES;
+    prof.hdr.freq = mrs(CNTFRQ_EL0);
+}
+
+void hv_prof_enable(bool enable, bool reset)
+{
+    prof_enabled = false;
+
+    if (reset) {
+        spin_lock(&prof_pages_lock);
+        memset(&prof, 0, sizeof(prof));
+        memset(dabort_ipa, 0, sizeof(dabort_ipa));
+        spin_unlock(&prof_pages_lock);
+    }
+
+    hv_prof_fill_hdr();
+
+    prof_enabled = enable;
+}
+
+/* Copies the profile into buf if it fits, and returns its size */
+size_t hv_prof_dump(void *buf, size_t size)
+{
+    if (buf && size >= sizeof(prof)) {
+        spin_lock(&prof_pages_lock);
+        hv_prof_fill_hdr();
+        memcpy(buf, &prof, sizeof(prof));
+        spin_unlock(&prof_pages_lock);
+    }
+
+    return sizeof(prof);
+}
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "hv.h"
+#include "cpu_regs.h"
+#include "malloc.h"
+#include "memory.h"
+#include "smp.h"
+#include "string.h"
+#include "utils.h"
+
+/*
+ * Guest sampling profiler. While it runs, every CPU's HV tick fires at least at the sampling
+ * rate, and each tick records where the guest was (PC, EL, TTBR0 and optionally a frame pointer
+ * backtrace) into that CPU's ring, without involving the proxy. The host drains the rings in bulk
+ * while the guest is stopped. A full ring overwrites its oldest samples.
+ *
+ * hv_sample() runs on the FIQ fast path, outside the HV lock. Each CPU flags itself as sampling
+ * before it looks at hv_sample_interval, so once the interval is cleared, waiting for the flags
+ * to drop means no CPU is touching the rings any more (see hv_sample_quiesce()).
+ */
+
+struct sample_ring {
+    u64 head; // samples ever written
+    u64 tail; // samples drained or overwritten
+    u64 dropped;
+    struct hv_sample *samples;
+};
+
+u64 hv_sample_interval;
+
+static struct sample_ring rings[MAX_CPUS];
+static struct hv_sample *ring_buf;
+static u32 ring_size, ring_capacity;
+static u32 sample_depth;
+static bool sampling[MAX_CPUS];
+
+/* Reads a frame record, but only from guest RAM, never from a passthrough device */
+static bool read_frame(u64 fp, u64 *next, u64 *lr)
+{
+    u64 pa = hv_translate(fp, false, false, NULL);
+
+    if (!pa || pa < ram_base || pa + 16 > ram_base + mem_size_actual)
+        return false;
+
+    *next = read64(pa);
+    *lr = read64(pa + 8);
+    return true;
+}
+
+static u64 strip_pac(u64 addr)
+{
+    return (addr & BIT(55)) ? addr | GENMASK(63, 48) : addr & GENMASK(47, 0);
+}
+
+void hv_sample(struct exc_info *ctx)
+{
+    bool *busy = &sampling[smp_id()];
+
+    __atomic_store_n(busy, true, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&hv_sample_interval, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(busy, false, __ATOMIC_RELEASE);
+        return;
+    }
+
+    struct sample_ring *ring = &rings[smp_id()];
+
+    if (ring->head - ring->tail == ring_size) {
+        ring->tail++;
+        ring->dropped++;
+    }
+
+    struct hv_sample *s = &ring->samples[ring->head % ring_size];
+
+    s->time = mrs(CNTPCT_EL0);
+    s->pc = hv_get_elr();
+    s->spsr = hv_get_spsr();
+    s->ttbr0 = mrs(TTBR0_EL12);
+    s->cpu = smp_id();
+    s->depth = 0;
+
+    // Frame records are 16 byte aligned and move up the stack, which bounds the walk
+    u64 fp = ctx->regs[29], next, lr;
+    while (s->depth < sample_depth && fp && !(fp & 15) && read_frame(fp, &next, &lr) && lr) {
+        s->frames[s->depth++] = strip_pac(lr);
+        if (next <= fp)
+            break;
+        fp = next;
+    }
+
+    ring->head++;
+    __atomic_store_n(busy, false, __ATOMIC_RELEASE);
+}
+
+/* Stops sampling, and waits for every CPU that was taking a sample to finish it */
+static void hv_sample_quiesce(void)
+{
+    __atomic_store_n(&hv_sample_interval, 0, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < MAX_CPUS; i++)
+        while (__atomic_load_n(&sampling[i], __ATOMIC_ACQUIRE))
+            ;
+}
+
+/* Samples every CPU rate times a second, keeping the last ring_size samples of each */
+int hv_sample_start(u64 rate, u32 depth, u32 size)
+{
+    if (!rate || !size)
+        return -1;
+
+    hv_sample_quiesce();
+
+    // The rings only ever grow, a smaller size reuses the start of each CPU's slice
+    if (size > ring_capacity) {
+        free(ring_buf);
+        ring_size = ring_capacity = 0;
+        ring_buf = calloc((size_t)MAX_CPUS * size, sizeof(*ring_buf));
+        if (!ring_buf)
+            return -1;
+        ring_capacity = size;
+    }
+    ring_size = size;
+
+    for (int i = 0; i < MAX_CPUS; i++) {
+        memset(&rings[i], 0, sizeof(rings[i]));
+        rings[i].samples = &ring_buf[(size_t)i * ring_capacity];
+    }
+
+    sample_depth = min(depth, HV_SAMPLE_DEPTH);
+    __atomic_store_n(&hv_sample_interval, max(mrs(CNTFRQ_EL0) / rate, 1UL), __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Stops sampling, leaving the rings to be drained, and returns how many samples were lost */
+u64 hv_sample_stop(void)
+{
+    u64 dropped = 0;
+
+    hv_sample_quiesce();
+
+    for (int i = 0; i < MAX_CPUS; i++)
+        dropped += rings[i].dropped;
+
+    return dropped;
+}
+
+/* Moves up to count samples into buf, oldest first for each CPU, and returns how many */
+size_t hv_sample_drain(struct hv_sample *buf, size_t count)
+{
+    size_t done = 0;
+
+    if (!ring_buf)
+        return 0;
+
+    for (int i = 0; i < MAX_CPUS && done < count; i++) {
+        struct sample_ring *ring = &rings[i];
+
+        while (ring->tail != ring->head && done < count)
+            buf[done++] = ring->samples[ring->tail++ % ring_size];
+    }
+
+    return done;
+}
@@ -0,0 +1,276 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "hv.h"
+#include "cpu_regs.h"
+#include "malloc.h"
+#include "memory.h"
+#include "smp.h"
+#include "string.h"
+#include "utils.h"
+
+/*
+ * Trapped system register dispatch. Entries are kept sorted by encoding (the MRS/MSR instruction
+ * bits [20:5]) and found by binary search. Passed through and remapped registers need no handler
+ * function: registering one builds an "mrs x0, reg; ret" / "msr reg, x0; ret" stub pair for it,
+ * since a system register can only be named in the instruction. Entries flagged
+ * HV_SYSREG_UNLOCKED are handled in the fast path without the HV lock, the rest with it held, and
+ * registers that are not in the table go to the proxy.
+ *
+ * The fast path runs on other CPUs while the proxy changes the table, so the table is never edited
+ * in place: changes go into a copy, which is published with a single pointer store. Each CPU flags
+ * itself while it looks at a table, and the old copy is only reused once every other CPU has
+ * dropped its flag (see sysreg_publish()). Stubs are likewise never rewritten while in use.
+ */
+
+#define HV_SYSREG_MAX 256
+
+#define INSN_MRS 0xd5200000
+#define INSN_MSR 0xd5000000
+#define INSN_RET 0xd65f03c0
+
+struct hv_sysreg {
+    u32 enc;
+    u32 flags;
+    hv_sysreg_handler_t *handler;
+    u32 *stub; // mrs/ret, msr/ret, for entries without a handler
+    u64 count;
+};
+
+struct hv_sysreg_table {
+    u32 count;
+    struct hv_sysreg entries[HV_SYSREG_MAX];
+};
+
+static struct hv_sysreg_table tables[2];
+static struct hv_sysreg_table *sysregs = &tables[0];
+static bool dispatching[MAX_CPUS];
+
+// One more than the entries, so a remap can build its new stub while the old one is still live
+static u32 (*stubs)[4];
+#define HV_SYSREG_STUBS (HV_SYSREG_MAX + 1)
+
+void hv_sysreg_init(void)
+{
+    memset(tables, 0, sizeof(tables));
+    sysregs = &tables[0];
+}
+
+static struct hv_sysreg *sysreg_find(struct hv_sysreg_table *table, u32 enc)
+{
+    u32 lo = 0, hi = table->count;
+
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+
+        if (table->entries[mid].enc == enc)
+            return &table->entries[mid];
+        if (table->entries[mid].enc < enc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+/* Returns a private copy of the live table to make changes in */
+static struct hv_sysreg_table *sysreg_begin(void)
+{
+    struct hv_sysreg_table *next = sysregs == &tables[0] ? &tables[1] : &tables[0];
+
+    next->count = sysregs->count;
+    memcpy(next->entries, sysregs->entries, sysregs->count * sizeof(*next->entries));
+    return next;
+}
+
+/*
+ * Makes next the live table, and waits until no other CPU can still be looking at the old one,
+ * which then becomes the next sysreg_begin() copy. Trap counts that land in the old table in the
+ * meantime are lost.
+ */
+static void sysreg_publish(struct hv_sysreg_table *next)
+{
+    __atomic_store_n(&sysregs, next, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < MAX_CPUS; i++)
+        while (i != smp_id() && __atomic_load_n(&dispatching[i], __ATOMIC_ACQUIRE))
+            ;
+}
+
+static struct hv_sysreg *sysreg_insert(struct hv_sysreg_table *table, u32 enc)
+{
+    struct hv_sysreg *sr = sysreg_find(table, enc);
+
+    if (sr)
+        return sr;
+    if (table->count == HV_SYSREG_MAX)
+        return NULL;
+
+    u32 pos = 0;
+    while (pos < table->count && table->entries[pos].enc < enc)
+        pos++;
+
+    memmove(&table->entries[pos + 1], &table->entries[pos],
+            (table->count - pos) * sizeof(*table->entries));
+    table->count++;
+
+    sr = &table->entries[pos];
+    memset(sr, 0, sizeof(*sr));
+    sr->enc = enc;
+    return sr;
+}
+
+int hv_sysreg_register(u32 enc, u32 flags, hv_sysreg_handler_t *handler)
+{
+    struct hv_sysreg_table *next = sysreg_begin();
+    struct hv_sysreg *sr = sysreg_insert(next, enc);
+
+    if (!sr)
+        return -1;
+
+    sr->flags = flags;
+    sr->handler = handler;
+    sr->stub = NULL;
+    sysreg_publish(next);
+    return 0;
+}
+
+/* Any stub the live table doesn't use is free, as sysreg_publish() already retired the rest */
+static u32 *stub_alloc(void)
+{
+    if (!stubs) {
+        stubs = memalign(64, HV_SYSREG_STUBS * sizeof(*stubs));
+        if (!stubs)
+            return NULL;
+    }
+
+    for (u32 i = 0; i < HV_SYSREG_STUBS; i++) {
+        bool used = false;
+
+        for (u32 j = 0; j < sysregs->count && !used; j++)
+            used = sysregs->entries[j].stub == stubs[i];
+        if (!used)
+            return stubs[i];
+    }
+
+    return NULL;
+}
+
+/* Passes enc through to the to register, which is usually enc itself or its EL12 alias */
+int hv_sysreg_map(u32 enc, u32 to, u32 flags)
+{
+    u32 *stub = stub_alloc();
+
+    if (!stub)
+        return -1;
+
+    stub[0] = INSN_MRS | (to << 5);
+    stub[1] = INSN_RET;
+    stub[2] = INSN_MSR | (to << 5);
+    stub[3] = INSN_RET;
+    dc_cvau_range(stub, 16);
+    ic_ivau_range(stub, 16);
+
+    struct hv_sysreg_table *next = sysreg_begin();
+    struct hv_sysreg *sr = sysreg_insert(next, enc);
+
+    if (!sr)
+        return -1;
+
+    sr->flags = flags;
+    sr->handler = NULL;
+    sr->stub = stub;
+    sysreg_publish(next);
+    return 0;
+}
+
+void hv_sysreg_unregister(u32 enc)
+{
+    struct hv_sysreg_table *next = sysreg_begin();
+    struct hv_sysreg *sr = sysreg_find(next, enc);
+
+    if (!sr)
+        return;
+
+    u32 pos = sr - next->entries;
+    next->count--;
+    memmove(&next->entries[pos], &next->entries[pos + 1],
+            (next->count - pos) * sizeof(*next->entries));
+    sysreg_publish(next);
+}
+
+/* The heap is only executable at EL2 through its RX alias */
+static void *stub_code(u32 *insn)
+{
+    return mmu_active() ? (void *)((u64)insn | REGION_RX_EL1) : insn;
+}
+
+/*
+ * Each entry is handled in one path only: the lockless fast path for HV_SYSREG_UNLOCKED ones and
+ * the locked path for the rest. Returns false to send the trap on to the next path. Handler
+ * functions are called after the table is let go, so they're free to change it.
+ */
+bool hv_sysreg_dispatch(struct exc_info *ctx, u64 iss, bool locked)
+{
+    u32 enc = (FIELD_GET(ESR_ISS_MSR_OP0, iss) << 14) | (FIELD_GET(ESR_ISS_MSR_OP1, iss) << 11) |
+              (FIELD_GET(ESR_ISS_MSR_CRn, iss) << 7) | (FIELD_GET(ESR_ISS_MSR_CRm, iss) << 3) |
+              FIELD_GET(ESR_ISS_MSR_OP2, iss);
+    u64 rt = FIELD_GET(ESR_ISS_MSR_Rt, iss);
+    bool is_read = iss & ESR_ISS_MSR_DIR;
+    u64 *regs = ctx->regs;
+    bool *busy = &dispatching[smp_id()];
+    hv_sysreg_handler_t *handler = NULL;
+    bool handled = true;
+
+    __atomic_store_n(busy, true, __ATOMIC_SEQ_CST);
+    struct hv_sysreg *sr = sysreg_find(__atomic_load_n(&sysregs, __ATOMIC_SEQ_CST), enc);
+
+    if (!sr || !(sr->flags & HV_SYSREG_UNLOCKED) != locked) {
+        handled = false;
+        goto out;
+    }
+
+    __atomic_add_fetch(&sr->count, 1, __ATOMIC_RELAXED);
+
+    regs[31] = 0;
+
+    if (sr->handler) {
+        handler = sr->handler;
+    } else if (sr->flags & HV_SYSREG_RAZ_WI) {
+        if (is_read)
+            regs[rt] = 0;
+    } else if (!sr->stub) {
+        handled = false;
+    } else if (is_read) {
+        regs[rt] = ((u64(*)(void))stub_code(&sr->stub[0]))();
+    } else {
+        ((void (*)(u64))stub_code(&sr->stub[2]))(regs[rt]);
+    }
+
+out:
+    __atomic_store_n(busy, false, __ATOMIC_RELEASE);
+
+    if (handler)
+        return handler(ctx, rt, is_read);
+    return handled;
+}
+
+/* Copies up to count entries' trap counts into stats, and returns the number of entries */
+size_t hv_sysreg_get_stats(struct hv_sysreg_stats *stats, size_t count, bool reset)
+{
+    struct hv_sysreg_table *table = sysregs;
+
+    for (u32 i = 0; i < table->count; i++) {
+        struct hv_sysreg *sr = &table->entries[i];
+
+        if (i < count) {
+            stats[i].enc = sr->enc;
+            stats[i].flags = sr->flags;
+            stats[i].count = __atomic_load_n(&sr->count, __ATOMIC_RELAXED);
+        }
+        if (reset)
+            __atomic_store_n(&sr->count, 0, __ATOMIC_RELAXED);
+    }
+
+    return table->count;
+}
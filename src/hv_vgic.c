@@ -20,6 +20,7 @@
 
 #include "hv.h"
 #include "hv_vgic.h"
+#include "hv_vgic_irq.h"
 #include "assert.h"
 #include "cpu_regs.h"
 #include "display.h"
@@ -30,6 +31,7 @@
 #include "usb.h"
 #include "utils.h"
 #include "aic.h"
+#include "aic_regs.h"
 #include "malloc.h"
 #include "heapblock.h"
 #include "smp.h"
@@ -81,13 +83,162 @@
 #define ITS_BASE_36_BIT 0xF20000000
 #define ITS_BASE_42_BIT 0x5200000000
 
+//
+// List register layout (ICH_LR<n>_EL2)
+//
+#define VGIC_NR_LRS 8
+#define ICH_LR_STATE_PENDING BIT(62)
+#define ICH_LR_GROUP1 BIT(60)
+#define ICH_LR_EOI BIT(41)
+#define ICH_LR_PRIORITY GENMASK(55, 48)
+#define ICH_LR_VINTID GENMASK(31, 0)
+
 
 vgicv3_dist *distributor;
 vgicv3_vcpu_redist *redistributors;
 // vgicv3_its *interrupt_translation_service;
 static u64 dist_base, redist_base, its_base;
 static u16 num_cpus;
-static bool vgic_inited;
+bool vgic_inited;
+
+//
+// Pending/enabled/priority state of every IRQ, kept as per-vCPU priority bitmaps (see hv_vgic_irq.h).
+//
+static struct vgic_state vgic;
+//
+// The IRQ each vCPU's list registers were last loaded with. An IRQ that becomes pending again while the
+// guest still has it in an LR gets merged into that LR, as the GIC spec forbids listing an IRQ twice.
+//
+static int *lr_irqs;
+
+//
+// Maps an offset from GICD/GICR_ISENABLER0 to the register bank it falls in - the banks are 0x80 apart,
+// in the same order as enum vgic_irq_reg.
+//
+static enum vgic_irq_reg hv_vgicv3_irq_reg(u64 offset)
+{
+    return (enum vgic_irq_reg)(offset / 0x80);
+}
+
+//
+// Finds the vCPU a GICD_IROUTER value targets by matching its affinity against the redistributors'.
+// 1 of N routing (and anything that doesn't match) goes to vCPU 0.
+//
+static u32 hv_vgicv3_irouter_to_vcpu(u64 irouter)
+{
+    u32 affinity;
+    if((irouter & BIT(31)) != 0) {
+        return 0;
+    }
+    affinity = ((irouter >> 8) & GENMASK(31, 24)) | (irouter & GENMASK(23, 0));
+    for(u32 i = 0; i < num_cpus; i++) {
+        if((redistributors[i].rd_region.gicr_type_reg >> 32) == affinity) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+//
+// GICD/GICR_IPRIORITYR accesses, one byte per IRQ. Only the top VGIC_PRIO_BITS bits of each
+// priority are implemented (to match the CPU interface), the rest are RAZ/WI.
+//
+static void hv_vgicv3_write_priorities(u32 cpu, u32 first_irq, u64 val, int width)
+{
+    for(u32 i = 0; i < (1U << width); i++) {
+        vgic_write_priority(&vgic, cpu, first_irq + i, (val >> (8 * i)) & GENMASK(7, VGIC_PRIO_SHIFT));
+    }
+}
+
+static u64 hv_vgicv3_read_priorities(u32 cpu, u32 first_irq, int width)
+{
+    u64 val = 0;
+    for(u32 i = 0; i < (1U << width); i++) {
+        val |= ((u64)vgic_read_priority(&vgic, cpu, first_irq + i)) << (8 * i);
+    }
+    return val;
+}
+
+//
+// AIC -> vGIC routing. AIC IRQs are numbered die * max_irq + num (as in hv_trace_irq()), and every one
+// the guest drives through the vGIC maps to an SPI. The table is filled in at init and can be changed by
+// the host (P_HV_VGIC_ROUTE_IRQ). AIC events without a route still go to the host, and are unmasked
+// again once it's done with them.
+//
+#define AIC_IRQ_UNMAPPED (-1)
+static u16 aic_to_spi[AIC_MAX_DIES * AIC_MAX_HW_NUM];
+static int spi_to_aic[VGIC_NR_IRQS];
+//
+// CNTPCT at the AIC ack of each SPI the guest hasn't finished with yet (0 otherwise). The AIC keeps
+// an acked IRQ masked, and it's only unmasked again once the guest deactivates it.
+//
+static u64 spi_ack_time[VGIC_NR_IRQS];
+static bool spi_listed[VGIC_NR_IRQS];
+static struct hv_vgic_irq_stats spi_stats[VGIC_NR_IRQS];
+
+//
+// Keeps the AIC mask of a routed SPI in line with its vGIC enable bit, except while it's in flight.
+//
+static void hv_vgicv3_update_aic_mask(u32 spi)
+{
+    bool enabled;
+    if((spi_to_aic[spi] == AIC_IRQ_UNMAPPED) || (spi_ack_time[spi] != 0)) {
+        return;
+    }
+    enabled = (vgic_read_bits(&vgic, 0, VGIC_ISENABLER, spi) & BIT(spi & 31)) != 0;
+    aic_set_mask(spi_to_aic[spi], !enabled);
+}
+
+//
+// Called after a guest write to GICD_IS/ICENABLER or GICD_IS/ICPENDR for SPIs.
+//
+static void hv_vgicv3_aic_reg_written(enum vgic_irq_reg reg, u32 first, u32 mask)
+{
+    while(mask != 0) {
+        u32 spi = first + __builtin_ctz(mask);
+        mask &= mask - 1;
+        if(spi_to_aic[spi] == AIC_IRQ_UNMAPPED) {
+            continue;
+        }
+        if((reg == VGIC_ICPENDR) && !spi_listed[spi]) {
+            //
+            // the guest dropped it before it was ever delivered, so it's done as far as the AIC is concerned.
+            //
+            spi_ack_time[spi] = 0;
+        }
+        if(reg != VGIC_ISPENDR) {
+            hv_vgicv3_update_aic_mask(spi);
+        }
+    }
+}
+
+static void hv_vgicv3_init_aic_routes(void)
+{
+    for(u32 i = 0; i < VGIC_NR_IRQS; i++) {
+        spi_to_aic[i] = AIC_IRQ_UNMAPPED;
+    }
+    memset(aic_to_spi, 0, sizeof(aic_to_spi));
+    if(aic == NULL) {
+        return;
+    }
+    //
+    // Default routing: every die's IRQs map 1:1 onto SPIs starting at SPI 32, one die after the other
+    // (die * nr_irq + num). They start out masked, as every SPI starts out disabled. IRQs past the last
+    // SPI keep going to the host.
+    //
+    for(u32 die = 0; die < aic->nr_die; die++) {
+        for(u32 num = 0; num < aic->nr_irq; num++) {
+            u32 irq = die * aic->max_irq + num;
+            u32 spi = VGIC_NR_PRIVATE + die * aic->nr_irq + num;
+            if((spi >= VGIC_NR_IRQS) || (irq >= ARRAY_SIZE(aic_to_spi))) {
+                break;
+            }
+            aic_to_spi[irq] = spi;
+            spi_to_aic[spi] = irq;
+            aic_set_mask(irq, true);
+        }
+    }
+}
 
 
 
@@ -282,164 +433,27 @@ static bool handle_vgic_dist_access(struct exc_info *ctx, u64 addr, u64 *val, bo
             register_handled = true;
 
         }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ISENABLER0) && (relative_addr <= GIC_DIST_ISENABLER31) ) {
-            //
-            // enables an IRQ to be forwarded to a CPU interface.
-            //
-            u32 reg_num;
-            reg_num = (relative_addr - GIC_DIST_ISENABLER0) / 4;
-            u32 value_is_enabler, value_ic_enabler, current_val;
-            u32 irq_num;
-            value_is_enabler = distributor->gicd_interrupt_set_enable_regs[reg_num];
-            value_ic_enabler = distributor->gicd_interrupt_clear_enable_regs[reg_num];
-            current_val = *val;
-
-            //
-            // if 1 is written to the bits in these registers, they need to read 1 in GICD_ICENABLER[0:31] as well.
-            // also this is banked for the first 8 processor cores - so changes must reflect across all of them.
-            //
-            // There has to be a way more efficient way of doing this...
-            //
-
-            for(u32 i = 0; i < 32; i++) {
-                if( ( (current_val & BIT(i)) != 0 ) && ( ( value_is_enabler & BIT(i) ) == 0) ) {
-                    value_is_enabler |= BIT(i);
-                    value_ic_enabler |= BIT(i);      
-                    irq_num = (32 * reg_num) + i;
-                    //
-                    // TODO: do the AIC operation associated with this.
-                    //        
-                }
-            }
-            if(reg_num == 0) {
-
-            }
-            else {
-                distributor->gicd_interrupt_set_enable_regs[reg_num] = value_is_enabler;
-                distributor->gicd_interrupt_clear_enable_regs[reg_num] = value_ic_enabler;
-            }
-
-            register_handled = true;
-
-        }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ICENABLER0) && (relative_addr <= GIC_DIST_ICENABLER31) ) {
+        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ISENABLER0) && (relative_addr <= GIC_DIST_ICPENDR31) ) {
             //
-            // disables an IRQ to be forwarded to a CPU interface.
+            // GICD_IS/ICENABLER and GICD_IS/ICPENDR: these go straight to the per-vCPU priority bitmaps (hv_vgic_irq.c),
+            // which keep track of the highest priority deliverable IRQ so that refilling the list registers never scans.
             //
             u32 reg_num;
-            reg_num = (relative_addr - GIC_DIST_ICENABLER0) / 4;
-            u32 irq_num;
-            u32 value_is_enabler, value_ic_enabler, current_val;
-            value_is_enabler = distributor->gicd_interrupt_set_enable_regs[reg_num];
-            value_ic_enabler = distributor->gicd_interrupt_clear_enable_regs[reg_num];
-            current_val = *val;
-
-            //
-            // if 1 is written to the bits in these registers, they need to read 0 in GICD_ISENABLER[0:31] as well.
-            // also this is banked for the first 8 processor cores - so changes must reflect across all of them.
-            //
-            // There has to be a way more efficient way of doing this...
-            //
-            for(u32 i = 0; i < 32; i++) {
-                if( ( (current_val & BIT(i)) != 0 ) && ( ( value_ic_enabler & BIT(i) ) != 0) ) {
-                    value_is_enabler &= ~BIT(i);
-                    value_ic_enabler &= ~BIT(i);      
-                    irq_num = (32 * reg_num) + i;
-                    //
-                    // TODO: do the AIC operation associated with this.
-                    //        
-                }
-            }
-            if(reg_num == 0) {
-
-            }
-            else {
-                distributor->gicd_interrupt_set_enable_regs[reg_num] = value_is_enabler;
-                distributor->gicd_interrupt_clear_enable_regs[reg_num] = value_ic_enabler;
-            }
-            register_handled = true;
-            //
-            // ICENABLER register writes require RWP dependent things to be updated, set the bit.
-            //
-            distributor->gicd_ctl_reg |= BIT(31);
-            //
-            // TODO: propagate the changes
-            //
-
-        }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ISPENDR0) && (relative_addr <= GIC_DIST_ISPENDR31) ) {
-            //
-            // sets an IRQ to pending
-            //
-            u32 reg_num, irq_num;
-            reg_num = (relative_addr - GIC_DIST_ISPENDR0) / 4;
-            u32 value_is_enabler, value_ic_enabler, current_val;
-            value_is_enabler = distributor->gicd_interrupt_set_pending_regs[reg_num];
-            value_ic_enabler = distributor->gicd_interrupt_clear_pending_regs[reg_num];
-            current_val = *val;
+            reg_num = ((relative_addr - GIC_DIST_ISENABLER0) % 0x80) / 4;
 
             //
-            // if 1 is written to the bits in these registers, they need to read 1 in GICD_ICENABLER[1:31] as well.
-            // also this is banked for the first 8 processor cores - so changes must reflect across all of them.
+            // register 0 covers SGIs and PPIs, which live in the redistributors since affinity routing is always on.
             //
-            // There has to be a way more efficient way of doing this...
-            //
-
-            for (u32 i = 0; i < 32; i++) {
-                if( ( (current_val & BIT(i)) != 0 ) && ( ( value_is_enabler & BIT(i) ) == 0) ) {
-                    value_is_enabler |= BIT(i);
-                    value_ic_enabler |= BIT(i);
-                    irq_num = (32 * reg_num) + i;
-                    //
-                    // TODO: do this
-                    //
-                }
+            if(reg_num != 0) {
+                enum vgic_irq_reg reg = hv_vgicv3_irq_reg(relative_addr - GIC_DIST_ISENABLER0);
+                vgic_write_bits(&vgic, ctx->cpu_id, reg, reg_num * 32, *val);
+                hv_vgicv3_aic_reg_written(reg, reg_num * 32, *val);
             }
-            if(reg_num == 0) {
+            if((relative_addr >= GIC_DIST_ICENABLER0) && (relative_addr <= GIC_DIST_ICENABLER31)) {
                 //
-                // don't attempt to write these registers, since affinity routing is always on.
+                // ICENABLER register writes require RWP dependent things to be updated, set the bit.
                 //
-            }
-            else {
-                distributor->gicd_interrupt_set_pending_regs[reg_num] = value_is_enabler;
-                distributor->gicd_interrupt_clear_pending_regs[reg_num] = value_ic_enabler;
-            }
-            register_handled = true;
-
-        }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ICPENDR0) && (relative_addr <= GIC_DIST_ICPENDR31) ) {
-            //
-            // clears the pending state from an IRQ
-            //
-            u32 reg_num, irq_num;
-            reg_num = (relative_addr - GIC_DIST_ICPENDR0) / 4;
-            u32 value_is_enabler, value_ic_enabler, current_val;
-            value_is_enabler = distributor->gicd_interrupt_set_pending_regs[reg_num];
-            value_ic_enabler = distributor->gicd_interrupt_clear_pending_regs[reg_num];
-            current_val = *val;
-
-            //
-            // if 1 is written to the bits in these registers, they need to read 0 in GICD_ISENABLER[0:31] as well.
-            // also this is banked for the first 8 processor cores - so changes must reflect across all of them.
-            //
-            // There has to be a way more efficient way of doing this...
-            //
-            for (u32 i = 0; i < 32; i++) {
-                if( ( (current_val & BIT(i)) != 0 ) && ( ( value_ic_enabler & BIT(i) ) != 0) ) {
-                    value_is_enabler &= ~BIT(i);
-                    value_ic_enabler &= ~BIT(i);
-                    irq_num = (32 * reg_num) + i;
-                    //
-                    // TODO: do this
-                    //
-                }  
-            }
-            if(reg_num == 0) {
-
-            }
-            else {
-                distributor->gicd_interrupt_set_pending_regs[reg_num] = value_is_enabler;
-                distributor->gicd_interrupt_clear_pending_regs[reg_num] = value_ic_enabler;
+                distributor->gicd_ctl_reg |= BIT(31);
             }
             register_handled = true;
 
@@ -516,13 +530,14 @@ static bool handle_vgic_dist_access(struct exc_info *ctx, u64 addr, u64 *val, bo
             }
             register_handled = true;
         }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_IPRIORITYR0) && (relative_addr <= GIC_DIST_IPRIORITYR254) ) {
+        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_IPRIORITYR0) && (relative_addr <= GIC_DIST_IPRIORITYR254 + 3) ) {
             //
-            // Unimplemented for now.
+            // one byte per IRQ, byte accesses are allowed. IPRIORITYR0-7 are the redistributors' job.
             //
-            printf("HV vGIC DEBUG [WARN]: interrupt priority registers are unimplemented (guest attempted to access register 0x%llx)\n", relative_addr);
+            if(relative_addr >= GIC_DIST_IPRIORITYR0 + VGIC_NR_PRIVATE) {
+                hv_vgicv3_write_priorities(ctx->cpu_id, relative_addr - GIC_DIST_IPRIORITYR0, *val, width);
+            }
             register_handled = true;
-            unimplemented_reg_accessed = true;
         }
         else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ITARGETSR0) && (relative_addr <= GIC_DIST_ITARGETSR254) ) {
             //
@@ -542,6 +557,16 @@ static bool handle_vgic_dist_access(struct exc_info *ctx, u64 addr, u64 *val, bo
             register_handled = true;
             unimplemented_reg_accessed = true;
         }
+        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_IROUTER32) && (relative_addr <= GIC_DIST_IROUTER1019) ) {
+            //
+            // SPI routing - move the IRQ's state over to the vCPU it now targets.
+            //
+            u32 reg_num;
+            reg_num = (relative_addr - GIC_DIST_IROUTER32) / 8;
+            distributor->gicd_interrupt_router_regs[reg_num] = *val;
+            vgic_route_spi(&vgic, 32 + reg_num, hv_vgicv3_irouter_to_vcpu(*val));
+            register_handled = true;
+        }
         else {
             //
             // the register is unknown (or unimplemented) - print a warning.
@@ -606,43 +631,18 @@ static bool handle_vgic_dist_access(struct exc_info *ctx, u64 addr, u64 *val, bo
             register_handled = true;
 
         }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ISENABLER0) && (relative_addr <= GIC_DIST_ISENABLER31) ) {
+        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ISENABLER0) && (relative_addr <= GIC_DIST_ICPENDR31) ) {
             //
-            // enables an IRQ to be forwarded to a CPU interface.
+            // the set and clear registers read back the same state.
             //
             u32 reg_num;
-            reg_num = (relative_addr - GIC_DIST_ISENABLER0) / 4;
-            *val = distributor->gicd_interrupt_set_enable_regs[reg_num];
-            register_handled = true;
-
-        }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ICENABLER0) && (relative_addr <= GIC_DIST_ICENABLER31) ) {
-            //
-            // disables an IRQ to be forwarded to a CPU interface.
-            //
-            u32 reg_num;
-            reg_num = (relative_addr - GIC_DIST_ICENABLER0) / 4;
-            *val = distributor->gicd_interrupt_clear_enable_regs[reg_num];
-            register_handled = true;
-
-        }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ISPENDR0) && (relative_addr <= GIC_DIST_ISPENDR31) ) {
-            //
-            // sets an IRQ to pending
-            //
-            u32 reg_num, irq_num;
-            reg_num = (relative_addr - GIC_DIST_ISPENDR0) / 4;
-            distributor->gicd_interrupt_set_pending_regs[reg_num];
-            register_handled = true;
-
-        }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ICPENDR0) && (relative_addr <= GIC_DIST_ICPENDR31) ) {
-            //
-            // clears the pending state from an IRQ
-            //
-            u32 reg_num, irq_num;
-            reg_num = (relative_addr - GIC_DIST_ICPENDR0) / 4;
-            *val = distributor->gicd_interrupt_clear_pending_regs[reg_num];
+            reg_num = ((relative_addr - GIC_DIST_ISENABLER0) % 0x80) / 4;
+            if(reg_num != 0) {
+                *val = vgic_read_bits(&vgic, ctx->cpu_id, hv_vgicv3_irq_reg(relative_addr - GIC_DIST_ISENABLER0), reg_num * 32);
+            }
+            else {
+                *val = 0;
+            }
             register_handled = true;
 
         }
@@ -666,16 +666,14 @@ static bool handle_vgic_dist_access(struct exc_info *ctx, u64 addr, u64 *val, bo
             *val = distributor->gicd_interrupt_clear_active_regs[reg_num];
             register_handled = true;
         }
-        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_IPRIORITYR0) && (relative_addr <= GIC_DIST_IPRIORITYR254) ) {
-            //
-            // Unimplemented for now.
-            //
-            u32 reg_num;
-            reg_num = (relative_addr - GIC_DIST_IPRIORITYR0) / 4;
-            printf("HV vGIC DEBUG [WARN]: interrupt priority registers are unimplemented (guest attempted to access register 0x%llx)\n", relative_addr);
-            *val = distributor->gicd_interrupt_priority_regs[reg_num];
+        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_IPRIORITYR0) && (relative_addr <= GIC_DIST_IPRIORITYR254 + 3) ) {
+            if(relative_addr >= GIC_DIST_IPRIORITYR0 + VGIC_NR_PRIVATE) {
+                *val = hv_vgicv3_read_priorities(ctx->cpu_id, relative_addr - GIC_DIST_IPRIORITYR0, width);
+            }
+            else {
+                *val = 0;
+            }
             register_handled = true;
-            unimplemented_reg_accessed = true;
         }
         else if ( (register_handled == false) && (relative_addr >= GIC_DIST_ITARGETSR0) && (relative_addr <= GIC_DIST_ITARGETSR254) ) {
             //
@@ -696,6 +694,12 @@ static bool handle_vgic_dist_access(struct exc_info *ctx, u64 addr, u64 *val, bo
             register_handled = true;
             unimplemented_reg_accessed = true;
         }
+        else if ( (register_handled == false) && (relative_addr >= GIC_DIST_IROUTER32) && (relative_addr <= GIC_DIST_IROUTER1019) ) {
+            u32 reg_num;
+            reg_num = (relative_addr - GIC_DIST_IROUTER32) / 8;
+            *val = distributor->gicd_interrupt_router_regs[reg_num];
+            register_handled = true;
+        }
         else {
             //
             // the register is unknown (or unimplemented) - print a warning.
@@ -736,20 +740,21 @@ static bool handle_vgic_redist_access(struct exc_info *ctx, u64 addr, u64 *val,
     u64 relative_addr;
     bool register_handled;
     bool unimplemented_reg_accessed;
-    relative_addr = addr - dist_base;
+    relative_addr = (addr - redist_base) % 0x20000;
     register_handled = false;
     unimplemented_reg_accessed = false;
     u8 cpu_num;
     u32 value_is_enabler, value_ic_enabler, current_val;
     u32 irq_num;
-    u32 reg_num;
     value_ic_enabler = 0;
     value_is_enabler = 0;
     current_val = 0;
     irq_num = 0;
-    reg_num = 0;
 
-    cpu_num = ctx->cpu_id;
+    //
+    // each vCPU has a 128KB redistributor frame (RD + SGI regions), the frame being accessed selects the vCPU.
+    //
+    cpu_num = (addr - redist_base) / 0x20000;
     if(write) {
         //
         // The guest attempted to write a register.
@@ -955,116 +960,14 @@ static bool handle_vgic_redist_access(struct exc_info *ctx, u64 addr, u64 *val,
                 register_handled = true;
                 break;
             case GIC_REDIST_ISENABLER0:
-                // u32 value_is_enabler, value_ic_enabler, current_val;
-                // u32 irq_num;
-                value_is_enabler = redistributors[cpu_num].sgi_region.gicr_isactiver0;
-                value_ic_enabler = redistributors[cpu_num].sgi_region.gicr_icactiver0;
-                current_val = *val;
-
-                //
-                // if 1 is written to the bits in these registers, they need to read 1 in GICR_ICENABLER0 as well.
-                // also this is banked for the first 8 processor cores - so changes must reflect across all of them.
-                //
-                // There has to be a way more efficient way of doing this...
-                //
-
-                for(u32 i = 0; i < 32; i++) {
-                    if( ( (current_val & BIT(i)) != 0 ) && ( ( value_is_enabler & BIT(i) ) == 0) ) {
-                        value_is_enabler |= BIT(i);
-                        value_ic_enabler |= BIT(i);      
-                        irq_num = i;
-                        //
-                        // TODO: do the AIC operation associated with this.
-                        //        
-                    }
-                }
-                redistributors[cpu_num].sgi_region.gicr_isactiver0 = value_is_enabler;
-                redistributors[cpu_num].sgi_region.gicr_icactiver0 = value_ic_enabler;
-                register_handled = true;
-                break;
             case GIC_REDIST_ICENABLER0:
-                // u32 value_is_enabler, value_ic_enabler, current_val;
-                // u32 irq_num;
-                value_is_enabler = redistributors[cpu_num].sgi_region.gicr_isactiver0;
-                value_ic_enabler = redistributors[cpu_num].sgi_region.gicr_icactiver0;
-                current_val = *val;
-
-                //
-                // if 1 is written to the bits in these registers, they need to read 1 in GICD_ICENABLER[0:31] as well.
-                // also this is banked for the first 8 processor cores - so changes must reflect across all of them.
-                //
-                // There has to be a way more efficient way of doing this...
-                //
-
-                for(u32 i = 0; i < 32; i++) {
-                    if( ( (current_val & BIT(i)) != 0 ) && ( ( value_is_enabler & BIT(i) ) != 0) ) {
-                        value_is_enabler &= ~BIT(i);
-                        value_ic_enabler &= ~BIT(i);      
-                        irq_num = i;
-                        //
-                        // TODO: do the AIC operation associated with this.
-                        //        
-                    }
-                }
-                redistributors[cpu_num].sgi_region.gicr_isactiver0 = value_is_enabler;
-                redistributors[cpu_num].sgi_region.gicr_icactiver0 = value_ic_enabler;
-                register_handled = true;
-                break;
             case GIC_REDIST_ISPENDR0:
-                // u32 value_is_enabler, value_ic_enabler, current_val;
-                // u32 irq_num;
-                value_is_enabler = redistributors[cpu_num].sgi_region.gicr_ispendr0;
-                value_ic_enabler = redistributors[cpu_num].sgi_region.gicr_icpendr0;
-                current_val = *val;
-
-                //
-                // if 1 is written to the bits in these registers, they need to read 1 in GICD_ICENABLER[0:31] as well.
-                // also this is banked for the first 8 processor cores - so changes must reflect across all of them.
-                //
-                // There has to be a way more efficient way of doing this...
-                //
-
-                for(u32 i = 0; i < 32; i++) {
-                    if( ( (current_val & BIT(i)) != 0 ) && ( ( value_is_enabler & BIT(i) ) == 0) ) {
-                        value_is_enabler |= BIT(i);
-                        value_ic_enabler |= BIT(i);      
-                        irq_num = i;
-                        //
-                        // TODO: do the AIC operation associated with this.
-                        //        
-                    }
-                }
-                register_handled = true;
-                redistributors[cpu_num].sgi_region.gicr_isactiver0 = value_is_enabler;
-                redistributors[cpu_num].sgi_region.gicr_icactiver0 = value_ic_enabler;
-                break;
             case GIC_REDIST_ICPENDR0:
-                // u32 value_is_enabler, value_ic_enabler, current_val;
-                // u32 irq_num;
-                value_is_enabler = redistributors[cpu_num].sgi_region.gicr_ispendr0;
-                value_ic_enabler = redistributors[cpu_num].sgi_region.gicr_icpendr0;
-                current_val = *val;
-
                 //
-                // if 1 is written to the bits in these registers, they need to read 1 in GICD_ICENABLER[0:31] as well.
-                // also this is banked for the first 8 processor cores - so changes must reflect across all of them.
-                //
-                // There has to be a way more efficient way of doing this...
+                // this vCPU's SGIs and PPIs, kept in the same priority bitmaps as the SPIs routed to it.
                 //
-
-                for(u32 i = 0; i < 32; i++) {
-                    if( ( (current_val & BIT(i)) != 0 ) && ( ( value_is_enabler & BIT(i) ) != 0) ) {
-                        value_is_enabler &= ~BIT(i);
-                        value_ic_enabler &= ~BIT(i);      
-                        irq_num = i;
-                        //
-                        // TODO: do the AIC operation associated with this.
-                        //        
-                    }
-                }
+                vgic_write_bits(&vgic, cpu_num, hv_vgicv3_irq_reg(relative_addr - GIC_REDIST_ISENABLER0), 0, *val);
                 register_handled = true;
-                redistributors[cpu_num].sgi_region.gicr_isactiver0 = value_is_enabler;
-                redistributors[cpu_num].sgi_region.gicr_icactiver0 = value_ic_enabler;
                 break;
             case GIC_REDIST_ISACTIVER0:
                 // u32 value_is_enabler, value_ic_enabler, current_val;
@@ -1138,25 +1041,15 @@ static bool handle_vgic_redist_access(struct exc_info *ctx, u64 addr, u64 *val,
                 redistributors[cpu_num].sgi_region.gicr_nsacr = *val;
                 register_handled = true;
                 break;
-            case GIC_REDIST_IPRIORITYR0:
-            case GIC_REDIST_IPRIORITYR1:
-            case GIC_REDIST_IPRIORITYR2:
-            case GIC_REDIST_IPRIORITYR3:
-                // u32 reg_num;
-                reg_num = (relative_addr - GIC_REDIST_IPRIORITYR0) / 4;
-                redistributors[cpu_num].sgi_region.gicr_ppi_ipriority_reg[reg_num] = *val;
-                register_handled = true;
-                break;
-            case GIC_REDIST_IPRIORITYR4:
-            case GIC_REDIST_IPRIORITYR5:
-            case GIC_REDIST_IPRIORITYR6:
-            case GIC_REDIST_IPRIORITYR7:
-                // u32 reg_num;
-                reg_num = (relative_addr - GIC_REDIST_IPRIORITYR4) / 4;
-                redistributors[cpu_num].sgi_region.gicr_ppi_ipriority_reg[reg_num] = *val;
-                register_handled = true;
-                break;
             default:
+                if((relative_addr >= GIC_REDIST_IPRIORITYR0) && (relative_addr <= GIC_REDIST_IPRIORITYR7 + 3)) {
+                    //
+                    // one byte per SGI/PPI, byte accesses are allowed.
+                    //
+                    hv_vgicv3_write_priorities(cpu_num, relative_addr - GIC_REDIST_IPRIORITYR0, *val, width);
+                    register_handled = true;
+                    break;
+                }
                 //
                 // an unimplemented register.
                 //
@@ -1232,19 +1125,10 @@ static bool handle_vgic_redist_access(struct exc_info *ctx, u64 addr, u64 *val,
                 register_handled = true;
                 break;
             case GIC_REDIST_ISENABLER0:
-                *val = redistributors[cpu_num].sgi_region.gicr_isenabler0;
-                register_handled = true;
-                break;
             case GIC_REDIST_ICENABLER0:
-                *val = redistributors[cpu_num].sgi_region.gicr_icenabler0;
-                register_handled = true;
-                break;
             case GIC_REDIST_ISPENDR0:
-                *val = redistributors[cpu_num].sgi_region.gicr_ispendr0;
-                register_handled = true;
-                break;
             case GIC_REDIST_ICPENDR0:
-                *val = redistributors[cpu_num].sgi_region.gicr_icpendr0;
+                *val = vgic_read_bits(&vgic, cpu_num, hv_vgicv3_irq_reg(relative_addr - GIC_REDIST_ISENABLER0), 0);
                 register_handled = true;
                 break;
             case GIC_REDIST_ISACTIVER0:
@@ -1271,25 +1155,15 @@ static bool handle_vgic_redist_access(struct exc_info *ctx, u64 addr, u64 *val,
                 *val = redistributors[cpu_num].sgi_region.gicr_nsacr;
                 register_handled = true;
                 break;
-            case GIC_REDIST_IPRIORITYR0:
-            case GIC_REDIST_IPRIORITYR1:
-            case GIC_REDIST_IPRIORITYR2:
-            case GIC_REDIST_IPRIORITYR3:
-                // u32 reg_num;
-                reg_num = (relative_addr - GIC_REDIST_IPRIORITYR0) / 4;
-                *val = redistributors[cpu_num].sgi_region.gicr_ppi_ipriority_reg[reg_num];
-                register_handled = true;
-                break;
-            case GIC_REDIST_IPRIORITYR4:
-            case GIC_REDIST_IPRIORITYR5:
-            case GIC_REDIST_IPRIORITYR6:
-            case GIC_REDIST_IPRIORITYR7:
-                // u32 reg_num;
-                reg_num = (relative_addr - GIC_REDIST_IPRIORITYR4) / 4;
-                *val = redistributors[cpu_num].sgi_region.gicr_ppi_ipriority_reg[reg_num];
-                register_handled = true;
-                break;
             default:
+                if((relative_addr >= GIC_REDIST_IPRIORITYR0) && (relative_addr <= GIC_REDIST_IPRIORITYR7 + 3)) {
+                    //
+                    // one byte per SGI/PPI, byte accesses are allowed.
+                    //
+                    *val = hv_vgicv3_read_priorities(cpu_num, relative_addr - GIC_REDIST_IPRIORITYR0, width);
+                    register_handled = true;
+                    break;
+                }
                 //
                 // an unimplemented register.
                 //
@@ -1488,11 +1362,222 @@ int hv_vgicv3_enable_virtual_interrupts(void)
     msr(ICH_VMCR_EL2, (BIT(1)));
     //bit 0 enables the virtual CPU interface registers
     //AMO/IMO/FMO set by m1n1 on boot
+    //SPIs from the AIC are listed with ICH_LR_EOI, so their deactivation raises a maintenance
+    //interrupt (a FIQ on Apple cores) and the CPU exits to unmask them in the AIC
     msr(ICH_HCR_EL2, (BIT(0)));
 
 
     return 0;
 }
+
+static u64 hv_vgicv3_read_list_register(int n)
+{
+    switch(n) {
+        case 0:
+            return mrs(ICH_LR0_EL2);
+        case 1:
+            return mrs(ICH_LR1_EL2);
+        case 2:
+            return mrs(ICH_LR2_EL2);
+        case 3:
+            return mrs(ICH_LR3_EL2);
+        case 4:
+            return mrs(ICH_LR4_EL2);
+        case 5:
+            return mrs(ICH_LR5_EL2);
+        case 6:
+            return mrs(ICH_LR6_EL2);
+        case 7:
+            return mrs(ICH_LR7_EL2);
+        default:
+            return 0;
+    }
+}
+
+static void hv_vgicv3_write_list_register(int n, u64 val)
+{
+    switch(n) {
+        case 0:
+            msr(ICH_LR0_EL2, val);
+            break;
+        case 1:
+            msr(ICH_LR1_EL2, val);
+            break;
+        case 2:
+            msr(ICH_LR2_EL2, val);
+            break;
+        case 3:
+            msr(ICH_LR3_EL2, val);
+            break;
+        case 4:
+            msr(ICH_LR4_EL2, val);
+            break;
+        case 5:
+            msr(ICH_LR5_EL2, val);
+            break;
+        case 6:
+            msr(ICH_LR6_EL2, val);
+            break;
+        case 7:
+            msr(ICH_LR7_EL2, val);
+            break;
+    }
+}
+
+//
+// Latency accounting for SPIs that came from the AIC: the IRQ has been loaded into a list register...
+//
+static void hv_vgicv3_aic_irq_listed(u32 spi, u64 now)
+{
+    u64 ticks;
+    if((spi_ack_time[spi] == 0) || spi_listed[spi]) {
+        return;
+    }
+    ticks = now - spi_ack_time[spi];
+    spi_listed[spi] = true;
+    spi_stats[spi].inject_ticks += ticks;
+    spi_stats[spi].inject_max = max(spi_stats[spi].inject_max, ticks);
+}
+
+//
+// ...and the guest has deactivated it, so the AIC can signal it again.
+//
+static void hv_vgicv3_aic_irq_done(u32 spi, u64 now)
+{
+    u64 ticks;
+    if(spi_ack_time[spi] == 0) {
+        return;
+    }
+    ticks = now - spi_ack_time[spi];
+    spi_stats[spi].complete_ticks += ticks;
+    spi_stats[spi].complete_max = max(spi_stats[spi].complete_max, ticks);
+    spi_ack_time[spi] = 0;
+    spi_listed[spi] = false;
+    hv_vgicv3_update_aic_mask(spi);
+}
+
+/**
+ * @brief hv_vgicv3_refill_list_registers
+ *
+ * Moves the highest priority pending IRQs of the current vCPU into its free list registers.
+ * Called on every exit back to the guest (with the big HV lock held), so it only ever looks at
+ * the free LRs (ICH_ELRSR_EL2) and the top of the priority bitmaps - nothing here scans the IRQ space.
+ */
+void hv_vgicv3_refill_list_registers(void)
+{
+    u32 cpu = smp_id();
+    u32 empty = mrs(ICH_ELRSR_EL2) & GENMASK(VGIC_NR_LRS - 1, 0);
+    u32 eoi = mrs(ICH_EISR_EL2) & GENMASK(VGIC_NR_LRS - 1, 0);
+    int *lrs = &lr_irqs[cpu * VGIC_NR_LRS];
+    struct vgic_irqs *irqs = &vgic.cpus[cpu];
+    u64 now = mrs(CNTPCT_EL0);
+
+    //
+    // Deactivated LRs with ICH_LR_EOI aren't in ELRSR, and keep the maintenance interrupt asserted
+    // until they're cleared.
+    //
+    for(u32 pending = eoi; pending != 0; pending &= pending - 1) {
+        hv_vgicv3_write_list_register(__builtin_ctz(pending), 0);
+    }
+    empty |= eoi;
+
+    //
+    // LRs we loaded that are empty now have been deactivated by the guest.
+    //
+    for(int n = 0; n < VGIC_NR_LRS; n++) {
+        if(((empty & BIT(n)) != 0) && (lrs[n] != VGIC_IRQ_NONE)) {
+            hv_vgicv3_aic_irq_done(lrs[n], now);
+            lrs[n] = VGIC_IRQ_NONE;
+        }
+    }
+
+    while(empty != 0) {
+        int irq = vgic_irqs_take(irqs);
+        if(irq == VGIC_IRQ_NONE) {
+            break;
+        }
+
+        //
+        // still listed (active, or pending and not yet acknowledged)? just mark it pending in place.
+        //
+        int n;
+        for(n = 0; n < VGIC_NR_LRS; n++) {
+            if(((empty & BIT(n)) == 0) && (lrs[n] == irq)) {
+                break;
+            }
+        }
+        if(n < VGIC_NR_LRS) {
+            hv_vgicv3_write_list_register(n, hv_vgicv3_read_list_register(n) | ICH_LR_STATE_PENDING);
+            continue;
+        }
+
+        n = __builtin_ctz(empty);
+        empty &= ~BIT(n);
+        lrs[n] = irq;
+        hv_vgicv3_write_list_register(n, ICH_LR_STATE_PENDING | ICH_LR_GROUP1 |
+                                      ((spi_ack_time[irq] != 0) ? ICH_LR_EOI : 0) |
+                                      FIELD_PREP(ICH_LR_PRIORITY, irqs->priority[irq]) |
+                                      FIELD_PREP(ICH_LR_VINTID, irq));
+        hv_vgicv3_aic_irq_listed(irq, now);
+    }
+}
+
+/**
+ * @brief hv_vgicv3_handle_aic_events
+ *
+ * Acks pending AIC events and injects the routed ones as SPIs, without involving the host.
+ * If the SPI targets another vCPU, that CPU gets an IPI so that it exits and refills its list registers.
+ *
+ * @return
+ * the first event without a route (for the host to handle, followed by hv_vgicv3_aic_event_done()),
+ * or 0 once the AIC has no more events.
+ */
+u32 hv_vgicv3_handle_aic_events(void)
+{
+    u32 event;
+    while((event = aic_ack()) != 0) {
+        u64 now = mrs(CNTPCT_EL0);
+        u32 irq = FIELD_GET(AIC_EVENT_DIE, event) * aic->max_irq + FIELD_GET(AIC_EVENT_NUM, event);
+        u32 spi, target;
+
+        if((FIELD_GET(AIC_EVENT_TYPE, event) != AIC_EVENT_TYPE_HW) || (irq >= ARRAY_SIZE(aic_to_spi)) || (aic_to_spi[irq] == 0)) {
+            return event;
+        }
+
+        spi = aic_to_spi[irq];
+        spi_ack_time[spi] = now;
+        spi_listed[spi] = false;
+        spi_stats[spi].count++;
+        vgic_inject(&vgic, smp_id(), spi);
+
+        target = vgic.spi_target[spi];
+        if(target != smp_id()) {
+            smp_send_ipi(target);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief hv_vgicv3_aic_event_done
+ *
+ * Called once the host has handled an event hv_vgicv3_handle_aic_events() passed on. Acking it masked
+ * the IRQ in the AIC, so it's unmasked again - unless the host routed it meanwhile, in which case
+ * its SPI's enable bit decides.
+ */
+void hv_vgicv3_aic_event_done(u32 event)
+{
+    u32 irq = FIELD_GET(AIC_EVENT_DIE, event) * aic->max_irq + FIELD_GET(AIC_EVENT_NUM, event);
+
+    if((FIELD_GET(AIC_EVENT_TYPE, event) != AIC_EVENT_TYPE_HW) || (irq >= ARRAY_SIZE(aic_to_spi))) {
+        return;
+    }
+    if(aic_to_spi[irq] != 0) {
+        hv_vgicv3_update_aic_mask(aic_to_spi[irq]);
+    } else {
+        aic_set_mask(irq, false);
+    }
+}
 #endif
 /**
  * @brief hv_vgicv3_init
@@ -1596,6 +1681,16 @@ void hv_vgicv3_init(void)
     printf("HV vGIC DEBUG: mapping redistributors into guest space\n");
     hv_map_hook(redist_base, handle_vgic_redist_access, ((0x20000) * num_cpus));
 
+    //
+    // IRQ state - SPIs all start out routed to vCPU 0, and no list register holds anything yet.
+    //
+    vgic_state_init(&vgic, heapblock_alloc(sizeof(struct vgic_irqs) * num_cpus), num_cpus);
+    hv_vgicv3_init_aic_routes();
+    lr_irqs = heapblock_alloc(sizeof(int) * VGIC_NR_LRS * num_cpus);
+    for(u32 i = 0; i < VGIC_NR_LRS * num_cpus; i++) {
+        lr_irqs[i] = VGIC_IRQ_NONE;
+    }
+
     //
     // ITS setup (for MSIs - PCIe devices usually signal via these.)
     // Disabled for now, seems like direct injection into the guest is easier.
@@ -1612,3 +1707,67 @@ void hv_vgicv3_init(void)
 #endif //ENABLE_VGIC_MODULE
 }
 
+/**
+ * @brief hv_vgicv3_route_aic_irq
+ *
+ * Routes an AIC IRQ (die * max_irq + num) to a vGIC SPI, replacing any previous routes of either.
+ * An SPI of 0 removes the route, and the IRQ is unmasked so the host gets its events again.
+ *
+ * @return
+ * 0 - success
+ * -1 - the vGIC is not running, or the IRQ or SPI is out of range.
+ */
+int hv_vgicv3_route_aic_irq(u32 irq, u32 spi)
+{
+#ifdef ENABLE_VGIC_MODULE
+    if(!vgic_inited || (irq >= ARRAY_SIZE(aic_to_spi)) || ((spi != 0) && ((spi < VGIC_NR_PRIVATE) || (spi >= VGIC_NR_IRQS)))) {
+        return -1;
+    }
+    if(aic_to_spi[irq] != 0) {
+        spi_to_aic[aic_to_spi[irq]] = AIC_IRQ_UNMAPPED;
+    }
+    aic_to_spi[irq] = spi;
+    if(spi == 0) {
+        aic_set_mask(irq, false);
+        return 0;
+    }
+    if(spi_to_aic[spi] != AIC_IRQ_UNMAPPED) {
+        aic_to_spi[spi_to_aic[spi]] = 0;
+    }
+    spi_to_aic[spi] = irq;
+    spi_ack_time[spi] = 0;
+    spi_listed[spi] = false;
+    memset(&spi_stats[spi], 0, sizeof(spi_stats[spi]));
+    hv_vgicv3_update_aic_mask(spi);
+    return 0;
+#else
+    UNUSED(irq);
+    UNUSED(spi);
+    return -1;
+#endif //ENABLE_VGIC_MODULE
+}
+
+/**
+ * @brief hv_vgicv3_get_irq_stats
+ *
+ * Copies out the injection counters of an SPI (see struct hv_vgic_irq_stats).
+ *
+ * @return
+ * 0 - success
+ * -1 - the vGIC is not running, or the SPI is out of range.
+ */
+int hv_vgicv3_get_irq_stats(u32 spi, struct hv_vgic_irq_stats *stats)
+{
+#ifdef ENABLE_VGIC_MODULE
+    if(!vgic_inited || (spi < VGIC_NR_PRIVATE) || (spi >= VGIC_NR_IRQS)) {
+        return -1;
+    }
+    memcpy(stats, &spi_stats[spi], sizeof(*stats));
+    return 0;
+#else
+    UNUSED(spi);
+    UNUSED(stats);
+    return -1;
+#endif //ENABLE_VGIC_MODULE
+}
+
@@ -0,0 +1,286 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "hv_vgic_irq.h"
+#include "string.h"
+#include "utils.h"
+
+static inline u32 level_of(u8 priority)
+{
+    return priority >> VGIC_PRIO_SHIFT;
+}
+
+static void ready_add(struct vgic_irqs *v, u32 irq)
+{
+    u32 level = level_of(v->priority[irq]);
+    u32 word = irq / 64;
+
+    v->ready[level][word] |= BIT(irq % 64);
+    v->ready_words[level] |= BIT(word);
+    v->ready_levels |= BIT(level);
+}
+
+static void ready_remove(struct vgic_irqs *v, u32 irq)
+{
+    u32 level = level_of(v->priority[irq]);
+    u32 word = irq / 64;
+
+    v->ready[level][word] &= ~BIT(irq % 64);
+    if (!v->ready[level][word]) {
+        v->ready_words[level] &= ~BIT(word);
+        if (!v->ready_words[level])
+            v->ready_levels &= ~BIT(level);
+    }
+}
+
+static inline u32 word_bits(const u64 *bitmap, u32 first)
+{
+    return bitmap[first / 64] >> (first % 64);
+}
+
+void vgic_irqs_init(struct vgic_irqs *v)
+{
+    memset(v, 0, sizeof(*v));
+}
+
+/* Only the bits whose pending && enabled state flips are visited */
+static void update_ready(struct vgic_irqs *v, u32 first, u32 before, u32 after)
+{
+    u32 added = after & ~before;
+    u32 removed = before & ~after;
+
+    while (added) {
+        u32 bit = __builtin_ctz(added);
+        added &= added - 1;
+        ready_add(v, first + bit);
+    }
+    while (removed) {
+        u32 bit = __builtin_ctz(removed);
+        removed &= removed - 1;
+        ready_remove(v, first + bit);
+    }
+}
+
+static void update_word(struct vgic_irqs *v, u64 *bitmap, u32 first, u32 set, u32 clear)
+{
+    if (first >= VGIC_NR_IRQS)
+        return;
+
+    first &= ~31;
+
+    u32 before = word_bits(v->pending, first) & word_bits(v->enabled, first);
+    u64 shift = first % 64;
+
+    bitmap[first / 64] |= (u64)set << shift;
+    bitmap[first / 64] &= ~((u64)clear << shift);
+
+    u32 after = word_bits(v->pending, first) & word_bits(v->enabled, first);
+    update_ready(v, first, before, after);
+}
+
+void vgic_irqs_set_enabled(struct vgic_irqs *v, u32 first, u32 mask)
+{
+    update_word(v, v->enabled, first, mask, 0);
+}
+
+void vgic_irqs_clear_enabled(struct vgic_irqs *v, u32 first, u32 mask)
+{
+    update_word(v, v->enabled, first, 0, mask);
+}
+
+void vgic_irqs_set_pending(struct vgic_irqs *v, u32 first, u32 mask)
+{
+    update_word(v, v->pending, first, mask, 0);
+}
+
+void vgic_irqs_clear_pending(struct vgic_irqs *v, u32 first, u32 mask)
+{
+    update_word(v, v->pending, first, 0, mask);
+}
+
+u32 vgic_irqs_enabled_word(const struct vgic_irqs *v, u32 first)
+{
+    return first < VGIC_NR_IRQS ? word_bits(v->enabled, first & ~31) : 0;
+}
+
+u32 vgic_irqs_pending_word(const struct vgic_irqs *v, u32 first)
+{
+    return first < VGIC_NR_IRQS ? word_bits(v->pending, first & ~31) : 0;
+}
+
+static inline bool is_ready(const struct vgic_irqs *v, u32 irq)
+{
+    return (v->pending[irq / 64] & v->enabled[irq / 64]) & BIT(irq % 64);
+}
+
+void vgic_irqs_set_priority(struct vgic_irqs *v, u32 irq, u8 priority)
+{
+    if (irq >= VGIC_NR_IRQS)
+        return;
+
+    if (!is_ready(v, irq)) {
+        v->priority[irq] = priority;
+        return;
+    }
+
+    ready_remove(v, irq);
+    v->priority[irq] = priority;
+    ready_add(v, irq);
+}
+
+void vgic_irqs_move(struct vgic_irqs *from, struct vgic_irqs *to, u32 irq)
+{
+    if (irq >= VGIC_NR_IRQS || from == to)
+        return;
+
+    u32 first = irq & ~31;
+    u32 mask = BIT(irq & 31);
+    bool pending = vgic_irqs_pending_word(from, first) & mask;
+    bool enabled = vgic_irqs_enabled_word(from, first) & mask;
+
+    vgic_irqs_clear_pending(from, first, mask);
+    vgic_irqs_clear_enabled(from, first, mask);
+
+    vgic_irqs_set_priority(to, irq, from->priority[irq]);
+    if (enabled)
+        vgic_irqs_set_enabled(to, first, mask);
+    if (pending)
+        vgic_irqs_set_pending(to, first, mask);
+}
+
+int vgic_irqs_highest(const struct vgic_irqs *v)
+{
+    if (!v->ready_levels)
+        return VGIC_IRQ_NONE;
+
+    u32 level = __builtin_ctz(v->ready_levels);
+    u32 word = __builtin_ctz(v->ready_words[level]);
+
+    return word * 64 + __builtin_ctzl(v->ready[level][word]);
+}
+
+int vgic_irqs_take(struct vgic_irqs *v)
+{
+    int irq = vgic_irqs_highest(v);
+
+    if (irq != VGIC_IRQ_NONE)
+        vgic_irqs_clear_pending(v, irq & ~31, BIT(irq & 31));
+
+    return irq;
+}
+
+void vgic_state_init(struct vgic_state *s, struct vgic_irqs *cpus, u32 num_cpus)
+{
+    s->cpus = cpus;
+    s->num_cpus = num_cpus;
+    memset(s->spi_target, 0, sizeof(s->spi_target));
+
+    for (u32 cpu = 0; cpu < num_cpus; cpu++)
+        vgic_irqs_init(&cpus[cpu]);
+}
+
+static inline struct vgic_irqs *irq_owner(const struct vgic_state *s, u32 cpu, u32 irq)
+{
+    if (irq < VGIC_NR_PRIVATE)
+        return &s->cpus[cpu];
+    return &s->cpus[s->spi_target[irq]];
+}
+
+static void write_word(struct vgic_irqs *v, enum vgic_irq_reg reg, u32 first, u32 mask)
+{
+    switch (reg) {
+        case VGIC_ISENABLER:
+            vgic_irqs_set_enabled(v, first, mask);
+            break;
+        case VGIC_ICENABLER:
+            vgic_irqs_clear_enabled(v, first, mask);
+            break;
+        case VGIC_ISPENDR:
+            vgic_irqs_set_pending(v, first, mask);
+            break;
+        case VGIC_ICPENDR:
+            vgic_irqs_clear_pending(v, first, mask);
+            break;
+    }
+}
+
+void vgic_write_bits(struct vgic_state *s, u32 cpu, enum vgic_irq_reg reg, u32 first, u32 mask)
+{
+    if (first >= VGIC_NR_IRQS || cpu >= s->num_cpus)
+        return;
+
+    first &= ~31;
+    if (first < VGIC_NR_PRIVATE) {
+        write_word(&s->cpus[cpu], reg, first, mask);
+        return;
+    }
+
+    // SPIs in one register can be routed to different vCPUs, so hand each its share
+    while (mask) {
+        u32 target = s->spi_target[first + __builtin_ctz(mask)];
+        u32 share = 0;
+
+        for (u32 bits = mask; bits; bits &= bits - 1) {
+            u32 bit = __builtin_ctz(bits);
+            if (s->spi_target[first + bit] == target)
+                share |= BIT(bit);
+        }
+
+        write_word(&s->cpus[target], reg, first, share);
+        mask &= ~share;
+    }
+}
+
+u32 vgic_read_bits(const struct vgic_state *s, u32 cpu, enum vgic_irq_reg reg, u32 first)
+{
+    if (first >= VGIC_NR_IRQS || cpu >= s->num_cpus)
+        return 0;
+
+    bool pending = reg == VGIC_ISPENDR || reg == VGIC_ICPENDR;
+
+    if (first < VGIC_NR_PRIVATE) {
+        const struct vgic_irqs *v = &s->cpus[cpu];
+        return pending ? vgic_irqs_pending_word(v, first) : vgic_irqs_enabled_word(v, first);
+    }
+
+    // Each SPI's bits are only ever set in the state of the vCPU it is routed to
+    u32 val = 0;
+    for (u32 i = 0; i < s->num_cpus; i++) {
+        const struct vgic_irqs *v = &s->cpus[i];
+        val |= pending ? vgic_irqs_pending_word(v, first) : vgic_irqs_enabled_word(v, first);
+    }
+
+    return val;
+}
+
+void vgic_write_priority(struct vgic_state *s, u32 cpu, u32 irq, u8 priority)
+{
+    if (irq >= VGIC_NR_IRQS || cpu >= s->num_cpus)
+        return;
+
+    vgic_irqs_set_priority(irq_owner(s, cpu, irq), irq, priority);
+}
+
+u8 vgic_read_priority(const struct vgic_state *s, u32 cpu, u32 irq)
+{
+    if (irq >= VGIC_NR_IRQS || cpu >= s->num_cpus)
+        return 0;
+
+    return irq_owner(s, cpu, irq)->priority[irq];
+}
+
+void vgic_route_spi(struct vgic_state *s, u32 irq, u32 cpu)
+{
+    if (irq < VGIC_NR_PRIVATE || irq >= VGIC_NR_IRQS || cpu >= s->num_cpus)
+        return;
+
+    vgic_irqs_move(&s->cpus[s->spi_target[irq]], &s->cpus[cpu], irq);
+    s->spi_target[irq] = cpu;
+}
+
+void vgic_inject(struct vgic_state *s, u32 cpu, u32 irq)
+{
+    if (irq >= VGIC_NR_IRQS || cpu >= s->num_cpus)
+        return;
+
+    vgic_irqs_set_pending(irq_owner(s, cpu, irq), irq & ~31, BIT(irq & 31));
+}
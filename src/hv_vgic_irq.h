@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef HV_VGIC_IRQ_H
+#define HV_VGIC_IRQ_H
+
+#include "types.h"
+
+#define VGIC_NR_IRQS     1024
+#define VGIC_NR_PRIVATE  32
+#define VGIC_IRQ_WORDS   (VGIC_NR_IRQS / 64)
+#define VGIC_PRIO_BITS   5
+#define VGIC_PRIO_LEVELS (1 << VGIC_PRIO_BITS)
+#define VGIC_PRIO_SHIFT  (8 - VGIC_PRIO_BITS)
+#define VGIC_IRQ_NONE    (-1)
+
+/*
+ * Per-vCPU interrupt state. The guest-visible enable and pending bits are kept as bitmaps, and
+ * every interrupt that is both pending and enabled is also linked into a bucket for its priority
+ * level. Apple's CPU interface only implements 5 priority bits, so there are 32 buckets, each a
+ * two level bitmap: finding the highest priority deliverable interrupt (lowest priority value,
+ * then lowest ID) takes three bit scans regardless of how many are pending.
+ *
+ * Private interrupts (SGIs and PPIs) live in the owning vCPU's state, and each SPI lives in the
+ * state of the vCPU it is routed to. Everything is updated incrementally from register writes
+ * and injections, so nothing ever scans the distributor registers.
+ */
+struct vgic_irqs {
+    u64 pending[VGIC_IRQ_WORDS];
+    u64 enabled[VGIC_IRQ_WORDS];
+    u64 ready[VGIC_PRIO_LEVELS][VGIC_IRQ_WORDS];
+    u16 ready_words[VGIC_PRIO_LEVELS];
+    u32 ready_levels;
+    u8 priority[VGIC_NR_IRQS];
+};
+
+void vgic_irqs_init(struct vgic_irqs *v);
+
+/*
+ * Register style updates: set or clear the bits in mask for the 32 interrupts starting at first,
+ * like a write to GICD_IS/ICENABLER or GICD_IS/ICPENDR does.
+ */
+void vgic_irqs_set_enabled(struct vgic_irqs *v, u32 first, u32 mask);
+void vgic_irqs_clear_enabled(struct vgic_irqs *v, u32 first, u32 mask);
+void vgic_irqs_set_pending(struct vgic_irqs *v, u32 first, u32 mask);
+void vgic_irqs_clear_pending(struct vgic_irqs *v, u32 first, u32 mask);
+
+u32 vgic_irqs_enabled_word(const struct vgic_irqs *v, u32 first);
+u32 vgic_irqs_pending_word(const struct vgic_irqs *v, u32 first);
+
+void vgic_irqs_set_priority(struct vgic_irqs *v, u32 irq, u8 priority);
+
+/* Move one interrupt's enable, pending and priority state to another vCPU */
+void vgic_irqs_move(struct vgic_irqs *from, struct vgic_irqs *to, u32 irq);
+
+/* Highest priority pending and enabled interrupt, or VGIC_IRQ_NONE */
+int vgic_irqs_highest(const struct vgic_irqs *v);
+/* Like vgic_irqs_highest(), but also clears its pending state, for moving it into an LR */
+int vgic_irqs_take(struct vgic_irqs *v);
+
+/*
+ * The whole vGIC: one struct vgic_irqs per vCPU, plus the vCPU each SPI is routed to. The
+ * register helpers take the vCPU that made the access, which selects the banked state for
+ * private interrupts and is ignored for SPIs.
+ */
+struct vgic_state {
+    struct vgic_irqs *cpus;
+    u32 num_cpus;
+    u8 spi_target[VGIC_NR_IRQS];
+};
+
+enum vgic_irq_reg {
+    VGIC_ISENABLER,
+    VGIC_ICENABLER,
+    VGIC_ISPENDR,
+    VGIC_ICPENDR,
+};
+
+void vgic_state_init(struct vgic_state *s, struct vgic_irqs *cpus, u32 num_cpus);
+
+void vgic_write_bits(struct vgic_state *s, u32 cpu, enum vgic_irq_reg reg, u32 first, u32 mask);
+u32 vgic_read_bits(const struct vgic_state *s, u32 cpu, enum vgic_irq_reg reg, u32 first);
+void vgic_write_priority(struct vgic_state *s, u32 cpu, u32 irq, u8 priority);
+u8 vgic_read_priority(const struct vgic_state *s, u32 cpu, u32 irq);
+void vgic_route_spi(struct vgic_state *s, u32 irq, u32 cpu);
+
+/* Make an interrupt pending, on the given vCPU for private ones and on its target for SPIs */
+void vgic_inject(struct vgic_state *s, u32 cpu, u32 irq);
+
+#endif
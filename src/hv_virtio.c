@@ -30,9 +30,19 @@
 #define IRQ_ACK     0x064
 #define DEV_STATUS  0x070
 
+#define STATUS_NEEDS_RESET BIT(6)
+
 #define DESC_NEXT  BIT(0)
 #define DESC_WRITE BIT(1)
 
+/*
+ * Console devices are served here, on the vUART's iodev, instead of by the proxyclient: each
+ * notification moves whole buffers, and the guest is interrupted once per batch.
+ */
+#define VIRTIO_ID_CONSOLE 3
+#define CONSOLE_RXQ       0
+#define CONSOLE_TXQ       1
+
 struct availring {
     u16 flags;
     u16 idx;
@@ -95,12 +105,164 @@ struct virtio_dev {
     u32 status;
     u32 irqstatus;
 
+    spinlock_t lock;
+
     struct virtio_q *currq;
     struct virtio_q qs[];
 };
 
 static struct virtio_dev *devlist;
 
+static void put_used(struct virtio_q *q, u32 id, u32 len)
+{
+    struct usedring *used = q->used;
+
+    used->ring[used->idx % q->size].id = id;
+    used->ring[used->idx % q->size].len = len;
+    dma_wmb();
+    used->idx++;
+}
+
+static void raise_used(struct virtio_dev *dev)
+{
+    dev->irqstatus |= USED_BUFFER;
+    aic_set_sw(dev->irq, true);
+}
+
+/*
+ * The guest handed us a descriptor index outside its queue, or a chain that loops: stop serving
+ * the device until the driver resets it, like the spec's DEVICE_NEEDS_RESET asks for.
+ */
+static void mark_broken(struct virtio_dev *dev, struct virtio_q *q, u16 idx)
+{
+    printf("virtio @ %lx: bad descriptor chain at %u on queue %d\n", dev->base, idx, q->idx);
+
+    dev->status |= STATUS_NEEDS_RESET;
+    dev->irqstatus |= CFG_CHANGE;
+    aic_set_sw(dev->irq, true);
+}
+
+static bool console_ready(struct virtio_dev *dev, u32 qidx)
+{
+    struct virtio_q *q = &dev->qs[qidx];
+
+    return !(dev->status & STATUS_NEEDS_RESET) && q->ready && q->size && q->desc && q->avail &&
+           q->used;
+}
+
+/* Send every buffer the guest has queued, one iodev write per descriptor */
+static void console_tx(struct virtio_dev *dev)
+{
+    struct virtio_q *q = &dev->qs[CONSOLE_TXQ];
+    bool done = false;
+
+    if (!console_ready(dev, CONSOLE_TXQ))
+        return;
+
+    for (; q->avail->idx != q->avail_seen; q->avail_seen++) {
+        dma_rmb();
+        u16 head = q->avail->ring[q->avail_seen % q->size];
+        u32 len = 0, n = 0;
+        u16 idx = head;
+
+        // A chain can use each descriptor once, so anything longer than the queue loops
+        for (;; idx = q->desc[idx].id) {
+            if (idx >= q->size || n++ >= q->size) {
+                mark_broken(dev, q, idx);
+                goto out;
+            }
+
+            struct desc *d = &q->desc[idx];
+
+            if (!(d->flags & DESC_WRITE) && d->len) {
+                if (iodev_can_write(IODEV_USB_VUART))
+                    iodev_write(IODEV_USB_VUART, (void *)d->addr, d->len);
+                len += d->len;
+            }
+            if (!(d->flags & DESC_NEXT))
+                break;
+        }
+
+        if (dev->verbose)
+            printf("virtio @ %lx: console sent %u bytes\n", dev->base, len);
+
+        put_used(q, head, 0);
+        done = true;
+    }
+
+out:
+    if (done)
+        raise_used(dev);
+}
+
+/* Fill the receive buffers the guest has posted with whatever input is waiting */
+static bool console_rx(struct virtio_dev *dev)
+{
+    struct virtio_q *q = &dev->qs[CONSOLE_RXQ];
+    bool done = false;
+    ssize_t avail;
+
+    if (!console_ready(dev, CONSOLE_RXQ))
+        return false;
+
+    while (q->avail->idx != q->avail_seen && (avail = iodev_can_read(IODEV_USB_VUART)) > 0) {
+        dma_rmb();
+        u16 head = q->avail->ring[q->avail_seen % q->size];
+        if (head >= q->size) {
+            mark_broken(dev, q, head);
+            break;
+        }
+
+        struct desc *d = &q->desc[head];
+        if (!(d->flags & DESC_WRITE))
+            break;
+
+        ssize_t got = iodev_read(IODEV_USB_VUART, (void *)d->addr, min((size_t)avail, d->len));
+        if (got <= 0)
+            break;
+
+        put_used(q, head, got);
+        q->avail_seen++;
+        done = true;
+    }
+
+    if (done)
+        raise_used(dev);
+
+    return done;
+}
+
+static void console_notify(struct virtio_dev *dev, u32 qidx)
+{
+    hv_tick_kick();
+
+    spin_lock(&dev->lock);
+    if (qidx == CONSOLE_TXQ)
+        console_tx(dev);
+    else if (qidx == CONSOLE_RXQ)
+        console_rx(dev);
+    spin_unlock(&dev->lock);
+}
+
+/* Returns whether any console had input to deliver */
+bool hv_virtio_poll(void)
+{
+    struct virtio_dev *dev;
+    bool busy = false;
+
+    for (dev = devlist; dev; dev = dev->next) {
+        if (dev->devid != VIRTIO_ID_CONSOLE)
+            continue;
+
+        iodev_handle_events(IODEV_USB_VUART);
+        spin_lock(&dev->lock);
+        busy |= console_rx(dev);
+        spin_unlock(&dev->lock);
+    }
+
+    return busy;
+}
+
 static void notify_avail(struct exc_info *ctx, struct virtio_q *q, int idx)
 {
     struct desc *d = &q->desc[idx];
@@ -129,6 +291,11 @@ static void notify_buffers(struct exc_info *ctx, struct virtio_dev *dev, u32 qid
     if (qidx >= (u32)dev->num_qus)
         return;
 
+    if (dev->devid == VIRTIO_ID_CONSOLE) {
+        console_notify(dev, qidx);
+        return;
+    }
+
     for (; avail->idx != q->avail_seen; q->avail_seen++)
         notify_avail(ctx, q, avail->ring[q->avail_seen % q->size]);
 }
@@ -147,23 +314,14 @@ static struct virtio_dev *dev_by_base(u64 base)
 void virtio_put_buffer(u64 base, int qu, u32 id, u32 len)
 {
     struct virtio_dev *dev = dev_by_base(base);
-    struct virtio_q *q;
-    struct usedring *used;
 
     if (!dev) {
         printf("virtio_put_buffer: no device at %lx\n", base);
         return;
     }
 
-    q = &dev->qs[qu];
-    used = q->used;
-
-    used->ring[used->idx % q->size].id = id;
-    used->ring[used->idx % q->size].len = len;
-    used->idx++;
-
-    dev->irqstatus |= USED_BUFFER;
-    aic_set_sw(dev->irq, true);
+    put_used(&dev->qs[qu], id, len);
+    raise_used(dev);
 }
 
 static bool handle_virtio(struct exc_info *ctx, u64 addr, u64 *val, bool write, int width)
@@ -185,7 +343,16 @@ static bool handle_virtio(struct exc_info *ctx, u64 addr, u64 *val, bool write,
 
         switch (addr) {
             case DEV_STATUS:
+                spin_lock(&dev->lock);
                 dev->status = *val;
+                // Writing 0 resets the device, which is also how a broken one comes back
+                if (!dev->status) {
+                    for (int i = 0; i < dev->num_qus; i++) {
+                        dev->qs[i].ready = false;
+                        dev->qs[i].avail_seen = 0;
+                    }
+                }
+                spin_unlock(&dev->lock);
                 break;
             case QSEL:
                 if (((int)*val) <= dev->num_qus)
@@ -200,9 +367,11 @@ static bool handle_virtio(struct exc_info *ctx, u64 addr, u64 *val, bool write,
                 dev->feat_host_sel = *val;
                 break;
             case IRQ_ACK:
+                spin_lock(&dev->lock);
                 dev->irqstatus &= ~(*val);
                 if (!dev->irqstatus)
                     aic_set_sw(dev->irq, false);
+                spin_unlock(&dev->lock);
                 break;
         }
 
@@ -292,6 +461,7 @@ void hv_map_virtio(u64 base, struct virtio_conf *conf)
     dev->config = conf->config;
     dev->config_len = conf->config_len;
     dev->verbose = conf->verbose;
+    spin_init(&dev->lock);
     for (i = 0; i < dev->num_qus; i++) {
         dev->qs[i].host = dev;
         dev->qs[i].idx = i;
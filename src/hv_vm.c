@@ -434,6 +434,66 @@ u64 hv_translate(u64 addr, bool s1, bool w, u64 *par_out)
     }
 }
 
+/*
+ * Translates the guest VA range [va, va + size) a 4K page at a time into extents of contiguous
+ * PAs, merging neighbouring pages. Runs of pages that fault become extents with a PA of 0, as
+ * hv_translate() reports them. Returns the number of extents, at most count, which may cover
+ * less than the whole range if it ran out of room.
+ */
+size_t hv_translate_range(u64 va, u64 size, bool s1, bool w, struct hv_xlate_extent *ext,
+                          size_t count)
+{
+    size_t n = 0;
+
+    while (size) {
+        u64 chunk = min(size, 0x1000 - (va & 0xfff));
+        u64 pa = hv_translate(va, s1, w, NULL);
+
+        if (n && (ext[n - 1].pa ? ext[n - 1].pa + ext[n - 1].size == pa : !pa)) {
+            ext[n - 1].size += chunk;
+        } else {
+            if (n == count)
+                break;
+            ext[n].pa = pa;
+            ext[n].size = chunk;
+            n++;
+        }
+
+        va += chunk;
+        size -= chunk;
+    }
+
+    return n;
+}
+
+/*
+ * Copies between a linear buffer and the extents from hv_translate_range(), stopping at the
+ * first faulting extent. Returns the number of bytes copied.
+ */
+size_t hv_gather(void *dst, const struct hv_xlate_extent *ext, size_t count)
+{
+    size_t done = 0;
+
+    for (size_t i = 0; i < count && ext[i].pa; i++) {
+        memcpy((u8 *)dst + done, (void *)ext[i].pa, ext[i].size);
+        done += ext[i].size;
+    }
+
+    return done;
+}
+
+size_t hv_scatter(const void *src, const struct hv_xlate_extent *ext, size_t count)
+{
+    size_t done = 0;
+
+    for (size_t i = 0; i < count && ext[i].pa; i++) {
+        memcpy((void *)ext[i].pa, (const u8 *)src + done, ext[i].size);
+        done += ext[i].size;
+    }
+
+    return done;
+}
+
 u64 hv_pt_walk(u64 addr)
 {
     dprintf("hv_pt_walk(0x%lx)\n", addr);
@@ -1143,6 +1203,8 @@ bool hv_handle_dabort(struct exc_info *ctx)
         return false;
     }
 
+    hv_prof_dabort(ipa);
+
     u64 pte = hv_pt_walk(ipa);
 
     if (!pte) {
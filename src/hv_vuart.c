@@ -6,6 +6,16 @@
 #include "uart.h"
 #include "uart_regs.h"
 #include "usb.h"
+#include "utils.h"
+
+/*
+ * The guest sees a UART with 16 byte FIFOs, like the real one. TX bytes are collected and sent
+ * to the iodev a FIFO's worth (or a line) at a time, RX bytes are read from the iodev in the
+ * same batches, and interrupts are only raised when a FIFO crosses its threshold, or for RX
+ * data that has been sitting below the threshold for a tick.
+ */
+#define VUART_FIFO_SIZE 16
+#define VUART_RX_THRESH 8
 
 bool active = false;
 
@@ -15,39 +25,77 @@ u32 ufstat = 0;
 
 int vuart_irq = 0;
 
-static void update_irq(void)
+static u8 tx_fifo[VUART_FIFO_SIZE];
+static u32 tx_count;
+
+static u8 rx_fifo[VUART_FIFO_SIZE];
+static u32 rx_head, rx_count;
+// Data arrived since the last poll tick, so the RX timeout hasn't run yet
+static bool rx_fresh;
+
+static DECLARE_SPINLOCK(vuart_lock);
+
+static void tx_flush(void)
 {
-    ssize_t rx_queued;
+    if (!tx_count)
+        return;
 
-    iodev_handle_events(IODEV_USB_VUART);
+    if (iodev_can_write(IODEV_USB_VUART))
+        iodev_write(IODEV_USB_VUART, tx_fifo, tx_count);
+    tx_count = 0;
+
+    // The FIFO just drained, so the guest can refill it
+    utrstat |= UTRSTAT_TXTHRESH;
+}
+
+static bool rx_fill(void)
+{
+    u8 buf[VUART_FIFO_SIZE];
+    ssize_t avail;
+
+    if (rx_count == VUART_FIFO_SIZE || !(avail = iodev_can_read(IODEV_USB_VUART)))
+        return false;
+
+    size_t space = VUART_FIFO_SIZE - rx_count;
+    ssize_t got = iodev_read(IODEV_USB_VUART, buf, min((size_t)avail, space));
+    for (ssize_t i = 0; i < got; i++)
+        rx_fifo[(rx_head + rx_count++) % VUART_FIFO_SIZE] = buf[i];
+
+    if (rx_count >= VUART_RX_THRESH)
+        utrstat |= UTRSTAT_RXTHRESH;
+    if (got > 0)
+        rx_fresh = true;
+
+    return got > 0;
+}
+
+static void update_irq(void)
+{
+    u32 pending = 0;
 
     utrstat |= UTRSTAT_TXBE | UTRSTAT_TXE;
     utrstat &= ~UTRSTAT_RXD;
-
-    ufstat = 0;
-    if ((rx_queued = iodev_can_read(IODEV_USB_VUART))) {
+    if (rx_count)
         utrstat |= UTRSTAT_RXD;
-        if (rx_queued > 15)
-            ufstat = FIELD_PREP(UFSTAT_RXCNT, 15) | UFSTAT_RXFULL;
-        else
-            ufstat = FIELD_PREP(UFSTAT_RXCNT, rx_queued);
 
-        if (FIELD_GET(UCON_RXMODE, ucon) == UCON_MODE_IRQ && ucon & UCON_RXTO_ENA) {
-            utrstat |= UTRSTAT_RXTO;
-        }
-    }
-
-    if (FIELD_GET(UCON_TXMODE, ucon) == UCON_MODE_IRQ && ucon & UCON_TXTHRESH_ENA) {
-        utrstat |= UTRSTAT_TXTHRESH;
+    ufstat = FIELD_PREP(UFSTAT_TXCNT, min(tx_count, 15U));
+    if (rx_count == VUART_FIFO_SIZE)
+        ufstat |= FIELD_PREP(UFSTAT_RXCNT, 15) | UFSTAT_RXFULL;
+    else
+        ufstat |= FIELD_PREP(UFSTAT_RXCNT, rx_count);
+
+    if (FIELD_GET(UCON_TXMODE, ucon) == UCON_MODE_IRQ && ucon & UCON_TXTHRESH_ENA)
+        pending |= utrstat & UTRSTAT_TXTHRESH;
+    if (FIELD_GET(UCON_RXMODE, ucon) == UCON_MODE_IRQ) {
+        if (ucon & UCON_RXTHRESH_ENA)
+            pending |= utrstat & UTRSTAT_RXTHRESH;
+        if (ucon & UCON_RXTO_ENA)
+            pending |= utrstat & UTRSTAT_RXTO;
     }
 
     if (vuart_irq) {
         uart_clear_irqs();
-        if (utrstat & (UTRSTAT_TXTHRESH | UTRSTAT_RXTHRESH | UTRSTAT_RXTO)) {
-            aic_set_sw(vuart_irq, true);
-        } else {
-            aic_set_sw(vuart_irq, false);
-        }
+        aic_set_sw(vuart_irq, !!pending);
     }
 
     //     printf("HV: vuart UTRSTAT=0x%x UFSTAT=0x%x UCON=0x%x\n", utrstat, ufstat, ucon);
@@ -84,18 +132,24 @@ static bool handle_vuart(struct exc_info *ctx, u64 addr, u64 *val, bool write, i
 
     addr &= 0xfff;
 
-    update_irq();
+    spin_lock(&vuart_lock);
 
     if (write) {
         //         printf("HV: vuart W 0x%lx <- 0x%lx (%d)\n", addr, *val, width);
         switch (addr) {
             case UCON:
+                // Enabling the TX interrupt with room in the FIFO raises it, as on hardware
+                if (*val & ~ucon & UCON_TXTHRESH_ENA)
+                    utrstat |= UTRSTAT_TXTHRESH;
                 ucon = *val;
                 break;
             case UTXH: {
                 uint8_t b = *val;
-                if (iodev_can_write(IODEV_USB_VUART))
-                    iodev_write(IODEV_USB_VUART, &b, 1);
+                tx_fifo[tx_count++] = b;
+                if (tx_count == VUART_FIFO_SIZE || b == '\n')
+                    tx_flush();
+                else
+                    hv_tick_kick(); // Keep polling fast while the guest is printing
                 handle_vuart_passthrough(b);
                 break;
             }
@@ -109,18 +163,26 @@ static bool handle_vuart(struct exc_info *ctx, u64 addr, u64 *val, bool write, i
                 *val = ucon;
                 break;
             case URXH:
-                if (iodev_can_read(IODEV_USB_VUART)) {
-                    uint8_t c;
-                    iodev_read(IODEV_USB_VUART, &c, 1);
-                    *val = c;
+                if (!rx_count)
+                    rx_fill();
+                if (rx_count) {
+                    *val = rx_fifo[rx_head];
+                    rx_head = (rx_head + 1) % VUART_FIFO_SIZE;
+                    rx_count--;
                 } else {
                     *val = 0;
                 }
                 break;
             case UTRSTAT:
+                if (!rx_count)
+                    rx_fill();
+                update_irq();
                 *val = utrstat;
                 break;
             case UFSTAT:
+                if (!rx_count)
+                    rx_fill();
+                update_irq();
                 *val = ufstat;
                 break;
             default:
@@ -130,15 +192,38 @@ static bool handle_vuart(struct exc_info *ctx, u64 addr, u64 *val, bool write, i
         //         printf("HV: vuart R 0x%lx -> 0x%lx (%d)\n", addr, *val, width);
     }
 
+    update_irq();
+    spin_unlock(&vuart_lock);
+
     return true;
 }
 
-void hv_vuart_poll(void)
+/* Returns whether there was any traffic to move */
+bool hv_vuart_poll(void)
 {
+    bool busy;
+
     if (!active)
-        return;
+        return false;
 
+    spin_lock(&vuart_lock);
+
+    iodev_handle_events(IODEV_USB_VUART);
+    busy = tx_count;
+    tx_flush();
+    // Leave input to a virtio console unless the guest is taking UART receive interrupts
+    if (FIELD_GET(UCON_RXMODE, ucon) == UCON_MODE_IRQ)
+        busy |= rx_fill();
+    // Data below the RX threshold that has waited a whole tick with nothing new behind it counts
+    // as the RX timeout, like the line going idle on real hardware
+    if (rx_count && !rx_fresh)
+        utrstat |= UTRSTAT_RXTO;
+    rx_fresh = false;
     update_irq();
+
+    spin_unlock(&vuart_lock);
+
+    return busy;
 }
 
 void hv_map_vuart(u64 base, int irq, iodev_id_t iodev)
@@ -13,6 +13,10 @@ void iovad_shutdown(iova_domain_t *iovad, dart_dev_t *dart);
 
 bool iova_reserve(iova_domain_t *iovad, u64 iova, size_t sz);
 u64 iova_alloc(iova_domain_t *iovad, size_t sz);
+u64 iova_alloc_aligned(iova_domain_t *iovad, size_t sz, u64 align);
 void iova_free(iova_domain_t *iovad, u64 iova, size_t sz);
 
+/* Free space in the domain and the size of its largest hole, both O(1) */
+void iova_stats(iova_domain_t *iovad, u64 *free_bytes, u64 *largest);
+
 #endif
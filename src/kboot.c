@@ -5,10 +5,12 @@
 #include "kboot.h"
 #include "adt.h"
 #include "assert.h"
+#include "bootprof.h"
 #include "clk.h"
 #include "dapf.h"
 #include "devicetree.h"
 #include "display.h"
+#include "dtree.h"
 #include "exception.h"
 #include "firmware.h"
 #include "iodev.h"
@@ -39,15 +41,15 @@
 
 #define MAX_MEM_REGIONS 32
 
-static void *dt = NULL;
-static int dt_bufsize = 0;
+static dtree_t *dt = NULL;
+static void *dt_blob = NULL;
 static void *initrd_start = NULL;
 static size_t initrd_size = 0;
 static char *chosen_params[MAX_CHOSEN_PARAMS][2];
 
 extern const char *const m1n1_version;
 
-int dt_set_gpu(void *dt);
+int dt_set_gpu(dtree_t *dt);
 
 #define DT_ALIGN 16384
 
@@ -119,9 +121,9 @@ static int dt_set_rng_seed_sep(int node)
     if (sep_get_random(rng_seed, sizeof(rng_seed)) != sizeof(rng_seed))
         bail("SEP: couldn't get enough random bytes for RNG seed\n");
 
-    if (fdt_setprop_u64(dt, node, "kaslr-seed", kaslr_seed))
+    if (dtree_setprop_u64(dt, node, "kaslr-seed", kaslr_seed))
         bail("FDT: couldn't set kaslr-seed\n");
-    if (fdt_setprop(dt, node, "rng-seed", rng_seed, sizeof(rng_seed)))
+    if (dtree_setprop(dt, node, "rng-seed", rng_seed, sizeof(rng_seed)))
         bail("FDT: couldn't set rng-seed\n");
 
     printf("FDT: Passing %ld bytes of KASLR seed and %ld bytes of random seed\n",
@@ -160,7 +162,7 @@ static int dt_set_rng_seed_adt(int node)
 
             kaslr_seed ^= (u64)cur_boot_args.virt_base;
 
-            if (fdt_setprop_u64(dt, node, "kaslr-seed", kaslr_seed))
+            if (dtree_setprop_u64(dt, node, "kaslr-seed", kaslr_seed))
                 bail("FDT: couldn't set kaslr-seed\n");
 
             printf("FDT: KASLR seed initialized\n");
@@ -169,7 +171,7 @@ static int dt_set_rng_seed_adt(int node)
         }
 
         if (seed_length) {
-            if (fdt_setprop(dt, node, "rng-seed", random_seed, seed_length))
+            if (dtree_setprop(dt, node, "rng-seed", random_seed, seed_length))
                 bail("FDT: couldn't set rng-seed\n");
 
             printf("FDT: Passing %d bytes of random seed\n", seed_length);
@@ -188,7 +190,7 @@ static int dt_set_fb(void)
         return 0;
     }
 
-    int fb = fdt_path_offset(dt, "/chosen/framebuffer");
+    int fb = dtree_path_offset(dt, "/chosen/framebuffer");
 
     if (fb < 0) {
         printf("FDT: No framebuffer found\n");
@@ -207,19 +209,19 @@ static int dt_set_fb(void)
 
     snprintf(fbname, sizeof(fbname), "framebuffer@%lx", fb_base);
 
-    if (fdt_setprop(dt, fb, "reg", fbreg, sizeof(fbreg)))
+    if (dtree_setprop(dt, fb, "reg", fbreg, sizeof(fbreg)))
         bail("FDT: couldn't set framebuffer.reg property\n");
 
-    if (fdt_set_name(dt, fb, fbname))
+    if (dtree_set_name(dt, fb, fbname))
         bail("FDT: couldn't set framebuffer name\n");
 
-    if (fdt_setprop_u32(dt, fb, "width", cur_boot_args.video.width))
+    if (dtree_setprop_u32(dt, fb, "width", cur_boot_args.video.width))
         bail("FDT: couldn't set framebuffer width\n");
 
-    if (fdt_setprop_u32(dt, fb, "height", fb_height))
+    if (dtree_setprop_u32(dt, fb, "height", fb_height))
         bail("FDT: couldn't set framebuffer height\n");
 
-    if (fdt_setprop_u32(dt, fb, "stride", cur_boot_args.video.stride))
+    if (dtree_setprop_u32(dt, fb, "stride", cur_boot_args.video.stride))
         bail("FDT: couldn't set framebuffer stride\n");
 
     const char *format = NULL;
@@ -239,10 +241,10 @@ static int dt_set_fb(void)
             return 0; // Do not error out, but don't set the FB
     }
 
-    if (fdt_setprop_string(dt, fb, "format", format))
+    if (dtree_setprop_string(dt, fb, "format", format))
         bail("FDT: couldn't set framebuffer format\n");
 
-    fdt_delprop(dt, fb, "status"); // may fail if it does not exist
+    dtree_delprop(dt, fb, "status"); // may fail if it does not exist
 
     printf("FDT: %s base 0x%lx size 0x%lx\n", fbname, fb_base, fb_size);
 
@@ -251,10 +253,10 @@ static int dt_set_fb(void)
 
     // save notch height in the dcp node if present
     if (cur_boot_args.video.height - fb_height) {
-        int dcp = fdt_path_offset(dt, "dcp");
+        int dcp = dtree_path_offset(dt, "dcp");
         if (dcp >= 0)
-            if (fdt_appendprop_u32(dt, dcp, "apple,notch-height",
-                                   cur_boot_args.video.height - fb_height))
+            if (dtree_appendprop_u32(dt, dcp, "apple,notch-height",
+                                     cur_boot_args.video.height - fb_height))
                 printf("FDT: couldn't set apple,notch-height\n");
     }
 
@@ -264,7 +266,7 @@ static int dt_set_fb(void)
 static int dt_set_chosen(void)
 {
 
-    int node = fdt_path_offset(dt, "/chosen");
+    int node = dtree_path_offset(dt, "/chosen");
     if (node < 0)
         bail("FDT: /chosen node not found in devtree\n");
 
@@ -274,20 +276,20 @@ static int dt_set_chosen(void)
 
         const char *name = chosen_params[i][0];
         const char *value = chosen_params[i][1];
-        if (fdt_setprop(dt, node, name, value, strlen(value) + 1) < 0)
+        if (dtree_setprop(dt, node, name, value, strlen(value) + 1) < 0)
             bail("FDT: couldn't set chosen.%s property\n", name);
         printf("FDT: %s = '%s'\n", name, value);
     }
 
     if (initrd_start && initrd_size) {
-        if (fdt_setprop_u64(dt, node, "linux,initrd-start", (u64)initrd_start))
+        if (dtree_setprop_u64(dt, node, "linux,initrd-start", (u64)initrd_start))
             bail("FDT: couldn't set chosen.linux,initrd-start property\n");
 
         u64 end = ((u64)initrd_start) + initrd_size;
-        if (fdt_setprop_u64(dt, node, "linux,initrd-end", end))
+        if (dtree_setprop_u64(dt, node, "linux,initrd-end", end))
             bail("FDT: couldn't set chosen.linux,initrd-end property\n");
 
-        if (fdt_add_mem_rsv(dt, (u64)initrd_start, initrd_size))
+        if (dtree_add_mem_rsv(dt, (u64)initrd_start, initrd_size))
             bail("FDT: couldn't add reservation for the initrd\n");
 
         printf("FDT: initrd at %p size 0x%lx\n", initrd_start, initrd_size);
@@ -296,29 +298,30 @@ static int dt_set_chosen(void)
     if (dt_set_fb())
         return -1;
 
-    node = fdt_path_offset(dt, "/chosen");
+    node = dtree_path_offset(dt, "/chosen");
     if (node < 0)
         bail("FDT: /chosen node not found in devtree\n");
 
     if (is_mac) {
-        if (fdt_setprop(dt, node, "asahi,iboot1-version", system_firmware.iboot,
-                        strlen(system_firmware.iboot) + 1))
+        if (dtree_setprop(dt, node, "asahi,iboot1-version", system_firmware.iboot,
+                          strlen(system_firmware.iboot) + 1))
             bail("FDT: couldn't set asahi,iboot1-version\n");
 
-        if (fdt_setprop(dt, node, "asahi,system-fw-version", system_firmware.string,
-                        strlen(system_firmware.string) + 1))
+        if (dtree_setprop(dt, node, "asahi,system-fw-version", system_firmware.string,
+                          strlen(system_firmware.string) + 1))
             bail("FDT: couldn't set asahi,system-fw-version\n");
     }
 
-    if (fdt_setprop(dt, node, "asahi,iboot2-version", os_firmware.iboot,
-                    strlen(os_firmware.iboot) + 1))
+    if (dtree_setprop(dt, node, "asahi,iboot2-version", os_firmware.iboot,
+                      strlen(os_firmware.iboot) + 1))
         bail("FDT: couldn't set asahi,iboot2-version\n");
 
-    if (fdt_setprop(dt, node, "asahi,os-fw-version", os_firmware.string,
-                    strlen(os_firmware.string) + 1))
+    if (dtree_setprop(dt, node, "asahi,os-fw-version", os_firmware.string,
+                      strlen(os_firmware.string) + 1))
         bail("FDT: couldn't set asahi,os-fw-version\n");
 
-    if (fdt_setprop(dt, node, "asahi,m1n1-stage2-version", m1n1_version, strlen(m1n1_version) + 1))
+    if (dtree_setprop(dt, node, "asahi,m1n1-stage2-version", m1n1_version,
+                      strlen(m1n1_version) + 1))
         bail("FDT: couldn't set asahi,m1n1-stage2-version\n");
 
     if (dt_set_rng_seed_sep(node))
@@ -363,24 +366,24 @@ static int dt_set_memory(void)
     } memreg[MAX_MEM_REGIONS] = {{cpu_to_fdt64(dram_min), cpu_to_fdt64(dram_max - dram_min)}};
     int num_regions = 1;
 
-    int resv_node = fdt_path_offset(dt, "/reserved-memory");
+    int resv_node = dtree_path_offset(dt, "/reserved-memory");
     if (resv_node < 0) {
         printf("FDT: '/reserved-memory' not found\n");
     } else {
         int node;
 
         /* Find all reserved memory nodes */
-        fdt_for_each_subnode(node, dt, resv_node)
+        dtree_for_each_subnode(node, dt, resv_node)
         {
-            const char *name = fdt_get_name(dt, node, NULL);
-            const char *status = fdt_getprop(dt, node, "status", NULL);
+            const char *name = dtree_get_name(dt, node, NULL);
+            const char *status = dtree_getprop(dt, node, "status", NULL);
             if (status && !strcmp(status, "disabled"))
                 continue;
 
-            if (fdt_getprop(dt, node, "no-map", NULL))
+            if (dtree_getprop(dt, node, "no-map", NULL))
                 continue;
 
-            const fdt64_t *reg = fdt_getprop(dt, node, "reg", NULL);
+            const fdt64_t *reg = dtree_getprop(dt, node, "reg", NULL);
             if (!reg)
                 continue;
 
@@ -421,11 +424,11 @@ static int dt_set_memory(void)
         }
     }
 
-    int node = fdt_path_offset(dt, "/memory");
+    int node = dtree_path_offset(dt, "/memory");
     if (node < 0)
         bail("FDT: /memory node not found in devtree\n");
 
-    if (fdt_setprop(dt, node, "reg", memreg, sizeof(memreg[0]) * num_regions))
+    if (dtree_setprop(dt, node, "reg", memreg, sizeof(memreg[0]) * num_regions))
         bail("FDT: couldn't set memory.reg property\n");
 
     return 0;
@@ -434,7 +437,7 @@ static int dt_set_memory(void)
 static int dt_set_serial_number(void)
 {
 
-    int fdt_root = fdt_path_offset(dt, "/");
+    int fdt_root = dtree_path_offset(dt, "/");
     int adt_root = adt_path_offset(adt, "/");
 
     if (fdt_root < 0)
@@ -444,7 +447,7 @@ static int dt_set_serial_number(void)
 
     u32 sn_len;
     const char *serial_number = adt_getprop(adt, adt_root, "serial-number", &sn_len);
-    if (fdt_setprop_string(dt, fdt_root, "serial-number", serial_number))
+    if (dtree_setprop_string(dt, fdt_root, "serial-number", serial_number))
         bail("FDT: unable to set device serial number!\n");
     printf("FDT: reporting device serial number: %s\n", serial_number);
 
@@ -455,7 +458,7 @@ static int dt_set_cpus(void)
 {
     int ret = 0;
 
-    int cpus = fdt_path_offset(dt, "/cpus");
+    int cpus = dtree_path_offset(dt, "/cpus");
     if (cpus < 0)
         bail("FDT: /cpus node not found in devtree\n");
 
@@ -466,15 +469,15 @@ static int dt_set_cpus(void)
 
     /* Prune CPU nodes */
     int node, cpu = 0;
-    for (node = fdt_first_subnode(dt, cpus); node >= 0;) {
-        const char *name = fdt_get_name(dt, node, NULL);
+    for (node = dtree_first_subnode(dt, cpus); node >= 0;) {
+        const char *name = dtree_get_name(dt, node, NULL);
         if (strncmp(name, "cpu@", 4))
             goto next_node;
 
         if (cpu > MAX_CPUS)
             bail_cleanup("Maximum number of CPUs exceeded, consider increasing MAX_CPUS\n");
 
-        const fdt64_t *prop = fdt_getprop(dt, node, "reg", NULL);
+        const fdt64_t *prop = dtree_getprop(dt, node, "reg", NULL);
         if (!prop)
             bail_cleanup("FDT: failed to get reg property of CPU\n");
 
@@ -485,20 +488,20 @@ static int dt_set_cpus(void)
 
         if (!smp_is_alive(cpu)) {
             printf("FDT: CPU %d is not alive, disabling...\n", cpu);
-            pruned_phandles[pruned++] = fdt_get_phandle(dt, node);
+            pruned_phandles[pruned++] = dtree_get_phandle(dt, node);
 
-            int next = fdt_next_subnode(dt, node);
-            fdt_nop_node(dt, node);
+            int next = dtree_next_subnode(dt, node);
+            dtree_nop_node(dt, node);
             cpu++;
             node = next;
             continue;
         } else {
             printf("FDT: Reserving stack for CPU %d 0x%lx\n", cpu, (uint64_t)secondary_stacks[cpu]);
-            fdt_add_mem_rsv(dt, (uint64_t)secondary_stacks[cpu], SECONDARY_STACK_SIZE);
+            dtree_add_mem_rsv(dt, (uint64_t)secondary_stacks[cpu], SECONDARY_STACK_SIZE);
             if (has_el3()) {
                 printf("FDT: Reserving EL3 stack for CPU %d 0x%lx\n", cpu,
                        (uint64_t)secondary_stacks_el3[cpu]);
-                fdt_add_mem_rsv(dt, (uint64_t)secondary_stacks_el3[cpu], SECONDARY_STACK_SIZE);
+                dtree_add_mem_rsv(dt, (uint64_t)secondary_stacks_el3[cpu], SECONDARY_STACK_SIZE);
             }
         }
 
@@ -508,7 +511,7 @@ static int dt_set_cpus(void)
             bail_cleanup("FDT: DT CPU %d MPIDR mismatch: 0x%lx != 0x%lx\n", cpu, dt_mpidr, mpidr);
 
         u64 release_addr = smp_get_release_addr(cpu);
-        if (fdt_setprop_inplace_u64(dt, node, "cpu-release-addr", release_addr))
+        if (dtree_setprop_inplace_u64(dt, node, "cpu-release-addr", release_addr))
             bail_cleanup("FDT: couldn't set cpu-release-addr property\n");
 
         printf("FDT: CPU %d MPIDR=0x%lx release-addr=0x%lx\n", cpu, mpidr, release_addr);
@@ -516,7 +519,7 @@ static int dt_set_cpus(void)
     next_cpu:
         cpu++;
     next_node:
-        node = fdt_next_subnode(dt, node);
+        node = dtree_next_subnode(dt, node);
     }
 
     if ((node < 0) && (node != -FDT_ERR_NOTFOUND)) {
@@ -524,23 +527,23 @@ static int dt_set_cpus(void)
     }
 
     /* Prune AIC PMU affinities */
-    int aic = fdt_node_offset_by_compatible(dt, -1, "apple,aic");
+    int aic = dtree_node_offset_by_compatible(dt, -1, "apple,aic");
     if (aic == -FDT_ERR_NOTFOUND)
-        aic = fdt_node_offset_by_compatible(dt, -1, "apple,aic2");
+        aic = dtree_node_offset_by_compatible(dt, -1, "apple,aic2");
     if (aic == -FDT_ERR_NOTFOUND)
-        aic = fdt_node_offset_by_compatible(dt, -1, "apple,aic3");
+        aic = dtree_node_offset_by_compatible(dt, -1, "apple,aic3");
     if (aic < 0)
         bail_cleanup("FDT: Failed to find AIC node\n");
 
-    int affinities = fdt_subnode_offset(dt, aic, "affinities");
+    int affinities = dtree_subnode_offset(dt, aic, "affinities");
     if (affinities < 0) {
         printf("FDT: Failed to find AIC affinities node, ignoring...\n");
     } else {
         int node;
-        for (node = fdt_first_subnode(dt, affinities); node >= 0;
-             node = fdt_next_subnode(dt, node)) {
+        for (node = dtree_first_subnode(dt, affinities); node >= 0;
+             node = dtree_next_subnode(dt, node)) {
             int len;
-            const fdt32_t *phs = fdt_getprop(dt, node, "cpus", &len);
+            const fdt32_t *phs = dtree_getprop(dt, node, "cpus", &len);
             if (!phs)
                 bail_cleanup("FDT: Failed to find cpus property under AIC affinity\n");
 
@@ -562,13 +565,13 @@ static int dt_set_cpus(void)
                     new_phs[index++] = phs[i];
             }
 
-            ret = fdt_setprop(dt, node, "cpus", new_phs, sizeof(fdt32_t) * index);
+            ret = dtree_setprop(dt, node, "cpus", new_phs, sizeof(fdt32_t) * index);
             free(new_phs);
 
             if (ret < 0)
                 bail_cleanup("FDT: Failed to set cpus property under AIC affinity\n");
 
-            const char *name = fdt_get_name(dt, node, NULL);
+            const char *name = dtree_get_name(dt, node, NULL);
             printf("FDT: Pruned %ld/%ld CPU references in [AIC]/affinities/%s\n", count - index,
                    count, name);
         }
@@ -578,7 +581,7 @@ static int dt_set_cpus(void)
     }
 
     /* Prune CPU-map */
-    int cpu_map = fdt_path_offset(dt, "/cpus/cpu-map");
+    int cpu_map = dtree_path_offset(dt, "/cpus/cpu-map");
     if (cpu_map < 0) {
         printf("FDT: /cpus/cpu-map node not found in devtree, ignoring...\n");
         free(pruned_phandles);
@@ -587,22 +590,22 @@ static int dt_set_cpus(void)
 
     int cluster_idx = 0;
     int cluster_node;
-    for (cluster_node = fdt_first_subnode(dt, cpu_map); cluster_node >= 0;) {
-        const char *name = fdt_get_name(dt, cluster_node, NULL);
+    for (cluster_node = dtree_first_subnode(dt, cpu_map); cluster_node >= 0;) {
+        const char *name = dtree_get_name(dt, cluster_node, NULL);
         int cpu_idx = 0;
 
         if (strncmp(name, "cluster", 7))
             goto next_cluster;
 
         int cpu_node;
-        for (cpu_node = fdt_first_subnode(dt, cluster_node); cpu_node >= 0;) {
-            const char *cpu_name = fdt_get_name(dt, cpu_node, NULL);
+        for (cpu_node = dtree_first_subnode(dt, cluster_node); cpu_node >= 0;) {
+            const char *cpu_name = dtree_get_name(dt, cpu_node, NULL);
 
             if (strncmp(cpu_name, "core", 4))
                 goto next_map_cpu;
 
             int len;
-            const fdt32_t *cpu_ph = fdt_getprop(dt, cpu_node, "cpu", &len);
+            const fdt32_t *cpu_ph = dtree_getprop(dt, cpu_node, "cpu", &len);
 
             if (!cpu_ph || len != sizeof(*cpu_ph))
                 bail_cleanup("FDT: Failed to get cpu prop for /cpus/cpu-map/%s/%s\n", name,
@@ -620,18 +623,18 @@ static int dt_set_cpus(void)
             if (prune) {
                 printf("FDT: Pruning /cpus/cpu-map/%s/%s\n", name, cpu_name);
 
-                int next = fdt_next_subnode(dt, cpu_node);
-                fdt_nop_node(dt, cpu_node);
+                int next = dtree_next_subnode(dt, cpu_node);
+                dtree_nop_node(dt, cpu_node);
                 cpu_node = next;
                 continue;
             } else {
                 char new_name[16];
 
                 snprintf(new_name, 16, "core%d", cpu_idx++);
-                fdt_set_name(dt, cpu_node, new_name);
+                dtree_set_name(dt, cpu_node, new_name);
             }
         next_map_cpu:
-            cpu_node = fdt_next_subnode(dt, cpu_node);
+            cpu_node = dtree_next_subnode(dt, cpu_node);
         }
 
         if ((cpu_node < 0) && (cpu_node != -FDT_ERR_NOTFOUND))
@@ -640,18 +643,18 @@ static int dt_set_cpus(void)
         if (cpu_idx == 0) {
             printf("FDT: Pruning /cpus/cpu-map/%s\n", name);
 
-            int next = fdt_next_subnode(dt, cluster_node);
-            fdt_nop_node(dt, cluster_node);
+            int next = dtree_next_subnode(dt, cluster_node);
+            dtree_nop_node(dt, cluster_node);
             cluster_node = next;
             continue;
         } else {
             char new_name[16];
 
             snprintf(new_name, 16, "cluster%d", cluster_idx++);
-            fdt_set_name(dt, cluster_node, new_name);
+            dtree_set_name(dt, cluster_node, new_name);
         }
     next_cluster:
-        cluster_node = fdt_next_subnode(dt, cluster_node);
+        cluster_node = dtree_next_subnode(dt, cluster_node);
     }
 
     if ((cluster_node < 0) && (cluster_node != -FDT_ERR_NOTFOUND))
@@ -711,15 +714,15 @@ static int dt_set_mac_addresses(void)
             }
         }
 
-        const char *path = fdt_get_alias(dt, mac_address_devices[i].alias);
+        const char *path = dtree_get_alias(dt, mac_address_devices[i].alias);
         if (path == NULL)
             continue;
 
-        int node = fdt_path_offset(dt, path);
+        int node = dtree_path_offset(dt, path);
         if (node < 0)
             continue;
 
-        fdt_setprop(dt, node, mac_address_devices[i].fdt_property, addr, sizeof(addr));
+        dtree_setprop(dt, node, mac_address_devices[i].fdt_property, addr, sizeof(addr));
     }
 
     return 0;
@@ -733,7 +736,7 @@ static int dt_set_bluetooth_cal(int anode, int node, const char *adt_name, const
     if (!cal_blob || !len)
         bail("ADT: Failed to get %s\n", adt_name);
 
-    fdt_setprop(dt, node, fdt_name, cal_blob, len);
+    dtree_setprop(dt, node, fdt_name, cal_blob, len);
     return 0;
 }
 
@@ -751,11 +754,11 @@ static int dt_set_bluetooth(void)
         return 0;
     }
 
-    const char *path = fdt_get_alias(dt, "bluetooth0");
+    const char *path = dtree_get_alias(dt, "bluetooth0");
     if (path == NULL)
         return 0;
 
-    int node = fdt_path_offset(dt, path);
+    int node = dtree_path_offset(dt, path);
     if (node < 0)
         return 0;
 
@@ -773,18 +776,18 @@ static int dt_set_bluetooth(void)
 
 static int dt_set_multitouch(void)
 {
-    const char *path = fdt_get_alias(dt, "touchbar0");
+    const char *path = dtree_get_alias(dt, "touchbar0");
     if (path == NULL)
         return 0;
 
-    int node = fdt_path_offset(dt, path);
+    int node = dtree_path_offset(dt, path);
     if (node < 0)
         bail("FDT: alias points at nonexistent node\n");
 
     const char *adt_touchbar;
-    if (fdt_node_check_compatible(dt, 0, "apple,j293") == 0)
+    if (dtree_node_check_compatible(dt, 0, "apple,j293") == 0)
         adt_touchbar = "/arm-io/spi0/multi-touch";
-    else if (fdt_node_check_compatible(dt, 0, "apple,j493") == 0)
+    else if (dtree_node_check_compatible(dt, 0, "apple,j493") == 0)
         adt_touchbar = "/arm-io/spi3/touch-bar";
     else
         return 0;
@@ -800,7 +803,7 @@ static int dt_set_multitouch(void)
         return 0;
     }
 
-    fdt_setprop(dt, node, "apple,z2-cal-blob", cal_blob, len);
+    dtree_setprop(dt, node, "apple,z2-cal-blob", cal_blob, len);
     return 0;
 }
 
@@ -808,7 +811,7 @@ static int dt_set_multitouch(void)
 
 static int dt_set_ipd(void)
 {
-    int chosen = fdt_path_offset(dt, "/chosen");
+    int chosen = dtree_path_offset(dt, "/chosen");
     if (chosen < 0)
         bail("FDT: /chosen node not found in devtree\n");
 
@@ -829,23 +832,23 @@ static int dt_set_ipd(void)
     }
     u8 code = kblang[1];
 
-    if (fdt_setprop_u32(dt, chosen, "asahi,kblang-code", code))
+    if (dtree_setprop_u32(dt, chosen, "asahi,kblang-code", code))
         bail("FDT: couldn't set asahi,kblang-code\n");
 
-    const char *path = fdt_get_alias(dt, "keyboard");
+    const char *path = dtree_get_alias(dt, "keyboard");
     if (path == NULL)
         return 0;
 
-    int node = fdt_path_offset(dt, path);
+    int node = dtree_path_offset(dt, path);
     if (node < 0)
         bail("FDT: keyboard alias points at nonexistent node\n");
 
-    if (fdt_setprop_u32(dt, node, "apple,keyboard-layout-id", code))
+    if (dtree_setprop_u32(dt, node, "apple,keyboard-layout-id", code))
         bail("FDT: couldn't set apple,keyboard-layout-id\n");
 
     if (code >= ARRAY_SIZE(keyboard_types))
         printf("ADT: kblang code out of range, not setting country code\n");
-    else if (fdt_setprop_u32(dt, node, "hid-country-code", keyboard_types[code]))
+    else if (dtree_setprop_u32(dt, node, "hid-country-code", keyboard_types[code]))
         bail("FDT: couldn't set hid-country-code\n");
 
     return 0;
@@ -882,7 +885,7 @@ static int dt_set_nvram(void)
         return 0;
     }
 
-    int node = fdt_path_offset(dt, "nvram");
+    int node = dtree_path_offset(dt, "nvram");
     if (node < 0) {
         printf("DT: nvram alias/partition not found\n");
         return 0;
@@ -891,12 +894,12 @@ static int dt_set_nvram(void)
     fdt32_t reg[2];
     fdt32_st(reg + 0, start);
     fdt32_st(reg + 1, size);
-    if (fdt_setprop(dt, node, "reg", reg, sizeof(reg))) {
+    if (dtree_setprop(dt, node, "reg", reg, sizeof(reg))) {
         printf("FDT: couldn't set nvram.reg\n");
         return 0;
     }
 
-    if (fdt_setprop_string(dt, node, "status", "okay") < 0)
+    if (dtree_setprop_string(dt, node, "status", "okay") < 0)
         printf("FDT: failed to enable nvram partition node\n");
 
     return 0;
@@ -919,17 +922,17 @@ static int dt_set_wifi(void)
     if (ADT_GETPROP_ARRAY(adt, anode, "wifi-antenna-sku-info", info) < 0)
         bail("ADT: Failed to get wifi-antenna-sku-info\n");
 
-    const char *path = fdt_get_alias(dt, "wifi0");
+    const char *path = dtree_get_alias(dt, "wifi0");
     if (path == NULL)
         return 0;
 
-    int node = fdt_path_offset(dt, path);
+    int node = dtree_path_offset(dt, path);
     if (node < 0)
         return 0;
 
     char antenna[8];
     memcpy(antenna, &info[8], sizeof(antenna));
-    fdt_setprop_string(dt, node, "apple,antenna-sku", antenna);
+    dtree_setprop_string(dt, node, "apple,antenna-sku", antenna);
 
     u32 len;
     const u8 *cal_blob = adt_getprop(adt, anode, "wifi-calibration-msf", &len);
@@ -937,7 +940,7 @@ static int dt_set_wifi(void)
     if (!cal_blob || !len)
         bail("ADT: Failed to get wifi-calibration-msf\n");
 
-    fdt_setprop(dt, node, "brcm,cal-blob", cal_blob, len);
+    dtree_setprop(dt, node, "brcm,cal-blob", cal_blob, len);
 
     return 0;
 }
@@ -945,12 +948,12 @@ static int dt_set_wifi(void)
 static void dt_set_uboot_dm_preloc(int node)
 {
     // Tell U-Boot to bind this node early
-    fdt_setprop_empty(dt, node, "u-boot,dm-pre-reloc");
-    fdt_setprop_empty(dt, node, "bootph-all");
+    dtree_setprop_empty(dt, node, "u-boot,dm-pre-reloc");
+    dtree_setprop_empty(dt, node, "bootph-all");
 
     // Make sure the power domains are bound early as well
     int pds_size;
-    const fdt32_t *pds = fdt_getprop(dt, node, "power-domains", &pds_size);
+    const fdt32_t *pds = dtree_getprop(dt, node, "power-domains", &pds_size);
     if (!pds)
         return;
 
@@ -962,18 +965,18 @@ static void dt_set_uboot_dm_preloc(int node)
     memcpy(phandles, pds, pds_size);
 
     for (int i = 0; i < pds_size / 4; i++) {
-        node = fdt_node_offset_by_phandle(dt, fdt32_ld(&phandles[i]));
+        node = dtree_node_offset_by_phandle(dt, fdt32_ld(&phandles[i]));
         if (node < 0)
             continue;
         dt_set_uboot_dm_preloc(node);
 
         // restore node offset after DT update
-        node = fdt_node_offset_by_phandle(dt, fdt32_ld(&phandles[i]));
+        node = dtree_node_offset_by_phandle(dt, fdt32_ld(&phandles[i]));
         if (node < 0)
             continue;
 
         // And make sure the PMGR node is bound early too
-        node = fdt_parent_offset(dt, node);
+        node = dtree_parent_offset(dt, node);
         if (node < 0)
             continue;
         dt_set_uboot_dm_preloc(node);
@@ -989,11 +992,11 @@ static int dt_set_uboot(void)
     // power domains it depends on with a "u-boot,dm-pre-reloc"
     // property.
 
-    const char *path = fdt_get_alias(dt, "serial0");
+    const char *path = dtree_get_alias(dt, "serial0");
     if (path == NULL)
         return 0;
 
-    int node = fdt_path_offset(dt, path);
+    int node = dtree_path_offset(dt, path);
     if (node < 0)
         return 0;
 
@@ -1082,12 +1085,12 @@ static int dt_append_acio_tunable(int adt_node, int fdt_node,
             return -1;
         }
 
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name,
-                               tunable->offset + tunable_info->reg_offset) < 0)
+        if (dtree_appendprop_u32(dt, fdt_node, tunable_info->fdt_name,
+                                 tunable->offset + tunable_info->reg_offset) < 0)
             return -1;
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->mask) < 0)
+        if (dtree_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->mask) < 0)
             return -1;
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->value) < 0)
+        if (dtree_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->value) < 0)
             return -1;
     }
 
@@ -1100,11 +1103,11 @@ static int dt_copy_usb4_drom(const char *adt_path, const char *dt_alias)
     if (adt_node < 0)
         return -1;
 
-    const char *fdt_path = fdt_get_alias(dt, dt_alias);
+    const char *fdt_path = dtree_get_alias(dt, dt_alias);
     if (fdt_path == NULL)
         bail("FDT: Unable to find alias %s\n", dt_alias);
 
-    int fdt_node = fdt_path_offset(dt, fdt_path);
+    int fdt_node = dtree_path_offset(dt, fdt_path);
     if (fdt_node < 0)
         bail("FDT: Unable to find path %s for alias %s\n", fdt_path, dt_alias);
 
@@ -1113,7 +1116,7 @@ static int dt_copy_usb4_drom(const char *adt_path, const char *dt_alias)
     if (!drom_blob || !drom_len)
         bail("ADT: Failed to get thunderbolt-drom\n");
 
-    return fdt_setprop(dt, fdt_node, "apple,thunderbolt-drom", drom_blob, drom_len);
+    return dtree_setprop(dt, fdt_node, "apple,thunderbolt-drom", drom_blob, drom_len);
 }
 
 static int dt_copy_acio_tunables(const char *adt_path, const char *dt_alias,
@@ -1124,11 +1127,11 @@ static int dt_copy_acio_tunables(const char *adt_path, const char *dt_alias,
     if (adt_node < 0)
         return -1;
 
-    const char *fdt_path = fdt_get_alias(dt, dt_alias);
+    const char *fdt_path = dtree_get_alias(dt, dt_alias);
     if (fdt_path == NULL)
         bail("FDT: Unable to find alias %s\n", dt_alias);
 
-    int fdt_node = fdt_path_offset(dt, fdt_path);
+    int fdt_node = dtree_path_offset(dt, fdt_path);
     if (fdt_node < 0)
         bail("FDT: Unable to find path %s for alias %s\n", fdt_path, dt_alias);
 
@@ -1142,7 +1145,7 @@ static int dt_copy_acio_tunables(const char *adt_path, const char *dt_alias,
 
 err:
     for (size_t i = 0; i < n_tunables; ++i)
-        fdt_delprop(dt, fdt_node, tunables[i].fdt_name);
+        dtree_delprop(dt, fdt_node, tunables[i].fdt_name);
 
     return -1;
 }
@@ -1198,15 +1201,15 @@ static int dt_copy_pciec_tunables(const char *adt_path, const char *dt_alias)
     if (adt_node < 0)
         return -1;
 
-    const char *fdt_path = fdt_get_alias(dt, dt_alias);
+    const char *fdt_path = dtree_get_alias(dt, dt_alias);
     if (fdt_path == NULL)
         bail("FDT: Unable to find alias %s\n", dt_alias);
 
-    int fdt_node = fdt_path_offset(dt, fdt_path);
+    int fdt_node = dtree_path_offset(dt, fdt_path);
     if (fdt_node < 0)
         bail("FDT: Unable to find path %s for alias %s\n", fdt_path, dt_alias);
 
-    int fdt_port_node = fdt_first_subnode(dt, fdt_node);
+    int fdt_port_node = dtree_first_subnode(dt, fdt_node);
     if (fdt_port_node < 0)
         bail("FDT: Unable to find port node for %s\n", fdt_path);
 
@@ -1224,8 +1227,8 @@ static int dt_copy_pciec_tunables(const char *adt_path, const char *dt_alias)
 
 err:
     for (size_t i = 0; i < sizeof(pciec_tunables) / sizeof(*pciec_tunables); ++i)
-        fdt_delprop(dt, fdt_node, pciec_tunables[i].fdt_name);
-    fdt_delprop(dt, fdt_port_node, pciec_port_tunable.fdt_name);
+        dtree_delprop(dt, fdt_node, pciec_tunables[i].fdt_name);
+    dtree_delprop(dt, fdt_port_node, pciec_port_tunable.fdt_name);
 
     return -1;
 }
@@ -1252,7 +1255,7 @@ static int dt_get_iommu_node(int node, u32 num)
 {
     int len;
     assert(num < 32);
-    const void *prop = fdt_getprop(dt, node, "iommus", &len);
+    const void *prop = dtree_getprop(dt, node, "iommus", &len);
     if (!prop || len < 0 || (u32)len < 8 * (num + 1)) {
         printf("FDT: unexpected 'iommus' prop / len %d\n", len);
         return -FDT_ERR_NOTFOUND;
@@ -1261,14 +1264,14 @@ static int dt_get_iommu_node(int node, u32 num)
     const fdt32_t *iommus = prop;
     uint32_t phandle = fdt32_ld(&iommus[num * 2]);
 
-    return fdt_node_offset_by_phandle(dt, phandle);
+    return dtree_node_offset_by_phandle(dt, phandle);
 }
 
 static dart_dev_t *dt_init_dart_by_node(int node, u32 num)
 {
     int len;
     assert(num < 32);
-    const void *prop = fdt_getprop(dt, node, "iommus", &len);
+    const void *prop = dtree_getprop(dt, node, "iommus", &len);
     if (!prop || len < 0 || (u32)len < 8 * (num + 1)) {
         printf("FDT: unexpected 'iommus' prop / len %d\n", len);
         return NULL;
@@ -1305,15 +1308,15 @@ static int dt_device_set_reserved_mem(int node, const char *name, uint32_t phand
 {
     int ret;
 
-    ret = fdt_appendprop_u32(dt, node, "iommu-addresses", phandle);
+    ret = dtree_appendprop_u32(dt, node, "iommu-addresses", phandle);
     if (ret != 0)
         bail("FDT: could not append phandle to '%s.iommu-addresses' property: %d\n", name, ret);
 
-    ret = fdt_appendprop_u64(dt, node, "iommu-addresses", iova);
+    ret = dtree_appendprop_u64(dt, node, "iommu-addresses", iova);
     if (ret != 0)
         bail("FDT: could not append iova to '%s.iommu-addresses' property: %d\n", name, ret);
 
-    ret = fdt_appendprop_u64(dt, node, "iommu-addresses", size);
+    ret = dtree_appendprop_u64(dt, node, "iommu-addresses", size);
     if (ret != 0)
         bail("FDT: could not append size to '%s.iommu-addresses' property: %d\n", name, ret);
 
@@ -1336,37 +1339,37 @@ static int dt_get_or_add_reserved_mem(const char *node_name, const char *compat,
                                       u64 paddr, size_t size)
 {
     int ret;
-    int resv_node = fdt_path_offset(dt, "/reserved-memory");
+    int resv_node = dtree_path_offset(dt, "/reserved-memory");
     if (resv_node < 0)
         bail("FDT: '/reserved-memory' not found\n");
 
-    int node = fdt_subnode_offset(dt, resv_node, node_name);
+    int node = dtree_subnode_offset(dt, resv_node, node_name);
     if (node < 0) {
-        node = fdt_add_subnode(dt, resv_node, node_name);
+        node = dtree_add_subnode(dt, resv_node, node_name);
         if (node < 0)
             bail("FDT: failed to add node '%s' to  '/reserved-memory'\n", node_name);
 
         uint32_t phandle;
-        ret = fdt_generate_phandle(dt, &phandle);
+        ret = dtree_generate_phandle(dt, &phandle);
         if (ret)
             bail("FDT: failed to generate phandle: %d\n", ret);
 
-        ret = fdt_setprop_u32(dt, node, "phandle", phandle);
+        ret = dtree_setprop_u32(dt, node, "phandle", phandle);
         if (ret != 0)
             bail("FDT: couldn't set '%s.phandle' property: %d\n", node_name, ret);
     }
 
     u64 reg[2] = {cpu_to_fdt64(paddr), cpu_to_fdt64(size)};
-    ret = fdt_setprop(dt, node, "reg", reg, sizeof(reg));
+    ret = dtree_setprop(dt, node, "reg", reg, sizeof(reg));
     if (ret != 0)
         bail("FDT: couldn't set '%s.reg' property: %d\n", node_name, ret);
 
-    ret = fdt_setprop_string(dt, node, "compatible", compat);
+    ret = dtree_setprop_string(dt, node, "compatible", compat);
     if (ret != 0)
         bail("FDT: couldn't set '%s.compatible' property: %d\n", node_name, ret);
 
     if (nomap) {
-        ret = fdt_setprop_empty(dt, node, "no-map");
+        ret = dtree_setprop_empty(dt, node, "no-map");
         if (ret != 0)
             bail("FDT: couldn't set '%s.no-map' property: %d\n", node_name, ret);
     }
@@ -1377,22 +1380,22 @@ static int dt_get_or_add_reserved_mem(const char *node_name, const char *compat,
 static int dt_device_add_mem_region(const char *alias, uint32_t phandle, const char *name)
 {
     int ret;
-    int dev_node = fdt_path_offset(dt, alias);
+    int dev_node = dtree_path_offset(dt, alias);
     if (dev_node < 0)
         bail("FDT: failed to get node for alias '%s'\n", alias);
 
-    ret = fdt_appendprop_u32(dt, dev_node, "memory-region", phandle);
+    ret = dtree_appendprop_u32(dt, dev_node, "memory-region", phandle);
     if (ret != 0)
         bail("FDT: failed to append to 'memory-region' property\n");
 
-    dev_node = fdt_path_offset(dt, alias);
+    dev_node = dtree_path_offset(dt, alias);
     if (dev_node < 0)
         bail("FDT: failed to update node for alias '%s'\n", alias);
 
     if (!name)
         return 0;
 
-    ret = fdt_appendprop_string(dt, dev_node, "memory-region-names", name);
+    ret = dtree_appendprop_string(dt, dev_node, "memory-region-names", name);
     if (ret != 0)
         bail("FDT: failed to append to 'memory-region-names' property\n");
 
@@ -1401,12 +1404,12 @@ static int dt_device_add_mem_region(const char *alias, uint32_t phandle, const c
 
 static int dt_set_dcp_firmware(const char *alias)
 {
-    const char *path = fdt_get_alias(dt, alias);
+    const char *path = dtree_get_alias(dt, alias);
 
     if (!path)
         return 0;
 
-    int node = fdt_path_offset(dt, path);
+    int node = dtree_path_offset(dt, path);
     if (node < 0)
         return 0;
 
@@ -1463,7 +1466,7 @@ static int dt_add_reserved_regions(const char *dcp_alias, const char *disp_alias
      * Otherwise init each dart and retrieve the node's phandle.
      */
     if (dcp_alias) {
-        int dcp_node = fdt_path_offset(dt, dcp_alias);
+        int dcp_node = dtree_path_offset(dt, dcp_alias);
         if (dcp_node < 0) {
             printf("FDT: could not resolve '%s' alias\n", dcp_alias);
             goto err; // cleanup
@@ -1471,11 +1474,11 @@ static int dt_add_reserved_regions(const char *dcp_alias, const char *disp_alias
         dart_dcp = dt_init_dart_by_node(dcp_node, 0);
         if (!dart_dcp)
             bail_cleanup("FDT: failed to init DART for '%s'\n", dcp_alias);
-        dcp_phandle = fdt_get_phandle(dt, dcp_node);
+        dcp_phandle = dtree_get_phandle(dt, dcp_node);
     }
 
     if (disp_alias) {
-        int disp_node = fdt_path_offset(dt, disp_alias);
+        int disp_node = dtree_path_offset(dt, disp_alias);
         if (disp_node < 0) {
             printf("FDT: could not resolve '%s' alias\n", disp_alias);
             goto err; // cleanup
@@ -1483,11 +1486,11 @@ static int dt_add_reserved_regions(const char *dcp_alias, const char *disp_alias
         dart_disp = dt_init_dart_by_node(disp_node, 0);
         if (!dart_disp)
             bail_cleanup("FDT: failed to init DART for '%s'\n", disp_alias);
-        disp_phandle = fdt_get_phandle(dt, disp_node);
+        disp_phandle = dtree_get_phandle(dt, disp_node);
     }
 
     if (piodma_alias) {
-        int piodma_node = fdt_path_offset(dt, piodma_alias);
+        int piodma_node = dtree_path_offset(dt, piodma_alias);
         if (piodma_node < 0) {
             printf("FDT: could not resolve '%s' alias\n", piodma_alias);
             goto err; // cleanup
@@ -1496,7 +1499,7 @@ static int dt_add_reserved_regions(const char *dcp_alias, const char *disp_alias
         dart_piodma = dt_init_dart_by_node(piodma_node, 0);
         if (!dart_piodma)
             bail_cleanup("FDT: failed to init DART for '%s'\n", piodma_alias);
-        piodma_phandle = fdt_get_phandle(dt, piodma_node);
+        piodma_phandle = dtree_get_phandle(dt, piodma_node);
     }
 
     for (unsigned i = 0; i < num_maps; i++) {
@@ -1509,7 +1512,7 @@ static int dt_add_reserved_regions(const char *dcp_alias, const char *disp_alias
         if (mem_node < 0)
             goto err;
 
-        uint32_t mem_phandle = fdt_get_phandle(dt, mem_node);
+        uint32_t mem_phandle = dtree_get_phandle(dt, mem_node);
 
         if (maps[i].map_dcp && dart_dcp) {
             ret = dt_device_set_reserved_mem_from_dart(mem_node, dart_dcp, node_name, dcp_phandle,
@@ -1554,18 +1557,18 @@ static int dt_add_reserved_regions(const char *dcp_alias, const char *disp_alias
      * does not lock dart-disp0.
      */
     if (disp_alias) {
-        int disp_node = fdt_path_offset(dt, disp_alias);
+        int disp_node = dtree_path_offset(dt, disp_alias);
 
         int dart_disp0 = dt_get_iommu_node(disp_node, 0);
         if (dart_disp0 < 0)
             bail_cleanup("FDT: failed to find 'dart-disp0'\n");
 
-        if (fdt_setprop_string(dt, dart_disp0, "status", "okay") < 0)
+        if (dtree_setprop_string(dt, dart_disp0, "status", "okay") < 0)
             bail_cleanup("FDT: failed to enable 'dart-disp0'\n");
     }
     /* enable dcp* */
-    int dcp_node = fdt_path_offset(dt, dcp_alias);
-    if (dcp_node < 0 || fdt_setprop_string(dt, dcp_node, "status", "okay") < 0)
+    int dcp_node = dtree_path_offset(dt, dcp_alias);
+    if (dcp_node < 0 || dtree_setprop_string(dt, dcp_node, "status", "okay") < 0)
         bail_cleanup("FDT: failed to enable '%s'\n", dcp_alias);
 
 err:
@@ -1590,7 +1593,7 @@ static int dt_carveout_reserved_regions(const char *dcp_alias, const char *disp_
     assert(num_maps <= MAX_DISP_MAPPINGS);
 
     // return early if dcp_alias does not exists
-    if (!fdt_get_alias(dt, dcp_alias))
+    if (!dtree_get_alias(dt, dcp_alias))
         return 0;
 
     ret = dt_set_dcp_firmware(dcp_alias);
@@ -1636,7 +1639,7 @@ static int dt_vram_reserved_region(const char *dcp_alias, const char *disp_alias
     struct mem_region region;
 
     // return early if dcp_alias does not exists
-    if (!fdt_get_alias(dt, dcp_alias))
+    if (!dtree_get_alias(dt, dcp_alias))
         return 0;
 
     int node = adt_path_offset_trace(adt, "/vram", adt_path);
@@ -1662,7 +1665,7 @@ static int dt_reserve_asc_firmware(const char *adt_path, const char *adt_path_al
 {
     int ret = 0;
 
-    int fdt_node = fdt_path_offset(dt, fdt_path);
+    int fdt_node = dtree_path_offset(dt, fdt_path);
     if (fdt_node < 0) {
         printf("FDT: '%s' not found\n", fdt_path);
         return 0;
@@ -1674,11 +1677,11 @@ static int dt_reserve_asc_firmware(const char *adt_path, const char *adt_path_al
     if (node < 0)
         bail("ADT: '%s' not found\n", adt_path);
 
-    uint32_t dev_phandle = fdt_get_phandle(dt, fdt_node);
+    uint32_t dev_phandle = dtree_get_phandle(dt, fdt_node);
     if (!dev_phandle) {
-        ret = fdt_generate_phandle(dt, &dev_phandle);
+        ret = dtree_generate_phandle(dt, &dev_phandle);
         if (!ret)
-            ret = fdt_setprop_u32(dt, fdt_node, "phandle", dev_phandle);
+            ret = dtree_setprop_u32(dt, fdt_node, "phandle", dev_phandle);
         if (ret != 0)
             bail("FDT: couldn't set '%s.phandle' property: %d\n", fdt_path, ret);
     }
@@ -1705,7 +1708,7 @@ static int dt_reserve_asc_firmware(const char *adt_path, const char *adt_path_al
             dt_get_or_add_reserved_mem(node_name, "apple,asc-mem", true, seg->phys, seg_size);
         if (mem_node < 0)
             return ret;
-        uint32_t mem_phandle = fdt_get_phandle(dt, mem_node);
+        uint32_t mem_phandle = dtree_get_phandle(dt, mem_node);
 
         ret = dt_device_set_reserved_mem(mem_node, node_name, dev_phandle, iova, seg_size);
         if (ret < 0)
@@ -1740,7 +1743,7 @@ static int dt_reserve_dcpext_firmware(void)
         if (adt_path_offset(adt, adt_path) < 0)
             continue;
 
-        int dcpext_node = fdt_path_offset(dt, dcpext_alias);
+        int dcpext_node = dtree_path_offset(dt, dcpext_alias);
         if (dcpext_node < 0)
             continue;
 
@@ -1753,8 +1756,8 @@ static int dt_reserve_dcpext_firmware(void)
             continue;
 
         // refresh dcpext_node
-        dcpext_node = fdt_path_offset(dt, dcpext_alias);
-        if ((dcpext_node < 0) || (fdt_setprop_string(dt, dcpext_node, "status", "okay") < 0))
+        dcpext_node = dtree_path_offset(dt, dcpext_alias);
+        if ((dcpext_node < 0) || (dtree_setprop_string(dt, dcpext_node, "status", "okay") < 0))
             printf("FDT: failed to enable '%s'\n", dcpext_alias);
     }
 
@@ -1855,7 +1858,7 @@ static int dt_set_display(void)
 
     int ret = 0;
 
-    if (!fdt_node_check_compatible(dt, 0, "apple,t8103")) {
+    if (!dtree_node_check_compatible(dt, 0, "apple,t8103")) {
         ret = dt_carveout_reserved_regions("dcp", "disp0", "disp0_piodma",
                                            disp_reserved_regions_t8103,
                                            ARRAY_SIZE(disp_reserved_regions_t8103));
@@ -1864,15 +1867,15 @@ static int dt_set_display(void)
 
         ret = dt_carveout_reserved_regions("dcpext", NULL, NULL, dcpext_reserved_regions_t8103,
                                            ARRAY_SIZE(dcpext_reserved_regions_t8103));
-    } else if (!fdt_node_check_compatible(dt, 0, "apple,t8112")) {
+    } else if (!dtree_node_check_compatible(dt, 0, "apple,t8112")) {
         ret = dt_carveout_reserved_regions("dcp", "disp0", "disp0_piodma",
                                            disp_reserved_regions_t8112,
                                            ARRAY_SIZE(disp_reserved_regions_t8112));
         if (ret)
             return ret;
-    } else if (!fdt_node_check_compatible(dt, 0, "apple,t6000") ||
-               !fdt_node_check_compatible(dt, 0, "apple,t6001") ||
-               !fdt_node_check_compatible(dt, 0, "apple,t6002")) {
+    } else if (!dtree_node_check_compatible(dt, 0, "apple,t6000") ||
+               !dtree_node_check_compatible(dt, 0, "apple,t6001") ||
+               !dtree_node_check_compatible(dt, 0, "apple,t6002")) {
         ret = dt_carveout_reserved_regions("dcp", "disp0", "disp0_piodma",
                                            disp_reserved_regions_t600x,
                                            ARRAY_SIZE(disp_reserved_regions_t600x));
@@ -1889,14 +1892,14 @@ static int dt_set_display(void)
                                                    ARRAY_SIZE(dcpext_reserved_regions_t600x[n]));
             }
         }
-    } else if (!fdt_node_check_compatible(dt, 0, "apple,t6020") ||
-               !fdt_node_check_compatible(dt, 0, "apple,t6021")) {
+    } else if (!dtree_node_check_compatible(dt, 0, "apple,t6020") ||
+               !dtree_node_check_compatible(dt, 0, "apple,t6021")) {
         ret = dt_carveout_reserved_regions("dcp", "disp0", "disp0_piodma",
                                            disp_reserved_regions_t602x,
                                            ARRAY_SIZE(disp_reserved_regions_t602x));
         if (ret)
             return ret;
-    } else if (!fdt_node_check_compatible(dt, 0, "apple,t6022")) {
+    } else if (!dtree_node_check_compatible(dt, 0, "apple,t6022")) {
         /* noop */
     } else {
         printf("FDT: unknown compatible, skip display reserved-memory setup\n");
@@ -1909,10 +1912,10 @@ static int dt_set_display(void)
      * Ignore errors for dcpext firmware reservation, nodes should be disabled
      * if the reservation fails allowing basic operation with just dcp.
      */
-    if (!fdt_node_check_compatible(dt, 0, "apple,t8112") ||
-        !fdt_node_check_compatible(dt, 0, "apple,t6020") ||
-        !fdt_node_check_compatible(dt, 0, "apple,t6021") ||
-        !fdt_node_check_compatible(dt, 0, "apple,t6022"))
+    if (!dtree_node_check_compatible(dt, 0, "apple,t8112") ||
+        !dtree_node_check_compatible(dt, 0, "apple,t6020") ||
+        !dtree_node_check_compatible(dt, 0, "apple,t6021") ||
+        !dtree_node_check_compatible(dt, 0, "apple,t6022"))
         dt_reserve_dcpext_firmware();
 
     const display_config_t *disp_cfg = display_get_config();
@@ -1925,7 +1928,7 @@ static int dt_set_display(void)
 
 static int dt_set_sep(void)
 {
-    const char *path = fdt_get_alias(dt, "sep");
+    const char *path = dtree_get_alias(dt, "sep");
     if (path == NULL) {
         printf("FDT: sep alias not found in devtree\n");
         return 0;
@@ -1946,12 +1949,12 @@ static int dt_set_sep(void)
     if (mem_node < 0)
         bail("FDT: failed to reserve sepfw");
 
-    uint32_t mem_phandle = fdt_get_phandle(dt, mem_node);
+    uint32_t mem_phandle = dtree_get_phandle(dt, mem_node);
     ret = dt_device_add_mem_region(path, mem_phandle, "sepfw");
     if (ret < 0)
         bail("FDT: failed to add sepfw region");
 
-    int node = fdt_path_offset(dt, path);
+    int node = dtree_path_offset(dt, path);
     if (node < 0)
         bail("FDT: sep not not found in devtree\n");
 
@@ -1962,33 +1965,33 @@ static int dt_set_sep(void)
     ret = ADT_GETPROP_ARRAY(adt, anode_manifest, "lpol", phys_map);
     if (ret != sizeof(phys_map))
         bail("ADT: could not get local policy\n");
-    fdt_setprop(dt, node, "local-policy-manifest", (void *)phys_map[0], phys_map[1]);
+    dtree_setprop(dt, node, "local-policy-manifest", (void *)phys_map[0], phys_map[1]);
 
     ret = ADT_GETPROP_ARRAY(adt, anode_manifest, "ibot", phys_map);
     if (ret != sizeof(phys_map))
         bail("ADT: could not get iboot manifest\n");
-    fdt_setprop(dt, node, "iboot-manifest", (void *)phys_map[0], phys_map[1]);
+    dtree_setprop(dt, node, "iboot-manifest", (void *)phys_map[0], phys_map[1]);
 
     return 0;
 }
 
 static int dt_set_sio_fwdata(const char *adt_path, const char *fdt_alias)
 {
-    int node = fdt_path_offset(dt, fdt_alias);
+    int node = dtree_path_offset(dt, fdt_alias);
     if (node < 0) {
         printf("FDT: '%s' node not found\n", fdt_alias);
         return 0;
     }
 
-    int phandle = fdt_get_phandle(dt, node);
+    int phandle = dtree_get_phandle(dt, node);
     uint32_t max_phandle;
-    int ret = fdt_find_max_phandle(dt, &max_phandle);
+    int ret = dtree_find_max_phandle(dt, &max_phandle);
     if (ret)
         bail("FDT: failed to get max phandle: %d\n", ret);
 
     if (!phandle) {
         phandle = ++max_phandle;
-        ret = fdt_setprop_u32(dt, node, "phandle", phandle);
+        ret = dtree_setprop_u32(dt, node, "phandle", phandle);
         if (ret != 0)
             bail("FDT: couldn't set '%s.phandle' property: %d\n", fdt_alias, ret);
     }
@@ -2007,7 +2010,7 @@ static int dt_set_sio_fwdata(const char *adt_path, const char *fdt_alias)
                                                   mapping->size);
         if (mem_node < 0)
             return ret;
-        uint32_t mem_phandle = fdt_get_phandle(dt, mem_node);
+        uint32_t mem_phandle = dtree_get_phandle(dt, mem_node);
 
         int ret =
             dt_device_set_reserved_mem(mem_node, node_name, phandle, mapping->iova, mapping->size);
@@ -2019,17 +2022,17 @@ static int dt_set_sio_fwdata(const char *adt_path, const char *fdt_alias)
             return ret;
     }
 
-    node = fdt_path_offset(dt, fdt_alias);
+    node = dtree_path_offset(dt, fdt_alias);
     if (node < 0)
         bail_cleanup("FDT: '%s' not found\n", fdt_alias);
 
     for (int i = 0; i < siodata->num_fwparams; i++) {
         struct sio_fwparam *param = &siodata->fwparams[i];
 
-        if (fdt_appendprop_u32(dt, node, "apple,sio-firmware-params", param->key))
+        if (dtree_appendprop_u32(dt, node, "apple,sio-firmware-params", param->key))
             bail_cleanup("FDT: couldn't append to SIO parameters\n");
 
-        if (fdt_appendprop_u32(dt, node, "apple,sio-firmware-params", param->value))
+        if (dtree_appendprop_u32(dt, node, "apple,sio-firmware-params", param->value))
             bail_cleanup("FDT: couldn't append to SIO parameters\n");
     }
 
@@ -2044,7 +2047,7 @@ static int dt_setup_sio(void)
 
     for (size_t i = 0; i < ARRAY_SIZE(sio_names); i++) {
 
-        int node = fdt_path_offset(dt, sio_names[i]);
+        int node = dtree_path_offset(dt, sio_names[i]);
         if (node < 0)
             continue;
 
@@ -2056,8 +2059,8 @@ static int dt_setup_sio(void)
         if (dt_set_sio_fwdata(adt_path, sio_names[i]))
             continue;
 
-        node = fdt_path_offset(dt, sio_names[i]);
-        fdt_setprop_string(dt, node, "status", "okay");
+        node = dtree_path_offset(dt, sio_names[i]);
+        dtree_setprop_string(dt, node, "status", "okay");
     }
 
     return 0;
@@ -2078,7 +2081,7 @@ static int dt_set_isp_fwdata(void)
 
     u64 phys, iova, size;
 
-    int fdt_node = fdt_path_offset(dt, fdt_path);
+    int fdt_node = dtree_path_offset(dt, fdt_path);
     if (fdt_node < 0) {
         printf("FDT: '%s' not found\n", fdt_path);
         return 0;
@@ -2102,11 +2105,11 @@ static int dt_set_isp_fwdata(void)
         bail("FDT: Could not set apple,firmware-compat for %s\n", fdt_path);
 
     if (isp_get_heap(&phys, &iova, &size)) {
-        const char *status = fdt_getprop(dt, fdt_node, "status", NULL);
+        const char *status = dtree_getprop(dt, fdt_node, "status", NULL);
 
         if (!status || strcmp(status, "disabled")) {
             printf("FDT: ISP enabled but not initialized, disabling\n");
-            if (fdt_setprop_string(dt, fdt_node, "status", "disabled") < 0)
+            if (dtree_setprop_string(dt, fdt_node, "status", "disabled") < 0)
                 bail("FDT: failed to set status property of ISP\n");
         }
 
@@ -2119,11 +2122,11 @@ static int dt_set_isp_fwdata(void)
     if (adt_node < 0)
         return 0;
 
-    uint32_t dev_phandle = fdt_get_phandle(dt, fdt_node);
+    uint32_t dev_phandle = dtree_get_phandle(dt, fdt_node);
     if (!dev_phandle) {
-        ret = fdt_generate_phandle(dt, &dev_phandle);
+        ret = dtree_generate_phandle(dt, &dev_phandle);
         if (!ret)
-            ret = fdt_setprop_u32(dt, fdt_node, "phandle", dev_phandle);
+            ret = dtree_setprop_u32(dt, fdt_node, "phandle", dev_phandle);
         if (ret != 0)
             bail("FDT: couldn't set '%s.phandle' property: %d\n", fdt_path, ret);
     }
@@ -2189,7 +2192,7 @@ static int dt_disable_missing_devs(const char *adt_prefix, const char *dt_prefix
             // pre-linux submission multi-die path
             // can probably removed the next time someone read this comment.
             snprintf(path, sizeof(path), "/soc/die%u", die);
-            int die_node = fdt_path_offset(dt, path);
+            int die_node = dtree_path_offset(dt, path);
             if (die_node < 0) {
                 /* this should use aliases for the soc nodes */
                 u64 die_unit_addr = die * PMGR_DIE_OFFSET + 0x200000000;
@@ -2197,7 +2200,7 @@ static int dt_disable_missing_devs(const char *adt_prefix, const char *dt_prefix
             }
         }
 
-        int soc = fdt_path_offset(dt, path);
+        int soc = dtree_path_offset(dt, path);
         if (soc < 0)
             bail("FDT: %s node not found in devtree\n", path);
 
@@ -2206,13 +2209,13 @@ static int dt_disable_missing_devs(const char *adt_prefix, const char *dt_prefix
         dt_parse_ranges(dt, soc, ranges);
 
         /* Disable primary devices */
-        fdt_for_each_subnode(node, dt, soc)
+        dtree_for_each_subnode(node, dt, soc)
         {
-            const char *name = fdt_get_name(dt, node, NULL);
+            const char *name = dtree_get_name(dt, node, NULL);
             if (strncmp(name, dt_prefix, dt_prefix_len))
                 continue;
 
-            const fdt64_t *reg = fdt_getprop(dt, node, "reg", NULL);
+            const fdt64_t *reg = dtree_getprop(dt, node, "reg", NULL);
             if (!reg)
                 bail_cleanup("FDT: failed to get reg property of %s\n", name);
 
@@ -2226,7 +2229,7 @@ static int dt_disable_missing_devs(const char *adt_prefix, const char *dt_prefix
                 continue;
 
             int iommus_size;
-            const fdt32_t *iommus = fdt_getprop(dt, node, "iommus", &iommus_size);
+            const fdt32_t *iommus = dtree_getprop(dt, node, "iommus", &iommus_size);
             if (iommus) {
                 if (iommus_size & 7 || iommus_size > 4 * 8) {
                     printf("FDT: bad iommus property for %s/%s\n", path, name);
@@ -2237,7 +2240,7 @@ static int dt_disable_missing_devs(const char *adt_prefix, const char *dt_prefix
             }
 
             int phys_size;
-            const fdt32_t *phys = fdt_getprop(dt, node, "phys", &phys_size);
+            const fdt32_t *phys = dtree_getprop(dt, node, "phys", &phys_size);
             if (phys) {
                 if (phys_size & 7 || phys_size > 4 * 8) {
                     printf("FDT: bad phys property for %s/%s\n", path, name);
@@ -2247,32 +2250,32 @@ static int dt_disable_missing_devs(const char *adt_prefix, const char *dt_prefix
                 }
             }
 
-            int port = fdt_subnode_offset(dt, node, "port");
+            int port = dtree_subnode_offset(dt, node, "port");
             if (port >= 0) {
-                int endpoint = fdt_subnode_offset(dt, port, "endpoint");
+                int endpoint = dtree_subnode_offset(dt, port, "endpoint");
                 if (endpoint >= 0) {
                     const fdt32_t *remote_endpoint =
-                        fdt_getprop(dt, endpoint, "remote-endpoint", NULL);
+                        dtree_getprop(dt, endpoint, "remote-endpoint", NULL);
                     if (remote_endpoint) {
                         phandles[phcnt++] = fdt32_ld(remote_endpoint);
                     }
                 }
             }
 
-            const char *status = fdt_getprop(dt, node, "status", NULL);
+            const char *status = dtree_getprop(dt, node, "status", NULL);
             if (!status || strcmp(status, "disabled")) {
                 printf("FDT: Disabling missing device %s/%s\n", path, name);
 
-                if (fdt_setprop_string(dt, node, "status", "disabled") < 0)
+                if (dtree_setprop_string(dt, node, "status", "disabled") < 0)
                     bail_cleanup("FDT: failed to set status property of %s/%s\n", path, name);
             }
         }
 
         /* Disable secondary devices */
-        fdt_for_each_subnode(node, dt, soc)
+        dtree_for_each_subnode(node, dt, soc)
         {
-            const char *name = fdt_get_name(dt, node, NULL);
-            u32 phandle = fdt_get_phandle(dt, node);
+            const char *name = dtree_get_name(dt, node, NULL);
+            u32 phandle = dtree_get_phandle(dt, node);
             if (!phandle)
                 continue;
 
@@ -2282,13 +2285,13 @@ static int dt_disable_missing_devs(const char *adt_prefix, const char *dt_prefix
 
                 phandles[i] = 0;
 
-                const char *status = fdt_getprop(dt, node, "status", NULL);
+                const char *status = dtree_getprop(dt, node, "status", NULL);
                 if (status && !strcmp(status, "disabled"))
                     continue;
 
                 printf("FDT: Disabling secondary device %s/%s (%d)\n", path, name, phandle);
 
-                if (fdt_setprop_string(dt, node, "status", "disabled") < 0)
+                if (dtree_setprop_string(dt, node, "status", "disabled") < 0)
                     bail_cleanup("FDT: failed to set status property of %s/%s\n", path, name);
             }
         }
@@ -2298,22 +2301,22 @@ static int dt_disable_missing_devs(const char *adt_prefix, const char *dt_prefix
         if (!phandles[i])
             continue;
 
-        int node = fdt_node_offset_by_phandle(dt, phandles[i]);
+        int node = dtree_node_offset_by_phandle(dt, phandles[i]);
         if (node < 0)
             bail_cleanup("FDT: failed to find secondary phandle %d\n", phandles[i]);
 
-        const char *name = fdt_get_name(dt, node, NULL);
+        const char *name = dtree_get_name(dt, node, NULL);
 
         // Should be usb-pd/connector/ports/port/endpoint
         if (!strcmp(name, "endpoint")) {
             for (int i = 0; i < 4; i++)
                 if (node >= 0)
-                    node = fdt_parent_offset(dt, node);
+                    node = dtree_parent_offset(dt, node);
             if (node < 0) {
                 printf("FDT: failed to walk up from endpoint phandle %d\n", phandles[i]);
                 continue;
             }
-            name = fdt_get_name(dt, node, NULL);
+            name = dtree_get_name(dt, node, NULL);
             if (strncmp(name, "usb-pd", 6)) {
                 printf("FDT: unexpected secondary device %s walking up from endpoint\n", name);
                 continue;
@@ -2323,13 +2326,13 @@ static int dt_disable_missing_devs(const char *adt_prefix, const char *dt_prefix
             continue;
         }
 
-        const char *status = fdt_getprop(dt, node, "status", NULL);
+        const char *status = dtree_getprop(dt, node, "status", NULL);
         if (status && !strcmp(status, "disabled"))
             continue;
 
         printf("FDT: Disabling secondary device %s\n", name);
 
-        if (fdt_setprop_string(dt, node, "status", "disabled") < 0)
+        if (dtree_setprop_string(dt, node, "status", "disabled") < 0)
             bail_cleanup("FDT: failed to set status property of %s\n", name);
         break;
     }
@@ -2349,16 +2352,16 @@ static int dt_transfer_virtios(void)
     if (path[0] < 0)
         bail("ADT: /arm-io not found\n");
 
-    int aic = fdt_node_offset_by_compatible(dt, -1, "apple,aic");
+    int aic = dtree_node_offset_by_compatible(dt, -1, "apple,aic");
     if (aic == -FDT_ERR_NOTFOUND)
-        aic = fdt_node_offset_by_compatible(dt, -1, "apple,aic2");
+        aic = dtree_node_offset_by_compatible(dt, -1, "apple,aic2");
     if (aic == -FDT_ERR_NOTFOUND)
-        aic = fdt_node_offset_by_compatible(dt, -1, "apple,aic3");
+        aic = dtree_node_offset_by_compatible(dt, -1, "apple,aic3");
     if (aic < 0)
         bail("FDT: failed to find AIC node\n");
 
-    u32 aic_phandle = fdt_get_phandle(dt, aic);
-    const fdt32_t *ic_prop = fdt_getprop(dt, aic, "#interrupt-cells", NULL);
+    u32 aic_phandle = dtree_get_phandle(dt, aic);
+    const fdt32_t *ic_prop = dtree_getprop(dt, aic, "#interrupt-cells", NULL);
     u32 intcells = 0;
     if (ic_prop)
         intcells = fdt32_ld(ic_prop);
@@ -2384,20 +2387,20 @@ static int dt_transfer_virtios(void)
         snprintf(fullname, sizeof(fullname) - 1, "virtio@%lx", addr);
         printf("FDT: Adding %s found in ADT\n", name);
 
-        int fnode = fdt_add_subnode(dt, 0, fullname);
+        int fnode = dtree_add_subnode(dt, 0, fullname);
         if (fnode < 0)
             bail("FDT: failed to create %s\n", fullname);
 
-        if (fdt_setprop_string(dt, fnode, "compatible", "virtio,mmio"))
+        if (dtree_setprop_string(dt, fnode, "compatible", "virtio,mmio"))
             bail("FDT: couldn't set %s.compatible\n", fullname);
 
         fdt64_t reg[2];
         fdt64_st(reg + 0, addr);
         fdt64_st(reg + 1, size);
-        if (fdt_setprop(dt, fnode, "reg", reg, sizeof(reg)))
+        if (dtree_setprop(dt, fnode, "reg", reg, sizeof(reg)))
             bail("FDT: couldn't set %s.reg\n", fullname);
 
-        if (fdt_setprop_u32(dt, fnode, "interrupt-parent", aic_phandle))
+        if (dtree_setprop_u32(dt, fnode, "interrupt-parent", aic_phandle))
             bail("FDT: couldn't set %s.interrupt-parent\n", fullname);
 
         fdt32_t intprop[4];
@@ -2405,7 +2408,7 @@ static int dt_transfer_virtios(void)
         fdt32_st(intprop + 1, 0);
         fdt32_st(intprop + intcells - 2, irq);
         fdt32_st(intprop + intcells - 1, 4); // IRQ_TYPE_LEVEL_HIGH
-        if (fdt_setprop(dt, fnode, "interrupts", intprop, 4 * intcells))
+        if (dtree_setprop(dt, fnode, "interrupts", intprop, 4 * intcells))
             bail("FDT: couldn't set %s.interrupts\n", fullname);
     }
 
@@ -2426,25 +2429,25 @@ static int dt_set_pmgr(void)
     if (mem_size_actual > 0x40000000)
         return 0;
 
-    int pmgr_node = fdt_path_offset(dt, "/soc/power-management@20e000000");
+    int pmgr_node = dtree_path_offset(dt, "/soc/power-management@20e000000");
     if (pmgr_node < 0) {
         printf("FDT: Failed to find pmgr node\n");
         return 0;
     }
 
-    int dcs2_node = fdt_path_offset(dt, "/soc/power-management@20e000000/power-controller@80258");
+    int dcs2_node = dtree_path_offset(dt, "/soc/power-management@20e000000/power-controller@80258");
     if (dcs2_node < 0)
         bail("FDT: failed to find ps_dcs2 node\n");
 
     /* Allow failure */
-    fdt_delprop(dt, dcs2_node, "apple,always-on");
+    dtree_delprop(dt, dcs2_node, "apple,always-on");
 
-    int dcs3_node = fdt_path_offset(dt, "/soc/power-management@20e000000/power-controller@80260");
+    int dcs3_node = dtree_path_offset(dt, "/soc/power-management@20e000000/power-controller@80260");
     if (dcs3_node < 0)
         bail("FDT: failed to find ps_dcs3 node\n");
 
     /* Allow failure */
-    fdt_delprop(dt, dcs3_node, "apple,always-on");
+    dtree_delprop(dt, dcs3_node, "apple,always-on");
 
     return 0;
 }
@@ -2544,7 +2547,7 @@ static int dt_setup_mtd_phram(void)
                                           ALIGN_UP(cur_boot_args.devtree_size, SZ_16K));
 
     if (node > 0) {
-        int ret = fdt_setprop_string(dt, node, "label", "adt");
+        int ret = dtree_setprop_string(dt, node, "label", "adt");
         if (ret)
             bail("FDT: failed to setup ADT MTD phram label\n");
     }
@@ -2558,7 +2561,7 @@ static int dt_setup_mtd_phram(void)
     node = dt_get_or_add_reserved_mem(node_name, "phram", false, (u64)logbuf.buffer, SZ_16K);
 
     if (node > 0) {
-        int ret = fdt_setprop_string(dt, node, "label", "m1n1_stage2.log");
+        int ret = dtree_setprop_string(dt, node, "label", "m1n1_stage2.log");
         if (ret)
             bail("FDT: failed to setup m1n1 log MTD phram label\n");
     }
@@ -2566,80 +2569,79 @@ static int dt_setup_mtd_phram(void)
     return 0;
 }
 
-int kboot_prepare_dt(void *fdt)
+static int dt_set_bootprof(void)
 {
-    if (dt) {
-        free(dt);
-        dt = NULL;
-    }
-
-    /* Need to init ISP early to carve out heap */
-    isp_init();
-
-    dt_bufsize = fdt_totalsize(fdt);
-    assert(dt_bufsize);
+    if (!bootprof_export_enabled())
+        return 0;
 
-    dt_bufsize += 6 * SZ_16K; // Add 96K of buffer for modifications
-    dt = memalign(DT_ALIGN, dt_bufsize);
+    int node = dtree_path_offset(dt, "/chosen");
+    if (node < 0)
+        bail("FDT: /chosen node not found in devtree\n");
 
-    if (fdt_open_into(fdt, dt, dt_bufsize) < 0)
-        bail("FDT: fdt_open_into() failed\n");
+    size_t size;
+    struct bootprof_report *report = bootprof_report(&size);
 
-    if (fdt_add_mem_rsv(dt, (u64)dt, dt_bufsize))
-        bail("FDT: couldn't add reservation for the devtree\n");
+    if (dtree_setprop(dt, node, "m1n1,boot-profile", report, size) < 0)
+        bail("FDT: couldn't set chosen.m1n1,boot-profile property\n");
 
-    if (fdt_add_mem_rsv(dt, (u64)_base, ((u64)_end) - ((u64)_base)))
-        bail("FDT: couldn't add reservation for m1n1\n");
+    printf("FDT: boot profile with %u spans\n", report->count);
+    return 0;
+}
 
+static int kboot_edit_dt(void)
+{
     /* setup console log buffer early to capture as much log as possible */
     dt_setup_mtd_phram();
 
-    if (dt_set_chosen())
+    if (BOOTPROF_RET("dt_set_chosen", dt_set_chosen()))
         return -1;
-    if (dt_set_serial_number())
+    if (BOOTPROF_RET("dt_set_serial_number", dt_set_serial_number()))
         return -1;
-    if (dt_set_cpus())
+    if (BOOTPROF_RET("dt_set_cpus", dt_set_cpus()))
         return -1;
-    if (dt_set_mac_addresses())
+    if (BOOTPROF_RET("dt_set_mac_addresses", dt_set_mac_addresses()))
         return -1;
-    if (dt_set_wifi())
+    if (BOOTPROF_RET("dt_set_wifi", dt_set_wifi()))
         return -1;
-    if (dt_set_bluetooth())
+    if (BOOTPROF_RET("dt_set_bluetooth", dt_set_bluetooth()))
         return -1;
-    if (dt_set_uboot())
+    if (BOOTPROF_RET("dt_set_uboot", dt_set_uboot()))
         return -1;
-    if (kboot_setup_atc(dt))
+    if (BOOTPROF_RET("kboot_setup_atc", kboot_setup_atc(dt)))
         return -1;
-    if (dt_set_acio_tunables())
+    if (BOOTPROF_RET("dt_set_acio_tunables", dt_set_acio_tunables()))
         return -1;
-    if (dt_set_pcie_tunables())
+    if (BOOTPROF_RET("dt_set_pcie_tunables", dt_set_pcie_tunables()))
         return -1;
-    if (dt_set_display())
+    if (BOOTPROF_RET("dt_set_display", dt_set_display()))
         return -1;
-    if (dt_set_gpu(dt))
+    if (BOOTPROF_RET("dt_set_gpu", dt_set_gpu(dt)))
         return -1;
-    if (dt_set_multitouch())
+    if (BOOTPROF_RET("dt_set_multitouch", dt_set_multitouch()))
         return -1;
-    if (dt_set_sep())
+    if (BOOTPROF_RET("dt_set_sep", dt_set_sep()))
         return -1;
-    if (dt_set_nvram())
+    if (BOOTPROF_RET("dt_set_nvram", dt_set_nvram()))
         return -1;
-    if (dt_set_ipd())
+    if (BOOTPROF_RET("dt_set_ipd", dt_set_ipd()))
         return -1;
-    if (dt_disable_missing_devs("usb-drd", "usb@", 8))
+    if (BOOTPROF_RET("dt_disable_missing_devs:usb-drd",
+                     dt_disable_missing_devs("usb-drd", "usb@", 8)))
         return -1;
-    if (dt_disable_missing_devs("i2c", "i2c@", 8))
+    if (BOOTPROF_RET("dt_disable_missing_devs:i2c", dt_disable_missing_devs("i2c", "i2c@", 8)))
         return -1;
-    if (dt_setup_sio())
+    if (BOOTPROF_RET("dt_setup_sio", dt_setup_sio()))
         return -1;
-    if (dt_reserve_asc_firmware("/arm-io/isp", "/arm-io/isp0", "isp", false, isp_iova_base()))
+    if (BOOTPROF_RET("dt_reserve_asc_firmware:isp",
+                     dt_reserve_asc_firmware("/arm-io/isp", "/arm-io/isp0", "isp", false,
+                                             isp_iova_base())))
         return -1;
-    if (dt_set_isp_fwdata())
+    if (BOOTPROF_RET("dt_set_isp_fwdata", dt_set_isp_fwdata()))
         return -1;
-    if (dt_set_pmgr())
+    if (BOOTPROF_RET("dt_set_pmgr", dt_set_pmgr()))
         return -1;
 #ifndef RELEASE
-    if (dt_transfer_virtios())
+    if (BOOTPROF_RET("dt_transfer_virtios", dt_transfer_virtios()))
         return 1;
 #endif
 
@@ -2648,19 +2650,58 @@ int kboot_prepare_dt(void *fdt)
      * in one of the above devicetree prep functions, and we want an up-to-date value
      * for the usable memory span to make it into the devicetree.
      */
-    if (dt_set_memory())
+    if (BOOTPROF_RET("dt_set_memory", dt_set_memory()))
+        return -1;
+
+    /* Last, so the exported profile covers all of the above */
+    if (dt_set_bootprof())
         return -1;
 
-    if (fdt_pack(dt))
-        bail("FDT: fdt_pack() failed\n");
+    return 0;
+}
+
+int kboot_prepare_dt(void *fdt)
+{
+    if (dt_blob) {
+        free(dt_blob);
+        dt_blob = NULL;
+    }
 
-    u32 dt_remain = dt_bufsize - fdt_totalsize(dt);
-    if (dt_remain < SZ_16K)
-        printf("FDT: free dt buffer space low, %u bytes left\n", dt_remain);
+    /* Need to init ISP early to carve out heap */
+    BOOTPROF("isp_init", isp_init());
 
-    printf("FDT prepared at %p\n", dt);
+    /*
+     * Edit an in-memory copy of the tree and serialize it once at the end, instead of shifting
+     * the whole blob around on every property change.
+     */
+    dt = BOOTPROF_RET("dtree_from_fdt", dtree_from_fdt(fdt));
+    if (!dt)
+        bail("FDT: failed to load the devicetree\n");
 
-    return 0;
+    int ret = -1;
+    if (dtree_add_mem_rsv(dt, (u64)_base, ((u64)_end) - ((u64)_base))) {
+        printf("FDT: couldn't add reservation for m1n1\n");
+        goto out;
+    }
+
+    ret = kboot_edit_dt();
+    if (ret)
+        goto out;
+
+    /* The blob carries a reservation for itself, like the old fixed-size buffer did */
+    dt_blob = BOOTPROF_RET("dtree_to_fdt", dtree_to_fdt(dt, DT_ALIGN, true));
+    if (!dt_blob) {
+        printf("FDT: failed to serialize the devicetree\n");
+        ret = -1;
+        goto out;
+    }
+
+    printf("FDT prepared at %p (%u bytes)\n", dt_blob, fdt_totalsize(dt_blob));
+
+out:
+    dtree_free(dt);
+    dt = NULL;
+    return ret;
 }
 
 int kboot_boot(void *kernel)
@@ -2675,10 +2716,10 @@ int kboot_boot(void *kernel)
 
     printf("Setting SMP mode to WFE...\n");
     smp_set_wfe_mode(true);
-    printf("Preparing to boot kernel at %p with fdt at %p\n", kernel, dt);
+    printf("Preparing to boot kernel at %p with fdt at %p\n", kernel, dt_blob);
 
     next_stage.entry = kernel;
-    next_stage.args[0] = (u64)dt;
+    next_stage.args[0] = (u64)dt_blob;
     next_stage.args[1] = 0;
     next_stage.args[2] = 0;
     next_stage.args[3] = 0;
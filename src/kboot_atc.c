@@ -7,7 +7,7 @@
 #include "pmgr.h"
 #include "utils.h"
 
-#include "libfdt/libfdt.h"
+#include "dtree.h"
 
 #define MAX_ATC_DEVS 8
 
@@ -60,7 +60,7 @@ static const struct adt_tunable_info atc_tunables[] = {
     {"tunable_CIO_LN1_AUSPMA_RX_EQ", "apple,tunable-lane1-cio", 0x11000, 0x1000, true},
 };
 
-static int dt_append_atc_tunable(void *dt, int adt_node, int fdt_node,
+static int dt_append_atc_tunable(dtree_t *dt, int adt_node, int fdt_node,
                                  const struct adt_tunable_info *tunable_info)
 {
     u32 tunables_len;
@@ -100,19 +100,19 @@ static int dt_append_atc_tunable(void *dt, int adt_node, int fdt_node,
             return -1;
         }
 
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name,
-                               tunable->offset + tunable_info->reg_offset) < 0)
+        if (dtree_appendprop_u32(dt, fdt_node, tunable_info->fdt_name,
+                                 tunable->offset + tunable_info->reg_offset) < 0)
             return -1;
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->mask) < 0)
+        if (dtree_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->mask) < 0)
             return -1;
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->value) < 0)
+        if (dtree_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->value) < 0)
             return -1;
     }
 
     return 0;
 }
 
-static void dt_copy_atc_tunables(void *dt, const char *adt_path, const char *dt_alias)
+static void dt_copy_atc_tunables(dtree_t *dt, const char *adt_path, const char *dt_alias)
 {
     int ret;
 
@@ -120,13 +120,13 @@ static void dt_copy_atc_tunables(void *dt, const char *adt_path, const char *dt_
     if (adt_node < 0)
         return;
 
-    const char *fdt_path = fdt_get_alias(dt, dt_alias);
+    const char *fdt_path = dtree_get_alias(dt, dt_alias);
     if (fdt_path == NULL) {
         printf("FDT: Unable to find alias %s\n", dt_alias);
         return;
     }
 
-    int fdt_node = fdt_path_offset(dt, fdt_path);
+    int fdt_node = dtree_path_offset(dt, fdt_path);
     if (fdt_node < 0) {
         printf("FDT: Unable to find path %s for alias %s\n", fdt_path, dt_alias);
         return;
@@ -147,12 +147,12 @@ cleanup:
      * try to boot with USB2 support only.
      */
     for (size_t i = 0; i < sizeof(atc_tunables) / sizeof(*atc_tunables); ++i)
-        fdt_delprop(dt, fdt_node, atc_tunables[i].fdt_name);
+        dtree_delprop(dt, fdt_node, atc_tunables[i].fdt_name);
 
     printf("FDT: Unable to setup ATC tunables for %s - USB3/Thunderbolt will not work\n", adt_path);
 }
 
-int kboot_setup_atc(void *dt)
+int kboot_setup_atc(dtree_t *dt)
 {
     char adt_path[32];
     char fdt_alias[32];
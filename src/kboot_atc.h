@@ -3,8 +3,9 @@
 #ifndef __ATC_H__
 #define __ATC_H__
 
+#include "dtree.h"
 #include "types.h"
 
-int kboot_setup_atc(void *dt);
+int kboot_setup_atc(dtree_t *dt);
 
 #endif
\ No newline at end of file
@@ -9,7 +9,7 @@
 #include "soc.h"
 #include "utils.h"
 
-#include "libfdt/libfdt.h"
+#include "dtree.h"
 
 #define bail(...)                                                                                  \
     do {                                                                                           \
@@ -373,7 +373,7 @@ static int calc_power_t600x(u32 count, u32 table_count, const struct perf_state
     return 0;
 }
 
-static int dt_set_region(void *dt, int sgx, const char *name, const char *path)
+static int dt_set_region(dtree_t *dt, int sgx, const char *name, const char *path)
 {
     u64 base, size;
     char prop[64];
@@ -386,7 +386,7 @@ static int dt_set_region(void *dt, int sgx, const char *name, const char *path)
     if (ADT_GETPROP(adt, sgx, prop, &size) < 0 || !base)
         bail("ADT: GPU: failed to find %s property\n", prop);
 
-    int node = fdt_path_offset(dt, path);
+    int node = dtree_path_offset(dt, path);
     if (node < 0)
         bail("FDT: GPU: failed to find %s node\n", path);
 
@@ -395,39 +395,39 @@ static int dt_set_region(void *dt, int sgx, const char *name, const char *path)
     fdt64_st(&reg[0], base);
     fdt64_st(&reg[1], size);
 
-    if (fdt_setprop_inplace(dt, node, "reg", reg, sizeof(reg)))
+    if (dtree_setprop_inplace(dt, node, "reg", reg, sizeof(reg)))
         bail("FDT: GPU: failed to set reg prop for %s\n", path);
 
     return 0;
 }
 
-int fdt_set_float_array(void *dt, int node, const char *name, float *val, int count)
+int dt_set_float_array(dtree_t *dt, int node, const char *name, float *val, int count)
 {
     fdt32_t data[MAX_CLUSTERS];
 
     if (count > MAX_CLUSTERS)
-        bail("FDT: GPU: fdt_set_float_array() with too many values\n");
+        bail("FDT: GPU: dt_set_float_array() with too many values\n");
 
     memcpy(data, val, sizeof(float) * count);
     for (int i = 0; i < count; i++) {
         data[i] = cpu_to_fdt32(data[i]);
     }
 
-    if (fdt_setprop_inplace(dt, node, name, data, sizeof(u32) * count))
+    if (dtree_setprop_inplace(dt, node, name, data, sizeof(u32) * count))
         bail("FDT: GPU: Failed to set %s\n", name);
 
     return 0;
 }
 
-static int fdt_set_aux_opp(void *dt, int gpu, const char *prop, const struct aux_perf_states *ps,
-                           u32 dies)
+static int dt_set_aux_opp(dtree_t *dt, int gpu, const char *prop, const struct aux_perf_states *ps,
+                          u32 dies)
 {
     int len;
-    const fdt32_t *opps_ph = fdt_getprop(dt, gpu, prop, &len);
+    const fdt32_t *opps_ph = dtree_getprop(dt, gpu, prop, &len);
     if (!opps_ph || len != 4)
         bail("FDT: GPU: %s not found\n", prop);
 
-    int opps = fdt_node_offset_by_phandle(dt, fdt32_ld(opps_ph));
+    int opps = dtree_node_offset_by_phandle(dt, fdt32_ld(opps_ph));
     if (opps < 0)
         bail("FDT: GPU: node for phandle %u not found\n", fdt32_ld(opps_ph));
 
@@ -435,7 +435,7 @@ static int fdt_set_aux_opp(void *dt, int gpu, const char *prop, const struct aux
 
     u32 i = 0;
     int opp;
-    fdt_for_each_subnode(opp, dt, opps)
+    dtree_for_each_subnode(opp, dt, opps)
     {
         fdt32_t volts[MAX_DIES];
 
@@ -446,10 +446,10 @@ static int fdt_set_aux_opp(void *dt, int gpu, const char *prop, const struct aux
         if (i >= count)
             bail("FDT: GPU: Expected %d operating points, but found more\n", count);
 
-        if (fdt_setprop_inplace(dt, opp, "opp-microvolt", &volts, sizeof(u32) * dies))
+        if (dtree_setprop_inplace(dt, opp, "opp-microvolt", &volts, sizeof(u32) * dies))
             bail("FDT: GPU: Failed to set opp-microvolt for aux PS %d\n", i);
 
-        if (fdt_setprop_inplace_u64(dt, opp, "opp-hz", ps->states[i].freq))
+        if (dtree_setprop_inplace_u64(dt, opp, "opp-hz", ps->states[i].freq))
             bail("FDT: GPU: Failed to set opp-hz for PS %d\n", i);
 
         i++;
@@ -458,7 +458,7 @@ static int fdt_set_aux_opp(void *dt, int gpu, const char *prop, const struct aux
     return 0;
 }
 
-int dt_set_gpu(void *dt)
+int dt_set_gpu(dtree_t *dt)
 {
     bool has_cs_afr = false;
     int (*calc_power)(u32 count, u32 table_count, const struct perf_state *core,
@@ -494,18 +494,18 @@ int dt_set_gpu(void *dt)
             return 0;
     }
 
-    int gpu = fdt_path_offset(dt, "gpu");
+    int gpu = dtree_path_offset(dt, "gpu");
     if (gpu < 0) {
         printf("FDT: GPU: gpu alias not found in device tree\n");
         return 0;
     }
 
     int len;
-    const fdt32_t *opps_ph = fdt_getprop(dt, gpu, "operating-points-v2", &len);
+    const fdt32_t *opps_ph = dtree_getprop(dt, gpu, "operating-points-v2", &len);
     if (!opps_ph || len != 4)
         bail("FDT: GPU: operating-points-v2 not found\n");
 
-    int opps = fdt_node_offset_by_phandle(dt, fdt32_ld(opps_ph));
+    int opps = dtree_node_offset_by_phandle(dt, fdt32_ld(opps_ph));
     if (opps < 0)
         bail("FDT: GPU: node for phandle %u not found\n", fdt32_ld(opps_ph));
 
@@ -575,15 +575,15 @@ int dt_set_gpu(void *dt)
     }
     printf("\n");
 
-    if (fdt_set_float_array(dt, gpu, "apple,core-leak-coef", core_leak, perf_state_table_count))
+    if (dt_set_float_array(dt, gpu, "apple,core-leak-coef", core_leak, perf_state_table_count))
         return -1;
 
-    if (fdt_set_float_array(dt, gpu, "apple,sram-leak-coef", sram_leak, perf_state_table_count))
+    if (dt_set_float_array(dt, gpu, "apple,sram-leak-coef", sram_leak, perf_state_table_count))
         return -1;
 
     u32 i = 0;
     int opp;
-    fdt_for_each_subnode(opp, dt, opps)
+    dtree_for_each_subnode(opp, dt, opps)
     {
         fdt32_t volts[MAX_CLUSTERS];
 
@@ -594,14 +594,14 @@ int dt_set_gpu(void *dt)
         if (i >= perf_state_count)
             bail("FDT: GPU: Expected %d operating points, but found more\n", perf_state_count);
 
-        if (fdt_setprop_inplace(dt, opp, "opp-microvolt", &volts,
-                                sizeof(u32) * perf_state_table_count))
+        if (dtree_setprop_inplace(dt, opp, "opp-microvolt", &volts,
+                                  sizeof(u32) * perf_state_table_count))
             bail("FDT: GPU: Failed to set opp-microvolt for PS %d\n", i);
 
-        if (fdt_setprop_inplace_u64(dt, opp, "opp-hz", perf_states[i].freq))
+        if (dtree_setprop_inplace_u64(dt, opp, "opp-hz", perf_states[i].freq))
             bail("FDT: GPU: Failed to set opp-hz for PS %d\n", i);
 
-        if (fdt_setprop_inplace_u32(dt, opp, "opp-microwatt", max_pwr[i]))
+        if (dtree_setprop_inplace_u32(dt, opp, "opp-microwatt", max_pwr[i]))
             bail("FDT: GPU: Failed to set opp-microwatt for PS %d\n", i);
 
         i++;
@@ -611,11 +611,11 @@ int dt_set_gpu(void *dt)
         bail("FDT: GPU: Expected %d operating points, but found %d\n", perf_state_count, i);
 
     if (has_cs_afr) {
-        int ret = fdt_set_aux_opp(dt, gpu, "apple,cs-opp", perf_states_cs, dies);
+        int ret = dt_set_aux_opp(dt, gpu, "apple,cs-opp", perf_states_cs, dies);
         if (ret)
             return ret;
 
-        if (fdt_set_float_array(dt, gpu, "apple,cs-leak-coef", cs_leak, dies))
+        if (dt_set_float_array(dt, gpu, "apple,cs-leak-coef", cs_leak, dies))
             return -1;
 
         printf("FDT: GPU: CS leakage table: ");
@@ -626,10 +626,10 @@ int dt_set_gpu(void *dt)
     }
 
     if (has_cs_afr) {
-        int ret = fdt_set_aux_opp(dt, gpu, "apple,afr-opp", perf_states_afr, dies);
+        int ret = dt_set_aux_opp(dt, gpu, "apple,afr-opp", perf_states_afr, dies);
         if (ret)
             return ret;
-        if (fdt_set_float_array(dt, gpu, "apple,afr-leak-coef", afr_leak, dies))
+        if (dt_set_float_array(dt, gpu, "apple,afr-leak-coef", afr_leak, dies))
             return -1;
 
         printf("FDT: GPU: AFR leakage table: ");
@@ -647,7 +647,7 @@ int dt_set_gpu(void *dt)
         return -1;
 
     // refresh gpu dt node offset after modifying the dt in dt_set_region()
-    gpu = fdt_path_offset(dt, "gpu");
+    gpu = dtree_path_offset(dt, "gpu");
     if (gpu < 0) {
         printf("FDT: GPU: gpu alias not found in device tree\n");
         return 0;
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+
+#define LZ4_OK           0
+#define LZ4_ERR_FORMAT   -1 // Bad magic, version or unsupported feature (dictionaries)
+#define LZ4_ERR_CORRUPT  -2 // Malformed block data
+#define LZ4_ERR_SRC      -3 // Input truncated
+#define LZ4_ERR_DST      -4 // Output buffer too small
+#define LZ4_ERR_CHECKSUM -5 // Header, block or content checksum mismatch
+
+/*
+ * Decompress a single raw LZ4 block. Matches may reach back into dest before the block, up to
+ * dest_start, so consecutive linked blocks can be decoded one after the other.
+ */
+int lz4_block_uncompress(void *dest_start, void *dest, size_t *dest_len, const void *source,
+                         size_t source_len);
+
+/*
+ * Decompress one LZ4 frame (either the standard frame format or the legacy format produced by
+ * `lz4 -l` and the Linux kernel build), skipping any skippable frames in front of it.
+ *
+ * On entry, *dest_len and *source_len hold the buffer sizes. On success, they are updated with
+ * the number of bytes produced and consumed respectively. Legacy frames carry no end marker, so
+ * they end at the end of the input or at the first chunk header that cannot be valid.
+ */
+int lz4_uncompress(void *dest, size_t *dest_len, const void *source, size_t *source_len);
+
+/*
+ * Peek at a standard frame header and return the decompressed size in *size, if the frame
+ * records it. Returns LZ4_ERR_FORMAT otherwise, including for all legacy frames.
+ */
+int lz4_content_size(const void *source, size_t source_len, size_t *size);
+
+#endif
@@ -0,0 +1,328 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Minimal freestanding LZ4 decoder: raw blocks, the LZ4 frame format (linked or independent
+ * blocks, optional XXH32 block/content checksums) and the legacy frame format.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lz4.h"
+
+#define LZ4_MAGIC        0x184d2204
+#define LZ4_LEGACY_MAGIC 0x184c2102
+#define LZ4_SKIP_MAGIC   0x184d2a50
+#define LZ4_SKIP_MASK    0xfffffff0
+
+#define LEGACY_BLOCK_MAX (8 << 20)
+// LZ4_compressBound(LEGACY_BLOCK_MAX)
+#define LEGACY_CHUNK_MAX (LEGACY_BLOCK_MAX + LEGACY_BLOCK_MAX / 255 + 16)
+
+#define MIN_MATCH 4
+
+#define FLG_VERSION_MASK 0xc0
+#define FLG_VERSION      0x40
+#define FLG_BLOCK_CSUM   (1 << 4)
+#define FLG_CONTENT_SIZE (1 << 3)
+#define FLG_CONTENT_CSUM (1 << 2)
+#define FLG_RESERVED     (1 << 1)
+#define FLG_DICT_ID      (1 << 0)
+
+#define BLOCK_UNCOMPRESSED (1u << 31)
+
+static inline uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void copy_bytes(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    while (n--)
+        *dst++ = *src++;
+}
+
+/* XXH32, used for the descriptor, block and content checksums */
+
+#define XXH_P1 0x9e3779b1U
+#define XXH_P2 0x85ebca77U
+#define XXH_P3 0xc2b2ae3dU
+#define XXH_P4 0x27d4eb2fU
+#define XXH_P5 0x165667b1U
+
+static inline uint32_t rotl32(uint32_t v, int r)
+{
+    return (v << r) | (v >> (32 - r));
+}
+
+static inline uint32_t xxh_round(uint32_t acc, uint32_t in)
+{
+    return rotl32(acc + in * XXH_P2, 13) * XXH_P1;
+}
+
+static uint32_t xxh32(const uint8_t *p, size_t len)
+{
+    const uint8_t *end = p + len;
+    uint32_t h;
+
+    if (len >= 16) {
+        uint32_t v1 = XXH_P1 + XXH_P2, v2 = XXH_P2, v3 = 0, v4 = -XXH_P1;
+
+        for (; end - p >= 16; p += 16) {
+            v1 = xxh_round(v1, le32(p));
+            v2 = xxh_round(v2, le32(p + 4));
+            v3 = xxh_round(v3, le32(p + 8));
+            v4 = xxh_round(v4, le32(p + 12));
+        }
+
+        h = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+    } else {
+        h = XXH_P5;
+    }
+
+    h += len;
+
+    for (; end - p >= 4; p += 4)
+        h = rotl32(h + le32(p) * XXH_P3, 17) * XXH_P4;
+    while (p < end)
+        h = rotl32(h + *p++ * XXH_P5, 11) * XXH_P1;
+
+    h ^= h >> 15;
+    h *= XXH_P2;
+    h ^= h >> 13;
+    h *= XXH_P3;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Blocks */
+
+static inline bool read_length(const uint8_t **p, const uint8_t *end, size_t *len)
+{
+    uint8_t b;
+
+    do {
+        if (*p >= end)
+            return false;
+        b = *(*p)++;
+        *len += b;
+    } while (b == 255);
+
+    return true;
+}
+
+int lz4_block_uncompress(void *dest_start, void *dest, size_t *dest_len, const void *source,
+                         size_t source_len)
+{
+    const uint8_t *p = source, *end = p + source_len;
+    uint8_t *start = dest_start, *dst = dest, *dst_end = dst + *dest_len;
+
+    while (true) {
+        if (p >= end)
+            return LZ4_ERR_SRC;
+
+        uint8_t token = *p++;
+        size_t llen = token >> 4;
+
+        if (llen == 15 && !read_length(&p, end, &llen))
+            return LZ4_ERR_SRC;
+        if (llen > (size_t)(end - p))
+            return LZ4_ERR_SRC;
+        if (llen > (size_t)(dst_end - dst))
+            return LZ4_ERR_DST;
+
+        copy_bytes(dst, p, llen);
+        dst += llen;
+        p += llen;
+
+        // The last sequence is literals only
+        if (p == end)
+            break;
+
+        if (end - p < 2)
+            return LZ4_ERR_SRC;
+
+        size_t offset = p[0] | (p[1] << 8);
+        size_t mlen = token & 0xf;
+        p += 2;
+
+        if (mlen == 15 && !read_length(&p, end, &mlen))
+            return LZ4_ERR_SRC;
+        mlen += MIN_MATCH;
+
+        if (!offset || offset > (size_t)(dst - start))
+            return LZ4_ERR_CORRUPT;
+        if (mlen > (size_t)(dst_end - dst))
+            return LZ4_ERR_DST;
+
+        // Byte by byte on purpose: matches may overlap their own output
+        copy_bytes(dst, dst - offset, mlen);
+        dst += mlen;
+    }
+
+    *dest_len = dst - (uint8_t *)dest;
+    return LZ4_OK;
+}
+
+/* Frames */
+
+static int lz4_legacy_uncompress(uint8_t *dest, size_t *dest_len, const uint8_t *source,
+                                 size_t *source_len)
+{
+    const uint8_t *p = source, *end = p + *source_len;
+    uint8_t *dst = dest, *dst_end = dst + *dest_len;
+
+    while (end - p >= 4) {
+        uint32_t csize = le32(p);
+
+        // No end marker: stop at anything that cannot be a chunk header, like the next magic
+        if (!csize || csize > LEGACY_CHUNK_MAX || csize > (size_t)(end - p - 4))
+            break;
+
+        size_t dlen = dst_end - dst;
+        int ret = lz4_block_uncompress(dst, dst, &dlen, p + 4, csize);
+        // Inline payloads have no length, so the size trailer can look like a chunk header.
+        // Anything else that fits but does not decode is a corrupt chunk, not the frame's end.
+        if (ret) {
+            if (dst == dest || csize != (uint32_t)(dst - dest))
+                return ret;
+            break;
+        }
+
+        dst += dlen;
+        p += 4 + csize;
+    }
+
+    // The kernel's Image.lz4 ends with the uncompressed size as a 32-bit word
+    if (end - p >= 4 && dst != dest && le32(p) == (uint32_t)(dst - dest))
+        p += 4;
+
+    *dest_len = dst - dest;
+    *source_len = p - source;
+    return LZ4_OK;
+}
+
+int lz4_content_size(const void *source, size_t source_len, size_t *size)
+{
+    const uint8_t *p = source;
+
+    if (source_len < 15 || le32(p) != LZ4_MAGIC)
+        return LZ4_ERR_FORMAT;
+    if ((p[4] & FLG_VERSION_MASK) != FLG_VERSION || !(p[4] & FLG_CONTENT_SIZE))
+        return LZ4_ERR_FORMAT;
+
+    *size = le32(p + 6) | ((uint64_t)le32(p + 10) << 32);
+    return LZ4_OK;
+}
+
+int lz4_uncompress(void *dest, size_t *dest_len, const void *source, size_t *source_len)
+{
+    const uint8_t *p = source, *end = p + *source_len;
+    uint8_t *dst = dest, *dst_end = dst + *dest_len;
+
+    while (true) {
+        if (end - p < 4)
+            return LZ4_ERR_SRC;
+
+        uint32_t magic = le32(p);
+        if ((magic & LZ4_SKIP_MASK) == LZ4_SKIP_MAGIC) {
+            if (end - p < 8 || le32(p + 4) > (size_t)(end - p - 8))
+                return LZ4_ERR_SRC;
+            p += 8 + le32(p + 4);
+            continue;
+        }
+
+        if (magic == LZ4_LEGACY_MAGIC) {
+            size_t consumed = end - p - 4;
+            int ret = lz4_legacy_uncompress(dest, dest_len, p + 4, &consumed);
+            if (ret)
+                return ret;
+            *source_len = p + 4 + consumed - (const uint8_t *)source;
+            return LZ4_OK;
+        }
+
+        if (magic != LZ4_MAGIC)
+            return LZ4_ERR_FORMAT;
+
+        p += 4;
+        break;
+    }
+
+    if (end - p < 3)
+        return LZ4_ERR_SRC;
+
+    const uint8_t *desc = p;
+    uint8_t flg = p[0];
+
+    if ((flg & FLG_VERSION_MASK) != FLG_VERSION || (flg & FLG_RESERVED))
+        return LZ4_ERR_FORMAT;
+    if (flg & FLG_DICT_ID)
+        return LZ4_ERR_FORMAT;
+
+    size_t desc_len = 2 + ((flg & FLG_CONTENT_SIZE) ? 8 : 0);
+    if ((size_t)(end - p) < desc_len + 1)
+        return LZ4_ERR_SRC;
+    if (((xxh32(desc, desc_len) >> 8) & 0xff) != desc[desc_len])
+        return LZ4_ERR_CHECKSUM;
+
+    uint64_t content_size = 0;
+    if (flg & FLG_CONTENT_SIZE) {
+        content_size = le32(p + 2) | ((uint64_t)le32(p + 6) << 32);
+        if (content_size > *dest_len)
+            return LZ4_ERR_DST;
+    }
+
+    p += desc_len + 1;
+
+    while (true) {
+        if (end - p < 4)
+            return LZ4_ERR_SRC;
+
+        uint32_t bhdr = le32(p);
+        size_t bsize = bhdr & ~BLOCK_UNCOMPRESSED;
+        p += 4;
+
+        if (!bhdr)
+            break;
+
+        size_t csum_len = (flg & FLG_BLOCK_CSUM) ? 4 : 0;
+        if (bsize + csum_len > (size_t)(end - p))
+            return LZ4_ERR_SRC;
+        if (csum_len && xxh32(p, bsize) != le32(p + bsize))
+            return LZ4_ERR_CHECKSUM;
+
+        // Independent blocks never reference earlier output, so linking them is harmless
+        size_t dlen = dst_end - dst;
+        if (bhdr & BLOCK_UNCOMPRESSED) {
+            if (bsize > dlen)
+                return LZ4_ERR_DST;
+            copy_bytes(dst, p, bsize);
+            dlen = bsize;
+        } else {
+            int ret = lz4_block_uncompress(dest, dst, &dlen, p, bsize);
+            if (ret)
+                return ret;
+        }
+
+        dst += dlen;
+        p += bsize + csum_len;
+    }
+
+    size_t produced = dst - (uint8_t *)dest;
+
+    if ((flg & FLG_CONTENT_SIZE) && produced != content_size)
+        return LZ4_ERR_CORRUPT;
+
+    if (flg & FLG_CONTENT_CSUM) {
+        if (end - p < 4)
+            return LZ4_ERR_SRC;
+        if (xxh32(dest, produced) != le32(p))
+            return LZ4_ERR_CHECKSUM;
+        p += 4;
+    }
+
+    *dest_len = produced;
+    *source_len = p - (const uint8_t *)source;
+    return LZ4_OK;
+}
@@ -7,6 +7,7 @@
 
 #include "adt.h"
 #include "aic.h"
+#include "bootprof.h"
 #include "cpufreq.h"
 #include "display.h"
 #include "exception.h"
@@ -118,7 +119,7 @@ void run_actions(void)
 
     printf("Checking for payloads...\n");
 
-    if (payload_run() == 0) {
+    if (BOOTPROF_RET("payload_run", payload_run()) == 0) {
         printf("Valid payload found\n");
         return;
     }
@@ -146,27 +147,34 @@ void m1n1_main(void)
 
     printf("Running in EL%lu\n\n", mrs(CurrentEL) >> 2);
 
-    firmware_init();
+    int init_span = bootprof_begin("init");
 
-    heapblock_init();
+    BOOTPROF("firmware_init", firmware_init());
+
+    BOOTPROF("heapblock_init", heapblock_init());
+
+    int adt_nodes =
+        BOOTPROF_RET("adt_index_build", adt_index_build(adt, cur_boot_args.devtree_size));
+    if (adt_nodes < 0)
+        printf("ADT: failed to build lookup index (%d)\n", adt_nodes);
 
 #ifndef BRINGUP
     if (supports_gxf())
-        gxf_init();
-    mcc_init();
-    mmu_init();
-    aic_init();
+        BOOTPROF("gxf_init", gxf_init());
+    BOOTPROF("mcc_init", mcc_init());
+    BOOTPROF("mmu_init", mmu_init());
+    BOOTPROF("aic_init", aic_init());
 #endif
-    wdt_disable();
+    BOOTPROF("wdt_disable", wdt_disable());
 #ifndef BRINGUP
-    pmgr_init();
+    BOOTPROF("pmgr_init", pmgr_init());
 #ifdef USE_FB
-    display_init();
+    BOOTPROF("display_init", display_init());
     // Kick DCP to sleep, so dodgy monitors which cause reconnect cycles don't cause us to lose the
     // framebuffer.
-    display_shutdown(DCP_SLEEP_IF_EXTERNAL);
+    BOOTPROF("display_shutdown", display_shutdown(DCP_SLEEP_IF_EXTERNAL));
     // On idevice we need to always clear, because otherwise it looks scuffed on white devices
-    fb_init(!is_mac);
+    BOOTPROF("fb_init", fb_init(!is_mac));
     fb_display_logo();
 #ifdef FB_SILENT_MODE
     fb_set_active(!cur_boot_args.video.display);
@@ -175,10 +183,12 @@ void m1n1_main(void)
 #endif
 #endif
 
-    cpufreq_fixup();
-    sep_init();
+    BOOTPROF("cpufreq_fixup", cpufreq_fixup());
+    BOOTPROF("sep_init", sep_init());
 #endif
 
+    bootprof_end(init_span);
+
     printf("Initialization complete.\n");
 
     run_actions();
@@ -15,6 +15,14 @@
 #define NVME_SHUTDOWN_TIMEOUT 5000000
 #define NVME_QUEUE_SIZE       64
 
+/*
+ * nvme_read_blocks() keeps up to NVME_IO_TAGS commands in flight, each transferring up to
+ * NVME_MAX_XFER_BLOCKS pages described by a per-tag PRP list. A list never crosses a page.
+ */
+#define NVME_IO_TAGS         16
+#define NVME_MAX_XFER_BLOCKS 128
+#define NVME_PRP_LIST_SIZE   (NVME_MAX_XFER_BLOCKS * sizeof(u64))
+
 #define NVME_CC            0x14
 #define NVME_CC_SHN        GENMASK(15, 14)
 #define NVME_CC_SHN_NONE   0
@@ -109,6 +117,7 @@ struct nvme_queue {
     struct apple_nvmmu_tcb *tcbs;
     struct nvme_command *cmds;
     struct nvme_completion *cqes;
+    u64 *prp_lists;
 
     u8 cq_head;
     u8 cq_phase;
@@ -119,6 +128,8 @@ struct nvme_queue {
 static_assert(sizeof(struct nvme_command) == 64, "invalid nvme_command size");
 static_assert(sizeof(struct nvme_completion) == 16, "invalid nvme_completion size");
 static_assert(sizeof(struct apple_nvmmu_tcb) == 128, "invalid apple_nvmmu_tcb size");
+static_assert(NVME_IO_TAGS <= 32, "tag bitmap too small");
+static_assert(SZ_4K % NVME_PRP_LIST_SIZE == 0, "PRP lists must not cross pages");
 
 static bool nvme_initialized = false;
 static u8 nvme_die;
@@ -166,6 +177,7 @@ static void free_queue(struct nvme_queue *q)
     free(q->cmds);
     free(q->tcbs);
     free(q->cqes);
+    free(q->prp_lists);
 }
 
 static void nvme_poll_syslog(void)
@@ -208,11 +220,8 @@ static bool nvme_ctrl_shutdown(void)
     return FIELD_GET(NVME_CSTS_SHST, read32(nvme_base + NVME_CSTS)) == NVME_CSTS_SHST_DONE;
 }
 
-static bool nvme_exec_command(struct nvme_queue *q, struct nvme_command *cmd, u64 *result)
+static void nvme_submit(struct nvme_queue *q, struct nvme_command *cmd, u8 tag)
 {
-    bool found = false;
-    u64 timeout;
-    u8 tag = 0;
     struct nvme_command *queue_cmd = &q->cmds[tag];
     struct apple_nvmmu_tcb *tcb = &q->tcbs[tag];
 
@@ -227,7 +236,7 @@ static bool nvme_exec_command(struct nvme_queue *q, struct nvme_command *cmd, u6
     tcb->prp1 = queue_cmd->prp1;
     tcb->prp2 = queue_cmd->prp2;
 
-    /* make sure ANS2 can see the command and tcb before triggering it */
+    /* make sure ANS2 can see the command, tcb and PRP list before triggering it */
     dma_wmb();
 
     nvme_poll_syslog();
@@ -236,29 +245,26 @@ static bool nvme_exec_command(struct nvme_queue *q, struct nvme_command *cmd, u6
     else
         write32(nvme_base + NVME_DB_LINEAR_IOSQ, tag);
     nvme_poll_syslog();
+}
 
-    timeout = timeout_calculate(NVME_TIMEOUT);
-    struct nvme_completion cqe;
-    while (!timeout_expired(timeout)) {
-        nvme_poll_syslog();
+/*
+ * Pop up to max completions off the CQ, invalidating their TCBs. The CQ doorbell is only rung
+ * once for the whole batch. Returns the number of completions stored in cqes.
+ */
+static int nvme_reap(struct nvme_queue *q, struct nvme_completion *cqes, int max)
+{
+    int count = 0;
 
+    while (count < max) {
         /* we need a DMA read barrier here since the CQ will be updated using DMA */
         dma_rmb();
-        memcpy(&cqe, &q->cqes[q->cq_head], sizeof(cqe));
-        if ((cqe.status & 1) != q->cq_phase)
-            continue;
-
-        if (cqe.tag == tag) {
-            found = true;
-            if (result)
-                *result = cqe.result;
-        } else {
-            printf("nvme: invalid tag in CQ: expected %d but got %d\n", tag, cqe.tag);
-        }
+        memcpy(&cqes[count], &q->cqes[q->cq_head], sizeof(*cqes));
+        if ((cqes[count].status & 1) != q->cq_phase)
+            break;
 
-        write32(nvme_base + NVMMU_TCB_INVAL, cqe.tag);
+        write32(nvme_base + NVMMU_TCB_INVAL, cqes[count].tag);
         if (read32(nvme_base + NVMMU_TCB_STAT))
-            printf("nvme: NVMMU invalidation for tag %d failed\n", cqe.tag);
+            printf("nvme: NVMMU invalidation for tag %d failed\n", cqes[count].tag);
 
         /* increment head and switch phase once the end of the queue has been reached */
         q->cq_head += 1;
@@ -267,10 +273,42 @@ static bool nvme_exec_command(struct nvme_queue *q, struct nvme_command *cmd, u6
             q->cq_phase ^= 1;
         }
 
+        count++;
+    }
+
+    if (count) {
         if (q->adminq)
             write32(nvme_base + NVME_DB_ACQ, q->cq_head);
         else
             write32(nvme_base + NVME_DB_IOCQ, q->cq_head);
+    }
+
+    return count;
+}
+
+static bool nvme_exec_command(struct nvme_queue *q, struct nvme_command *cmd, u64 *result)
+{
+    bool found = false;
+    u64 timeout;
+    u8 tag = 0;
+
+    nvme_submit(q, cmd, tag);
+
+    timeout = timeout_calculate(NVME_TIMEOUT);
+    struct nvme_completion cqe;
+    while (!timeout_expired(timeout)) {
+        nvme_poll_syslog();
+
+        if (!nvme_reap(q, &cqe, 1))
+            continue;
+
+        if (cqe.tag == tag) {
+            found = true;
+            if (result)
+                *result = cqe.result;
+        } else {
+            printf("nvme: invalid tag in CQ: expected %d but got %d\n", tag, cqe.tag);
+        }
         break;
     }
 
@@ -327,6 +365,12 @@ bool nvme_init(void)
     ioq.adminq = false;
     adminq.adminq = true;
 
+    ioq.prp_lists = memalign(SZ_16K, NVME_IO_TAGS * NVME_PRP_LIST_SIZE);
+    if (!ioq.prp_lists) {
+        printf("nvme: Error allocating PRP lists\n");
+        goto out_ioq;
+    }
+
     nvme_asc = asc_init("/arm-io/ans");
     if (!nvme_asc)
         goto out_ioq;
@@ -548,3 +592,95 @@ bool nvme_read(u32 nsid, u64 lba, void *buffer)
 
     return nvme_exec_command(&ioq, &cmd, NULL);
 }
+
+/*
+ * Build a read command for count pages starting at buffer. Two pages fit in prp1/prp2, anything
+ * larger goes through the tag's PRP list. buffer must be page aligned, so every entry is too.
+ */
+static void nvme_build_read(struct nvme_command *cmd, u8 tag, u32 nsid, u64 lba, u32 count,
+                            u64 buffer)
+{
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->opcode = NVME_CMD_READ;
+    cmd->nsid = nsid;
+    cmd->prp1 = buffer;
+    cmd->cdw10 = lba;
+    cmd->cdw11 = lba >> 32;
+    cmd->cdw12 = count - 1; // 0's based
+
+    if (count == 2) {
+        cmd->prp2 = buffer + SZ_4K;
+    } else if (count > 2) {
+        u64 *list = &ioq.prp_lists[tag * NVME_MAX_XFER_BLOCKS];
+
+        for (u32 i = 1; i < count; i++)
+            list[i - 1] = buffer + i * SZ_4K;
+        cmd->prp2 = (u64)list;
+    }
+}
+
+bool nvme_read_blocks(u32 nsid, u64 lba, u32 count, void *buffer)
+{
+    struct nvme_command cmd;
+    struct nvme_completion cqes[NVME_IO_TAGS];
+    u64 buffer_addr = (u64)buffer;
+    u32 free_tags = BIT(NVME_IO_TAGS) - 1;
+    u32 inflight = 0;
+    bool ok = true;
+
+    if (!nvme_initialized)
+        return false;
+
+    if (buffer_addr & (SZ_4K - 1))
+        return false;
+
+    u64 timeout = timeout_calculate(NVME_TIMEOUT);
+
+    while ((count && ok) || inflight) {
+        /* top up the queue first, so ANS2 always has the next commands lined up */
+        while (count && ok && free_tags) {
+            u8 tag = __builtin_ctz(free_tags);
+            u32 blocks = min(count, NVME_MAX_XFER_BLOCKS);
+
+            nvme_build_read(&cmd, tag, nsid, lba, blocks, buffer_addr);
+            nvme_submit(&ioq, &cmd, tag);
+
+            free_tags &= ~BIT(tag);
+            inflight++;
+            buffer_addr += blocks * SZ_4K;
+            lba += blocks;
+            count -= blocks;
+        }
+
+        int reaped = nvme_reap(&ioq, cqes, ARRAY_SIZE(cqes));
+        if (!reaped) {
+            if (timeout_expired(timeout)) {
+                printf("nvme: timed out with %d reads in flight\n", inflight);
+                return false;
+            }
+            nvme_poll_syslog();
+            continue;
+        }
+
+        for (int i = 0; i < reaped; i++) {
+            u16 tag = cqes[i].tag;
+
+            if (tag >= NVME_IO_TAGS || (free_tags & BIT(tag))) {
+                printf("nvme: unexpected tag %d in CQ\n", tag);
+                continue;
+            }
+
+            free_tags |= BIT(tag);
+            inflight--;
+
+            if (cqes[i].status >> 1) {
+                printf("nvme: read failed with status %d\n", cqes[i].status >> 1);
+                ok = false;
+            }
+        }
+
+        timeout = timeout_calculate(NVME_TIMEOUT);
+    }
+
+    return ok;
+}
@@ -10,5 +10,6 @@ void nvme_shutdown(void);
 
 bool nvme_flush(u32 nsid);
 bool nvme_read(u32 nsid, u64 lba, void *buffer);
+bool nvme_read_blocks(u32 nsid, u64 lba, u32 count, void *buffer);
 
 #endif
@@ -6,6 +6,7 @@
 #include "payload.h"
 #include "adt.h"
 #include "assert.h"
+#include "bootprof.h"
 #include "chainload.h"
 #include "cpufreq.h"
 #include "display.h"
@@ -16,14 +17,19 @@
 #include "utils.h"
 
 #include "libfdt/libfdt.h"
+#include "lz4/lz4.h"
 #include "minilzlib/minlzma.h"
 #include "tinf/tinf.h"
+#include "zstd/zstd.h"
 
 // Kernels must be 2MB aligned
 #define KERNEL_ALIGN (2 << 20)
 
 static const u8 gz_magic[] = {0x1f, 0x8b};
 static const u8 xz_magic[] = {0xfd, '7', 'z', 'X', 'Z', 0x00};
+static const u8 zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+static const u8 lz4_magic[] = {0x04, 0x22, 0x4d, 0x18};
+static const u8 lz4_legacy_magic[] = {0x02, 0x21, 0x4c, 0x18}; // lz4 -l, as used by Image.lz4
 static const u8 fdt_magic[] = {0xd0, 0x0d, 0xfe, 0xed};
 static const u8 kernel_magic[] = {'A', 'R', 'M', 0x64};          // at 0x38
 static const u8 cpio_magic[] = {'0', '7', '0', '7', '0'};        // '1' or '2' next
@@ -46,63 +52,132 @@ static char *chainload_spec = NULL;
 
 static void *load_one_payload(void *start, size_t size);
 
-static void finalize_uncompression(void *dest, size_t dest_len)
+/*
+ * Compressed payloads are decoded straight into their final placement: the current end of the
+ * heap, aligned to KERNEL_ALIGN since the output may turn out to be a kernel. Nothing is reserved
+ * until decoding is done, so that placement is the one spot with "infinite" room behind it. The
+ * following code must not use malloc or heapblock until finalize_uncompression() is called.
+ *
+ * Each uncompress hook takes the source size (0 if unknown, for in-line payloads) and the
+ * destination size, and updates them with the consumed and produced sizes. content_size, if
+ * present, peeks at the header and returns the decompressed size if the format records it.
+ */
+struct payload_codec {
+    const char *name;
+    const u8 *magic;
+    size_t magic_len;
+    int (*uncompress)(void *dest, size_t *dest_len, void *src, size_t *src_len);
+    bool (*content_size)(void *src, size_t src_len, size_t *size);
+};
+
+static int gz_uncompress(void *dest, size_t *dest_len, void *src, size_t *src_len)
 {
-    // Actually reserve the space. malloc is safe after this, but...
-    assert(dest == heapblock_alloc_aligned(dest_len, KERNEL_ALIGN));
+    unsigned int dlen = *dest_len, slen = *src_len;
 
-    void *end = ((u8 *)dest) + dest_len;
-    void *next = load_one_payload(dest, dest_len);
-    assert(!next || next >= dest);
+    int ret = tinf_gzip_uncompress(dest, &dlen, src, &slen);
+    *dest_len = dlen;
+    *src_len = slen;
+    return ret;
+}
 
-    // If the payload needs padding, we need to reserve more, so it better have not used
-    // malloc either.
-    if (next > end) {
-        // Explicitly *un*aligned or it'll fail this assert, since 64b alignment is the default
-        assert(end == heapblock_alloc_aligned((u8 *)next - (u8 *)end, 1));
-    }
+static bool gz_content_size(void *src, size_t src_len, size_t *size)
+{
+    // ISIZE trailer, only reachable if we know where the member ends
+    if (src_len < 18)
+        return false;
+
+    u32 isize;
+    memcpy(&isize, (u8 *)src + src_len - 4, 4);
+    *size = isize;
+    return true;
 }
 
-static void *decompress_gz(void *p, size_t size)
+static int xz_uncompress(void *dest, size_t *dest_len, void *src, size_t *src_len)
 {
-    unsigned int source_len = size, dest_len = 1 << 30; // 1 GiB should be enough hopefully
+    uint32_t dlen = *dest_len, slen = *src_len;
 
-    // Start at the end of the heap area, no allocation yet. The following code must not use
-    // malloc or heapblock, until finalize_uncompression is called.
-    void *dest = heapblock_alloc_aligned(0, KERNEL_ALIGN);
+    if (!XzDecode(src, &slen, dest, &dlen))
+        return -1;
 
-    printf("Uncompressing... ");
-    int ret = tinf_gzip_uncompress(dest, &dest_len, p, &source_len);
+    *dest_len = dlen;
+    *src_len = slen;
+    return 0;
+}
 
-    if (ret != TINF_OK) {
-        printf("Error %d\n", ret);
-        return NULL;
-    }
+static int zstd_payload_uncompress(void *dest, size_t *dest_len, void *src, size_t *src_len)
+{
+    // In-line payloads have no known size, the frame itself delimits them
+    if (!*src_len)
+        *src_len = 1 << 30;
 
-    printf("%d bytes uncompressed to %d bytes\n", source_len, dest_len);
+    return zstd_uncompress(dest, dest_len, src, src_len);
+}
 
-    finalize_uncompression(dest, dest_len);
+static bool zstd_payload_content_size(void *src, size_t src_len, size_t *size)
+{
+    return zstd_content_size(src, src_len ? src_len : 1 << 30, size) == ZSTD_OK;
+}
 
-    return ((u8 *)p) + source_len;
+static int lz4_payload_uncompress(void *dest, size_t *dest_len, void *src, size_t *src_len)
+{
+    // In-line payloads have no known size, the frame itself delimits them
+    if (!*src_len)
+        *src_len = 1 << 30;
+
+    return lz4_uncompress(dest, dest_len, src, src_len);
 }
 
-static void *decompress_xz(void *p, size_t size)
+static bool lz4_payload_content_size(void *src, size_t src_len, size_t *size)
 {
-    uint32_t source_len = size, dest_len = 1 << 30; // 1 GiB should be enough hopefully
+    return lz4_content_size(src, src_len ? src_len : 1 << 30, size) == LZ4_OK;
+}
 
-    // Start at the end of the heap area, no allocation yet. The following code must not use
-    // malloc or heapblock, until finalize_uncompression is called.
-    void *dest = heapblock_alloc_aligned(0, KERNEL_ALIGN);
+static const struct payload_codec codecs[] = {
+    {"gzip", gz_magic, sizeof gz_magic, gz_uncompress, gz_content_size},
+    {"XZ", xz_magic, sizeof xz_magic, xz_uncompress, NULL},
+    {"zstd", zstd_magic, sizeof zstd_magic, zstd_payload_uncompress, zstd_payload_content_size},
+    {"LZ4", lz4_magic, sizeof lz4_magic, lz4_payload_uncompress, lz4_payload_content_size},
+    {"LZ4", lz4_legacy_magic, sizeof lz4_legacy_magic, lz4_payload_uncompress, NULL},
+};
+
+static void finalize_uncompression(void *dest, size_t dest_len)
+{
+    size_t reserve = dest_len;
+
+    // Kernels need image_size bytes (code, data and BSS), which extends beyond the decompressed
+    // data. Peek at the header so the whole thing is reserved in one go.
+    struct kernel_header *hdr = dest;
+    if (dest_len >= sizeof(*hdr) && !memcmp(&hdr->magic, kernel_magic, sizeof kernel_magic) &&
+        hdr->image_size > reserve)
+        reserve = hdr->image_size;
+
+    // Actually reserve the space. malloc is safe after this.
+    assert(dest == heapblock_alloc_aligned(reserve, KERNEL_ALIGN));
+
+    void *next = load_one_payload(dest, dest_len);
+    assert(!next || (next >= dest && next <= dest + reserve));
+}
 
-    printf("Uncompressing... ");
-    int ret = XzDecode(p, &source_len, dest, &dest_len);
+static void *decompress(const struct payload_codec *codec, void *p, size_t size)
+{
+    size_t source_len = size, dest_len = 1 << 30; // 1 GiB should be enough hopefully
+
+    // Bound the output exactly if the header tells us how big it is, so bogus data is caught
+    // early instead of scribbling over the rest of RAM
+    if (codec->content_size && codec->content_size(p, size, &dest_len))
+        printf("Uncompressing %ld bytes... ", dest_len);
+    else
+        printf("Uncompressing... ");
+
+    void *dest = heapblock_alloc_aligned(0, KERNEL_ALIGN);
+    int ret = BOOTPROF_RET(codec->name, codec->uncompress(dest, &dest_len, p, &source_len));
 
-    if (!ret) {
-        printf("XZ decode failed\n");
+    if (ret) {
+        printf("%s decode failed (%d)\n", codec->name, ret);
         return NULL;
     }
 
-    printf("%d bytes uncompressed to %d bytes\n", source_len, dest_len);
+    printf("%ld bytes uncompressed to %ld bytes\n", source_len, dest_len);
 
     finalize_uncompression(dest, dest_len);
 
@@ -137,10 +212,21 @@ static void *load_kernel(void *p, size_t size)
 
     assert(size <= kernel->image_size);
 
-    // If this is an in-line kernel, it's probably not aligned, so we need to make a copy
+    /*
+     * Compressed kernels were decompressed straight into an aligned placement. An in-line kernel
+     * is probably not aligned though, and then moving it is unavoidable. Only what is actually in
+     * the payload area is worth copying: anything beyond is BSS, which the kernel clears itself.
+     */
     if (((u64)kernel) & (KERNEL_ALIGN - 1)) {
+        size_t copy = size ? size : min(kernel->image_size, (size_t)(_payload_end - (char *)p));
         void *new_addr = heapblock_alloc_aligned(kernel->image_size, KERNEL_ALIGN);
-        memcpy(new_addr, kernel, size ? size : kernel->image_size);
+
+        if (!((u64)p & 15)) {
+            memcpy128(new_addr, p, copy);
+            memcpy(new_addr + (copy & ~15), p + (copy & ~15), copy & 15);
+        } else {
+            memcpy(new_addr, p, copy);
+        }
         kernel = new_addr;
     }
 
@@ -205,6 +291,8 @@ static bool check_var(u8 **p)
         mitigations_configure(val);
     } else if (IS_VAR("tso=")) {
         enable_tso = val[0] == '1';
+    } else if (IS_VAR("bootprof=")) {
+        bootprof_set_export(val[0] == '1');
     } else {
         printf("Unknown variable %s\n", *p);
     }
@@ -220,13 +308,14 @@ static void *load_one_payload(void *start, size_t size)
     if (!start)
         return NULL;
 
-    if (!memcmp(p, gz_magic, sizeof gz_magic)) {
-        printf("Found a gzip compressed payload at %p\n", p);
-        return decompress_gz(p, size);
-    } else if (!memcmp(p, xz_magic, sizeof xz_magic)) {
-        printf("Found an XZ compressed payload at %p\n", p);
-        return decompress_xz(p, size);
-    } else if (!memcmp(p, fdt_magic, sizeof fdt_magic)) {
+    for (size_t i = 0; i < ARRAY_SIZE(codecs); i++) {
+        if (!memcmp(p, codecs[i].magic, codecs[i].magic_len)) {
+            printf("Found a %s compressed payload at %p\n", codecs[i].name, p);
+            return decompress(&codecs[i], p, size);
+        }
+    }
+
+    if (!memcmp(p, fdt_magic, sizeof fdt_magic)) {
         return load_fdt(p, size);
     } else if (!memcmp(p, cpio_magic, sizeof cpio_magic)) {
         printf("Found a cpio initramfs at %p\n", p);
@@ -308,17 +397,19 @@ int payload_run(void)
 
     void *p = _payload_start;
 
+    int parse_span = bootprof_begin("payload_parse");
     while (p)
         p = load_one_payload(p, 0);
+    bootprof_end(parse_span);
 
     if (chainload_spec) {
         return chainload_load(chainload_spec, chosen, chosen_cnt);
     }
 
     if (kernel && fdt) {
-        cpufreq_init();
-        smp_start_secondaries();
-        mitigations_perform();
+        BOOTPROF("cpufreq_init", cpufreq_init());
+        BOOTPROF("smp_start_secondaries", smp_start_secondaries());
+        BOOTPROF("mitigations_perform", mitigations_perform());
         if (enable_tso) {
 
             do_enable_tso();
@@ -342,7 +433,7 @@ int payload_run(void)
                 printf("Failed to kboot set %s='%s'\n", chosen[i], val);
         }
 
-        if (kboot_prepare_dt(fdt)) {
+        if (BOOTPROF_RET("kboot_prepare_dt", kboot_prepare_dt(fdt))) {
             printf("Failed to prepare FDT!\n");
             return -1;
         }
@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: MIT */
 
 #include "proxy.h"
+#include "adt.h"
+#include "bootprof.h"
 #include "cpufreq.h"
 #include "dapf.h"
 #include "dart.h"
@@ -29,8 +31,100 @@
 #include "xnuboot.h"
 #include "hv_psci.h"
 
+#include "lz4/lz4.h"
 #include "minilzlib/minlzma.h"
 #include "tinf/tinf.h"
+#include "zstd/zstd.h"
+
+static u64 proxy_call(enum proxy_call_mode mode, void *func, u64 a, u64 b, u64 c, u64 d)
+{
+    switch (mode) {
+        case PROXY_CALL_EL2:
+            return ((generic_func *)func)(a, b, c, d, 0);
+        case PROXY_CALL_EL1:
+            return el1_call(func, a, b, c, d);
+        case PROXY_CALL_EL0:
+            return el0_call(func, a, b, c, d);
+        case PROXY_CALL_GL2:
+            return gl2_call(func, a, b, c, d);
+        case PROXY_CALL_GL1:
+            return gl1_call(func, a, b, c, d);
+    }
+
+    return 0;
+}
+
+/*
+ * Run func with the exception guard from flags set just for this call. Exceptions are reported
+ * through the reply status, so clients don't need separate round trips to set the guard and
+ * read back the exception count.
+ */
+static u64 proxy_guarded_call(ProxyReply *reply, u64 flags, void *func, u64 a, u64 b, u64 c, u64 d)
+{
+    exc_count = 0;
+    exc_guard = FIELD_GET(PROXY_CALL_GUARD, flags);
+
+    u64 ret = proxy_call(FIELD_GET(PROXY_CALL_MODE, flags), func, a, b, c, d);
+
+    if (exc_count)
+        reply->status = S_EXCEPTION;
+    exc_count = 0;
+
+    return ret;
+}
+
+/*
+ * System registers can only be named in the instruction encoding, so P_SYSREG_RW runs small
+ * "mrs x0, reg" / "msr reg, x0" stubs. They are generated on first use and kept in a direct
+ * mapped cache, so sweeps over the same registers don't pay for cache maintenance every time.
+ */
+#define SYSREG_STUBS    256
+#define SYSREG_MRS      0xd5200000
+#define SYSREG_MSR      0xd5000000
+#define SYSREG_ENC_MASK GENMASK(20, 5)
+#define INSN_RET        0xd65f03c0
+
+static u32 (*sysreg_stubs)[2];
+static u32 sysreg_stub_insn[SYSREG_STUBS];
+
+static void *sysreg_stub(u64 enc, bool write)
+{
+    u32 insn = (write ? SYSREG_MSR : SYSREG_MRS) | FIELD_PREP(SYSREG_ENC_MASK, enc);
+    u32 slot = ((insn >> 5) ^ (insn >> 13) ^ (write ? SYSREG_STUBS / 2 : 0)) % SYSREG_STUBS;
+
+    if (!sysreg_stubs) {
+        sysreg_stubs = memalign(64, SYSREG_STUBS * sizeof(*sysreg_stubs));
+        if (!sysreg_stubs)
+            return NULL;
+    }
+
+    if (sysreg_stub_insn[slot] != insn) {
+        sysreg_stubs[slot][0] = insn;
+        sysreg_stubs[slot][1] = INSN_RET;
+        dc_cvau_range(sysreg_stubs[slot], sizeof(sysreg_stubs[slot]));
+        ic_ivau_range(sysreg_stubs[slot], sizeof(sysreg_stubs[slot]));
+        sysreg_stub_insn[slot] = insn;
+    }
+
+    return sysreg_stubs[slot];
+}
+
+/* The heap is not executable at EL2 and EL0 through its identity mapping, only via its aliases */
+static void *proxy_code_alias(void *code, enum proxy_call_mode mode)
+{
+    if (!mmu_active())
+        return code;
+
+    switch (mode) {
+        case PROXY_CALL_EL2:
+        case PROXY_CALL_GL2:
+            return (void *)((u64)code | REGION_RX_EL1);
+        case PROXY_CALL_EL0:
+            return (void *)((u64)code | REGION_RWX_EL0);
+        default:
+            return code;
+    }
+}
 
 int proxy_process(ProxyRequest *request, ProxyReply *reply)
 {
@@ -120,6 +214,26 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
         case P_EL3_CALL:
             reply->retval = el3_call((void *)request->args[0], request->args[1], request->args[2],
                                      request->args[3], request->args[4]);
+            break;
+        case P_CALL_GUARDED:
+            reply->retval =
+                proxy_guarded_call(reply, request->args[1], (void *)request->args[0],
+                                   request->args[2], request->args[3], request->args[4],
+                                   request->args[5]);
+            break;
+        case P_SYSREG_RW: {
+            u64 flags = request->args[1];
+            void *stub = sysreg_stub(request->args[0], flags & PROXY_SYSREG_WR);
+
+            if (!stub) {
+                reply->status = S_BADCMD;
+                break;
+            }
+
+            stub = proxy_code_alias(stub, FIELD_GET(PROXY_CALL_MODE, flags));
+            reply->retval = proxy_guarded_call(reply, flags, stub, request->args[2], 0, 0, 0);
+            break;
+        }
 
         case P_WRITE64:
             exc_guard = GUARD_SKIP;
@@ -328,6 +442,33 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
                 reply->retval = destlen;
             break;
         }
+        case P_ZSTDDEC: {
+            size_t destlen, srclen;
+            destlen = request->args[3];
+            srclen = request->args[1];
+            int ret = zstd_uncompress((void *)request->args[2], &destlen,
+                                      (void *)request->args[0], &srclen);
+            if (ret != ZSTD_OK)
+                reply->retval = ret;
+            else
+                reply->retval = destlen;
+            break;
+        }
+        case P_LZ4DEC: {
+            size_t destlen, srclen;
+            destlen = request->args[3];
+            srclen = request->args[1];
+            int ret = lz4_uncompress((void *)request->args[2], &destlen, (void *)request->args[0],
+                                     &srclen);
+            if (ret != LZ4_OK)
+                reply->retval = ret;
+            else
+                reply->retval = destlen;
+            break;
+        }
+        case P_CRC32:
+            reply->retval = tinf_crc32((void *)request->args[0], request->args[1]);
+            break;
 
         case P_SMP_START_SECONDARIES:
             smp_start_secondaries();
@@ -467,6 +608,11 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
         case P_DART_UNMAP:
             dart_unmap((dart_dev_t *)request->args[0], request->args[1], request->args[2]);
             break;
+        case P_DART_MAP_BATCH:
+            reply->retval = dart_map_batch((dart_dev_t *)request->args[0],
+                                           (const struct dart_map_entry *)request->args[1],
+                                           request->args[2]);
+            break;
 
         case P_HV_INIT:
             hv_init();
@@ -481,6 +627,22 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
             reply->retval = hv_translate(request->args[0], request->args[1], request->args[2],
                                          (void *)request->args[3]);
             break;
+        case P_HV_TRANSLATE_RANGE:
+            reply->retval = hv_translate_range(request->args[0], request->args[1],
+                                               request->args[2], request->args[3],
+                                               (struct hv_xlate_extent *)request->args[4],
+                                               request->args[5]);
+            break;
+        case P_HV_GATHER:
+            exc_guard = GUARD_RETURN;
+            reply->retval = hv_gather((void *)request->args[0],
+                                      (struct hv_xlate_extent *)request->args[1], request->args[2]);
+            break;
+        case P_HV_SCATTER:
+            exc_guard = GUARD_RETURN;
+            reply->retval = hv_scatter((void *)request->args[0],
+                                       (struct hv_xlate_extent *)request->args[1], request->args[2]);
+            break;
         case P_HV_PT_WALK:
             reply->retval = hv_pt_walk(request->args[0]);
             break;
@@ -498,6 +660,42 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
             reply->retval = hv_trace_irq(request->args[0], request->args[1], request->args[2],
                                          request->args[3]);
             break;
+        case P_HV_VGIC_ROUTE_IRQ:
+            reply->retval = hv_vgicv3_route_aic_irq(request->args[0], request->args[1]);
+            break;
+        case P_HV_VGIC_IRQ_STATS:
+            reply->retval = hv_vgicv3_get_irq_stats(request->args[0],
+                                                    (struct hv_vgic_irq_stats *)request->args[1]);
+            break;
+        case P_HV_TICK_STATS:
+            hv_get_tick_stats((struct hv_tick_stats *)request->args[0]);
+            break;
+        case P_HV_PROF_ENABLE:
+            hv_prof_enable(request->args[0], request->args[1]);
+            break;
+        case P_HV_PROF_DUMP:
+            reply->retval = hv_prof_dump((void *)request->args[0], request->args[1]);
+            break;
+        case P_HV_SAMPLE_START:
+            reply->retval = hv_sample_start(request->args[0], request->args[1], request->args[2]);
+            break;
+        case P_HV_SAMPLE_STOP:
+            reply->retval = hv_sample_stop();
+            break;
+        case P_HV_SAMPLE_DRAIN:
+            reply->retval =
+                hv_sample_drain((struct hv_sample *)request->args[0], request->args[1]);
+            break;
+        case P_HV_SYSREG_MAP:
+            reply->retval = hv_sysreg_map(request->args[0], request->args[1], request->args[2]);
+            break;
+        case P_HV_SYSREG_UNREGISTER:
+            hv_sysreg_unregister(request->args[0]);
+            break;
+        case P_HV_SYSREG_STATS:
+            reply->retval = hv_sysreg_get_stats((struct hv_sysreg_stats *)request->args[0],
+                                                request->args[1], request->args[2]);
+            break;
         case P_HV_WDT_START:
             hv_wdt_start(request->args[0]);
             break;
@@ -603,6 +801,10 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
         case P_NVME_FLUSH:
             reply->retval = nvme_flush(request->args[0]);
             break;
+        case P_NVME_READ_BLOCKS:
+            reply->retval = nvme_read_blocks(request->args[0], request->args[1], request->args[2],
+                                             (void *)request->args[3]);
+            break;
 
         case P_MCC_GET_CARVEOUTS:
             reply->retval = (u64)mcc_carveouts;
@@ -635,6 +837,17 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
             reply->retval = cpufreq_init();
             break;
 
+        case P_BOOTPROF_GET:
+            reply->retval = (u64)bootprof_report(NULL);
+            break;
+        case P_BOOTPROF_SET_EXPORT:
+            bootprof_set_export(request->args[0]);
+            break;
+
+        case P_ADT_INDEX_BUILD:
+            reply->retval = adt_index_build(adt, request->args[0]);
+            break;
+
         default:
             reply->status = S_BADCMD;
             break;
@@ -25,6 +25,8 @@ typedef enum {
     P_REBOOT,
     P_SLEEP,
     P_EL3_CALL,
+    P_CALL_GUARDED,
+    P_SYSREG_RW,
 
     P_WRITE64 = 0x100, // Generic register functions
     P_WRITE32,
@@ -79,6 +81,9 @@ typedef enum {
 
     P_XZDEC = 0x400, // Decompression and data processing ops
     P_GZDEC,
+    P_ZSTDDEC,
+    P_LZ4DEC,
+    P_CRC32,
 
     P_SMP_START_SECONDARIES = 0x500, // SMP and system management ops
     P_SMP_CALL,
@@ -124,6 +129,7 @@ typedef enum {
     P_DART_SHUTDOWN,
     P_DART_MAP,
     P_DART_UNMAP,
+    P_DART_MAP_BATCH,
 
     P_HV_INIT = 0xc00,
     P_HV_MAP,
@@ -150,6 +156,20 @@ typedef enum {
     P_HV_PSCI_FEATURES,
     P_HV_PSCI_MEM_PROTECT,
     P_HV_PSCI_MEM_PROTECT_CHECK_RANGE,
+    P_HV_VGIC_ROUTE_IRQ = 0xc1a,
+    P_HV_VGIC_IRQ_STATS,
+    P_HV_TICK_STATS,
+    P_HV_PROF_ENABLE,
+    P_HV_PROF_DUMP,
+    P_HV_SAMPLE_START,
+    P_HV_SAMPLE_STOP,
+    P_HV_SAMPLE_DRAIN,
+    P_HV_SYSREG_MAP,
+    P_HV_SYSREG_UNREGISTER,
+    P_HV_SYSREG_STATS,
+    P_HV_TRANSLATE_RANGE,
+    P_HV_GATHER,
+    P_HV_SCATTER,
 
     P_FB_INIT = 0xd00,
     P_FB_SHUTDOWN,
@@ -168,6 +188,7 @@ typedef enum {
     P_NVME_SHUTDOWN,
     P_NVME_READ,
     P_NVME_FLUSH,
+    P_NVME_READ_BLOCKS,
 
     P_MCC_GET_CARVEOUTS = 0x1000,
 
@@ -181,10 +202,32 @@ typedef enum {
     P_DAPF_INIT,
 
     P_CPUFREQ_INIT = 0x1300,
+
+    P_BOOTPROF_GET = 0x1400,
+    P_BOOTPROF_SET_EXPORT,
+
+    P_ADT_INDEX_BUILD = 0x1500,
 } ProxyOp;
 
-#define S_OK     0
-#define S_BADCMD -1
+#define S_OK        0
+#define S_BADCMD    -1
+#define S_EXCEPTION -2 // Guarded call took an exception, retval still holds its return value
+
+/*
+ * Flags for P_CALL_GUARDED and P_SYSREG_RW: the exception guard to use for the duration of the
+ * call, and the exception level / guarded level it runs at.
+ */
+#define PROXY_CALL_GUARD GENMASK(15, 0)
+#define PROXY_CALL_MODE  GENMASK(23, 16)
+#define PROXY_SYSREG_WR  BIT(24)
+
+enum proxy_call_mode {
+    PROXY_CALL_EL2 = 0,
+    PROXY_CALL_EL1,
+    PROXY_CALL_EL0,
+    PROXY_CALL_GL2,
+    PROXY_CALL_GL1,
+};
 
 typedef struct {
     u64 opcode;
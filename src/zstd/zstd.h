@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef ZSTD_H
+#define ZSTD_H
+
+#include <stddef.h>
+
+#define ZSTD_OK           0
+#define ZSTD_ERR_FORMAT   -1 // Bad magic, reserved bits set or unsupported feature (dictionaries)
+#define ZSTD_ERR_CORRUPT  -2 // Malformed block or entropy coded data
+#define ZSTD_ERR_SRC      -3 // Input truncated
+#define ZSTD_ERR_DST      -4 // Output buffer too small
+#define ZSTD_ERR_CHECKSUM -5 // Content checksum mismatch
+
+/*
+ * Decompress a single zstd frame, skipping any skippable frames in front of it.
+ *
+ * On entry, *dest_len and *source_len hold the buffer sizes. On success, they are updated with
+ * the number of bytes produced and consumed respectively. The decoder writes the output strictly
+ * sequentially and never reads back beyond the current frame's output, so the destination may
+ * be the final placement of the data.
+ *
+ * Not reentrant: the entropy tables and literal buffer live in static storage.
+ */
+int zstd_uncompress(void *dest, size_t *dest_len, const void *source, size_t *source_len);
+
+/*
+ * Peek at the frame header and return the decompressed size in *size, if the frame records it.
+ * Returns ZSTD_ERR_FORMAT if it does not.
+ */
+int zstd_content_size(const void *source, size_t source_len, size_t *size);
+
+#endif
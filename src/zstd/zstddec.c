@@ -0,0 +1,929 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Minimal freestanding Zstandard (RFC 8878) decoder.
+ *
+ * Supports everything a stock `zstd` produces for a single frame without a dictionary: raw, RLE
+ * and compressed blocks, Huffman coded literals (1 and 4 streams, treeless reuse), predefined,
+ * RLE, FSE and repeat sequence table modes, repeat offsets and the optional XXH64 content
+ * checksum. Output goes straight into the caller's buffer, which doubles as the history window.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "zstd.h"
+
+#define ZSTD_MAGIC      0xfd2fb528
+#define ZSTD_SKIP_MAGIC 0x184d2a50
+#define ZSTD_SKIP_MASK  0xfffffff0
+
+#define BLOCK_MAX (128 << 10)
+
+#define BLOCK_RAW        0
+#define BLOCK_RLE        1
+#define BLOCK_COMPRESSED 2
+
+#define LIT_RAW        0
+#define LIT_RLE        1
+#define LIT_COMPRESSED 2
+#define LIT_TREELESS   3
+
+#define SEQ_PREDEFINED 0
+#define SEQ_RLE        1
+#define SEQ_FSE        2
+#define SEQ_REPEAT     3
+
+#define HUF_MAX_BITS    11
+#define HUF_MAX_WEIGHTS 255
+#define HUF_WEIGHT_LOG  6
+
+#define FSE_MAX_LOG  9
+#define FSE_MAX_SYMS 256
+
+#define LL_MAX_LOG 9
+#define ML_MAX_LOG 9
+#define OF_MAX_LOG 8
+#define LL_MAX_SYM 35
+#define ML_MAX_SYM 52
+#define OF_MAX_SYM 31
+
+typedef struct {
+    uint8_t sym;
+    uint8_t bits;
+    uint16_t base;
+} fse_entry_t;
+
+typedef struct {
+    int log; // -1: no table yet
+    fse_entry_t t[1 << FSE_MAX_LOG];
+} fse_table_t;
+
+typedef struct {
+    uint8_t sym;
+    uint8_t bits;
+} huf_entry_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    int64_t pos; // bits left to read, may go negative (reads then return zeros)
+} bitrev_t;
+
+static struct {
+    uint8_t *dst_start;
+    uint8_t *dst;
+    uint8_t *dst_end;
+
+    int huf_bits; // 0: no table yet
+    huf_entry_t huf[1 << HUF_MAX_BITS];
+
+    fse_table_t ll, ml, of, weights;
+    uint32_t rep[3];
+
+    uint8_t lits[BLOCK_MAX];
+} ctx;
+
+static const int16_t ll_default[LL_MAX_SYM + 1] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1,
+};
+static const int16_t ml_default[ML_MAX_SYM + 1] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1, -1, -1,
+};
+static const int16_t of_default[OF_MAX_SYM - 2] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1,
+};
+
+static const uint32_t ll_base[LL_MAX_SYM + 1] = {
+    0,  1,  2,  3,  4,  5,  6,  7,  8,   9,   10,  11,   12,   13,   14,   15,    16,    18,
+    20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536,
+};
+static const uint8_t ll_bits[LL_MAX_SYM + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0,  0,  1,  1,
+    1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+};
+static const uint32_t ml_base[ML_MAX_SYM + 1] = {
+    3,   4,    5,    6,    7,    8,    9,    10,    11,    12,    13,    14,   15,  16,
+    17,  18,   19,   20,   21,   22,   23,   24,    25,    26,    27,    28,   29,  30,
+    31,  32,   33,   34,   35,   37,   39,   41,    43,    47,    51,    59,   67,  83,
+    99,  131,  259,  515,  1027, 2051, 4099, 8195,  16387, 32771, 65539,
+};
+static const uint8_t ml_bits[ML_MAX_SYM + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+};
+
+static inline int highbit(uint32_t v)
+{
+    return 31 - __builtin_clz(v);
+}
+
+static inline uint16_t le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t le64(const uint8_t *p)
+{
+    return le32(p) | ((uint64_t)le32(p + 4) << 32);
+}
+
+// Little endian load of up to 8 bytes, zero-filled past the end of the buffer
+static inline uint64_t load_le(const uint8_t *p, size_t avail)
+{
+    if (avail >= 8)
+        return le64(p);
+
+    uint64_t v = 0;
+    for (size_t i = 0; i < avail; i++)
+        v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+/* Backward bitstreams (Huffman, FSE), read from the last byte towards the first */
+
+static int br_init(bitrev_t *br, const uint8_t *data, size_t len)
+{
+    if (!len || !data[len - 1])
+        return ZSTD_ERR_CORRUPT;
+
+    br->data = data;
+    br->len = len;
+    br->pos = (len - 1) * 8 + highbit(data[len - 1]);
+    return ZSTD_OK;
+}
+
+static inline uint32_t br_peek(const bitrev_t *br, int n)
+{
+    int64_t pos = br->pos - n;
+    uint64_t v;
+
+    if (pos >= 0) {
+        size_t byte = pos >> 3;
+        v = load_le(br->data + byte, br->len - byte) >> (pos & 7);
+    } else if (pos > -64) {
+        v = load_le(br->data, br->len) << -pos;
+    } else {
+        return 0;
+    }
+
+    return v & ((1ULL << n) - 1);
+}
+
+static inline uint32_t br_read(bitrev_t *br, int n)
+{
+    if (!n)
+        return 0;
+
+    uint32_t v = br_peek(br, n);
+    br->pos -= n;
+    return v;
+}
+
+/* FSE tables */
+
+static int fse_build(fse_table_t *t, const int16_t *norm, int nsyms, int log)
+{
+    uint16_t next[FSE_MAX_SYMS];
+    int size = 1 << log;
+    int high = size - 1;
+
+    for (int s = 0; s < nsyms; s++) {
+        if (norm[s] == -1) {
+            t->t[high--].sym = s;
+            next[s] = 1;
+        } else {
+            next[s] = norm[s];
+        }
+    }
+
+    int step = (size >> 1) + (size >> 3) + 3;
+    int pos = 0;
+
+    for (int s = 0; s < nsyms; s++) {
+        for (int i = 0; i < norm[s]; i++) {
+            t->t[pos].sym = s;
+            do {
+                pos = (pos + step) & (size - 1);
+            } while (pos > high);
+        }
+    }
+
+    if (pos != 0)
+        return ZSTD_ERR_CORRUPT;
+
+    for (int i = 0; i < size; i++) {
+        uint16_t n = next[t->t[i].sym]++;
+        int bits = log - highbit(n);
+
+        t->t[i].bits = bits;
+        t->t[i].base = (n << bits) - size;
+    }
+
+    t->log = log;
+    return ZSTD_OK;
+}
+
+static void fse_build_rle(fse_table_t *t, uint8_t sym)
+{
+    t->log = 0;
+    t->t[0].sym = sym;
+    t->t[0].bits = 0;
+    t->t[0].base = 0;
+}
+
+static int fse_read(fse_table_t *t, const uint8_t *src, size_t len, int max_log, int max_sym,
+                    size_t *used)
+{
+    int16_t norm[FSE_MAX_SYMS];
+    size_t pos = 0; // in bits
+
+#define FWD_READ(n)                                                                                \
+    ({                                                                                             \
+        size_t _byte = pos >> 3;                                                                   \
+        uint64_t _v = _byte < len ? load_le(src + _byte, len - _byte) >> (pos & 7) : 0;            \
+        pos += (n);                                                                                \
+        (uint32_t)(_v & ((1ULL << (n)) - 1));                                                      \
+    })
+
+    int log = FWD_READ(4) + 5;
+    if (log > max_log)
+        return ZSTD_ERR_CORRUPT;
+
+    int remaining = 1 << log;
+    int sym = 0;
+
+    while (remaining > 0 && sym < FSE_MAX_SYMS) {
+        int bits = highbit(remaining + 1) + 1;
+        uint32_t val = FWD_READ(bits);
+        uint32_t lower_mask = (1 << (bits - 1)) - 1;
+        uint32_t threshold = (1 << bits) - 1 - (remaining + 1);
+
+        if ((val & lower_mask) < threshold) {
+            pos--;
+            val &= lower_mask;
+        } else if (val > lower_mask) {
+            val -= threshold;
+        }
+
+        int prob = (int)val - 1;
+        remaining -= prob < 0 ? -prob : prob;
+        norm[sym++] = prob;
+
+        if (prob == 0) {
+            uint32_t repeat = FWD_READ(2);
+            while (true) {
+                for (uint32_t i = 0; i < repeat && sym < FSE_MAX_SYMS; i++)
+                    norm[sym++] = 0;
+                if (repeat != 3)
+                    break;
+                repeat = FWD_READ(2);
+            }
+        }
+    }
+
+#undef FWD_READ
+
+    *used = (pos + 7) >> 3;
+    if (*used > len)
+        return ZSTD_ERR_SRC;
+    if (remaining != 0 || sym > max_sym + 1)
+        return ZSTD_ERR_CORRUPT;
+
+    return fse_build(t, norm, sym, log);
+}
+
+/* Huffman coded literals */
+
+static int huf_read_table(const uint8_t *src, size_t len, size_t *used)
+{
+    uint8_t w[HUF_MAX_WEIGHTS + 1];
+    int n = 0;
+
+    if (len < 1)
+        return ZSTD_ERR_SRC;
+
+    uint8_t hdr = src[0];
+    if (hdr >= 128) {
+        n = hdr - 127;
+        *used = 1 + (n + 1) / 2;
+        if (*used > len)
+            return ZSTD_ERR_SRC;
+
+        for (int i = 0; i < n; i++)
+            w[i] = (i & 1) ? (src[1 + i / 2] & 0xf) : (src[1 + i / 2] >> 4);
+    } else {
+        size_t hlen;
+        bitrev_t br;
+
+        *used = 1 + hdr;
+        if (*used > len)
+            return ZSTD_ERR_SRC;
+
+        int ret = fse_read(&ctx.weights, src + 1, hdr, HUF_WEIGHT_LOG, HUF_MAX_WEIGHTS, &hlen);
+        if (ret)
+            return ret;
+        if (br_init(&br, src + 1 + hlen, hdr - hlen))
+            return ZSTD_ERR_CORRUPT;
+
+        const fse_entry_t *t = ctx.weights.t;
+        int log = ctx.weights.log;
+        uint16_t s1 = br_read(&br, log);
+        uint16_t s2 = br_read(&br, log);
+
+        // Two interleaved states share one table. Once the stream runs dry, the other state
+        // still holds one last symbol.
+        uint16_t *cur = &s1, *other = &s2;
+        while (true) {
+            if (n >= HUF_MAX_WEIGHTS)
+                return ZSTD_ERR_CORRUPT;
+            w[n++] = t[*cur].sym;
+            *cur = t[*cur].base + br_read(&br, t[*cur].bits);
+            if (br.pos < 0) {
+                if (n >= HUF_MAX_WEIGHTS)
+                    return ZSTD_ERR_CORRUPT;
+                w[n++] = t[*other].sym;
+                break;
+            }
+
+            uint16_t *tmp = cur;
+            cur = other;
+            other = tmp;
+        }
+    }
+
+    uint32_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        if (w[i] > HUF_MAX_BITS)
+            return ZSTD_ERR_CORRUPT;
+        if (w[i])
+            sum += 1 << (w[i] - 1);
+    }
+    if (!sum)
+        return ZSTD_ERR_CORRUPT;
+
+    // The last weight is implied: it completes the sum to the next power of two
+    int bits = highbit(sum) + 1;
+    uint32_t left = (1 << bits) - sum;
+    if (bits > HUF_MAX_BITS || (left & (left - 1)))
+        return ZSTD_ERR_CORRUPT;
+    w[n++] = highbit(left) + 1;
+
+    // Canonical codes: lowest weight (longest code) first, then by symbol value
+    uint32_t idx = 0;
+    for (int wt = 1; wt <= bits; wt++) {
+        for (int s = 0; s < n; s++) {
+            if (w[s] != wt)
+                continue;
+            uint32_t cnt = 1 << (wt - 1);
+            for (uint32_t i = 0; i < cnt; i++) {
+                ctx.huf[idx + i].sym = s;
+                ctx.huf[idx + i].bits = bits + 1 - wt;
+            }
+            idx += cnt;
+        }
+    }
+
+    if (idx != (1u << bits))
+        return ZSTD_ERR_CORRUPT;
+
+    ctx.huf_bits = bits;
+    return ZSTD_OK;
+}
+
+static int huf_decode_stream(uint8_t *out, size_t n, const uint8_t *src, size_t len)
+{
+    bitrev_t br;
+    int bits = ctx.huf_bits;
+
+    if (br_init(&br, src, len))
+        return ZSTD_ERR_CORRUPT;
+
+    for (size_t i = 0; i < n; i++) {
+        const huf_entry_t *e = &ctx.huf[br_peek(&br, bits)];
+        out[i] = e->sym;
+        br.pos -= e->bits;
+    }
+
+    return br.pos == 0 ? ZSTD_OK : ZSTD_ERR_CORRUPT;
+}
+
+static int decode_literals(const uint8_t *src, size_t len, const uint8_t **lits, size_t *nlits,
+                           size_t *used)
+{
+    if (len < 1)
+        return ZSTD_ERR_SRC;
+
+    int type = src[0] & 3;
+    int fmt = (src[0] >> 2) & 3;
+    uint64_t hdr = load_le(src, len < 5 ? len : 5);
+    size_t hsize, regen;
+
+    if (type == LIT_RAW || type == LIT_RLE) {
+        switch (fmt) {
+            case 1:
+                hsize = 2;
+                regen = (hdr >> 4) & 0xfff;
+                break;
+            case 3:
+                hsize = 3;
+                regen = (hdr >> 4) & 0xfffff;
+                break;
+            default:
+                hsize = 1;
+                regen = (hdr >> 3) & 0x1f;
+                break;
+        }
+
+        if (hsize > len)
+            return ZSTD_ERR_SRC;
+        if (regen > BLOCK_MAX)
+            return ZSTD_ERR_CORRUPT;
+
+        if (type == LIT_RAW) {
+            if (hsize + regen > len)
+                return ZSTD_ERR_SRC;
+            *lits = src + hsize;
+            *used = hsize + regen;
+        } else {
+            if (hsize + 1 > len)
+                return ZSTD_ERR_SRC;
+            memset(ctx.lits, src[hsize], regen);
+            *lits = ctx.lits;
+            *used = hsize + 1;
+        }
+
+        *nlits = regen;
+        return ZSTD_OK;
+    }
+
+    int streams = fmt == 0 ? 1 : 4;
+    int sbits = fmt < 2 ? 10 : (fmt == 2 ? 14 : 18);
+    hsize = fmt < 2 ? 3 : (fmt == 2 ? 4 : 5);
+
+    if (hsize > len)
+        return ZSTD_ERR_SRC;
+
+    regen = (hdr >> 4) & ((1 << sbits) - 1);
+    size_t csize = (hdr >> (4 + sbits)) & ((1 << sbits) - 1);
+
+    if (hsize + csize > len)
+        return ZSTD_ERR_SRC;
+    if (regen > BLOCK_MAX)
+        return ZSTD_ERR_CORRUPT;
+
+    const uint8_t *p = src + hsize;
+    size_t rem = csize;
+
+    if (type == LIT_COMPRESSED) {
+        size_t tlen;
+        int ret = huf_read_table(p, rem, &tlen);
+        if (ret)
+            return ret;
+        p += tlen;
+        rem -= tlen;
+    } else if (!ctx.huf_bits) {
+        return ZSTD_ERR_CORRUPT;
+    }
+
+    if (streams == 1) {
+        int ret = huf_decode_stream(ctx.lits, regen, p, rem);
+        if (ret)
+            return ret;
+    } else {
+        if (rem < 6)
+            return ZSTD_ERR_SRC;
+
+        size_t ssize[4] = {le16(p), le16(p + 2), le16(p + 4), 0};
+        p += 6;
+        rem -= 6;
+
+        if (ssize[0] + ssize[1] + ssize[2] > rem)
+            return ZSTD_ERR_CORRUPT;
+        ssize[3] = rem - ssize[0] - ssize[1] - ssize[2];
+
+        size_t seg = (regen + 3) / 4;
+        if (3 * seg > regen)
+            return ZSTD_ERR_CORRUPT;
+
+        uint8_t *out = ctx.lits;
+        for (int i = 0; i < 4; i++) {
+            size_t n = i < 3 ? seg : regen - 3 * seg;
+            int ret = huf_decode_stream(out, n, p, ssize[i]);
+            if (ret)
+                return ret;
+            out += n;
+            p += ssize[i];
+        }
+    }
+
+    *lits = ctx.lits;
+    *nlits = regen;
+    *used = hsize + csize;
+    return ZSTD_OK;
+}
+
+/* Sequences */
+
+static int seq_table(fse_table_t *t, int mode, const uint8_t **p, const uint8_t *end,
+                     const int16_t *def, int def_syms, int def_log, int max_log, int max_sym)
+{
+    size_t used;
+    int ret;
+
+    switch (mode) {
+        case SEQ_PREDEFINED:
+            return fse_build(t, def, def_syms, def_log);
+        case SEQ_RLE:
+            if (*p >= end)
+                return ZSTD_ERR_SRC;
+            if (**p > max_sym)
+                return ZSTD_ERR_CORRUPT;
+            fse_build_rle(t, *(*p)++);
+            return ZSTD_OK;
+        case SEQ_FSE:
+            ret = fse_read(t, *p, end - *p, max_log, max_sym, &used);
+            if (ret)
+                return ret;
+            *p += used;
+            return ZSTD_OK;
+        default:
+            return t->log < 0 ? ZSTD_ERR_CORRUPT : ZSTD_OK;
+    }
+}
+
+static inline void copy_bytes(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    while (n--)
+        *dst++ = *src++;
+}
+
+static int decode_sequences(const uint8_t *src, size_t len, const uint8_t *lits, size_t nlits)
+{
+    const uint8_t *p = src, *end = src + len;
+    const uint8_t *lit_end = lits + nlits;
+    uint32_t nseq;
+
+    if (p >= end)
+        return ZSTD_ERR_SRC;
+
+    nseq = *p++;
+    if (nseq >= 128) {
+        if (nseq < 255) {
+            if (p >= end)
+                return ZSTD_ERR_SRC;
+            nseq = ((nseq - 128) << 8) + *p++;
+        } else {
+            if (end - p < 2)
+                return ZSTD_ERR_SRC;
+            nseq = le16(p) + 0x7f00;
+            p += 2;
+        }
+    }
+
+    if (nseq) {
+        int ret;
+        bitrev_t br;
+
+        if (p >= end)
+            return ZSTD_ERR_SRC;
+
+        uint8_t modes = *p++;
+        if (modes & 3)
+            return ZSTD_ERR_CORRUPT;
+
+        ret = seq_table(&ctx.ll, modes >> 6, &p, end, ll_default, LL_MAX_SYM + 1, 6, LL_MAX_LOG,
+                        LL_MAX_SYM);
+        if (!ret)
+            ret = seq_table(&ctx.of, (modes >> 4) & 3, &p, end, of_default, OF_MAX_SYM - 2, 5,
+                            OF_MAX_LOG, OF_MAX_SYM);
+        if (!ret)
+            ret = seq_table(&ctx.ml, (modes >> 2) & 3, &p, end, ml_default, ML_MAX_SYM + 1, 6,
+                            ML_MAX_LOG, ML_MAX_SYM);
+        if (ret)
+            return ret;
+
+        if (br_init(&br, p, end - p))
+            return ZSTD_ERR_CORRUPT;
+
+        uint16_t lls = br_read(&br, ctx.ll.log);
+        uint16_t ofs = br_read(&br, ctx.of.log);
+        uint16_t mls = br_read(&br, ctx.ml.log);
+
+        for (uint32_t i = 0; i < nseq; i++) {
+            const fse_entry_t *lle = &ctx.ll.t[lls];
+            const fse_entry_t *ofe = &ctx.of.t[ofs];
+            const fse_entry_t *mle = &ctx.ml.t[mls];
+
+            uint32_t offset = (1u << ofe->sym) + br_read(&br, ofe->sym);
+            uint32_t mlen = ml_base[mle->sym] + br_read(&br, ml_bits[mle->sym]);
+            uint32_t llen = ll_base[lle->sym] + br_read(&br, ll_bits[lle->sym]);
+
+            if (offset > 3) {
+                offset -= 3;
+                ctx.rep[2] = ctx.rep[1];
+                ctx.rep[1] = ctx.rep[0];
+                ctx.rep[0] = offset;
+            } else {
+                int idx = offset - 1 + (llen == 0);
+
+                if (idx == 0) {
+                    offset = ctx.rep[0];
+                } else {
+                    offset = idx < 3 ? ctx.rep[idx] : ctx.rep[0] - 1;
+                    if (idx > 1)
+                        ctx.rep[2] = ctx.rep[1];
+                    ctx.rep[1] = ctx.rep[0];
+                    ctx.rep[0] = offset;
+                }
+            }
+
+            if (i + 1 < nseq) {
+                lls = lle->base + br_read(&br, lle->bits);
+                mls = mle->base + br_read(&br, mle->bits);
+                ofs = ofe->base + br_read(&br, ofe->bits);
+            }
+
+            if (llen > (size_t)(lit_end - lits))
+                return ZSTD_ERR_CORRUPT;
+            if ((size_t)llen + mlen > (size_t)(ctx.dst_end - ctx.dst))
+                return ZSTD_ERR_DST;
+
+            copy_bytes(ctx.dst, lits, llen);
+            ctx.dst += llen;
+            lits += llen;
+
+            if (!offset || offset > (size_t)(ctx.dst - ctx.dst_start))
+                return ZSTD_ERR_CORRUPT;
+
+            // Byte by byte on purpose: matches may overlap their own output
+            copy_bytes(ctx.dst, ctx.dst - offset, mlen);
+            ctx.dst += mlen;
+        }
+
+        if (br.pos != 0)
+            return ZSTD_ERR_CORRUPT;
+    }
+
+    if ((size_t)(lit_end - lits) > (size_t)(ctx.dst_end - ctx.dst))
+        return ZSTD_ERR_DST;
+
+    copy_bytes(ctx.dst, lits, lit_end - lits);
+    ctx.dst += lit_end - lits;
+    return ZSTD_OK;
+}
+
+static int decode_block(const uint8_t *src, size_t len)
+{
+    const uint8_t *lits;
+    size_t nlits, used;
+
+    int ret = decode_literals(src, len, &lits, &nlits, &used);
+    if (ret)
+        return ret;
+
+    return decode_sequences(src + used, len - used, lits, nlits);
+}
+
+/* XXH64, used for the optional content checksum */
+
+#define XXH_P1 0x9e3779b185ebca87ULL
+#define XXH_P2 0xc2b2ae3d27d4eb4fULL
+#define XXH_P3 0x165667b19e3779f9ULL
+#define XXH_P4 0x85ebca77c2b2ae63ULL
+#define XXH_P5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t rotl64(uint64_t v, int r)
+{
+    return (v << r) | (v >> (64 - r));
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t in)
+{
+    return rotl64(acc + in * XXH_P2, 31) * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v)
+{
+    return (acc ^ xxh_round(0, v)) * XXH_P1 + XXH_P4;
+}
+
+static uint64_t xxh64(const uint8_t *p, size_t len)
+{
+    const uint8_t *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = XXH_P1 + XXH_P2, v2 = XXH_P2, v3 = 0, v4 = -XXH_P1;
+
+        for (; end - p >= 32; p += 32) {
+            v1 = xxh_round(v1, le64(p));
+            v2 = xxh_round(v2, le64(p + 8));
+            v3 = xxh_round(v3, le64(p + 16));
+            v4 = xxh_round(v4, le64(p + 24));
+        }
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = XXH_P5;
+    }
+
+    h += len;
+
+    for (; end - p >= 8; p += 8)
+        h = rotl64(h ^ xxh_round(0, le64(p)), 27) * XXH_P1 + XXH_P4;
+    if (end - p >= 4) {
+        h = rotl64(h ^ (le32(p) * XXH_P1), 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    while (p < end)
+        h = rotl64(h ^ (*p++ * XXH_P5), 11) * XXH_P1;
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* Frames */
+
+typedef struct {
+    bool have_fcs;
+    bool checksum;
+    uint64_t fcs;
+} frame_header_t;
+
+// Parse everything up to the first block header, returning a pointer to it in *pp
+static int frame_header(const uint8_t **pp, const uint8_t *end, frame_header_t *hdr)
+{
+    const uint8_t *p = *pp;
+
+    while (true) {
+        if (end - p < 4)
+            return ZSTD_ERR_SRC;
+
+        uint32_t magic = le32(p);
+        if ((magic & ZSTD_SKIP_MASK) == ZSTD_SKIP_MAGIC) {
+            if (end - p < 8 || le32(p + 4) > (size_t)(end - p - 8))
+                return ZSTD_ERR_SRC;
+            p += 8 + le32(p + 4);
+            continue;
+        }
+
+        if (magic != ZSTD_MAGIC)
+            return ZSTD_ERR_FORMAT;
+
+        p += 4;
+        break;
+    }
+
+    if (p >= end)
+        return ZSTD_ERR_SRC;
+
+    uint8_t fhd = *p++;
+    int fcs_flag = fhd >> 6;
+    bool single_segment = fhd & (1 << 5);
+    int dict_flag = fhd & 3;
+
+    if (fhd & (1 << 3))
+        return ZSTD_ERR_FORMAT;
+
+    static const uint8_t dict_sizes[] = {0, 1, 2, 4};
+    static const uint8_t fcs_sizes[] = {0, 2, 4, 8};
+    size_t dict_size = dict_sizes[dict_flag];
+    size_t fcs_size = (fcs_flag == 0 && single_segment) ? 1 : fcs_sizes[fcs_flag];
+
+    if ((size_t)(end - p) < !single_segment + dict_size + fcs_size)
+        return ZSTD_ERR_SRC;
+
+    // The whole output is the window, so the window descriptor is irrelevant
+    if (!single_segment)
+        p++;
+
+    if (dict_size) {
+        if (load_le(p, dict_size))
+            return ZSTD_ERR_FORMAT;
+        p += dict_size;
+    }
+
+    hdr->have_fcs = fcs_size != 0;
+    hdr->checksum = fhd & (1 << 2);
+    hdr->fcs = load_le(p, fcs_size);
+    if (fcs_size == 2)
+        hdr->fcs += 256;
+    p += fcs_size;
+
+    *pp = p;
+    return ZSTD_OK;
+}
+
+int zstd_content_size(const void *source, size_t source_len, size_t *size)
+{
+    const uint8_t *p = source;
+    frame_header_t hdr;
+
+    int ret = frame_header(&p, p + source_len, &hdr);
+    if (ret)
+        return ret;
+    if (!hdr.have_fcs)
+        return ZSTD_ERR_FORMAT;
+
+    *size = hdr.fcs;
+    return ZSTD_OK;
+}
+
+int zstd_uncompress(void *dest, size_t *dest_len, const void *source, size_t *source_len)
+{
+    const uint8_t *p = source, *end = p + *source_len;
+    frame_header_t hdr;
+
+    int ret = frame_header(&p, end, &hdr);
+    if (ret)
+        return ret;
+
+    if (hdr.have_fcs && hdr.fcs > *dest_len)
+        return ZSTD_ERR_DST;
+
+    ctx.dst_start = ctx.dst = dest;
+    ctx.dst_end = ctx.dst + *dest_len;
+    ctx.huf_bits = 0;
+    ctx.ll.log = ctx.ml.log = ctx.of.log = -1;
+    ctx.rep[0] = 1;
+    ctx.rep[1] = 4;
+    ctx.rep[2] = 8;
+
+    bool last = false;
+    while (!last) {
+        if (end - p < 3)
+            return ZSTD_ERR_SRC;
+
+        uint32_t bhdr = p[0] | (p[1] << 8) | (p[2] << 16);
+        size_t bsize = bhdr >> 3;
+
+        last = bhdr & 1;
+        p += 3;
+
+        switch ((bhdr >> 1) & 3) {
+            case BLOCK_RAW:
+                if (bsize > (size_t)(end - p))
+                    return ZSTD_ERR_SRC;
+                if (bsize > (size_t)(ctx.dst_end - ctx.dst))
+                    return ZSTD_ERR_DST;
+                copy_bytes(ctx.dst, p, bsize);
+                ctx.dst += bsize;
+                p += bsize;
+                break;
+            case BLOCK_RLE:
+                if (p >= end)
+                    return ZSTD_ERR_SRC;
+                if (bsize > (size_t)(ctx.dst_end - ctx.dst))
+                    return ZSTD_ERR_DST;
+                memset(ctx.dst, *p++, bsize);
+                ctx.dst += bsize;
+                break;
+            case BLOCK_COMPRESSED:
+                if (bsize > BLOCK_MAX)
+                    return ZSTD_ERR_CORRUPT;
+                if (bsize > (size_t)(end - p))
+                    return ZSTD_ERR_SRC;
+                ret = decode_block(p, bsize);
+                if (ret)
+                    return ret;
+                p += bsize;
+                break;
+            default:
+                return ZSTD_ERR_CORRUPT;
+        }
+    }
+
+    size_t produced = ctx.dst - ctx.dst_start;
+
+    if (hdr.have_fcs && produced != hdr.fcs)
+        return ZSTD_ERR_CORRUPT;
+
+    if (hdr.checksum) {
+        if (end - p < 4)
+            return ZSTD_ERR_SRC;
+        if ((uint32_t)xxh64(dest, produced) != le32(p))
+            return ZSTD_ERR_CHECKSUM;
+        p += 4;
+    }
+
+    *dest_len = produced;
+    *source_len = p - (const uint8_t *)source;
+    return ZSTD_OK;
+}
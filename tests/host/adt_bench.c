@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * ADT lookup rate. A synthetic tree shaped like a real machine's (a couple of hundred devices
+ * under /arm-io, each with a dozen properties) is built in memory, and the same mix of path and
+ * property lookups the boot path does is timed by linear walk and again with the lookup index.
+ * Both passes must return the same offsets.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "adt.h"
+
+#define ADT_BUF_SIZE SZ_1M
+#define NUM_DEVICES  200
+#define NUM_CPUS     10
+#define MIN_TIME     0.5
+
+void *adt;
+
+static u8 *buf;
+static size_t buf_used;
+
+static const char *const device_props[] = {
+    "compatible", "device_type", "AAPL,phandle", "interrupt-parent", "clock-ids",
+    "clock-gates", "power-gates", "iommu-parent", "function-dart", "segment-names",
+    "segment-ranges", "interrupts", "reg",
+};
+
+static const char *const lookup_paths[] = {
+    "/arm-io",           "/arm-io/pmgr",      "/arm-io/aic",        "/arm-io/dart-disp0",
+    "/arm-io/uart0",     "/arm-io/i2c0",      "/arm-io/wdt",        "/arm-io/dcp",
+    "/arm-io/sio",       "/arm-io/ans",       "/arm-io/dart-sio",   "/cpus/cpu0",
+    "/cpus/cpu7",        "/chosen",           "/chosen/memory-map", "/arm-io/atc-phy0",
+    "/arm-io/nonexistent",
+};
+
+static const char *const lookup_props[] = {"reg", "compatible", "interrupts", "clock-gates",
+                                           "missing-property"};
+
+static void *emit(size_t size)
+{
+    void *p = buf + buf_used;
+
+    buf_used += ALIGN_UP(size, 4);
+    if (buf_used > ADT_BUF_SIZE)
+        panic("synthetic ADT too large\n");
+
+    return p;
+}
+
+static void emit_prop(const char *name, const void *value, u32 size)
+{
+    struct adt_property *prop = emit(sizeof(*prop) + size);
+
+    // The buffer starts out zeroed, which terminates the name
+    memcpy(prop->name, name, min(strlen(name), sizeof(prop->name) - 1));
+    prop->size = size;
+    if (value)
+        memcpy(prop->value, value, size);
+}
+
+static void emit_string(const char *name, const char *value)
+{
+    emit_prop(name, value, strlen(value) + 1);
+}
+
+static struct adt_node_hdr *emit_node(const char *name, u32 props, u32 children)
+{
+    struct adt_node_hdr *node = emit(sizeof(*node));
+
+    node->property_count = props + 1;
+    node->child_count = children;
+    emit_string("name", name);
+
+    return node;
+}
+
+static void emit_device(const char *name)
+{
+    u32 regs[8] = {0x2, 0x35000000, 0x0, 0x4000};
+
+    emit_node(name, ARRAY_SIZE(device_props), 0);
+    for (u32 i = 0; i < ARRAY_SIZE(device_props) - 1; i++)
+        emit_prop(device_props[i], NULL, 4 + 4 * (i % 5));
+    emit_prop("reg", regs, sizeof(regs));
+}
+
+static void build_adt(void)
+{
+    static const char *const named[] = {"pmgr",     "aic",  "dart-disp0", "uart0",
+                                        "i2c0",     "wdt",  "dcp",        "sio",
+                                        "dart-sio", "ans",  "atc-phy0"};
+    char name[32];
+
+    buf = calloc(1, ADT_BUF_SIZE);
+    adt = buf;
+
+    emit_node("device-tree", 3, 3);
+    emit_string("compatible", "J314sAP\0MacBookPro18,3\0AppleARM");
+    emit_string("model", "MacBookPro18,3");
+    emit_prop("#address-cells", NULL, 4);
+
+    emit_node("chosen", 4, 1);
+    for (u32 i = 0; i < 4; i++) {
+        snprintf(name, sizeof(name), "chosen-prop%u", i);
+        emit_prop(name, NULL, 8);
+    }
+    emit_node("memory-map", 8, 0);
+    for (u32 i = 0; i < 8; i++) {
+        snprintf(name, sizeof(name), "region%u", i);
+        emit_prop(name, NULL, 16);
+    }
+
+    emit_node("cpus", 0, NUM_CPUS);
+    for (u32 i = 0; i < NUM_CPUS; i++) {
+        snprintf(name, sizeof(name), "cpu%u", i);
+        emit_device(name);
+    }
+
+    emit_node("arm-io", 2, NUM_DEVICES);
+    emit_prop("ranges", NULL, 48);
+    emit_prop("reg", NULL, 16);
+    // The well-known devices are spread through the list, like the real ordering by address
+    for (u32 i = 0; i < NUM_DEVICES; i++) {
+        u32 slot = NUM_DEVICES / ARRAY_SIZE(named);
+        if (i % slot == slot - 1 && i / slot < ARRAY_SIZE(named))
+            snprintf(name, sizeof(name), "%s", named[i / slot]);
+        else
+            snprintf(name, sizeof(name), "device%u", i);
+        emit_device(name);
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* One round of lookups; the result folds every offset found, so both passes can be compared */
+static u64 lookup_round(void)
+{
+    u64 sum = 0;
+
+    for (u32 i = 0; i < ARRAY_SIZE(lookup_paths); i++) {
+        int node = adt_path_offset(adt, lookup_paths[i]);
+
+        sum = sum * 31 + node;
+        if (node < 0)
+            continue;
+
+        for (u32 j = 0; j < ARRAY_SIZE(lookup_props); j++) {
+            u32 len = 0;
+            const void *val = adt_getprop(adt, node, lookup_props[j], &len);
+
+            sum = sum * 31 + (val ? (const u8 *)val - buf : 0) + len;
+        }
+    }
+
+    return sum;
+}
+
+static u64 bench(const char *what)
+{
+    u32 lookups = ARRAY_SIZE(lookup_paths) * (1 + ARRAY_SIZE(lookup_props));
+    u64 sum = lookup_round(), runs = 0;
+
+    double t0 = now(), elapsed;
+    do {
+        if (lookup_round() != sum)
+            panic("adt: lookups are not stable\n");
+        runs++;
+        elapsed = now() - t0;
+    } while (elapsed < MIN_TIME);
+
+    printf("adt: %-6s %10.0f lookups/s\n", what, runs * lookups / elapsed);
+    return sum;
+}
+
+int main(void)
+{
+    build_adt();
+
+    if (adt_check_header(adt))
+        panic("adt: synthetic tree is malformed\n");
+    if (adt_path_offset(adt, "/arm-io/dcp") < 0)
+        panic("adt: /arm-io/dcp not found\n");
+
+    u64 walk = bench("walk");
+
+    double t0 = now();
+    int nodes = adt_index_build(adt, buf_used);
+    double built = now() - t0;
+
+    if (nodes < 0)
+        panic("adt: index build failed: %d\n", nodes);
+    printf("adt: indexed %d nodes (%lu bytes) in %.1f us\n", nodes, buf_used, built * 1e6);
+
+    if (bench("index") != walk)
+        panic("adt: indexed lookups differ from the linear walk\n");
+
+    adt_index_drop();
+    return 0;
+}
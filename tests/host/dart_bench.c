@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * DART reverse lookups. dart.c is built as is, with its registers and page tables in host
+ * memory. The tables are kept in a low arena, since PTEs only hold 40-odd bits of address. A
+ * DART we own is filled with scattered mappings, and the same tables are then opened again with
+ * keep_pts, the way kboot opens firmware owned DARTs. dart_search() and dart_find_iova() are
+ * checked against a plain scan of the tables and timed on both, and the kept DART's index is
+ * checked again after it has mapped and unmapped some pages of its own.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+void *bench_memalign(size_t align, size_t size);
+void bench_free(void *ptr);
+bool is_heap(void *addr);
+
+// Page tables come from the arena, everything else from the host heap
+#define memalign bench_memalign
+#define free     bench_free
+#include "dart.c"
+#undef memalign
+#undef free
+
+#define ARENA_BASE 0x10000000000UL
+#define ARENA_SIZE (64 * SZ_1M)
+#define MAPPINGS   4096
+#define PA_BASE    0x800000000UL
+#define IOVA_SPAN  (16UL << 30)
+#define MIN_TIME   0.5
+
+static u8 regs[0x4000] ALIGNED(SZ_16K);
+static u8 *arena;
+static size_t arena_used;
+
+void *bench_memalign(size_t align, size_t size)
+{
+    arena_used = ALIGN_UP(arena_used, align);
+    if (arena_used + size > ARENA_SIZE)
+        return NULL;
+
+    void *ptr = arena + arena_used;
+    arena_used += size;
+    return ptr;
+}
+
+void bench_free(void *ptr)
+{
+    if ((u8 *)ptr < arena || (u8 *)ptr >= arena + ARENA_SIZE)
+        free(ptr);
+}
+
+bool is_heap(void *addr)
+{
+    return (u8 *)addr >= arena && (u8 *)addr < arena + ARENA_SIZE;
+}
+
+static u64 rng_state = 0x2545f4914f6cdd1dUL;
+
+static u64 rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static u64 iovas[MAPPINGS];
+
+/* Mappings spread over the first 16GB of IOVA space, so the tables have many sparse L2s */
+static void fill(dart_dev_t *dart)
+{
+    for (u32 i = 0; i < MAPPINGS; i++) {
+        u64 iova;
+
+        do
+            iova = (rng() % (IOVA_SPAN / SZ_16K)) * SZ_16K;
+        while (dart_translate_silent(dart, iova) || dart_prealloc_l2(dart, iova, SZ_16K));
+
+        if (dart_map(dart, iova, (void *)(PA_BASE + i * SZ_16K), SZ_16K))
+            panic("dart: map of 0x%lx failed\n", iova);
+        iovas[i] = iova;
+    }
+}
+
+static void check(dart_dev_t *dart, const char *name)
+{
+    for (u32 i = 0; i < MAPPINGS; i += 7) {
+        void *pa = (void *)(PA_BASE + i * SZ_16K);
+        u64 iova = dart_search(dart, pa);
+
+        if (iova != dart_search_scan(dart, pa))
+            panic("dart %s: search for %p found 0x%lx, scan 0x%lx\n", name, pa, iova,
+                  dart_search_scan(dart, pa));
+        if (dart_translate_silent(dart, iova) != pa)
+            panic("dart %s: search for %p found unmapped 0x%lx\n", name, pa, iova);
+    }
+
+    for (u32 i = 0; i < 64; i++) {
+        s64 start = (rng() % (IOVA_SPAN / SZ_16K)) * SZ_16K;
+        size_t len = (1 + rng() % 64) * SZ_16K;
+        u64 iova = dart_find_iova(dart, start, len);
+        u64 scan = dart_find_iova_scan(dart, start, 1LLU << 36, len);
+
+        if (iova != scan)
+            panic("dart %s: find_iova(0x%lx, 0x%lx) = 0x%lx, scan 0x%lx\n", name, start, len,
+                  iova, scan);
+    }
+}
+
+/* Unmap every other page the owner mapped and map as many new ones in their place */
+static void churn(dart_dev_t *dart)
+{
+    for (u32 i = 0; i < MAPPINGS; i += 2) {
+        dart_unmap(dart, iovas[i], SZ_16K);
+
+        u64 iova;
+        do
+            iova = (rng() % (IOVA_SPAN / SZ_16K)) * SZ_16K;
+        while (dart_translate_silent(dart, iova) || dart_prealloc_l2(dart, iova, SZ_16K));
+
+        if (dart_map(dart, iova, (void *)(PA_BASE + i * SZ_16K), SZ_16K))
+            panic("dart: remap of 0x%lx failed\n", iova);
+        iovas[i] = iova;
+    }
+}
+
+static void bench(dart_dev_t *dart, const char *name)
+{
+    u64 search_ops = 0, find_ops = 0;
+    double search_time = 0, find_time = 0;
+
+    while (search_time + find_time < MIN_TIME) {
+        double t0 = now();
+        for (u32 i = 0; i < 64; i++, search_ops++)
+            dart_search(dart, (void *)(PA_BASE + (rng() % MAPPINGS) * SZ_16K));
+        double t1 = now();
+        for (u32 i = 0; i < 64; i++, find_ops++)
+            dart_find_iova(dart, iovas[rng() % MAPPINGS], SZ_16K * 4);
+        double t2 = now();
+
+        search_time += t1 - t0;
+        find_time += t2 - t1;
+    }
+
+    printf("dart: %s: search %.0f ops/s, find_iova %.0f ops/s\n", name, search_ops / search_time,
+           find_ops / find_time);
+}
+
+int main(void)
+{
+    arena = mmap((void *)ARENA_BASE, ARENA_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (arena != (void *)ARENA_BASE)
+        panic("dart: cannot map the page table arena\n");
+
+    dart_dev_t *owned = dart_init((uintptr_t)regs, 0, false, DART_T6000);
+    if (!owned)
+        panic("dart: init failed\n");
+    fill(owned);
+
+    // Same registers and tables, taken over the way kboot takes over firmware DARTs
+    dart_dev_t *kept = dart_init((uintptr_t)regs, 0, true, DART_T6000);
+    if (!kept || kept->l1[0] != owned->l1[0])
+        panic("dart: keep_pts init did not pick up the tables\n");
+
+    check(owned, "owned");
+    bench(owned, "owned");
+
+    // From here on the tables change through the kept DART only, which leaves owned's index stale
+    check(kept, "keep_pts");
+    if (!kept->index_valid)
+        panic("dart: keep_pts DART did not build an index\n");
+    churn(kept);
+    if (!kept->index_valid)
+        panic("dart: keep_pts DART dropped its index\n");
+    check(kept, "keep_pts");
+    bench(kept, "keep_pts");
+
+    return 0;
+}
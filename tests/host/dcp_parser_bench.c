@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * The DCP/AFK property parser. EPIC service announcements are serialized the way the firmware
+ * sends them: a dictionary holding the name, provider class and unit among a pile of other keys
+ * (nested dictionaries, arrays, blobs and booleans) that have to be skipped. Every one must parse
+ * back to what was written, every truncation of one must fail cleanly (or parse the same, if only
+ * skipped values were cut), and then parsing is timed.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "dcp/parser.h"
+
+#define TYPE_DICT   1
+#define TYPE_ARRAY  2
+#define TYPE_INT64  4
+#define TYPE_STRING 9
+#define TYPE_BLOB   10
+#define TYPE_BOOL   11
+
+#define BLOBS    64
+#define MIN_TIME 0.25
+
+struct blob {
+    u8 data[2048];
+    size_t len;
+    char name[32];
+    char class[32];
+    s64 unit;
+};
+
+static struct blob blobs[BLOBS];
+
+static u64 rng_state = 0x2545f4914f6cdd1dUL;
+
+static u64 rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void put_tag(struct blob *b, u32 type, u32 size, bool last)
+{
+    u32 tag = size | (type << 24) | ((u32)last << 31);
+
+    b->len = ALIGN_UP(b->len, 4);
+    memcpy(b->data + b->len, &tag, 4);
+    b->len += 4;
+}
+
+static void put_bytes(struct blob *b, u32 type, const void *data, u32 len)
+{
+    put_tag(b, type, len, false);
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void put_string(struct blob *b, const char *s)
+{
+    put_bytes(b, TYPE_STRING, s, strlen(s));
+}
+
+static void put_int(struct blob *b, s64 val)
+{
+    put_tag(b, TYPE_INT64, 0, false);
+    memcpy(b->data + b->len, &val, 8);
+    b->len += 8;
+}
+
+/* Values for the keys the parser doesn't know, nested up to depth levels deep */
+static void put_junk(struct blob *b, int depth)
+{
+    u8 data[16] = {0};
+
+    switch (rng() % (depth ? 6 : 4)) {
+        case 0:
+            put_int(b, rng());
+            break;
+        case 1:
+            put_string(b, "IOReportLegend");
+            break;
+        case 2:
+            put_bytes(b, TYPE_BLOB, data, rng() % sizeof(data));
+            break;
+        case 3:
+            put_tag(b, TYPE_BOOL, rng() % 2, false);
+            break;
+        case 4: {
+            u32 n = rng() % 4;
+            put_tag(b, TYPE_ARRAY, n, false);
+            for (u32 i = 0; i < n; i++)
+                put_junk(b, depth - 1);
+            break;
+        }
+        default: {
+            u32 n = rng() % 4;
+            put_tag(b, TYPE_DICT, n, false);
+            for (u32 i = 0; i < n; i++) {
+                put_string(b, "key");
+                put_junk(b, depth - 1);
+            }
+            break;
+        }
+    }
+}
+
+static void build(struct blob *b, int i)
+{
+    u32 junk = 2 + rng() % 8, slot[3];
+
+    snprintf(b->name, sizeof(b->name), "service%d", i);
+    snprintf(b->class, sizeof(b->class), "AppleEPICClass%d", i);
+    b->unit = rng() % 16;
+
+    b->len = 0;
+    u32 header = 0xd3;
+    memcpy(b->data, &header, 4);
+    b->len = 4;
+
+    // The three keys the parser wants go in random places among the others
+    for (int k = 0; k < 3; k++)
+        slot[k] = rng() % (junk + 3);
+
+    put_tag(b, TYPE_DICT, junk + 3, false);
+    for (u32 n = 0, k = 0; n < junk + 3; n++) {
+        if (k < 3 && (n == slot[k] || junk + 3 - n == 3 - k)) {
+            switch (k++) {
+                case 0:
+                    put_string(b, "EPICName");
+                    put_string(b, b->name);
+                    break;
+                case 1:
+                    put_string(b, "EPICProviderClass");
+                    put_string(b, b->class);
+                    break;
+                default:
+                    put_string(b, "EPICUnit");
+                    put_int(b, b->unit);
+                    break;
+            }
+        } else {
+            put_string(b, "IOPropertyJunk");
+            put_junk(b, 3);
+        }
+    }
+}
+
+static int parse_blob(struct blob *b, size_t len, char **name, char **class, s64 *unit)
+{
+    struct dcp_parse_ctx ctx;
+
+    *name = *class = NULL;
+    if (parse(b->data, len, &ctx))
+        return -1;
+    return parse_epic_service_init(&ctx, name, class, unit);
+}
+
+static void check(struct blob *b)
+{
+    char *name, *class;
+    s64 unit;
+
+    if (parse_blob(b, b->len, &name, &class, &unit))
+        panic("dcp: %s did not parse\n", b->name);
+    if (strcmp(name, b->name) || strcmp(class, b->class) || unit != b->unit)
+        panic("dcp: %s parsed as %s/%s/%ld\n", b->name, name, class, unit);
+    free(name);
+    free(class);
+
+    // Cut short anywhere, it must fail cleanly - or, if only a value it skips was cut (skip()
+    // errors are ignored), still find the same three keys
+    for (size_t len = 0; len < b->len; len++) {
+        if (!parse_blob(b, len, &name, &class, &unit)) {
+            if (strcmp(name, b->name) || strcmp(class, b->class) || unit != b->unit)
+                panic("dcp: %s cut at %zu parsed as %s/%s/%ld\n", b->name, len, name, class,
+                      unit);
+            free(name);
+            free(class);
+        } else if (name || class) {
+            panic("dcp: %s cut at %zu failed but returned strings\n", b->name, len);
+        }
+    }
+}
+
+int main(void)
+{
+    size_t bytes = 0;
+
+    for (int i = 0; i < BLOBS; i++) {
+        build(&blobs[i], i);
+        check(&blobs[i]);
+        bytes += blobs[i].len;
+    }
+
+    u64 count = 0;
+    double t0 = now(), elapsed;
+    do {
+        for (int i = 0; i < BLOBS; i++, count++) {
+            char *name, *class;
+            s64 unit;
+
+            if (!parse_blob(&blobs[i], blobs[i].len, &name, &class, &unit)) {
+                free(name);
+                free(class);
+            }
+        }
+        elapsed = now() - t0;
+    } while (elapsed < MIN_TIME);
+
+    printf("dcp: %.0f announcements/s, %.1f MB/s\n", count / elapsed,
+           count * (bytes / (double)BLOBS) / elapsed / 1e6);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Decompression throughput of the payload codecs. Each argument is a compressed copy of the
+ * same corpus, picked by extension (.gz, .xz, .zst, .lz4); the first one that is not compressed
+ * is the reference every decoded copy is checked against.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "lz4/lz4.h"
+#include "minilzlib/minlzma.h"
+#include "tinf/tinf.h"
+#include "zstd/zstd.h"
+
+#define MIN_TIME 0.5
+
+struct codec {
+    const char *ext;
+    const char *name;
+    int (*uncompress)(void *dest, size_t *dest_len, const void *src, size_t src_len);
+};
+
+static int gz_uncompress(void *dest, size_t *dest_len, const void *src, size_t src_len)
+{
+    unsigned int dlen = *dest_len, slen = src_len;
+
+    int ret = tinf_gzip_uncompress(dest, &dlen, src, &slen);
+    *dest_len = dlen;
+    return ret;
+}
+
+static int xz_uncompress(void *dest, size_t *dest_len, const void *src, size_t src_len)
+{
+    uint32_t dlen = *dest_len, slen = src_len;
+
+    if (!XzDecode((void *)src, &slen, dest, &dlen))
+        return -1;
+
+    *dest_len = dlen;
+    return 0;
+}
+
+static int zstd_bench_uncompress(void *dest, size_t *dest_len, const void *src, size_t src_len)
+{
+    return zstd_uncompress(dest, dest_len, src, &src_len);
+}
+
+static int lz4_bench_uncompress(void *dest, size_t *dest_len, const void *src, size_t src_len)
+{
+    return lz4_uncompress(dest, dest_len, src, &src_len);
+}
+
+static const struct codec codecs[] = {
+    {".gz", "gzip", gz_uncompress},
+    {".xz", "xz", xz_uncompress},
+    {".zst", "zstd", zstd_bench_uncompress},
+    {".lz4", "lz4", lz4_bench_uncompress},
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *load(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        panic("can't open %s\n", path);
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    void *buf = malloc(*size);
+    if (!buf || fread(buf, 1, *size, f) != *size)
+        panic("can't read %s\n", path);
+
+    fclose(f);
+    return buf;
+}
+
+static const struct codec *codec_for(const char *path)
+{
+    size_t len = strlen(path);
+
+    for (u32 i = 0; i < ARRAY_SIZE(codecs); i++) {
+        size_t elen = strlen(codecs[i].ext);
+        if (len > elen && !strcmp(path + len - elen, codecs[i].ext))
+            return &codecs[i];
+    }
+
+    return NULL;
+}
+
+static void bench(const struct codec *c, const char *path, const u8 *ref, size_t ref_size)
+{
+    size_t src_size;
+    void *src = load(path, &src_size);
+    u8 *dest = malloc(ref_size + 1);
+    u32 runs = 0;
+
+    double t0 = now(), elapsed;
+    do {
+        size_t dest_len = ref_size + 1;
+        int ret = c->uncompress(dest, &dest_len, src, src_size);
+
+        if (ret)
+            panic("%s: %s decoder failed: %d\n", path, c->name, ret);
+        if (dest_len != ref_size || memcmp(dest, ref, ref_size))
+            panic("%s: %s output does not match the corpus\n", path, c->name);
+
+        runs++;
+        elapsed = now() - t0;
+    } while (elapsed < MIN_TIME);
+
+    printf("decompress: %-4s %8lu -> %8lu bytes, %7.1f MB/s\n", c->name, src_size, ref_size,
+           ref_size * (double)runs / elapsed / 1e6);
+
+    free(dest);
+    free(src);
+}
+
+int main(int argc, char **argv)
+{
+    const char *ref_path = NULL;
+
+    for (int i = 1; i < argc && !ref_path; i++)
+        if (!codec_for(argv[i]))
+            ref_path = argv[i];
+
+    if (!ref_path)
+        panic("usage: %s <corpus> <corpus>.{gz,xz,zst,lz4}...\n", argv[0]);
+
+    size_t ref_size;
+    u8 *ref = load(ref_path, &ref_size);
+
+    tinf_init();
+
+    for (int i = 1; i < argc; i++) {
+        const struct codec *c = codec_for(argv[i]);
+        if (c)
+            bench(c, argv[i], ref, ref_size);
+    }
+
+    free(ref);
+    return 0;
+}
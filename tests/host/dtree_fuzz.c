@@ -0,0 +1,398 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Differential test of dtree.c against libfdt. Random trees are built with libfdt, loaded into a
+ * dtree, and then the same random edit sequence (setprop, appendprop, inplace, delprop,
+ * add_subnode, set_name, nop_node, mem_rsv, phandles) is applied to both. Every edit must return
+ * the same error code from both, and every so often the dtree is serialized, checked for
+ * structure and compared node by node, property by property and in order with the blob
+ * libfdt edited. Nodes are tracked by path, since libfdt offsets move with every edit.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "dtree.h"
+
+#define FDT_SIZE   (4 * SZ_1M)
+#define MAX_NODES  2048
+#define PATH_LEN   256
+#define EDITS      4000
+#define CHECK_STEP 97
+
+static char paths[MAX_NODES][PATH_LEN];
+static int npaths;
+static u32 name_seq;
+
+static u8 fdt[FDT_SIZE];
+
+static const char *const prop_names[] = {
+    "compatible", "reg", "status", "interrupts", "#address-cells", "#size-cells", "ranges",
+    "clocks", "phandle", "linux,phandle", "label", "x",
+};
+
+static u64 rng_state = 0x2545f4914f6cdd1dUL;
+
+static u64 rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *random_prop(void)
+{
+    return prop_names[rng() % ARRAY_SIZE(prop_names)];
+}
+
+static int random_value(u8 *buf)
+{
+    int len = rng() % 5 == 0 ? 0 : 1 + rng() % 48;
+
+    for (int i = 0; i < len; i++)
+        buf[i] = rng();
+    return len;
+}
+
+static int random_path(void)
+{
+    return rng() % npaths;
+}
+
+static void add_path(int parent, const char *name)
+{
+    if (npaths == MAX_NODES)
+        panic("dtree: too many nodes\n");
+
+    char path[PATH_LEN];
+    snprintf(path, PATH_LEN, "%s/%s", parent ? paths[parent] : "", name);
+    strcpy(paths[npaths++], path);
+}
+
+static bool is_below(const char *path, const char *node)
+{
+    size_t len = strlen(node);
+    return !strncmp(path, node, len) && path[len] == '/';
+}
+
+static void remove_subtree(int idx)
+{
+    char node[PATH_LEN];
+
+    strcpy(node, paths[idx]);
+    for (int i = 0; i < npaths;) {
+        if (!strcmp(paths[i], node) || is_below(paths[i], node))
+            memcpy(paths[i], paths[--npaths], PATH_LEN);
+        else
+            i++;
+    }
+}
+
+static void rename_subtree(int idx, const char *name)
+{
+    char node[PATH_LEN], renamed[PATH_LEN];
+
+    strcpy(node, paths[idx]);
+    strcpy(renamed, node);
+    strcpy(strrchr(renamed, '/') + 1, name);
+
+    for (int i = 0; i < npaths; i++) {
+        if (!strcmp(paths[i], node) || is_below(paths[i], node)) {
+            char tail[PATH_LEN];
+            strcpy(tail, paths[i] + strlen(node));
+            snprintf(paths[i], PATH_LEN, "%s%s", renamed, tail);
+        }
+    }
+}
+
+static void expect(int a, int b, const char *what, const char *path)
+{
+    if (a != b)
+        panic("dtree: %s on %s: libfdt returned %d, dtree %d\n", what, path, a, b);
+}
+
+static void compare_props(const void *a, int na, const void *b, int nb, const char *path)
+{
+    int pa = fdt_first_property_offset(a, na);
+    int pb = fdt_first_property_offset(b, nb);
+
+    while (pa >= 0 && pb >= 0) {
+        const char *name_a, *name_b;
+        int len_a, len_b;
+        const void *val_a = fdt_getprop_by_offset(a, pa, &name_a, &len_a);
+        const void *val_b = fdt_getprop_by_offset(b, pb, &name_b, &len_b);
+
+        if (strcmp(name_a, name_b) || len_a != len_b || memcmp(val_a, val_b, len_a))
+            panic("dtree: %s: property %s (%d) vs %s (%d)\n", path, name_a, len_a, name_b, len_b);
+
+        pa = fdt_next_property_offset(a, pa);
+        pb = fdt_next_property_offset(b, pb);
+    }
+
+    if (pa != pb)
+        panic("dtree: %s: property counts differ\n", path);
+}
+
+static void compare_nodes(const void *a, int na, const void *b, int nb, const char *path)
+{
+    const char *name_a = fdt_get_name(a, na, NULL);
+    const char *name_b = fdt_get_name(b, nb, NULL);
+
+    if (strcmp(name_a, name_b))
+        panic("dtree: %s: node named %s vs %s\n", path, name_a, name_b);
+
+    compare_props(a, na, b, nb, path);
+
+    int ca = fdt_first_subnode(a, na);
+    int cb = fdt_first_subnode(b, nb);
+    while (ca >= 0 && cb >= 0) {
+        char child[PATH_LEN];
+        snprintf(child, PATH_LEN, "%s/%s", path, fdt_get_name(a, ca, NULL));
+        compare_nodes(a, ca, b, cb, child);
+        ca = fdt_next_subnode(a, ca);
+        cb = fdt_next_subnode(b, cb);
+    }
+
+    if (ca != cb)
+        panic("dtree: %s: child counts differ\n", path);
+}
+
+/* The fdt_check_full() subset this libfdt lacks: the header, and a balanced structure block */
+static int check_blob(const void *blob)
+{
+    int ret = fdt_check_header(blob);
+    if (ret)
+        return ret;
+
+    int offset = 0, next, depth = 0;
+    for (;;) {
+        u32 tag = fdt_next_tag(blob, offset, &next);
+        if (next < 0)
+            return next;
+
+        switch (tag) {
+            case FDT_BEGIN_NODE:
+                if (!fdt_get_name(blob, offset, NULL))
+                    return -FDT_ERR_BADSTRUCTURE;
+                depth++;
+                break;
+            case FDT_END_NODE:
+                if (--depth < 0)
+                    return -FDT_ERR_BADSTRUCTURE;
+                break;
+            case FDT_PROP:
+                if (!depth || !fdt_getprop_by_offset(blob, offset, NULL, NULL))
+                    return -FDT_ERR_BADSTRUCTURE;
+                break;
+            case FDT_NOP:
+                break;
+            case FDT_END:
+                return depth ? -FDT_ERR_TRUNCATED : 0;
+            default:
+                return -FDT_ERR_BADSTRUCTURE;
+        }
+        offset = next;
+    }
+}
+
+static void compare(dtree_t *t)
+{
+    void *blob = dtree_to_fdt(t, 8, false);
+    if (!blob)
+        panic("dtree: serialization failed\n");
+
+    int ret = check_blob(blob);
+    if (ret)
+        panic("dtree: serialized blob is invalid: %s\n", fdt_strerror(ret));
+
+    if (fdt_num_mem_rsv(fdt) != fdt_num_mem_rsv(blob))
+        panic("dtree: reservation counts differ\n");
+    for (int i = 0; i < fdt_num_mem_rsv(fdt); i++) {
+        u64 addr_a, size_a, addr_b, size_b;
+        fdt_get_mem_rsv(fdt, i, &addr_a, &size_a);
+        fdt_get_mem_rsv(blob, i, &addr_b, &size_b);
+        if (addr_a != addr_b || size_a != size_b)
+            panic("dtree: reservation %d differs\n", i);
+    }
+
+    compare_nodes(fdt, 0, blob, 0, "");
+    free(blob);
+}
+
+/* Keeps the libfdt blob roomy, the dtree grows on its own */
+static void grow(void)
+{
+    if (fdt_totalsize(fdt) < FDT_SIZE / 2)
+        fdt_open_into(fdt, fdt, FDT_SIZE);
+}
+
+static void build(int nodes)
+{
+    u8 val[64];
+
+    fdt_create_empty_tree(fdt, FDT_SIZE);
+    npaths = 0;
+    strcpy(paths[npaths++], "/");
+
+    for (int i = 0; i < nodes; i++) {
+        int parent = random_path();
+        char name[32];
+
+        snprintf(name, sizeof(name), "n%u@%x", name_seq++, (u32)rng() & 0xffff);
+        int node = fdt_add_subnode(fdt, fdt_path_offset(fdt, paths[parent]), name);
+        if (node < 0)
+            panic("dtree: building: %s\n", fdt_strerror(node));
+        add_path(parent, name);
+
+        for (int p = rng() % 6; p > 0; p--)
+            fdt_setprop(fdt, node, random_prop(), val, random_value(val));
+    }
+}
+
+static void edit(dtree_t *t)
+{
+    int idx = random_path();
+    const char *path = paths[idx];
+    int a = fdt_path_offset(fdt, path);
+    int b = dtree_path_offset(t, path);
+    const char *prop = random_prop();
+    u8 val[64];
+    int len = random_value(val);
+
+    if (a < 0 || b < 0)
+        panic("dtree: lost node %s (%d, %d)\n", path, a, b);
+
+    switch (rng() % 10) {
+        case 0:
+        case 1:
+            expect(fdt_setprop(fdt, a, prop, val, len), dtree_setprop(t, b, prop, val, len),
+                   "setprop", path);
+            break;
+        case 2:
+            expect(fdt_appendprop(fdt, a, prop, val, len), dtree_appendprop(t, b, prop, val, len),
+                   "appendprop", path);
+            break;
+        case 3: {
+            int cur;
+            if (fdt_getprop(fdt, a, prop, &cur) && rng() % 2)
+                len = cur;
+            expect(fdt_setprop_inplace(fdt, a, prop, val, len),
+                   dtree_setprop_inplace(t, b, prop, val, len), "setprop_inplace", path);
+            break;
+        }
+        case 4:
+            expect(fdt_delprop(fdt, a, prop), dtree_delprop(t, b, prop), "delprop", path);
+            break;
+        case 5:
+        case 6:
+            if (idx && rng() % 8 == 0) {
+                // A sibling with this node's own name, which must fail with -FDT_ERR_EXISTS
+                const char *name = strrchr(path, '/') + 1;
+                expect(fdt_add_subnode(fdt, fdt_parent_offset(fdt, a), name),
+                       dtree_add_subnode(t, dtree_parent_offset(t, b), name), "add_subnode",
+                       path);
+            } else {
+                char name[32];
+                snprintf(name, sizeof(name), "n%u", name_seq++);
+                int ra = fdt_add_subnode(fdt, a, name);
+                int rb = dtree_add_subnode(t, b, name);
+                expect(ra < 0 ? ra : 0, rb < 0 ? rb : 0, "add_subnode", path);
+                if (ra >= 0)
+                    add_path(idx, name);
+            }
+            break;
+        case 7:
+            if (!idx)
+                break;
+            char name[32];
+            snprintf(name, sizeof(name), "r%u", name_seq++);
+            expect(fdt_set_name(fdt, a, name), dtree_set_name(t, b, name), "set_name", path);
+            rename_subtree(idx, name);
+            break;
+        case 8:
+            if (!idx || rng() % 4)
+                break;
+            expect(fdt_nop_node(fdt, a), dtree_nop_node(t, b), "nop_node", path);
+            remove_subtree(idx);
+            break;
+        case 9:
+            if (rng() % 2) {
+                u64 addr = rng() & ~0xfffUL, size = rng() & 0xffffff;
+                expect(fdt_add_mem_rsv(fdt, addr, size), dtree_add_mem_rsv(t, addr, size),
+                       "add_mem_rsv", path);
+            } else {
+                u32 pa = 0, pb = 0;
+                expect(fdt_generate_phandle(fdt, &pa), dtree_generate_phandle(t, &pb),
+                       "generate_phandle", path);
+                if (pa != pb)
+                    panic("dtree: generated phandle 0x%x vs 0x%x\n", pa, pb);
+                expect(fdt_setprop_u32(fdt, a, "phandle", pa),
+                       dtree_setprop_u32(t, b, "phandle", pb), "setprop phandle", path);
+                int fa = fdt_node_offset_by_phandle(fdt, pa);
+                int fb = dtree_node_offset_by_phandle(t, pb);
+                if ((fa < 0) != (fb < 0) ||
+                    (fa >= 0 && strcmp(fdt_get_name(fdt, fa, NULL), dtree_get_name(t, fb, NULL))))
+                    panic("dtree: phandle 0x%x found different nodes\n", pa);
+            }
+            break;
+    }
+
+    // Property reads must agree right after every edit, not just after serializing
+    a = fdt_path_offset(fdt, path);
+    b = dtree_path_offset(t, path);
+    if ((a < 0) != (b < 0))
+        panic("dtree: %s exists in only one tree\n", path);
+    if (a >= 0) {
+        int len_a, len_b;
+        const void *va = fdt_getprop(fdt, a, prop, &len_a);
+        const void *vb = dtree_getprop(t, b, prop, &len_b);
+        if (len_a != len_b || (va && memcmp(va, vb, len_a)))
+            panic("dtree: %s: getprop %s differs (%d vs %d)\n", path, prop, len_a, len_b);
+    }
+
+    grow();
+}
+
+int main(int argc, char **argv)
+{
+    u32 trees = argc > 1 ? strtoul(argv[1], NULL, 0) : 8;
+    u64 edits = 0;
+    double t0 = now();
+
+    for (u32 tree = 0; tree < trees; tree++) {
+        build(50 + rng() % 400);
+        fdt_pack(fdt);
+
+        // The dtree points into its source, so give it a copy libfdt won't touch
+        void *source = malloc(fdt_totalsize(fdt));
+        memcpy(source, fdt, fdt_totalsize(fdt));
+        fdt_open_into(fdt, fdt, FDT_SIZE);
+
+        dtree_t *t = dtree_from_fdt(source);
+        if (!t)
+            panic("dtree: dtree_from_fdt failed\n");
+        compare(t);
+
+        for (int i = 0; i < EDITS; i++, edits++) {
+            edit(t);
+            if (i % CHECK_STEP == 0)
+                compare(t);
+        }
+        compare(t);
+
+        dtree_free(t);
+        free(source);
+    }
+
+    printf("dtree: %u trees, %lu edits matched libfdt in %.3f s\n", trees, edits, now() - t0);
+    return 0;
+}
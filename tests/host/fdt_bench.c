@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * libfdt speed, on a synthetic tree shaped like the devicetree kboot hands to Linux: a few hundred
+ * device nodes under /soc with compatible, reg, interrupts and phandle properties, and some
+ * nesting. Every node is looked up by path, by phandle and by compatible and checked against where
+ * it was created, and then those lookups are timed along with the property edits kboot does.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "libfdt/libfdt.h"
+
+#define FDT_SIZE SZ_1M
+#define DEVICES  384
+#define MIN_TIME 0.25
+
+static u8 fdt[FDT_SIZE];
+static char paths[DEVICES][64];
+static char compats[DEVICES][32];
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check(int ret, const char *what)
+{
+    if (ret < 0)
+        panic("fdt: %s: %s\n", what, fdt_strerror(ret));
+}
+
+/* Devices come in groups of 8 under a bus node, and every third one has a child */
+static void build(void)
+{
+    u32 reg[4], irq[3] = {0, 0, 4};
+
+    check(fdt_create_empty_tree(fdt, FDT_SIZE), "create");
+    int soc = fdt_add_subnode(fdt, 0, "soc");
+    check(soc, "soc");
+
+    for (int i = 0; i < DEVICES; i++) {
+        char name[32];
+        int bus;
+
+        snprintf(name, sizeof(name), "bus@%lx", 0x200000000UL + (i / 8) * 0x1000000);
+        bus = fdt_subnode_offset(fdt, soc, name);
+        if (bus < 0)
+            bus = fdt_add_subnode(fdt, soc, name);
+        check(bus, "bus");
+
+        snprintf(name, sizeof(name), "dev@%x", i * 0x4000);
+        int node = fdt_add_subnode(fdt, bus, name);
+        check(node, "device");
+
+        snprintf(compats[i], sizeof(compats[i]), "apple,t8103-dev%d", i);
+        reg[0] = cpu_to_fdt32(2);
+        reg[1] = cpu_to_fdt32(i * 0x4000);
+        reg[2] = 0;
+        reg[3] = cpu_to_fdt32(0x4000);
+        irq[1] = cpu_to_fdt32(i);
+        check(fdt_setprop_string(fdt, node, "status", "okay"), "status");
+        check(fdt_setprop(fdt, node, "interrupts", irq, sizeof(irq)), "interrupts");
+        check(fdt_setprop(fdt, node, "reg", reg, sizeof(reg)), "reg");
+        check(fdt_setprop_string(fdt, node, "compatible", compats[i]), "compatible");
+        check(fdt_setprop_u32(fdt, node, "phandle", i + 1), "phandle");
+
+        if (i % 3 == 0)
+            check(fdt_add_subnode(fdt, node, "port"), "port");
+
+        check(fdt_get_path(fdt, node, paths[i], sizeof(paths[i])), "path");
+    }
+
+    check(fdt_pack(fdt), "pack");
+    check(fdt_open_into(fdt, fdt, FDT_SIZE), "open");
+}
+
+static void verify(void)
+{
+    for (int i = 0; i < DEVICES; i++) {
+        int node = fdt_path_offset(fdt, paths[i]);
+        check(node, paths[i]);
+
+        if (fdt_node_offset_by_phandle(fdt, i + 1) != node)
+            panic("fdt: phandle %d is not %s\n", i + 1, paths[i]);
+        if (fdt_node_offset_by_compatible(fdt, -1, compats[i]) != node)
+            panic("fdt: %s is not %s\n", compats[i], paths[i]);
+
+        int len;
+        const fdt32_t *irq = fdt_getprop(fdt, node, "interrupts", &len);
+        if (!irq || len != 12 || fdt32_to_cpu(irq[1]) != (u32)i)
+            panic("fdt: %s has the wrong interrupts\n", paths[i]);
+    }
+}
+
+typedef u64 (*bench_fn)(u32 i);
+
+/* Keeps the compiler from dropping lookups whose results are never used */
+static volatile u64 sink;
+
+static u64 by_path(u32 i)
+{
+    return fdt_path_offset(fdt, paths[i % DEVICES]);
+}
+
+static u64 by_phandle(u32 i)
+{
+    return fdt_node_offset_by_phandle(fdt, 1 + i % DEVICES);
+}
+
+static u64 by_compatible(u32 i)
+{
+    return fdt_node_offset_by_compatible(fdt, -1, compats[i % DEVICES]);
+}
+
+static u64 getprop(u32 i)
+{
+    int node = fdt_path_offset(fdt, paths[i % DEVICES]);
+    return (u64)fdt_getprop(fdt, node, "reg", NULL);
+}
+
+/* Like kboot filling in a property it didn't know the size of: grow it, then shrink it back */
+static u64 setprop(u32 i)
+{
+    static const char big[64] = "a,rather-longer-compatible";
+    int node = fdt_path_offset(fdt, paths[i % DEVICES]);
+
+    check(fdt_setprop(fdt, node, "compatible", big, sizeof(big)), "grow");
+    check(fdt_setprop_string(fdt, node, "compatible", compats[i % DEVICES]), "shrink");
+    return 0;
+}
+
+static void bench(const char *name, bench_fn fn)
+{
+    u64 count = 0;
+    double t0 = now(), elapsed;
+
+    do {
+        for (u32 i = 0; i < 64; i++)
+            sink = fn(count++ * 7919);
+        elapsed = now() - t0;
+    } while (elapsed < MIN_TIME);
+
+    printf("fdt: %-14s %9.0f ops/s\n", name, count / elapsed);
+}
+
+int main(void)
+{
+    build();
+    verify();
+
+    bench("path", by_path);
+    bench("phandle", by_phandle);
+    bench("compatible", by_compatible);
+    bench("path + getprop", getprop);
+    bench("setprop", setprop);
+
+    verify();
+    return 0;
+}
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * heapblock.c, the bump allocator behind malloc and the decompressors. The heap starts at
+ * top_of_kernel_data, here a host buffer. Every block must be aligned, lie after the previous
+ * one and never overlap it, and a zero sized allocation must return where the next block will
+ * go. Then allocations of a few typical sizes are timed.
+ */
+
+#include <string.h>
+#include <time.h>
+
+// #included, so the benchmark can rewind heap_base without heapblock_init()'s log line
+#include "heapblock.c"
+
+#define ARENA_SIZE (256 * SZ_1M)
+#define CHECK_OPS  50000
+#define MIN_TIME   0.25
+
+struct boot_args cur_boot_args;
+
+static u8 *arena;
+
+static u64 rng_state = 0x2545f4914f6cdd1dUL;
+
+static u64 rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check(void)
+{
+    uintptr_t end = (uintptr_t)heapblock_alloc(0);
+
+    for (int i = 0; i < CHECK_OPS; i++) {
+        size_t size = rng() % 4096;
+        size_t align = 1UL << (rng() % 13);
+        uintptr_t next = (uintptr_t)heapblock_alloc(0);
+        uintptr_t block = (uintptr_t)heapblock_alloc_aligned(size, align);
+
+        if (block % align || block < end || block < next)
+            panic("heapblock: block 0x%lx (align 0x%zx) after 0x%lx\n", block, align, end);
+        if (align <= 64 && block != next)
+            panic("heapblock: block 0x%lx, but alloc(0) promised 0x%lx\n", block, next);
+        end = block + size;
+    }
+
+    if (end > (uintptr_t)arena + ARENA_SIZE)
+        panic("heapblock: ran past the arena\n");
+}
+
+static void bench(size_t size, size_t align)
+{
+    u64 count = 0;
+    double t0 = now(), elapsed;
+
+    do {
+        // Rewind the heap, the allocator never frees
+        heap_base = arena;
+        for (int i = 0; i < 1024; i++, count++)
+            heapblock_alloc_aligned(size, align);
+        elapsed = now() - t0;
+    } while (elapsed < MIN_TIME);
+
+    printf("heapblock: %5zu bytes (align %5zu) %.1f ns/alloc\n", size, align,
+           elapsed / count * 1e9);
+}
+
+int main(void)
+{
+    arena = malloc(ARENA_SIZE);
+    if (!arena)
+        panic("heapblock: no arena\n");
+    cur_boot_args.top_of_kernel_data = (u64)arena;
+
+    heapblock_init();
+    check();
+
+    bench(64, 64);
+    bench(4096, 64);
+    bench(SZ_16K, SZ_16K);
+
+    free(arena);
+    return 0;
+}
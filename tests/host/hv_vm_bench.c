@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Stage 2 page table and MMIO instruction decoder speed. hv_vm.c is built as is, with its tables
+ * in host memory: a guest-like address space (RAM as L2 blocks, MMIO as L3 pages and sub-page
+ * hooks) is mapped, every mapping is walked back and checked, and then the decoder is timed on
+ * the load/store encodings that data aborts see most.
+ */
+
+#include <string.h>
+#include <time.h>
+
+// hv_translate() issues AT instructions, which the benchmark never calls
+#define asm(...) ((void)0)
+#include "hv_vm.c"
+#undef asm
+
+#define RAM_BASE  0x800000000UL
+#define MMIO_BASE 0x200000000UL
+#define RAM_SIZE  (256 * (u64)SZ_32M)
+#define MIN_TIME  0.5
+
+char _base[1];
+u64 ram_base = RAM_BASE;
+volatile enum exc_guard_t exc_guard;
+volatile int exc_count;
+iodev_id_t uartproxy_iodev;
+
+u64 host_sysreg(const char *name)
+{
+    // 36-bit IPA space, like the M1
+    if (!strcmp(name, "ID_AA64MMFR0_EL1"))
+        return FIELD_PREP(ID_AA64MMFR0_PARange, 1);
+    return 0;
+}
+
+u64 hv_get_spsr(void)
+{
+    return 0;
+}
+
+u64 hv_get_esr(void)
+{
+    return 0;
+}
+
+u64 hv_get_far(void)
+{
+    return 0;
+}
+
+void hv_wdt_breadcrumb(char c)
+{
+    UNUSED(c);
+}
+
+void hv_wdt_suspend(void)
+{
+}
+
+void hv_wdt_resume(void)
+{
+}
+
+void hv_exc_proxy(struct exc_info *ctx, uartproxy_boot_reason_t reason, u32 type, void *extra)
+{
+    UNUSED(ctx);
+    UNUSED(reason);
+    UNUSED(type);
+    UNUSED(extra);
+}
+
+void hv_prof_dabort(u64 ipa)
+{
+    UNUSED(ipa);
+}
+
+void iodev_flush(iodev_id_t id)
+{
+    UNUSED(id);
+}
+
+void uartproxy_send_event(u16 event_type, void *data, u16 length)
+{
+    UNUSED(event_type);
+    UNUSED(data);
+    UNUSED(length);
+}
+
+/* Hook PTEs drop the low two bits, always clear for AArch64 code but not for x86 */
+static bool ALIGNED(4) hook(struct exc_info *ctx, u64 addr, u64 *val, bool write, int width)
+{
+    UNUSED(ctx);
+    UNUSED(addr);
+    UNUSED(val);
+    UNUSED(write);
+    UNUSED(width);
+    return true;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* 8GB of RAM in 32MB blocks, 1024 MMIO pages, and 256 word sized hooks in the AIC's page */
+static u64 map_guest(void)
+{
+    u64 ops = 0;
+
+    if (hv_map_hw(RAM_BASE, RAM_BASE, RAM_SIZE))
+        panic("hv_vm: RAM map failed\n");
+    ops++;
+
+    for (u64 page = 0; page < 1024; page++, ops++)
+        if (hv_map_hw(MMIO_BASE + page * 2 * PAGE_SIZE, MMIO_BASE + page * 2 * PAGE_SIZE,
+                      PAGE_SIZE))
+            panic("hv_vm: MMIO map failed\n");
+
+    for (u64 word = 0; word < 256; word++, ops++)
+        if (hv_map_hook(MMIO_BASE + PAGE_SIZE + word * 4, hook, 4))
+            panic("hv_vm: hook map failed\n");
+
+    return ops;
+}
+
+static u64 walk_guest(void)
+{
+    u64 ops = 0;
+
+    for (u64 off = 0; off < RAM_SIZE; off += SZ_32M / 4, ops++)
+        if ((hv_pt_walk(RAM_BASE + off + 0x40) & PTE_TARGET_MASK_L4) != RAM_BASE + off + 0x40)
+            panic("hv_vm: RAM walk of 0x%lx is wrong\n", RAM_BASE + off);
+
+    for (u64 page = 0; page < 1024; page++, ops++) {
+        u64 addr = MMIO_BASE + page * 2 * PAGE_SIZE + 0x10;
+        if ((hv_pt_walk(addr) & PTE_TARGET_MASK_L4) != addr)
+            panic("hv_vm: MMIO walk of 0x%lx is wrong\n", addr);
+    }
+
+    for (u64 word = 0; word < 256; word++, ops++) {
+        u64 pte = hv_pt_walk(MMIO_BASE + PAGE_SIZE + word * 4);
+        if ((pte & PTE_TARGET_MASK_L4) != (u64)hook || FIELD_GET(SPTE_TYPE, pte) != SPTE_HOOK)
+            panic("hv_vm: hook walk of word %lu is wrong\n", word);
+    }
+
+    return ops;
+}
+
+static u64 unmap_guest(void)
+{
+    hv_unmap(RAM_BASE, RAM_SIZE);
+    for (u64 page = 0; page < 1024; page++)
+        hv_unmap(MMIO_BASE + page * 2 * PAGE_SIZE, PAGE_SIZE);
+    hv_unmap(MMIO_BASE + PAGE_SIZE, PAGE_SIZE);
+
+    if (hv_pt_walk(RAM_BASE) || hv_pt_walk(MMIO_BASE) || hv_pt_walk(MMIO_BASE + PAGE_SIZE))
+        panic("hv_vm: mappings left behind after unmap\n");
+
+    return 1 + 1024 + 1;
+}
+
+static void bench_pt(void)
+{
+    u64 map_ops = 0, walk_ops = 0, unmap_ops = 0;
+    double map_time = 0, walk_time = 0, unmap_time = 0;
+
+    while (map_time + walk_time + unmap_time < MIN_TIME) {
+        double t0 = now();
+        map_ops += map_guest();
+        double t1 = now();
+        walk_ops += walk_guest();
+        double t2 = now();
+        unmap_ops += unmap_guest();
+        double t3 = now();
+
+        map_time += t1 - t0;
+        walk_time += t2 - t1;
+        unmap_time += t3 - t2;
+    }
+
+    printf("hv_vm: map %.0f ops/s, walk %.0f ops/s, unmap %.0f ops/s\n", map_ops / map_time,
+           walk_ops / walk_time, unmap_ops / unmap_time);
+}
+
+/* What MMIO drivers compile to, with the base in x0 and data in w1/x1 (and x2 for pairs) */
+static const struct {
+    u32 insn;
+    bool store;
+} insns[] = {
+    {0xb9401001, false}, // ldr w1, [x0, #0x10]
+    {0xf9400401, false}, // ldr x1, [x0, #8]
+    {0x39400001, false}, // ldrb w1, [x0]
+    {0x79400401, false}, // ldrh w1, [x0, #2]
+    {0xb85fc001, false}, // ldur w1, [x0, #-4]
+    {0xb8404401, false}, // ldr w1, [x0], #4
+    {0xb8626801, false}, // ldr w1, [x0, x2]
+    {0x29400801, false}, // ldp w1, w2, [x0]
+    {0x88dffc01, false}, // ldar w1, [x0]
+    {0xb9001001, true},  // str w1, [x0, #0x10]
+    {0xf9000001, true},  // str x1, [x0]
+    {0x39000001, true},  // strb w1, [x0]
+    {0xb81fc001, true},  // stur w1, [x0, #-4]
+    {0xa9010801, true},  // stp x1, x2, [x0, #16]
+    {0x889ffc01, true},  // stlr w1, [x0]
+};
+
+/*
+ * Like hv_handle_dabort(): stores produce the data to write in the first pass, loads are decoded
+ * with val == NULL first and then completed with the data that was read.
+ */
+static void bench_decode(bool complete)
+{
+    struct exc_info ctx = {0};
+    u64 val[HV_MAX_RW_SIZE / 8] = {0x1234, 0x5678};
+    u64 count = 0, width, vaddr;
+
+    double t0 = now(), elapsed;
+    do {
+        for (u32 i = 0; i < ARRAY_SIZE(insns); i++) {
+            bool ok;
+
+            ctx.regs[0] = MMIO_BASE;
+            if (insns[i].store)
+                ok = emulate_store(&ctx, insns[i].insn, val, &width, &vaddr);
+            else
+                ok = emulate_load(&ctx, insns[i].insn, complete ? val : NULL, &width, &vaddr);
+
+            if (!ok)
+                panic("hv_vm: failed to decode 0x%08x\n", insns[i].insn);
+        }
+        count += ARRAY_SIZE(insns);
+        elapsed = now() - t0;
+    } while (elapsed < MIN_TIME);
+
+    printf("hv_vm: %s %.1f ns/insn\n", complete ? "decode + complete" : "decode",
+           elapsed / count * 1e9);
+}
+
+int main(void)
+{
+    hv_pt_init();
+
+    bench_pt();
+    bench_decode(false);
+    bench_decode(true);
+
+    return 0;
+}
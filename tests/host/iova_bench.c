@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Randomized alloc/free traffic against iova_domain_t. Every allocation is checked against a
+ * shadow list for overlaps and alignment, the O(1) stats are checked against the expected free
+ * space, and the run ends by freeing everything, which must coalesce back into a single hole.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "iova.h"
+
+#define DOMAIN_BASE SZ_32M
+#define DOMAIN_SIZE (1UL << 36)
+#define MAX_LIVE    8192
+
+struct live {
+    u64 iova;
+    u64 size;
+};
+
+static struct live live[MAX_LIVE];
+static u32 nlive;
+
+void dart_free_l2(dart_dev_t *dart, uintptr_t iova)
+{
+    UNUSED(dart);
+    UNUSED(iova);
+}
+
+static u64 rng_state = 0x2545f4914f6cdd1dUL;
+
+static u64 rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Mostly small buffers with a long tail of large ones, like rtkit and DCP traffic */
+static u64 random_size(void)
+{
+    u64 r = rng() % 100;
+
+    if (r < 70)
+        return (1 + rng() % 8) * SZ_16K;
+    if (r < 95)
+        return (1 + rng() % 64) * SZ_16K;
+    return (1 + rng() % 1024) * SZ_16K;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_live(const void *a, const void *b)
+{
+    const struct live *x = a, *y = b;
+
+    return x->iova < y->iova ? -1 : x->iova > y->iova;
+}
+
+static void check_disjoint(void)
+{
+    static struct live sorted[MAX_LIVE];
+
+    memcpy(sorted, live, nlive * sizeof(*live));
+    qsort(sorted, nlive, sizeof(*sorted), cmp_live);
+
+    for (u32 i = 1; i < nlive; i++) {
+        if (sorted[i - 1].iova + sorted[i - 1].size > sorted[i].iova)
+            panic("overlap: [%lx; +%lx] and [%lx; +%lx]\n", sorted[i - 1].iova,
+                  sorted[i - 1].size, sorted[i].iova, sorted[i].size);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    u64 ops = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000000;
+    u64 allocs = 0, frees = 0, failed = 0, used = 0;
+
+    iova_domain_t *iovad = iovad_init(DOMAIN_BASE, DOMAIN_SIZE);
+    if (!iovad)
+        panic("iovad_init failed\n");
+
+    u64 initial_free, initial_largest;
+    iova_stats(iovad, &initial_free, &initial_largest);
+
+    double t0 = now();
+
+    for (u64 i = 0; i < ops; i++) {
+        // Drift between a nearly empty and a nearly full live set to get a fragmented domain
+        bool grow = (i / 100000) % 2 == 0;
+        bool do_alloc = nlive == 0 || (nlive < MAX_LIVE && rng() % 100 < (grow ? 70u : 30u));
+
+        if (do_alloc) {
+            u64 size = random_size();
+            u64 align = rng() % 8 == 0 ? SZ_16K << (rng() % 6) : SZ_16K;
+            u64 iova = iova_alloc_aligned(iovad, size, align);
+
+            if (!iova) {
+                failed++;
+                continue;
+            }
+            if (iova % align)
+                panic("misaligned: %lx for alignment %lx\n", iova, align);
+
+            live[nlive++] = (struct live){iova, size};
+            used += size;
+            allocs++;
+        } else {
+            u32 idx = rng() % nlive;
+
+            iova_free(iovad, live[idx].iova, live[idx].size);
+            used -= live[idx].size;
+            live[idx] = live[--nlive];
+            frees++;
+        }
+
+        if (i % 65536 == 0) {
+            u64 free_bytes;
+            iova_stats(iovad, &free_bytes, NULL);
+            if (free_bytes != initial_free - used)
+                panic("free space is %lx, expected %lx\n", free_bytes, initial_free - used);
+            check_disjoint();
+        }
+    }
+
+    double elapsed = now() - t0;
+
+    u64 free_bytes, largest;
+    iova_stats(iovad, &free_bytes, &largest);
+    printf("iova: %lu ops (%lu allocs, %lu frees, %lu failed) in %.3f s, %.2f Mops/s\n", ops,
+           allocs, frees, failed, elapsed, ops / elapsed / 1e6);
+    printf("iova: %u live, %lu MiB free, largest hole %lu MiB\n", nlive, free_bytes >> 20,
+           largest >> 20);
+
+    while (nlive) {
+        nlive--;
+        iova_free(iovad, live[nlive].iova, live[nlive].size);
+    }
+
+    iova_stats(iovad, &free_bytes, &largest);
+    if (free_bytes != initial_free || largest != initial_largest)
+        panic("free space did not coalesce: %lx free, largest %lx\n", free_bytes, largest);
+
+    iovad_shutdown(iovad, NULL);
+    return 0;
+}
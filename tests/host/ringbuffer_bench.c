@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * ringbuffer.c throughput. A counting byte stream is pushed through a ring in random sized
+ * chunks, checking on the way out that nothing was lost, duplicated or reordered and that
+ * get_used()/get_free() always add up. Then whole chunks of a few typical sizes are timed.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "ringbuffer.h"
+
+#define RING_SIZE 4096
+#define CHECK_OPS 1000000
+#define MIN_TIME  0.25
+
+static u64 rng_state = 0x2545f4914f6cdd1dUL;
+
+static u64 rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check(ringbuffer_t *ring)
+{
+    u8 buf[RING_SIZE * 2];
+    u64 written = 0, read = 0;
+
+    for (int i = 0; i < CHECK_OPS; i++) {
+        size_t len = rng() % sizeof(buf);
+
+        if (rng() % 2) {
+            for (size_t j = 0; j < len; j++)
+                buf[j] = written + j;
+            size_t done = ringbuffer_write(buf, len, ring);
+            // One slot always stays empty, to tell a full ring from an empty one
+            if (done != min(len, (size_t)(RING_SIZE - 1 - (written - read))))
+                panic("ringbuffer: wrote %zu of %zu with %lu used\n", done, len, written - read);
+            written += done;
+        } else {
+            size_t done = ringbuffer_read(buf, len, ring);
+            if (done != min(len, (size_t)(written - read)))
+                panic("ringbuffer: read %zu of %zu with %lu used\n", done, len, written - read);
+            for (size_t j = 0; j < done; j++)
+                if (buf[j] != (u8)(read + j))
+                    panic("ringbuffer: byte %lu is 0x%02x\n", read + j, buf[j]);
+            read += done;
+        }
+
+        if (ringbuffer_get_used(ring) != written - read ||
+            ringbuffer_get_used(ring) + ringbuffer_get_free(ring) != RING_SIZE)
+            panic("ringbuffer: %zu used, %zu free with %lu queued\n", ringbuffer_get_used(ring),
+                  ringbuffer_get_free(ring), written - read);
+    }
+}
+
+static void bench(ringbuffer_t *ring, size_t chunk)
+{
+    u8 buf[RING_SIZE];
+    u64 bytes = 0;
+    double t0 = now(), elapsed;
+
+    memset(buf, 0x5a, sizeof(buf));
+    do {
+        for (int i = 0; i < 256; i++) {
+            ringbuffer_write(buf, chunk, ring);
+            bytes += ringbuffer_read(buf, chunk, ring);
+        }
+        elapsed = now() - t0;
+    } while (elapsed < MIN_TIME);
+
+    printf("ringbuffer: %4zu byte chunks %7.1f MB/s\n", chunk, bytes / elapsed / 1e6);
+}
+
+int main(void)
+{
+    ringbuffer_t *ring = ringbuffer_alloc(RING_SIZE);
+    if (!ring)
+        panic("ringbuffer: alloc failed\n");
+
+    check(ring);
+    bench(ring, 1);
+    bench(ring, 64);
+    bench(ring, 1024);
+
+    ringbuffer_free(ring);
+    return 0;
+}
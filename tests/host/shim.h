@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Force-included (-include shim.h) into every source built for the host. It takes the place of
+ * src/utils.h, which is full of AArch64 system register and MMIO accessors, and provides the
+ * handful of helpers the portable subsystems actually use.
+ */
+
+#ifndef HOST_SHIM_H
+#define HOST_SHIM_H
+
+#define UTILS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
+
+#define ARRAY_SIZE(s) (sizeof(s) / sizeof((s)[0]))
+
+#define ALIGN_UP(x, a)   (((x) + ((a) - 1)) & ~((a) - 1))
+#define ALIGN_DOWN(x, a) ((x) & ~((a) - 1))
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+
+#ifdef DEBUG
+#define dprintf(...) printf(__VA_ARGS__)
+#else
+#define dprintf(...)                                                                               \
+    do {                                                                                           \
+    } while (0)
+#endif
+
+/*
+ * MMIO accessors work on plain host memory, so code that pokes at descriptors or tables through
+ * read32()/write64() runs against buffers the benchmark sets up.
+ */
+#define HOST_MMIO(bits)                                                                            \
+    static inline u##bits read##bits(u64 addr)                                                     \
+    {                                                                                              \
+        return *(volatile u##bits *)addr;                                                          \
+    }                                                                                              \
+    static inline void write##bits(u64 addr, u##bits data)                                         \
+    {                                                                                              \
+        *(volatile u##bits *)addr = data;                                                          \
+    }                                                                                              \
+    static inline u##bits set##bits(u64 addr, u##bits set)                                         \
+    {                                                                                              \
+        u##bits val = read##bits(addr) | set;                                                      \
+        write##bits(addr, val);                                                                    \
+        return val;                                                                                \
+    }                                                                                              \
+    static inline u##bits clear##bits(u64 addr, u##bits clear)                                     \
+    {                                                                                              \
+        u##bits val = read##bits(addr) & ~clear;                                                   \
+        write##bits(addr, val);                                                                    \
+        return val;                                                                                \
+    }                                                                                              \
+    static inline u##bits mask##bits(u64 addr, u##bits clear, u##bits set)                         \
+    {                                                                                              \
+        u##bits val = (read##bits(addr) & ~clear) | set;                                           \
+        write##bits(addr, val);                                                                    \
+        return val;                                                                                \
+    }
+
+HOST_MMIO(8)
+HOST_MMIO(16)
+HOST_MMIO(32)
+HOST_MMIO(64)
+
+/* Nothing else writes to host memory, so a poll either succeeds at once or never will */
+static inline int poll32(u64 addr, u32 mask, u32 target, u32 timeout)
+{
+    (void)timeout;
+    return (read32(addr) & mask) == target ? 0 : -1;
+}
+
+/*
+ * System registers are looked up by name. Reads return 0 unless the benchmark defines
+ * host_sysreg() to hand out something more useful (ID registers, mostly), and writes are dropped.
+ */
+u64 host_sysreg(const char *name) __attribute__((weak));
+
+static inline u64 host_mrs(const char *name)
+{
+    return host_sysreg ? host_sysreg(name) : 0;
+}
+
+#define mrs(reg)                host_mrs(#reg)
+#define msr(reg, val)           ((void)(val))
+#define msr_sync(reg, val)      msr(reg, val)
+#define reg_clr(reg, bits)      msr(reg, mrs(reg) & ~(bits))
+#define reg_set(reg, bits)      msr(reg, mrs(reg) | (bits))
+#define reg_mask(reg, clr, set) msr(reg, (mrs(reg) & ~(clr)) | (set))
+
+#define sysop(op)                                                                                  \
+    do {                                                                                           \
+    } while (0)
+#define cacheop(op, val) ((void)(val))
+#define dc_civac(p)      cacheop("dc civac", p)
+#define dc_cvac(p)       cacheop("dc cvac", p)
+#define dma_mb()         sysop("dmb osh")
+#define dma_rmb()        sysop("dmb oshld")
+#define dma_wmb()        sysop("dmb oshst")
+
+static inline int in_el2(void)
+{
+    return (mrs(CurrentEL) >> 2) == 2;
+}
+
+static inline int in_el3(void)
+{
+    return (mrs(CurrentEL) >> 2) == 3;
+}
+
+/* Start of the m1n1 image, defined by whichever benchmark links code that looks at it */
+extern char _base[];
+
+static inline void memset64(void *dst, u64 value, size_t size)
+{
+    for (u64 *p = dst; size >= 8; size -= 8)
+        *p++ = value;
+}
+
+/* There's no guest FP/SIMD state on the host, so it reads as zeroes (q0-q31) */
+static inline void get_simd_state(void *state)
+{
+    __builtin_memset(state, 0, 32 * 16);
+}
+
+static inline void put_simd_state(void *state)
+{
+    (void)state;
+}
+
+static inline void hexdump(const void *d, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        printf("%02x%c", ((const u8 *)d)[i], (i % 16 == 15) ? '\n' : ' ');
+    printf("\n");
+}
+
+/* Benchmarks are single threaded */
+typedef struct {
+    s64 lock;
+    int count;
+} spinlock_t;
+
+#define SPINLOCK_INIT       {-1, 0}
+#define DECLARE_SPINLOCK(n) spinlock_t n = SPINLOCK_INIT;
+
+static inline void spin_init(spinlock_t *lock)
+{
+    lock->lock = -1;
+    lock->count = 0;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    lock->count++;
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+    lock->count--;
+}
+
+#define panic(fmt, ...)                                                                            \
+    do {                                                                                           \
+        fprintf(stderr, "PANIC: " fmt, ##__VA_ARGS__);                                             \
+        abort();                                                                                   \
+    } while (0)
+
+#endif
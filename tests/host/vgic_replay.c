@@ -0,0 +1,347 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Replays vGIC register traces (traces/ *.trace) against struct vgic_state and checks every
+ * register read and list register refill against a brute force model that keeps plain
+ * per-interrupt arrays and scans them. The replay then continues with random traffic, and the
+ * run ends with a timing of the refill path.
+ *
+ * Trace lines, offsets as in the GICv3 spec (redistributor offsets are in the vCPU's frame):
+ *   d <offset> <value>         distributor write
+ *   D <offset>                 distributor read
+ *   r <cpu> <offset> <value>   redistributor write
+ *   R <cpu> <offset>           redistributor read
+ *   i <cpu> <irq>              interrupt arrives while <cpu> is handling exceptions
+ *   l <cpu> <count>            refill up to <count> list registers of <cpu>
+ */
+
+#include <string.h>
+#include <time.h>
+
+#define ENABLE_VGIC_MODULE
+#include "hv_vgic.h"
+#include "hv_vgic_irq.h"
+
+#define NUM_CPUS 4
+
+static struct vgic_irqs cpus[NUM_CPUS];
+static struct vgic_state vgic;
+
+/* The model: SPI state is global, private state is per vCPU */
+static struct {
+    bool pending[NUM_CPUS][VGIC_NR_IRQS];
+    bool enabled[NUM_CPUS][VGIC_NR_IRQS];
+    u8 priority[NUM_CPUS][VGIC_NR_IRQS];
+    u32 target[VGIC_NR_IRQS];
+} ref;
+
+static u64 refills, delivered;
+
+static u32 ref_cpu(u32 cpu, u32 irq)
+{
+    return irq < VGIC_NR_PRIVATE ? cpu : 0;
+}
+
+static int ref_highest(u32 cpu)
+{
+    int best = VGIC_IRQ_NONE;
+    u32 best_level = VGIC_PRIO_LEVELS;
+
+    for (u32 irq = 0; irq < VGIC_NR_IRQS; irq++) {
+        if (irq >= VGIC_NR_PRIVATE && ref.target[irq] != cpu)
+            continue;
+
+        u32 c = ref_cpu(cpu, irq);
+        u32 level = ref.priority[c][irq] >> VGIC_PRIO_SHIFT;
+
+        if (ref.pending[c][irq] && ref.enabled[c][irq] && level < best_level) {
+            best = irq;
+            best_level = level;
+        }
+    }
+
+    return best;
+}
+
+static void check_highest(void)
+{
+    for (u32 cpu = 0; cpu < NUM_CPUS; cpu++) {
+        int got = vgic_irqs_highest(&cpus[cpu]);
+        int want = ref_highest(cpu);
+
+        if (got != want)
+            panic("vCPU %u: highest pending is %d, expected %d\n", cpu, got, want);
+    }
+}
+
+static void refill(u32 cpu, u32 count)
+{
+    for (u32 i = 0; i < count; i++) {
+        int got = vgic_irqs_take(&cpus[cpu]);
+        int want = ref_highest(cpu);
+
+        if (got != want)
+            panic("vCPU %u: refill picked %d, expected %d\n", cpu, got, want);
+        if (got == VGIC_IRQ_NONE)
+            break;
+
+        ref.pending[ref_cpu(cpu, got)][got] = false;
+        delivered++;
+    }
+
+    refills++;
+}
+
+static void write_bits(u32 cpu, enum vgic_irq_reg reg, u32 first, u32 mask)
+{
+    vgic_write_bits(&vgic, cpu, reg, first, mask);
+
+    for (u32 bit = 0; bit < 32; bit++) {
+        if (!(mask & BIT(bit)))
+            continue;
+
+        u32 c = ref_cpu(cpu, first + bit);
+        if (reg == VGIC_ISENABLER || reg == VGIC_ICENABLER)
+            ref.enabled[c][first + bit] = reg == VGIC_ISENABLER;
+        else
+            ref.pending[c][first + bit] = reg == VGIC_ISPENDR;
+    }
+}
+
+static u32 read_bits(u32 cpu, enum vgic_irq_reg reg, u32 first)
+{
+    u32 got = vgic_read_bits(&vgic, cpu, reg, first);
+    u32 want = 0;
+
+    for (u32 bit = 0; bit < 32; bit++) {
+        u32 c = ref_cpu(cpu, first + bit);
+        bool set = (reg == VGIC_ISENABLER || reg == VGIC_ICENABLER) ? ref.enabled[c][first + bit]
+                                                                    : ref.pending[c][first + bit];
+        if (set)
+            want |= BIT(bit);
+    }
+
+    if (got != want)
+        panic("vCPU %u: read of IRQs %u-%u returned %x, expected %x\n", cpu, first, first + 31,
+              got, want);
+
+    return got;
+}
+
+static void write_priority(u32 cpu, u32 irq, u8 priority)
+{
+    vgic_write_priority(&vgic, cpu, irq, priority);
+    ref.priority[ref_cpu(cpu, irq)][irq] = priority;
+}
+
+static void route(u32 irq, u32 cpu)
+{
+    vgic_route_spi(&vgic, irq, cpu);
+    ref.target[irq] = cpu;
+}
+
+static void inject(u32 cpu, u32 irq)
+{
+    vgic_inject(&vgic, cpu, irq);
+    ref.pending[ref_cpu(cpu, irq)][irq] = true;
+}
+
+/* Decodes the banked IRQ registers, like the MMIO handlers in hv_vgic.c */
+static void access(u32 cpu, u64 off, u32 val, bool write)
+{
+    static const struct {
+        u64 base;
+        enum vgic_irq_reg reg;
+    } banks[] = {
+        {GIC_DIST_ISENABLER0, VGIC_ISENABLER},
+        {GIC_DIST_ICENABLER0, VGIC_ICENABLER},
+        {GIC_DIST_ISPENDR0, VGIC_ISPENDR},
+        {GIC_DIST_ICPENDR0, VGIC_ICPENDR},
+    };
+
+    for (u32 i = 0; i < ARRAY_SIZE(banks); i++) {
+        if (off >= banks[i].base && off < banks[i].base + 0x80) {
+            u32 first = (off - banks[i].base) * 8;
+            if (write)
+                write_bits(cpu, banks[i].reg, first, val);
+            else
+                read_bits(cpu, banks[i].reg, first);
+            return;
+        }
+    }
+
+    if (off >= GIC_DIST_IPRIORITYR0 && off <= GIC_DIST_IPRIORITYR254 && write) {
+        for (u32 i = 0; i < 4; i++)
+            write_priority(cpu, off - GIC_DIST_IPRIORITYR0 + i, val >> (8 * i));
+    } else if (off >= GIC_DIST_IROUTER32 && off <= GIC_DIST_IROUTER1019 && write) {
+        // Aff0 is the vCPU number, and 1 of N routing goes to vCPU 0
+        route(32 + (off - GIC_DIST_IROUTER32) / 8, (val & BIT(31)) ? 0 : (val & 0xff) % NUM_CPUS);
+    }
+}
+
+static void replay(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        panic("can't open %s\n", path);
+
+    char line[256];
+    u32 lineno = 0, ops = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        u32 cpu = 0, a = 0;
+        u64 off = 0;
+        lineno++;
+
+        switch (line[0]) {
+            case 'd':
+                if (sscanf(line + 1, "%lx %x", &off, &a) != 2)
+                    goto bad;
+                access(0, off, a, true);
+                break;
+            case 'D':
+                if (sscanf(line + 1, "%lx", &off) != 1)
+                    goto bad;
+                access(0, off, 0, false);
+                break;
+            case 'r':
+                if (sscanf(line + 1, "%u %lx %x", &cpu, &off, &a) != 3 || cpu >= NUM_CPUS)
+                    goto bad;
+                access(cpu, off - GIC_REDIST_IGROUPR0 + GIC_DIST_IGROUPR0, a, true);
+                break;
+            case 'R':
+                if (sscanf(line + 1, "%u %lx", &cpu, &off) != 2 || cpu >= NUM_CPUS)
+                    goto bad;
+                access(cpu, off - GIC_REDIST_IGROUPR0 + GIC_DIST_IGROUPR0, 0, false);
+                break;
+            case 'i':
+                if (sscanf(line + 1, "%u %u", &cpu, &a) != 2 || cpu >= NUM_CPUS)
+                    goto bad;
+                inject(cpu, a);
+                break;
+            case 'l':
+                if (sscanf(line + 1, "%u %u", &cpu, &a) != 2 || cpu >= NUM_CPUS)
+                    goto bad;
+                refill(cpu, a);
+                break;
+            case '#':
+            case '\n':
+                continue;
+            default:
+                goto bad;
+        }
+
+        check_highest();
+        ops++;
+    }
+
+    fclose(f);
+    printf("vgic: replayed %u accesses from %s\n", ops, path);
+    return;
+
+bad:
+    panic("%s:%u: bad trace line: %s", path, lineno, line);
+}
+
+static u64 rng_state = 0x9e3779b97f4a7c15UL;
+
+static u32 rng(u32 n)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state % n;
+}
+
+/* Interrupt numbers cluster like on real machines: PPIs, then a few hundred SPIs */
+static u32 random_irq(void)
+{
+    return rng(4) ? 32 + rng(352) : rng(32);
+}
+
+static void random_traffic(u32 ops)
+{
+    for (u32 i = 0; i < ops; i++) {
+        u32 cpu = rng(NUM_CPUS);
+        u32 irq = random_irq();
+
+        switch (rng(10)) {
+            case 0:
+                write_bits(cpu, VGIC_ISENABLER, irq & ~31, BIT(irq & 31) | (rng(2) ? rng(~0u) : 0));
+                break;
+            case 1:
+                write_bits(cpu, VGIC_ICENABLER, irq & ~31, BIT(irq & 31));
+                break;
+            case 2:
+                write_bits(cpu, VGIC_ICPENDR, irq & ~31, BIT(irq & 31));
+                break;
+            case 3:
+                write_priority(cpu, irq, rng(256));
+                break;
+            case 4:
+                if (irq >= VGIC_NR_PRIVATE)
+                    route(irq, rng(NUM_CPUS));
+                break;
+            case 5:
+                read_bits(cpu, rng(2) ? VGIC_ISPENDR : VGIC_ISENABLER, irq & ~31);
+                break;
+            case 6:
+                refill(cpu, 1 + rng(8));
+                break;
+            default:
+                inject(cpu, irq);
+                break;
+        }
+
+        check_highest();
+    }
+
+    printf("vgic: %u random accesses, %lu refills delivered %lu interrupts\n", ops, refills,
+           delivered);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Keep ~50 interrupts pending on vCPU 0 and time picking the next one, against the model's scan */
+static void bench(u32 ops)
+{
+    volatile int sink = 0;
+
+    for (u32 i = 0; i < 50; i++)
+        inject(0, random_irq());
+
+    double t0 = now();
+    for (u32 i = 0; i < ops; i++) {
+        vgic_inject(&vgic, 0, random_irq());
+        sink += vgic_irqs_take(&cpus[0]);
+    }
+    double t1 = now();
+    for (u32 i = 0; i < ops / 100; i++)
+        sink += ref_highest(0);
+    double t2 = now();
+
+    printf("vgic: inject + refill %.1f ns, model scan %.1f ns\n", (t1 - t0) / ops * 1e9,
+           (t2 - t1) / (ops / 100) * 1e9);
+}
+
+int main(int argc, char **argv)
+{
+    vgic_state_init(&vgic, cpus, NUM_CPUS);
+
+    for (int i = 1; i < argc; i++)
+        replay(argv[i]);
+
+    random_traffic(200000);
+
+    for (u32 first = 0; first < 384; first += 32)
+        write_bits(0, VGIC_ISENABLER, first, ~0u);
+    bench(1000000);
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * printf formatting. vsprintf.c is built under other names, so the host's vsnprintf() is still
+ * around to check it against: random integer, character and string conversions with random
+ * flags, widths, precisions and length modifiers must format exactly like libc, truncation
+ * included. Then the formats m1n1 logs most are timed.
+ */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#define vsnprintf m1n1_vsnprintf
+#define vsprintf  m1n1_vsprintf
+#include "vsprintf.c"
+#undef vsnprintf
+#undef vsprintf
+
+#define CASES    200000
+#define MIN_TIME 0.5
+
+static u64 rng_state = 0x2545f4914f6cdd1dUL;
+
+static u64 rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int m1n1_snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    int ret = m1n1_vsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+/* Values near the interesting edges: zero, small, sign boundaries and all ones */
+static u64 random_int(void)
+{
+    switch (rng() % 6) {
+        case 0:
+            return 0;
+        case 1:
+            return rng() % 100;
+        case 2:
+            return -(rng() % 100);
+        case 3:
+            return 1UL << (rng() % 64);
+        case 4:
+            return ~0UL >> (rng() % 64);
+        default:
+            return rng();
+    }
+}
+
+static const char *const strings[] = {"", "a", "m1n1", "Hypervisor", "a somewhat longer string"};
+
+/* One conversion, with only the flags C99 defines for it, so that libc's output is well defined */
+static void check_one(void)
+{
+    static const char *const int_mods[] = {"hh", "h", "", "l", "ll", "z", "j", "t"};
+    static const char convs[] = "diuxXoxcs";
+    char fmt[32], *f = fmt;
+    char conv = convs[rng() % (sizeof(convs) - 1)];
+    bool is_int = conv != 'c' && conv != 's';
+    const char *mod = is_int ? int_mods[rng() % ARRAY_SIZE(int_mods)] : "";
+    char ours[128], theirs[128];
+    size_t size = rng() % 4 == 0 ? rng() % 16 : sizeof(ours);
+    int width = rng() % 3 == 0 ? (int)(rng() % 24) : -1;
+    int precision = rng() % 3 == 0 ? (int)(rng() % 24) : -1;
+
+    *f++ = '%';
+    if (rng() % 4 == 0)
+        *f++ = '-';
+    if ((conv == 'd' || conv == 'i') && rng() % 4 == 0)
+        *f++ = rng() % 2 ? '+' : ' ';
+    if ((conv == 'x' || conv == 'X' || conv == 'o') && rng() % 4 == 0)
+        *f++ = '#';
+    if (is_int && rng() % 4 == 0)
+        *f++ = '0';
+    // %c ignores its width, like the upstream snprintf.c, and nothing in m1n1 pads characters
+    if (width >= 0 && conv != 'c')
+        f += sprintf(f, "%d", width);
+    if (precision >= 0 && conv != 'c')
+        f += sprintf(f, ".%d", precision);
+    f += sprintf(f, "%s%c", mod, conv);
+    *f = 0;
+
+    int ret_ours, ret_theirs;
+    if (conv == 's') {
+        const char *s = strings[rng() % ARRAY_SIZE(strings)];
+        ret_ours = m1n1_snprintf(ours, size, fmt, s);
+        ret_theirs = snprintf(theirs, size, fmt, s);
+    } else if (conv == 'c') {
+        int c = 'A' + rng() % 26;
+        ret_ours = m1n1_snprintf(ours, size, fmt, c);
+        ret_theirs = snprintf(theirs, size, fmt, c);
+    } else {
+        u64 v = random_int();
+        // C99 prints nothing for a zero with precision 0, vsprintf.c still prints the "0"
+        // (at any width the length modifier truncates it to)
+        if (!precision)
+            v |= 1;
+        // Varargs promote everything below int, so only the wide types need a u64 argument
+        if (!strcmp(mod, "l") || !strcmp(mod, "ll") || !strcmp(mod, "z") || !strcmp(mod, "j") ||
+            !strcmp(mod, "t")) {
+            ret_ours = m1n1_snprintf(ours, size, fmt, v);
+            ret_theirs = snprintf(theirs, size, fmt, v);
+        } else {
+            ret_ours = m1n1_snprintf(ours, size, fmt, (int)v);
+            ret_theirs = snprintf(theirs, size, fmt, (int)v);
+        }
+    }
+
+    if (ret_ours != ret_theirs || (size && strcmp(ours, theirs)))
+        panic("vsprintf: \"%s\" (size %zu) gave \"%s\" (%d), libc \"%s\" (%d)\n", fmt, size,
+              size ? ours : "", ret_ours, size ? theirs : "", ret_theirs);
+}
+
+static void bench(void)
+{
+    char buf[256];
+    u64 count = 0;
+    double t0 = now(), elapsed;
+
+    do {
+        for (int i = 0; i < 64; i++) {
+            m1n1_snprintf(buf, sizeof(buf), "HV: Guest abort at 0x%lx -> 0x%lx (%d bytes)\n",
+                          0xfffffe0007a3c000UL + i, 0x200000000UL + i, 4);
+            m1n1_snprintf(buf, sizeof(buf), "%08x %08x %08x %08x\n", i, i * 3, i * 5, i * 7);
+            m1n1_snprintf(buf, sizeof(buf), "%s: %d entries, %s\n", "dart", i, "ok");
+        }
+        count += 64 * 3;
+        elapsed = now() - t0;
+    } while (elapsed < MIN_TIME);
+
+    printf("vsprintf: %.1f ns/call\n", elapsed / count * 1e9);
+}
+
+int main(void)
+{
+    for (int i = 0; i < CASES; i++)
+        check_one();
+    printf("vsprintf: %d random conversions matched libc\n", CASES);
+
+    bench();
+    return 0;
+}